@@ -2,7 +2,7 @@ QT       += core gui network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
-CONFIG += c++11
+CONFIG += c++14
 
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
@@ -21,7 +21,13 @@ HEADERS += \
     widget.h \
     dialog.h \
     messagebroadcaster.h \
-    filetransfer.h
+    filetransfer.h \
+    ../../LetsChat_common/CYondCodec.h \
+    ../../LetsChat_common/CYondCrc32c.h \
+    ../../LetsChat_common/CYondScan.h \
+    ../../LetsChat_common/CYondChunkMap.h \
+    ../../LetsChat_common/CYondCdc.h \
+    ../../LetsChat_common/CYondSha256.h
 
 FORMS += \
     widget.ui \
@@ -3,115 +3,65 @@
 
 #include <qDebug>
 #include <string>
+#include "../../LetsChat_common/CYondCodec.h"
 
-
-enum YondCmd
-{
-    YDef,
-    YConnect,
-    YMsg,
-    YFile,
-    YRecv
-};
-
+// 持有负载的帧, 线上格式由CYondCodec定义, 与服务端一致.
+// 客户端发出的帧默认是带CRC32C的v2紧凑帧, 服务端据此对本连接改用同样的格式
 class CClientPacket
 {
 public:
-    CClientPacket() :m_sHead(0), m_nLength(0), m_sCmd(YDef), m_sSum(0) {}
-    CClientPacket(YondCmd sCmd, const char* pData, size_t nSize) {
-        m_sHead = 0xFEFF;
-        m_nLength = nSize + 4;
+    CClientPacket() :m_sCmd(YNULL), m_sUser(0), m_nVersion(YOND_PROTO_V2), m_bCrc(true), m_nCheck(0) {}
+    CClientPacket(YondCmd sCmd, const char* pData, size_t nSize, unsigned short sUser = 0) {
         m_sCmd = sCmd;
+        m_sUser = sUser;
+        m_nVersion = YOND_PROTO_V2;
+        m_bCrc = true;
+        m_nCheck = 0;
         if (nSize > 0) {
-            m_strData.reserve(nSize);
-            memcpy((void*)m_strData.c_str(), pData, nSize);
+            m_strData.assign(pData, nSize);
         }
         else {
             m_strData.clear();
         }
-        m_sSum = 0;
-        for (size_t i = 0; i < m_strData.size(); i++) {
-            m_sSum += (unsigned char)(m_strData[i] & 0xFF);
-        }
-    }
-    CClientPacket(const CClientPacket& pack) {
-        m_sHead = pack.m_sHead;
-        m_nLength = pack.m_nLength;
-        m_sCmd = pack.m_sCmd;
-        m_strData = pack.m_strData;
-        m_sSum = pack.m_sSum;
     }
-    CClientPacket(const unsigned short* pData, size_t& nSize) {
-        size_t i = 0;
-        for (; i < nSize; i++) {
-            if (*(unsigned short*)(pData + i) == 0xFEFF) {
-                m_sHead = *(unsigned short*)(pData + i);
-                i += 2;
-                break;
-            }
-        }
-        if (i + 4 + 2 + 2 + 2 > nSize) {
-            nSize = 0;
-            qDebug() << "Incomplete packet header!";
-            return;
-        }
-        m_nLength = *(unsigned long*)(pData + i); i += 4;
-        if (m_nLength + i > nSize) {
+    // 从pData解出一帧并复制负载, nSize返回帧之后剩余的字节数, 失败时为0
+    CClientPacket(const unsigned char* pData, size_t& nSize) : CClientPacket() {
+        size_t nUsed = 0;
+        YondFrameHead head;
+        int ret = CYondCodec::DecodeStream(pData, nSize, nUsed, head);
+        if (ret != YDecodeFrame) {
+            qDebug() << (ret == YDecodeBadSum ? "Packet sum check error!!" : "Failed to recv the packet!!");
             nSize = 0;
-            qDebug() << "Failed to recv the packet!!";
-            return;
-        }
-        m_sCmd = *(YondCmd*)(pData + i); i += 2;
-        m_sUser = *(unsigned short*)(pData + i); i += 2;
-        if (m_nLength > 4) {
-            m_strData.resize(m_nLength - 2 - 2);
-            memcpy((void*)m_strData.c_str(), pData + i, m_nLength - 4);
-            i += m_nLength - 4;
-        }
-        m_sSum = *(unsigned short*)(pData + i); i += 2;
-        unsigned short sum = 0;
-        for (size_t j = 0; j < m_strData.size(); j++) {
-            sum += (unsigned char)((m_strData[j]) & 0xFF);
-        }
-        if (sum == m_sSum) {
-            nSize -= i;
             return;
         }
-        qDebug() << "Packet sum check error!!";
-        nSize = 0;
+        m_sCmd = (YondCmd)head.sCmd;
+        m_sUser = (unsigned short)head.sUser;
+        m_strData.assign((const char*)pData + head.nBody, head.nBodySize);
+        m_nVersion = head.nVersion;
+        m_bCrc = head.bCrc;
+        m_nCheck = CYondCodec::Get(pData + head.nBody + head.nBodySize, head.bCrc ? YFieldCrc : YFieldSum);
+        nSize -= nUsed;
     }
-    ~CClientPacket() {};
-    CClientPacket& operator=(const CClientPacket& pack) {
-        if (this != &pack) {
-            m_sHead = pack.m_sHead;
-            m_nLength = pack.m_nLength;
-            m_sCmd = pack.m_sCmd;
-            m_strData = pack.m_strData;
-            m_sSum = pack.m_sSum;
+    size_t Size() const {
+        if (m_nVersion == YOND_PROTO_V2) {
+            return CYondCodec::FrameSizeV2(m_strData.size(), m_sUser != 0, m_bCrc);
         }
-        return *this;
+        return CYondCodec::FrameSize(m_strData.size(), m_bCrc);
     }
-    size_t Size() {
-        return m_nLength + 6;
-    }
-    const char* Data() {
-        m_strOut.resize(m_nLength + 6);
-        char* pData = (char*)m_strOut.c_str();
-        *(unsigned short*)pData = m_sHead; pData += 2;
-        *(unsigned long*)pData = m_nLength; pData += 4;
-        *(YondCmd*)pData = m_sCmd; pData += 2;
-        memcpy(pData, m_strData.c_str(), m_strData.size()); pData += m_strData.size();
-        *(unsigned short*)pData = m_sSum;
-        return m_strOut.c_str();
+    // 序列化到调用方的缓冲, nCap不足Size()时返回0
+    size_t Serialize(char* pOut, size_t nCap) const {
+        if (m_nVersion == YOND_PROTO_V2) {
+            return CYondCodec::EncodeV2(pOut, nCap, m_sCmd, m_sUser, m_strData.data(), m_strData.size(), m_bCrc);
+        }
+        return CYondCodec::Encode(pOut, nCap, m_sCmd, m_sUser, m_strData.data(), m_strData.size(), m_bCrc);
     }
 public:
-    unsigned short m_sHead;
-    size_t m_nLength;
     YondCmd m_sCmd;
-    short m_sUser;
+    unsigned short m_sUser;
+    unsigned m_nVersion;    // YOND_PROTO_VERSION或YOND_PROTO_V2
     std::string m_strData;
-    unsigned short m_sSum;
-    std::string m_strOut;
+    bool m_bCrc;
+    uint32_t m_nCheck;  // 解出的帧尾校验值, 自行构造的包为0, 序列化时才计算
 };
 
 #endif // CCLIENTPACKET_H
@@ -1,67 +1,545 @@
 #include "filetransfer.h"
 #include <QDebug>
 #include <QFileInfo>
+#include "../../LetsChat_common/CYondCdc.h"
+#include "../../LetsChat_common/CYondSha256.h"
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 FileTransfer::FileTransfer(QObject *parent)
     : QObject(parent)
     , m_uploadSocket(new QTcpSocket(this))
-    , m_downloadSocket(new QTcpSocket(this))
     , m_uploadFile(nullptr)
     , m_downloadFile(nullptr)
     , m_uploadTotalBytes(0)
     , m_downloadTotalBytes(0)
+    , m_uploadMap(nullptr)
+    , m_uploadRunsLeft(-1)
+    , m_uploadNeedBytes(0)
+    , m_uploadSeg(0)
+    , m_uploadSegOff(0)
+    , m_uploadSent(0)
+    , m_uploadAcked(0)
+    , m_uploadChunkSize(DEFAULT_CHUNK_SIZE)
+    , m_uploadWindow(DEFAULT_WINDOW_CHUNKS)
+    , m_uploadAccepted(false)
+    , m_downloadIdx(nullptr)
+    , m_downloadResumed(false)
+    , m_downloadSized(false)
+    , m_downloadDone(0)
+    , m_downloadPort(0)
+    , m_uploadPort(0)
+    , m_uploadPutDone(0)
+    , m_uploadCommit(false)
+    , m_maxStreams(DEFAULT_MAX_STREAMS)
+    , m_tuneTimer(new QTimer(this))
 {
     connect(m_uploadSocket, &QTcpSocket::readyRead, this, &FileTransfer::handleUploadReadyRead);
-    connect(m_downloadSocket, &QTcpSocket::readyRead, this, &FileTransfer::handleDownloadReadyRead);
+    connect(m_uploadSocket, &QTcpSocket::bytesWritten, this, &FileTransfer::handleUploadBytesWritten);
     
     connect(m_uploadSocket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
             this, &FileTransfer::handleUploadError);
-    connect(m_downloadSocket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
-            this, &FileTransfer::handleDownloadError);
+
+    m_tuneTimer->setInterval(TUNE_INTERVAL_MS);
+    connect(m_tuneTimer, &QTimer::timeout, this, &FileTransfer::handleTuneTimeout);
 }
 
 FileTransfer::~FileTransfer()
 {
-    if (m_uploadFile) {
-        m_uploadFile->close();
-        delete m_uploadFile;
-    }
-    if (m_downloadFile) {
-        m_downloadFile->close();
-        delete m_downloadFile;
-    }
+    closeUpload();
+    closeDownload(false);
 }
 
 void FileTransfer::uploadFile(const QString &filePath, const QString &host, quint16 port)
 {
     QMutexLocker locker(&m_uploadMutex);
     
+    closeUpload();
     m_uploadFile = new QFile(filePath);
     if (!m_uploadFile->open(QIODevice::ReadOnly)) {
         emit error(u8"无法打开文件进行上传");
+        closeUpload();
         return;
     }
 
     m_uploadTotalBytes = m_uploadFile->size();
-    
-    QString msg = QString("FILE %1 %2").arg(QFileInfo(filePath).fileName()).arg(m_uploadTotalBytes);
-    m_uploadSocket->connectToHost(host, port);
-    m_uploadSocket->write(msg.toUtf8());
+    m_uploadMap = m_uploadTotalBytes > 0 ? m_uploadFile->map(0, m_uploadTotalBytes) : nullptr;
+    if (!m_uploadMap && m_uploadTotalBytes > 0) {
+        m_uploadBuffer = m_uploadFile->readAll();
+        if (m_uploadBuffer.size() != m_uploadTotalBytes) {
+            emit error(u8"无法读取上传的文件");
+            closeUpload();
+            return;
+        }
+        m_uploadMap = reinterpret_cast<uchar *>(m_uploadBuffer.data());
+    }
+    m_uploadHost = host;
+    m_uploadPort = port;
+    m_uploadCommit = false;
+
+    // 切块和哈希与服务端入库时一致, 相同内容的块只存一份
+    m_uploadChunks.clear();
+    m_uploadHashes.clear();
+    QByteArray list;
+    const char *data = reinterpret_cast<const char *>(m_uploadMap);
+    for (qint64 off = 0; off < m_uploadTotalBytes; ) {
+        qint64 len = (qint64)CYondCdc::Cut(data + off, size_t(m_uploadTotalBytes - off));
+        m_uploadChunks.append(qMakePair(off, len));
+        m_uploadHashes.append(QByteArray::fromStdString(CYondSha256::Hex(data + off, size_t(len))));
+        list += m_uploadHashes.last() + ' ' + QByteArray::number(len) + '\n';
+        off += len;
+    }
+
+    // 服务端回"NEED <区间数>"和各区间"<首块> <块数>", 之后按缺少的字节累计回"ACP <n>"
+    QString msg = QString("PUSH %1 %2 %3\n").arg(QFileInfo(filePath).fileName())
+            .arg(m_uploadTotalBytes).arg(m_uploadChunks.size());
+    m_uploadPush = msg.toUtf8() + list;
+    sendPush();
 }
 
-void FileTransfer::downloadFile(const QString &filename, const QString &host, quint16 port)
+void FileTransfer::sendPush()
+{
+    m_uploadSegments.clear();
+    m_uploadNeed.clear();
+    m_uploadRunsLeft = -1;
+    m_uploadNeedBytes = 0;
+    m_uploadSeg = 0;
+    m_uploadSegOff = 0;
+    m_uploadSent = 0;
+    m_uploadAcked = 0;
+    m_uploadAccepted = false;
+    m_uploadReply.clear();
+    m_uploadSocket->abort();
+    m_uploadSocket->connectToHost(m_uploadHost, m_uploadPort);
+    m_uploadSocket->write(m_uploadPush);
+}
+
+void FileTransfer::downloadFile(const QString &savePath, const QString &filename, const QString &host, quint16 port)
 {
     QMutexLocker locker(&m_downloadMutex);
-    
-    m_downloadFile = new QFile(filename);
-    if (!m_downloadFile->open(QIODevice::WriteOnly)) {
+
+    closeDownload(false);
+    m_downloadSavePath = savePath;
+    m_downloadName = QFileInfo(filename).fileName();
+    m_downloadHost = host;
+    m_downloadPort = port;
+    startDownload();
+}
+
+void FileTransfer::startDownload()
+{
+    m_downloadFile = new QFile(m_downloadSavePath + ".part");
+    m_downloadIdx = new QFile(m_downloadSavePath + ".part.idx");
+
+    // 上次没下完的暂存文件和块表都在时从第一个未完成块续传
+    m_downloadResumed = false;
+    if (m_downloadFile->exists() && m_downloadIdx->open(QIODevice::ReadOnly)) {
+        m_downloadResumed = m_downloadChunks.Parse(m_downloadIdx->readAll().toStdString());
+        m_downloadIdx->close();
+    }
+    QIODevice::OpenMode mode = QIODevice::ReadWrite;
+    if (!m_downloadResumed) {
+        mode |= QIODevice::Truncate;
+    }
+    // 各段按偏移直接写文件, 不经过QFile的缓冲
+    if (!m_downloadFile->open(mode | QIODevice::Unbuffered)
+            || (m_downloadResumed && !m_downloadIdx->open(QIODevice::ReadWrite))) {
         emit error(u8"无法创建文件进行下载");
+        closeDownload(false);
         return;
     }
 
-    QString msg = QString("REQ %1").arg(filename);
-    m_downloadSocket->connectToHost(host, port);
-    m_downloadSocket->write(msg.toUtf8());
+    // 文件大小要等第一个RANGE头, 第一段先按段长请求, 服务端会截到文件末尾
+    m_downloadSized = false;
+    m_downloadTotalBytes = 0;
+    m_downloadDone = 0;
+    m_downloadPieces.clear();
+    qint64 first = m_downloadResumed ? m_downloadChunks.Offset(m_downloadChunks.FirstMissing()) : 0;
+    addRangeStream(first, first + PIECE_BYTES);
+}
+
+bool FileTransfer::resetDownloadChunks(qint64 size)
+{
+    if (!m_downloadChunks.Reset(size)) {
+        return false;
+    }
+    m_downloadIdx->close();
+    if (!m_downloadIdx->open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        return false;
+    }
+    std::string data = m_downloadChunks.Serialize();
+    return m_downloadIdx->write(data.data(), data.size()) == (qint64)data.size() && m_downloadIdx->flush();
+}
+
+void FileTransfer::planDownload(qint64 from)
+{
+    // 续传时from之前的块都已完成, 之后缺的块按连续区间切成段
+    qint64 missing = 0;
+    for (size_t i = m_downloadChunks.FirstMissing(); i < m_downloadChunks.Count(); i++) {
+        if (m_downloadChunks.Done(i)) continue;
+        qint64 begin = m_downloadChunks.Offset(i);
+        qint64 end = m_downloadChunks.Offset(i + 1);
+        missing += end - begin;
+        begin = qMax(begin, from);
+        if (begin >= end) continue;
+        if (!m_downloadPieces.isEmpty() && m_downloadPieces.last().second == begin
+                && m_downloadPieces.last().second - m_downloadPieces.last().first < PIECE_BYTES) {
+            m_downloadPieces.last().second = end;
+        } else {
+            m_downloadPieces.append(qMakePair(begin, end));
+        }
+    }
+    m_downloadDone = m_downloadTotalBytes - missing;
+
+    m_downloadTuner.reset(m_maxStreams);
+    if (missing < PARALLEL_MIN_BYTES || m_maxStreams <= 1) {
+        // 只用一条连接时相邻的段合并, 省掉段间的往返
+        QVector<QPair<qint64, qint64> > merged;
+        for (const QPair<qint64, qint64> &piece : m_downloadPieces) {
+            if (!merged.isEmpty() && merged.last().second == piece.first) {
+                merged.last().second = piece.second;
+            } else {
+                merged.append(piece);
+            }
+        }
+        m_downloadPieces = merged;
+        m_downloadTuner.target = 1;
+        return;
+    }
+    m_tuneTimer->start();
+    while (m_downloadStreams.size() < m_downloadTuner.target && !m_downloadPieces.isEmpty()) {
+        QPair<qint64, qint64> piece = m_downloadPieces.takeFirst();
+        addRangeStream(piece.first, piece.second);
+    }
+}
+
+void FileTransfer::addRangeStream(qint64 pos, qint64 end)
+{
+    RangeStream *stream = new RangeStream();
+    stream->socket = new QTcpSocket(this);
+    m_downloadStreams.append(stream);
+    connect(stream->socket, &QTcpSocket::readyRead, this, [this, stream]() {
+        handleRangeReadyRead(stream);
+    });
+    connect(stream->socket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
+            this, [this, stream](QAbstractSocket::SocketError) {
+        handleRangeError(stream);
+    });
+    stream->socket->connectToHost(m_downloadHost, m_downloadPort);
+    requestRange(stream, pos, end);
+}
+
+void FileTransfer::requestRange(RangeStream *stream, qint64 pos, qint64 end)
+{
+    stream->pos = stream->marked = pos;
+    stream->end = end;
+    stream->headerDone = false;
+    stream->header.clear();
+    QString msg = QString("GET %1 %2 %3\n").arg(m_downloadName).arg(pos).arg(end - pos);
+    stream->socket->write(msg.toUtf8());
+}
+
+void FileTransfer::removeRangeStream(RangeStream *stream)
+{
+    m_downloadStreams.removeOne(stream);
+    stream->socket->disconnect(this);
+    stream->socket->abort();
+    stream->socket->deleteLater();
+    delete stream;
+}
+
+bool FileTransfer::preallocateDownload(qint64 size)
+{
+    // 先占好整个文件, 各段乱序写入时不会反复扩展文件; 文件系统不支持时退回设置长度
+#ifdef Q_OS_LINUX
+    if (size > 0 && ::fallocate(m_downloadFile->handle(), 0, 0, size) == 0) {
+        return true;
+    }
+#endif
+    return m_downloadFile->resize(size);
+}
+
+bool FileTransfer::writeDownloadAt(qint64 offset, const char *data, qint64 len)
+{
+#ifdef Q_OS_UNIX
+    int fd = m_downloadFile->handle();
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd, data, size_t(len), off_t(offset));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+#else
+    // 所有连接都在同一线程处理, 定位后写不会被打断
+    return m_downloadFile->seek(offset) && m_downloadFile->write(data, len) == len;
+#endif
+}
+
+void FileTransfer::saveDownloadChunks(RangeStream *stream)
+{
+    // 段的起点按块对齐, 每条连接各自把收满的块记进块表
+    std::pair<size_t, size_t> range = m_downloadChunks.MarkRange(stream->marked, stream->pos);
+    if (range.first == range.second) return;
+
+    QByteArray done(int(range.second - range.first), '1');
+    m_downloadIdx->seek(qint64(m_downloadChunks.HeaderSize() + range.first));
+    m_downloadIdx->write(done);
+    m_downloadIdx->flush();
+    stream->marked = m_downloadChunks.Offset(range.second);
+}
+
+void FileTransfer::handleRangeReadyRead(RangeStream *stream)
+{
+    QMutexLocker locker(&m_downloadMutex);
+
+    if (!m_downloadFile) return;
+
+    QByteArray data = stream->socket->readAll();
+    if (data.isEmpty()) return;
+
+    // 头部一行之后紧跟这一段内容, 可能在同一次读到
+    if (!stream->headerDone) {
+        stream->header.append(data);
+        int nl = stream->header.indexOf('\n');
+        if (nl < 0) return;
+        QString header = QString::fromUtf8(stream->header.left(nl));
+        data = stream->header.mid(nl + 1);
+        stream->header.clear();
+        if (!handleRangeHeader(stream, header)) return;
+    }
+
+    // 下一段要等这一段收完才请求, 多出的数据说明协议错乱
+    qint64 len = data.size();
+    if (len > stream->end - stream->pos) {
+        emit error(u8"下载文件失败: 服务端多发了数据");
+        closeDownload(false);
+        return;
+    }
+    if (len > 0) {
+        if (!writeDownloadAt(stream->pos, data.constData(), len)) {
+            emit error("error process download file");
+            closeDownload(false);
+            return;
+        }
+        stream->pos += len;
+        m_downloadDone += len;
+        saveDownloadChunks(stream);
+        emit downloadProgress(m_downloadDone, m_downloadTotalBytes);
+    }
+    if (stream->pos == stream->end) {
+        nextRange(stream);
+    }
+}
+
+bool FileTransfer::handleRangeHeader(RangeStream *stream, const QString &header)
+{
+    // 文件名可能含空格, 数字取最后三段
+    QStringList fields = header.split(' ');
+    if (!header.startsWith("RANGE ") || fields.size() < 5) {
+        emit error(u8"下载文件失败: " + header);
+        closeDownload(true);
+        return false;
+    }
+    qint64 size = fields.at(fields.size() - 3).toLongLong();
+    qint64 offset = fields.at(fields.size() - 2).toLongLong();
+    qint64 len = fields.at(fields.size() - 1).toLongLong();
+    if (!m_downloadSized) {
+        if (!m_downloadResumed || m_downloadChunks.Size() != size) {
+            if (offset != 0) {
+                // 服务端的文件已不是暂存时那个, 丢掉暂存从头下载
+                closeDownload(true);
+                startDownload();
+                return false;
+            }
+            if (!resetDownloadChunks(size)) {
+                emit error(u8"无法创建文件进行下载");
+                closeDownload(false);
+                return false;
+            }
+        }
+        if (!preallocateDownload(size)) {
+            emit error(u8"无法创建文件进行下载");
+            closeDownload(false);
+            return false;
+        }
+        m_downloadTotalBytes = size;
+        m_downloadSized = true;
+        stream->end = offset + len;
+        planDownload(stream->end);
+    } else if (size != m_downloadTotalBytes || offset != stream->pos || offset + len != stream->end) {
+        // 下载途中服务端的文件被替换了
+        emit error(u8"下载文件失败: 文件已在服务端变更");
+        closeDownload(true);
+        return false;
+    }
+    stream->headerDone = true;
+    return true;
+}
+
+void FileTransfer::nextRange(RangeStream *stream)
+{
+    // 连接数超过调整后的目标时这条连接不再取新段
+    if (!m_downloadPieces.isEmpty() && m_downloadStreams.size() <= m_downloadTuner.target) {
+        QPair<qint64, qint64> piece = m_downloadPieces.takeFirst();
+        requestRange(stream, piece.first, piece.second);
+        return;
+    }
+    removeRangeStream(stream);
+    if (m_downloadStreams.isEmpty()) {
+        finishDownload();
+    }
+}
+
+void FileTransfer::finishDownload()
+{
+    if (!m_downloadPieces.isEmpty() || !m_downloadChunks.Complete()) {
+        emit error(u8"下载文件失败: 数据不完整");
+        closeDownload(false);
+        return;
+    }
+    // 收齐后改成正式文件名, 块表不再需要
+    m_downloadFile->close();
+    QFile::remove(m_downloadSavePath);
+    if (!QFile::rename(m_downloadFile->fileName(), m_downloadSavePath)) {
+        emit error(u8"无法保存下载的文件");
+        closeDownload(false);
+        return;
+    }
+    m_downloadIdx->remove();
+    closeDownload(false);
+    emit downloadFinished();
+}
+
+void FileTransfer::handleRangeError(RangeStream *stream)
+{
+    QMutexLocker locker(&m_downloadMutex);
+    if (!m_downloadFile) return;
+
+    // 其他连接还在时把这一段没记进块表的部分放回去, 由它们接着下载
+    if (m_downloadSized && m_downloadStreams.size() > 1) {
+        m_downloadDone -= stream->pos - stream->marked;
+        m_downloadPieces.prepend(qMakePair(stream->marked, stream->end));
+        removeRangeStream(stream);
+        return;
+    }
+    // 已下完的块留在暂存文件里, 再次下载时续传
+    QString errorMsg = u8"下载文件时发生错误: " + stream->socket->errorString();
+    closeDownload(false);
+    emit error(errorMsg);
+}
+
+void FileTransfer::closeDownload(bool discard)
+{
+    if (!m_downloadFile) return;
+    while (!m_downloadStreams.isEmpty()) {
+        removeRangeStream(m_downloadStreams.first());
+    }
+    m_downloadPieces.clear();
+    m_downloadFile->close();
+    m_downloadIdx->close();
+    if (discard) {
+        m_downloadFile->remove();
+        m_downloadIdx->remove();
+    }
+    delete m_downloadFile;
+    delete m_downloadIdx;
+    m_downloadFile = nullptr;
+    m_downloadIdx = nullptr;
+}
+
+void FileTransfer::setChunkSize(qint64 bytes)
+{
+    QMutexLocker locker(&m_uploadMutex);
+    m_uploadChunkSize = qMax<qint64>(bytes, 4096);
+}
+
+void FileTransfer::setWindowChunks(int chunks)
+{
+    QMutexLocker locker(&m_uploadMutex);
+    m_uploadWindow = qMax(chunks, 1);
+}
+
+void FileTransfer::setMaxStreams(int streams)
+{
+    QMutexLocker uploadLocker(&m_uploadMutex);
+    QMutexLocker downloadLocker(&m_downloadMutex);
+    m_maxStreams = qMax(streams, 1);
+}
+
+void FileTransfer::StreamTuner::reset(int maxStreams)
+{
+    limit = maxStreams;
+    target = qMin(2, maxStreams);
+    lastBytes = 0;
+    bestRate = 0;
+    settled = false;
+    clock.start();
+}
+
+void FileTransfer::StreamTuner::sample(qint64 bytes)
+{
+    double rate = double(bytes - lastBytes) / qMax<qint64>(clock.restart(), 1);
+    lastBytes = bytes;
+    if (settled) {
+        if (rate < bestRate * 0.7) {
+            settled = false;
+            bestRate = rate;
+        }
+        return;
+    }
+    if (rate > bestRate * 1.1) {
+        bestRate = rate;
+        if (target < limit) {
+            target++;
+        } else {
+            settled = true;
+        }
+    } else {
+        // 上一条没有带来提升, 退回去
+        if (rate < bestRate * 0.9 && target > 1) {
+            target--;
+        }
+        settled = true;
+    }
+}
+
+void FileTransfer::handleTuneTimeout()
+{
+    bool active = false;
+    {
+        QMutexLocker locker(&m_uploadMutex);
+        if (m_uploadFile && !m_uploadStreams.isEmpty()) {
+            active = true;
+            qint64 acked = m_uploadPutDone;
+            for (PutStream *stream : m_uploadStreams) {
+                acked += stream->acked;
+            }
+            m_uploadTuner.sample(acked);
+            while (m_uploadStreams.size() < m_uploadTuner.target && !m_uploadPieces.isEmpty()) {
+                QPair<int, int> piece = m_uploadPieces.takeFirst();
+                addPutStream(piece.first, piece.second);
+            }
+        }
+    }
+    QMutexLocker locker(&m_downloadMutex);
+    if (m_downloadFile && m_downloadSized && !m_downloadStreams.isEmpty()) {
+        active = true;
+        m_downloadTuner.sample(m_downloadDone);
+        while (m_downloadStreams.size() < m_downloadTuner.target && !m_downloadPieces.isEmpty()) {
+            QPair<qint64, qint64> piece = m_downloadPieces.takeFirst();
+            addRangeStream(piece.first, piece.second);
+        }
+    }
+    // 两个方向都没有并行传输时停下
+    if (!active) {
+        m_tuneTimer->stop();
+    }
 }
 
 void FileTransfer::handleUploadReadyRead()
@@ -70,86 +548,265 @@ void FileTransfer::handleUploadReadyRead()
     
     if (!m_uploadFile) return;
     
-    QByteArray data = m_uploadSocket->readAll();
-    QString message = QString::fromUtf8(data);
-    
-    if (message.startsWith("ACP")) {
-        sendFileChunk();
+    m_uploadReply.append(m_uploadSocket->readAll());
+    int nl;
+    while (m_uploadFile && (nl = m_uploadReply.indexOf('\n')) >= 0) {
+        QString line = QString::fromUtf8(m_uploadReply.left(nl));
+        m_uploadReply.remove(0, nl + 1);
+        if (!handleUploadLine(line)) return;
     }
+    pumpUpload();
 }
 
-void FileTransfer::handleDownloadReadyRead()
+bool FileTransfer::handleUploadLine(const QString &line)
 {
-    QMutexLocker locker(&m_downloadMutex);
-    
-    if (!m_downloadFile) return;
-    
-    QByteArray data = m_downloadSocket->readAll();
-    if (data.isEmpty()) return;
-    
-    QString message = QString::fromUtf8(data);
-    if (message.startsWith("FILE")) {
-        QStringList parts = message.split(" ");
-        if (parts.size() >= 3) {
-            m_downloadTotalBytes = parts[2].toLongLong();
+    if (m_uploadRunsLeft < 0 && line.startsWith("NEED ")) {
+        m_uploadRunsLeft = line.mid(5).toInt();
+    } else if (m_uploadRunsLeft > 0) {
+        // 缺少的块区间, 相邻的合并成一段连续发送
+        int first = line.section(' ', 0, 0).toInt();
+        int count = line.section(' ', 1, 1).toInt();
+        if (first < 0 || count <= 0 || first + count > m_uploadChunks.size()) {
+            emit error(u8"上传文件失败: " + line);
+            closeUpload();
+            return false;
+        }
+        for (int i = first; i < first + count; i++) {
+            m_uploadNeed.append(i);
+        }
+        qint64 off = m_uploadChunks[first].first;
+        qint64 len = m_uploadChunks[first + count - 1].first + m_uploadChunks[first + count - 1].second - off;
+        if (!m_uploadSegments.isEmpty()
+                && m_uploadSegments.last().first + m_uploadSegments.last().second == off) {
+            m_uploadSegments.last().second += len;
+        } else {
+            m_uploadSegments.append(qMakePair(off, len));
+        }
+        m_uploadNeedBytes += len;
+        m_uploadRunsLeft--;
+    } else if (m_uploadAccepted && line.startsWith("ACP ")) {
+        // 累计确认, 只需看最新的一条
+        m_uploadAcked = qMax(m_uploadAcked, line.mid(4).toLongLong());
+    } else {
+        emit error(u8"上传文件失败: " + line);
+        closeUpload();
+        return false;
+    }
+
+    if (!m_uploadAccepted && m_uploadRunsLeft == 0) {
+        m_uploadAccepted = true;
+        // 缺得多时这条连接不再发块, 改由多条PUT连接分段并行上传, 传完后再PUSH一次
+        if (!m_uploadCommit && m_maxStreams > 1 && m_uploadNeedBytes >= PARALLEL_MIN_BYTES) {
+            startParallelUpload();
+            return false;
+        }
+    }
+    if (m_uploadAccepted) {
+        // 服务端已有的块算作已上传
+        emit uploadProgress(m_uploadTotalBytes - m_uploadNeedBytes + m_uploadAcked, m_uploadTotalBytes);
+        if (m_uploadAcked >= m_uploadNeedBytes) {
+            closeUpload();
+            emit uploadFinished();
+            return false;
+        }
+    }
+    return true;
+}
+
+void FileTransfer::startParallelUpload()
+{
+    m_uploadSocket->abort();
+
+    // 按NEED的顺序每凑够一段的字节切一段
+    m_uploadPieces.clear();
+    qint64 bytes = 0;
+    int first = 0;
+    for (int i = 0; i < m_uploadNeed.size(); i++) {
+        bytes += m_uploadChunks[m_uploadNeed[i]].second;
+        if (bytes >= PIECE_BYTES || i == m_uploadNeed.size() - 1) {
+            m_uploadPieces.append(qMakePair(first, i + 1 - first));
+            first = i + 1;
+            bytes = 0;
+        }
+    }
+    m_uploadPutDone = 0;
+    m_uploadTuner.reset(m_maxStreams);
+    m_tuneTimer->start();
+    while (m_uploadStreams.size() < m_uploadTuner.target && !m_uploadPieces.isEmpty()) {
+        QPair<int, int> piece = m_uploadPieces.takeFirst();
+        addPutStream(piece.first, piece.second);
+    }
+    emitUploadProgress();
+}
+
+void FileTransfer::addPutStream(int first, int count)
+{
+    PutStream *stream = new PutStream();
+    stream->socket = new QTcpSocket(this);
+    m_uploadStreams.append(stream);
+    connect(stream->socket, &QTcpSocket::readyRead, this, [this, stream]() {
+        handlePutReadyRead(stream);
+    });
+    connect(stream->socket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::error),
+            this, [this, stream](QAbstractSocket::SocketError) {
+        handlePutError(stream);
+    });
+    stream->socket->connectToHost(m_uploadHost, m_uploadPort);
+    sendPiece(stream, first, count);
+}
+
+void FileTransfer::sendPiece(PutStream *stream, int first, int count)
+{
+    stream->first = first;
+    stream->count = count;
+    stream->bytes = 0;
+    stream->acked = 0;
+    stream->reply.clear();
+    // 一段不超过PIECE_BYTES, 整段交给socket的写缓冲
+    QByteArray msg = "PUT " + QByteArray::number(count) + '\n';
+    stream->socket->write(msg);
+    for (int i = first; i < first + count; i++) {
+        const QPair<qint64, qint64> &chunk = m_uploadChunks[m_uploadNeed[i]];
+        stream->socket->write(m_uploadHashes[m_uploadNeed[i]] + ' ' + QByteArray::number(chunk.second) + '\n');
+        stream->socket->write(reinterpret_cast<const char *>(m_uploadMap) + chunk.first, chunk.second);
+        stream->bytes += chunk.second;
+    }
+}
+
+void FileTransfer::handlePutReadyRead(PutStream *stream)
+{
+    QMutexLocker locker(&m_uploadMutex);
+
+    if (!m_uploadFile) return;
+
+    stream->reply.append(stream->socket->readAll());
+    int nl;
+    while ((nl = stream->reply.indexOf('\n')) >= 0) {
+        QString line = QString::fromUtf8(stream->reply.left(nl));
+        stream->reply.remove(0, nl + 1);
+        if (!line.startsWith("ACP ")) {
+            emit error(u8"上传文件失败: " + line);
+            closeUpload();
             return;
         }
+        stream->acked = qMax(stream->acked, line.mid(4).toLongLong());
     }
-    
-    receiveFileChunk();
+    emitUploadProgress();
+    if (stream->acked >= stream->bytes) {
+        nextPutPiece(stream);
+    }
+}
+
+void FileTransfer::nextPutPiece(PutStream *stream)
+{
+    m_uploadPutDone += stream->bytes;
+    if (!m_uploadPieces.isEmpty() && m_uploadStreams.size() <= m_uploadTuner.target) {
+        QPair<int, int> piece = m_uploadPieces.takeFirst();
+        sendPiece(stream, piece.first, piece.second);
+        return;
+    }
+    removePutStream(stream);
+    if (m_uploadStreams.isEmpty()) {
+        // 缺的块都已入库, 再发一次块清单让服务端写清单, 正常应回"NEED 0"
+        m_uploadCommit = true;
+        sendPush();
+    }
+}
+
+void FileTransfer::removePutStream(PutStream *stream)
+{
+    m_uploadStreams.removeOne(stream);
+    stream->socket->disconnect(this);
+    stream->socket->abort();
+    stream->socket->deleteLater();
+    delete stream;
 }
 
-void FileTransfer::sendFileChunk()
+void FileTransfer::handlePutError(PutStream *stream)
 {
+    QMutexLocker locker(&m_uploadMutex);
     if (!m_uploadFile) return;
-    
-    QByteArray buffer = m_uploadFile->read(BUFFER_SIZE);
-    if (!buffer.isEmpty()) {
-        m_uploadSocket->write(buffer);
-        emit uploadProgress(m_uploadFile->pos(), m_uploadTotalBytes);
+
+    // 其他连接还在时整段放回去重发, 服务端已存下的块会直接跳过
+    if (m_uploadStreams.size() > 1) {
+        m_uploadPieces.prepend(qMakePair(stream->first, stream->count));
+        removePutStream(stream);
+        return;
     }
-    
-    if (m_uploadFile->atEnd()) {
-        m_uploadFile->close();
-        delete m_uploadFile;
-        m_uploadFile = nullptr;
-        emit uploadFinished();
+    QString errorMsg = u8"上传文件时发生错误: " + stream->socket->errorString();
+    closeUpload();
+    emit error(errorMsg);
+}
+
+void FileTransfer::emitUploadProgress()
+{
+    qint64 acked = m_uploadPutDone;
+    for (PutStream *stream : m_uploadStreams) {
+        acked += stream->acked;
     }
+    emit uploadProgress(m_uploadTotalBytes - m_uploadNeedBytes + acked, m_uploadTotalBytes);
 }
 
-void FileTransfer::receiveFileChunk()
+void FileTransfer::handleUploadBytesWritten(qint64 bytes)
 {
-    if (!m_downloadFile) return;
-    
-    QByteArray data = m_downloadSocket->readAll();
-    if (!data.isEmpty()) {
-        qint64 written = m_downloadFile->write(data);
-        if (written == -1) {
-            emit error("error process download file");
+    Q_UNUSED(bytes);
+    QMutexLocker locker(&m_uploadMutex);
+    pumpUpload();
+}
+
+void FileTransfer::pumpUpload()
+{
+    if (!m_uploadFile || !m_uploadAccepted) return;
+
+    // 在途字节受窗口限制; socket写缓冲里最多压一块, 其余等bytesWritten再补
+    qint64 window = m_uploadChunkSize * m_uploadWindow;
+    while (m_uploadSeg < m_uploadSegments.size()
+           && m_uploadSent - m_uploadAcked < window
+           && m_uploadSocket->bytesToWrite() < m_uploadChunkSize) {
+        const QPair<qint64, qint64> &seg = m_uploadSegments[m_uploadSeg];
+        qint64 len = qMin(m_uploadChunkSize, seg.second - m_uploadSegOff);
+        len = qMin(len, window - (m_uploadSent - m_uploadAcked));
+        qint64 written = m_uploadSocket->write(
+                    reinterpret_cast<const char *>(m_uploadMap) + seg.first + m_uploadSegOff, len);
+        if (written <= 0) {
+            emit error(u8"上传文件时发生错误: " + m_uploadSocket->errorString());
+            closeUpload();
             return;
         }
-        
-        emit downloadProgress(m_downloadFile->size(), m_downloadTotalBytes);
-        
-        if (m_downloadFile->size() >= m_downloadTotalBytes) {
-            m_downloadFile->close();
-            delete m_downloadFile;
-            m_downloadFile = nullptr;
-            emit downloadFinished();
+        m_uploadSent += written;
+        m_uploadSegOff += written;
+        if (m_uploadSegOff == seg.second) {
+            m_uploadSeg++;
+            m_uploadSegOff = 0;
         }
     }
 }
 
-void FileTransfer::handleUploadError(QAbstractSocket::SocketError socketError)
+void FileTransfer::closeUpload()
 {
-    Q_UNUSED(socketError);
-    QString errorMsg = u8"上传文件时发生错误: " + m_uploadSocket->errorString();
-    emit error(errorMsg);
+    if (!m_uploadFile) return;
+    if (m_uploadMap && m_uploadBuffer.isEmpty()) {
+        m_uploadFile->unmap(m_uploadMap);
+    }
+    m_uploadMap = nullptr;
+    m_uploadBuffer.clear();
+    while (!m_uploadStreams.isEmpty()) {
+        removePutStream(m_uploadStreams.first());
+    }
+    m_uploadPieces.clear();
+    m_uploadChunks.clear();
+    m_uploadHashes.clear();
+    m_uploadNeed.clear();
+    m_uploadSegments.clear();
+    m_uploadFile->close();
+    delete m_uploadFile;
+    m_uploadFile = nullptr;
+    m_uploadSocket->disconnectFromHost();
 }
 
-void FileTransfer::handleDownloadError(QAbstractSocket::SocketError socketError)
+void FileTransfer::handleUploadError(QAbstractSocket::SocketError socketError)
 {
     Q_UNUSED(socketError);
-    QString errorMsg = u8"下载文件时发生错误: " + m_downloadSocket->errorString();
+    QString errorMsg = u8"上传文件时发生错误: " + m_uploadSocket->errorString();
     emit error(errorMsg);
-} 
+}
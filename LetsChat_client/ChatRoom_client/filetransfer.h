@@ -6,6 +6,12 @@
 #include <QFile>
 #include <QThread>
 #include <QMutex>
+#include <QVector>
+#include <QPair>
+#include <QList>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "../../LetsChat_common/CYondChunkMap.h"
 
 class FileTransfer : public QObject
 {
@@ -14,8 +20,19 @@ public:
     explicit FileTransfer(QObject *parent = nullptr);
     ~FileTransfer();
 
+    // 文件按内容切块后先发块清单, 只上传服务端没有的块; 中断后重传时已存下的块不再发送.
+    // 缺的块较多时分成若干段, 由多条PUT连接并行上传
     void uploadFile(const QString &filePath, const QString &host, quint16 port);
-    void downloadFile(const QString &filename, const QString &host, quint16 port);
+    // savePath为本地保存路径, filename为服务端中转处的文件名.
+    // 下载先写到"<savePath>.part", 旁边的.idx记录已写完的块, 中断后再次调用从第一个未完成块续传.
+    // 大文件按段由多条连接并行下载, 各段写到暂存文件中各自的位置
+    void downloadFile(const QString &savePath, const QString &filename, const QString &host, quint16 port);
+
+    // 上传分块大小和在途块数, 在途字节超过二者之积时等服务端确认
+    void setChunkSize(qint64 bytes);
+    void setWindowChunks(int chunks);
+    // 每个方向并行连接数的上限, 为1时不并行
+    void setMaxStreams(int streams);
 
 signals:
     void uploadProgress(qint64 bytesSent, qint64 bytesTotal);
@@ -26,23 +43,140 @@ signals:
 
 private slots:
     void handleUploadReadyRead();
-    void handleDownloadReadyRead();
+    void handleUploadBytesWritten(qint64 bytes);
     void handleUploadError(QAbstractSocket::SocketError socketError);
-    void handleDownloadError(QAbstractSocket::SocketError socketError);
+    void handleTuneTimeout();
 
 private:
+    // 一条下载连接, 每次用GET取一段[pos, end)
+    struct RangeStream
+    {
+        QTcpSocket *socket;
+        qint64 pos;         // 下一个收到的字节在文件中的偏移
+        qint64 end;
+        qint64 marked;      // 块表已记录到的偏移
+        bool headerDone;    // 已收到"RANGE <name> <size> <offset> <len>"头
+        QByteArray header;
+    };
+
+    // 一条上传连接, 每次用PUT发m_uploadNeed中的一段块
+    struct PutStream
+    {
+        QTcpSocket *socket;
+        int first;          // 这一段在m_uploadNeed中的起始下标
+        int count;
+        qint64 bytes;       // 这一段的字节数
+        qint64 acked;       // 这一段服务端已确认的字节
+        QByteArray reply;
+    };
+
+    // 按观测到的总吞吐调整并行连接数: 加一条后吞吐涨了一成以上就继续加, 否则退掉一条停下;
+    // 之后吞吐跌到最好时的七成以下说明链路变了, 重新试探
+    struct StreamTuner
+    {
+        int target;
+        int limit;
+        qint64 lastBytes;
+        double bestRate;
+        bool settled;
+        QElapsedTimer clock;
+
+        void reset(int maxStreams);
+        // bytes为至今累计传输的字节
+        void sample(qint64 bytes);
+    };
+
     QTcpSocket *m_uploadSocket;
-    QTcpSocket *m_downloadSocket;
     QFile *m_uploadFile;
     QFile *m_downloadFile;
     QMutex m_uploadMutex;
     QMutex m_downloadMutex;
     qint64 m_uploadTotalBytes;
     qint64 m_downloadTotalBytes;
-    
-    static const int BUFFER_SIZE = 4096;
-    void sendFileChunk();
-    void receiveFileChunk();
+    QFile *m_downloadIdx;       // 下载块表
+    CYondChunkMap m_downloadChunks;
+    bool m_downloadResumed;     // 块表来自上次未完成的下载
+    bool m_downloadSized;       // 已由第一个RANGE头得知文件大小并分好段
+    qint64 m_downloadDone;      // 已写进暂存文件的字节, 含续传前已有的块
+    QList<RangeStream *> m_downloadStreams;
+    QVector<QPair<qint64, qint64> > m_downloadPieces;   // 还没分给连接的段(起点, 终点)
+    StreamTuner m_downloadTuner;
+    QString m_downloadSavePath;
+    QString m_downloadName;
+    QString m_downloadHost;
+    quint16 m_downloadPort;
+
+    uchar *m_uploadMap;         // 整个上传文件的内容, 映射失败时指向m_uploadBuffer
+    QByteArray m_uploadBuffer;
+    QVector<QPair<qint64, qint64> > m_uploadChunks;     // 切出的块(偏移, 长度)
+    QVector<QPair<qint64, qint64> > m_uploadSegments;   // 服务端缺少的块合并成的连续区间
+    int m_uploadRunsLeft;       // NEED之后还差的区间行数, -1表示还没收到NEED
+    qint64 m_uploadNeedBytes;   // 需要上传的字节, 窗口和确认都按这部分计数
+    int m_uploadSeg;            // 下一次发送所在的区间
+    qint64 m_uploadSegOff;      // 在该区间内的偏移
+    qint64 m_uploadSent;        // 已交给socket的字节
+    qint64 m_uploadAcked;       // 服务端累计确认的字节
+    qint64 m_uploadChunkSize;
+    int m_uploadWindow;
+    bool m_uploadAccepted;      // 已收齐NEED, 可以开始发送
+    QByteArray m_uploadReply;   // 未凑成整行的服务端回复
+    QString m_uploadHost;
+    quint16 m_uploadPort;
+    QByteArray m_uploadPush;    // PUSH行和块清单, 并行上传完后再发一次写清单
+    QVector<QByteArray> m_uploadHashes;     // 各块的SHA-256十六进制
+    QVector<int> m_uploadNeed;  // 服务端缺少的块下标, 按NEED的顺序
+    QList<PutStream *> m_uploadStreams;
+    QVector<QPair<int, int> > m_uploadPieces;   // 还没分给连接的段(m_uploadNeed起始下标, 块数)
+    qint64 m_uploadPutDone;     // PUT连接已确认完的段的字节
+    bool m_uploadCommit;        // 缺的块已由PUT连接传完, 这次PUSH只为写清单
+    StreamTuner m_uploadTuner;
+
+    int m_maxStreams;
+    QTimer *m_tuneTimer;
+
+    static const qint64 DEFAULT_CHUNK_SIZE = 256 * 1024;
+    static const int DEFAULT_WINDOW_CHUNKS = 8;
+    static const int DEFAULT_MAX_STREAMS = 8;
+    static const qint64 PIECE_BYTES = 8 * YOND_FILE_CHUNK;     // 每段的大小, 下载时按块表的块对齐
+    static const qint64 PARALLEL_MIN_BYTES = 4 * PIECE_BYTES;  // 要传的字节少于这个时只用一条连接
+    static const int TUNE_INTERVAL_MS = 1000;
+    // 在窗口和socket写缓冲允许时连续写出分块
+    void pumpUpload();
+    void closeUpload();
+    // 处理服务端的一行回复, 返回false表示上传已结束或转为并行上传
+    bool handleUploadLine(const QString &line);
+    // 清掉上一次PUSH的应答状态, 连上服务端发出块清单
+    void sendPush();
+    // 断开PUSH连接, 把缺的块分段交给PUT连接
+    void startParallelUpload();
+    void addPutStream(int first, int count);
+    void sendPiece(PutStream *stream, int first, int count);
+    void handlePutReadyRead(PutStream *stream);
+    void handlePutError(PutStream *stream);
+    // 段确认完后接着取下一段, 没有段或连接数超过目标时关掉连接
+    void nextPutPiece(PutStream *stream);
+    void removePutStream(PutStream *stream);
+    void emitUploadProgress();
+    // 打开暂存文件并从第一个未完成块请求第一段, 调用方持有m_downloadMutex
+    void startDownload();
+    // 建立新的块表文件, 从0开始下载
+    bool resetDownloadChunks(qint64 size);
+    // 第一个RANGE头之后把其余缺的块分段, 文件够大时开始并行
+    void planDownload(qint64 from);
+    void addRangeStream(qint64 pos, qint64 end);
+    void requestRange(RangeStream *stream, qint64 pos, qint64 end);
+    void handleRangeReadyRead(RangeStream *stream);
+    void handleRangeError(RangeStream *stream);
+    bool handleRangeHeader(RangeStream *stream, const QString &header);
+    void nextRange(RangeStream *stream);
+    void removeRangeStream(RangeStream *stream);
+    bool preallocateDownload(qint64 size);
+    // 写到暂存文件的指定偏移, 各连接互不影响
+    bool writeDownloadAt(qint64 offset, const char *data, qint64 len);
+    void saveDownloadChunks(RangeStream *stream);
+    void finishDownload();
+    // discard为false时保留暂存文件和块表供续传
+    void closeDownload(bool discard);
 };
 
 #endif // FILETRANSFER_H 
\ No newline at end of file
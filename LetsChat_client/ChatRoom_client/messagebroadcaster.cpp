@@ -1,13 +1,11 @@
 #include "messagebroadcaster.h"
 #include <QDebug>
 
-// 消息头部标识
-const unsigned short MESSAGE_HEADER = 0xFEFF;
-
 MessageBroadcaster::MessageBroadcaster(QObject *parent)
     : QObject(parent)
     , m_socket(new QTcpSocket(this))
     , m_isConnected(false)
+    , m_want(0)
 {
     connect(m_socket, &QTcpSocket::readyRead, this, &MessageBroadcaster::handleReadyRead);
     connect(m_socket, &QTcpSocket::connected, this, &MessageBroadcaster::handleConnected);
@@ -28,67 +26,19 @@ void MessageBroadcaster::connectToServer(const QString &host, quint16 port)
     m_socket->connectToHost(host, port);
 }
 
-// 写入大端序的16位整数
-void writeUint16(char*& pData, quint16 value) {
-    pData[0] = (value >> 8) & 0xFF;
-    pData[1] = value & 0xFF;
-    pData += 2;
-}
-
-// 写入大端序的32位整数
-void writeUint32(char*& pData, quint32 value) {
-    pData[0] = (value >> 24) & 0xFF;
-    pData[1] = (value >> 16) & 0xFF;
-    pData[2] = (value >> 8) & 0xFF;
-    pData[3] = value & 0xFF;
-    pData += 4;
-}
-
-QByteArray MessageBroadcaster::createMessagePacket(MessageType type, const QString &data)
+QByteArray MessageBroadcaster::createMessagePacket(YondCmd type, const QString &data)
 {
     QByteArray dataBytes = data.toUtf8();
-    quint32 length = dataBytes.size() + 4; // 4 = 命令类型(2字节) + 用户ID(2字节)
-    
-    // 预分配空间
-    QByteArray packet;
-    packet.resize(2 + 4 + 2 + 2 + dataBytes.size() + 2); // 头部(2) + 长度(4) + 命令(2) + 用户ID(2) + 数据 + 校验和(2)
-    char* pData = packet.data();
-    
-    // 写入消息头
-    writeUint16(pData, MESSAGE_HEADER);
-    writeUint32(pData, length);
-    writeUint16(pData, type);
-    writeUint16(pData, 0); // 用户ID暂时使用0
-    
-    // 写入数据
-    memcpy(pData, dataBytes.constData(), dataBytes.size());
-    pData += dataBytes.size();
-    
-    // 计算并写入校验和
-    quint16 sum = 0;
-    for (int i = 0; i < dataBytes.size(); i++) {
-        sum += (quint8)dataBytes[i];
-    }
-    writeUint16(pData, sum);
 
+    // 按共用的编解码直接写进预分配的包, 用户ID暂时使用0.
+    // 总是发带CRC32C的v2紧凑帧, 服务端收到后对本连接也改用同样的格式并合并广播; 解析时各种帧都接受
+    QByteArray packet(int(CYondCodec::FrameSizeV2(dataBytes.size(), false, true)), Qt::Uninitialized);
+    size_t size = CYondCodec::EncodeV2(packet.data(), packet.size(), type, 0,
+                                       dataBytes.constData(), dataBytes.size(), true);
+    packet.resize(int(size));
     return packet;
 }
 
-// 读取大端序的16位整数
-quint16 readUint16(const QByteArray& data, int& pos) {
-    quint16 value = ((quint8)data[pos] << 8) | (quint8)data[pos + 1];
-    pos += 2;
-    return value;
-}
-
-// 读取大端序的32位整数
-quint32 readUint32(const QByteArray& data, int& pos) {
-    quint32 value = ((quint8)data[pos] << 24) | ((quint8)data[pos + 1] << 16) |
-                   ((quint8)data[pos + 2] << 8) | (quint8)data[pos + 3];
-    pos += 4;
-    return value;
-}
-
 void MessageBroadcaster::sendMessage(const QString &message)
 {
     QByteArray packet = createMessagePacket(YMsg, message);
@@ -124,71 +74,46 @@ void MessageBroadcaster::handleReadyRead()
     QByteArray data = m_socket->readAll();
     qDebug() << "Received raw data:" << data;
     m_buffer.append(data);
-    
-    while (m_buffer.size() >= 2) {
-        // 查找消息头部
-        int headerPos = -1;
-        for (int i = 0; i <= m_buffer.size() - 2; i++) {
-            if ((quint8)m_buffer[i] == ((MESSAGE_HEADER >> 8) & 0xFF) &&
-                (quint8)m_buffer[i + 1] == (MESSAGE_HEADER & 0xFF)) {
-                headerPos = i;
-                break;
-            }
+    if (m_buffer.size() < m_want) {
+        return;
+    }
+
+    // 逐帧解析, 处理完后一次性移除已消费的字节, 剩余的半帧留到下次.
+    // 错位时由DecodeStream成块跳过垃圾
+    m_want = 0;
+    size_t pos = 0;
+    while (pos < size_t(m_buffer.size())) {
+        const char* pData = m_buffer.constData() + pos;
+        size_t used = 0;
+        YondFrameHead head;
+        int ret = CYondCodec::DecodeStream(pData, m_buffer.size() - pos, used, head);
+        pos += used;
+        if (ret == YDecodeMore) {
+            m_want = int(head.nWant);
+            break;
         }
-        
-        if (headerPos == -1) {
-            if (m_buffer.size() > 1) {
-                m_buffer = m_buffer.right(1);
-            }
-            return;
+        if (ret != YDecodeFrame) continue;
+
+        if (head.sCmd != YBatch) {
+            QString message = QString::fromUtf8(pData + head.nBody, int(head.nBodySize));
+            qDebug() << "Parsed message:" << message;
+            handleMessage(quint16(head.sCmd), quint16(head.sUser), message);
+            continue;
         }
-        
-        if (headerPos > 0) {
-            m_buffer.remove(0, headerPos);
+        // 批量帧按顺序拆成多条消息
+        const char* pBatch = pData + head.nBody;
+        size_t entryPos = 0;
+        YondBatchEntry entry;
+        while (CYondCodec::NextBatchEntry(pBatch, head.nBodySize, entryPos, entry) == YDecodeFrame) {
+            QString message = QString::fromUtf8(pBatch + entry.nBody, int(entry.nBodySize));
+            handleMessage(quint16(entry.sCmd), quint16(entry.sUser), message);
         }
-        
-        if (m_buffer.size() < 6) return;
-        
-        int pos = 0;
-        quint16 header = readUint16(m_buffer, pos);
-        quint32 length = readUint32(m_buffer, pos);
-        
-        if (m_buffer.size() < length + 8) return;
-        
-        QByteArray message = m_buffer.left(length + 8);
-        m_buffer.remove(0, length + 8);
-        
-        parseMessage(message);
     }
+    m_buffer.remove(0, int(pos));
 }
 
-void MessageBroadcaster::parseMessage(const QByteArray &data)
+void MessageBroadcaster::handleMessage(quint16 cmd, quint16 userId, const QString &message)
 {
-    if (data.size() < 8) return;
-
-    int pos = 0;
-    quint16 header = readUint16(data, pos);
-    if (header != MESSAGE_HEADER) return;
-
-    quint32 length = readUint32(data, pos);
-    if (length > data.size() - 6) return;
-
-    quint16 cmd = readUint16(data, pos);
-    quint16 userId = readUint16(data, pos);
-
-    QByteArray messageData = data.mid(pos, length - 4);
-    QString message = QString::fromUtf8(messageData);
-    qDebug() << "Parsed message:" << message;
-
-    int tempPos = pos + messageData.size();
-    quint16 sum = readUint16(data, tempPos);
-
-    quint16 calculatedSum = 0;
-    for (int i = 0; i < messageData.size(); i++) {
-        calculatedSum += (quint8)messageData[i];
-    }
-    if (calculatedSum != sum) return;
-
     switch (cmd) {
         case YMsg:
             emit messageReceived(QString::number(userId), message);
@@ -222,6 +147,8 @@ void MessageBroadcaster::parseMessage(const QByteArray &data)
 void MessageBroadcaster::handleConnected()
 {
     m_isConnected = true;
+    m_buffer.clear();
+    m_want = 0;
     //emit connectionError("");
 }
 
@@ -4,6 +4,7 @@
 #include <QObject>
 #include <QTcpSocket>
 #include <QByteArray>
+#include "../../LetsChat_common/CYondCodec.h"
 
 class MessageBroadcaster : public QObject
 {
@@ -33,50 +34,13 @@ private slots:
     void handleError(QAbstractSocket::SocketError socketError);
 
 private:
-    enum MessageType {
-        YConnect,
-        YMsg,
-        YFile,
-        YRecv
-    };
-
-    // 写入大端序的16位整数
-    static void writeUint16(char*& pData, quint16 value) {
-        pData[0] = (value >> 8) & 0xFF;
-        pData[1] = value & 0xFF;
-        pData += 2;
-    }
-
-    // 写入大端序的32位整数
-    static void writeUint32(char*& pData, quint32 value) {
-        pData[0] = (value >> 24) & 0xFF;
-        pData[1] = (value >> 16) & 0xFF;
-        pData[2] = (value >> 8) & 0xFF;
-        pData[3] = value & 0xFF;
-        pData += 4;
-    }
-
-    // 读取大端序的16位整数
-    static quint16 readUint16(const QByteArray& data, int& pos) {
-        quint16 value = ((quint8)data[pos] << 8) | (quint8)data[pos + 1];
-        pos += 2;
-        return value;
-    }
-
-    // 读取大端序的32位整数
-    static quint32 readUint32(const QByteArray& data, int& pos) {
-        quint32 value = ((quint8)data[pos] << 24) | ((quint8)data[pos + 1] << 16) |
-                       ((quint8)data[pos + 2] << 8) | (quint8)data[pos + 3];
-        pos += 4;
-        return value;
-    }
-
-    QByteArray createMessagePacket(MessageType type, const QString &data);
-    void parseMessage(const QByteArray &data);
+    QByteArray createMessagePacket(YondCmd type, const QString &data);
+    void handleMessage(quint16 cmd, quint16 userId, const QString &message);
 
     QTcpSocket *m_socket;
     bool m_isConnected;
     QByteArray m_buffer;
+    int m_want;     // 缓冲中是半帧时凑齐需要的长度, 不足时不再重新解析
 };
 
 #endif // MESSAGEBROADCASTER_H 
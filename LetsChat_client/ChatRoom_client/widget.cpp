@@ -139,7 +139,7 @@ void Widget::handleFileDownloadRequested(const QString& filename, const QString&
 	m_downloadProgress->setAutoClose(true);
 	m_downloadProgress->setAutoReset(true);
 
-	m_fileTransfer->downloadFile(savePath, "localhost", 8888);
+	m_fileTransfer->downloadFile(savePath, filename, "localhost", 8888);
 }
 
 void Widget::handleConnectionError(const QString& error)
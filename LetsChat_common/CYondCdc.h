@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define YOND_CDC_MIN (16 * 1024)		// 块长下限, 这之前不找切点
+#define YOND_CDC_AVG_BITS 16			// 越过下限后每字节以1/65536的概率切开, 平均块长约80KB
+#define YOND_CDC_MAX (256 * 1024)		// 块长上限, 到了强制切开
+
+// 内容定义分块(gear滚动哈希): 切点只取决于附近的内容, 文件中间插入或删除数据时
+// 其余块的边界和哈希不变. 服务端和客户端共用(C++14), 两端切出的块必须一致
+class CYondCdc
+{
+public:
+	// 从pData开始的下一块的长度, nSize为剩余字节数
+	static size_t Cut(const void* pData, size_t nSize) {
+		if (nSize <= YOND_CDC_MIN) {
+			return nSize;
+		}
+		const unsigned char* p = (const unsigned char*)pData;
+		const uint64_t* pGear = Gear();
+		const uint64_t nMask = ((uint64_t)1 << YOND_CDC_AVG_BITS) - 1;
+		size_t nEnd = nSize < YOND_CDC_MAX ? nSize : YOND_CDC_MAX;
+		uint64_t h = 0;
+		// 哈希只受最近64个字节影响, 从下限前64字节开始滚动即可
+		for (size_t i = YOND_CDC_MIN - 64; i < nEnd; i++) {
+			h = (h << 1) + pGear[p[i]];
+			// 取高位判断, 低位只反映最后几个字节
+			if (i >= YOND_CDC_MIN && ((h >> (64 - YOND_CDC_AVG_BITS)) & nMask) == 0) {
+				return i + 1;
+			}
+		}
+		return nEnd;
+	}
+
+private:
+	// 固定种子的splitmix64生成的随机表, 两端相同
+	static const uint64_t* Gear() {
+		struct Table
+		{
+			uint64_t v[256];
+			Table() {
+				uint64_t x = 0x59454e4443444331ull;
+				for (int i = 0; i < 256; i++) {
+					uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+					z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+					z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+					v[i] = z ^ (z >> 31);
+				}
+			}
+		};
+		static const Table table;
+		return table.v;
+	}
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+
+#define YOND_FILE_CHUNK (1024 * 1024)	// 断点续传的块大小
+#define YOND_CHUNK_MAP_MAX (16 * 1024 * 1024)	// 块表最多的块数, 按默认块大小为16TB
+
+// 中转文件的块完成表, 服务端和客户端共用(C++14). 存成暂存文件旁的"<name>.part.idx":
+//   "YCM1 <size> <chunk>\n" 后面每块一个字节, '1'为已写完, '0'为未写.
+// 更新时只改动对应字节, 偏移为HeaderSize()+块下标
+class CYondChunkMap
+{
+public:
+	CYondChunkMap() : m_nSize(0), m_nChunk(YOND_FILE_CHUNK) {}
+
+	// 长度为负、块大小不为正或块数超过YOND_CHUNK_MAP_MAX时返回false, 表保持不变
+	bool Reset(int64_t nSize, int64_t nChunk = YOND_FILE_CHUNK) {
+		if (nSize < 0 || nChunk <= 0) {
+			return false;
+		}
+		// 不用nSize + nChunk - 1, 长度接近上限时会溢出
+		int64_t nCount = nSize / nChunk + (nSize % nChunk != 0 ? 1 : 0);
+		if (nCount > YOND_CHUNK_MAP_MAX) {
+			return false;
+		}
+		m_nSize = nSize;
+		m_nChunk = nChunk;
+		m_vDone.assign((size_t)nCount, '0');
+		return true;
+	}
+
+	// 格式或长度不对时返回false, 表保持不变
+	bool Parse(const std::string& strData) {
+		long long nSize = 0, nChunk = 0;
+		int nHead = 0;
+		if (sscanf(strData.c_str(), "YCM1 %lld %lld\n%n", &nSize, &nChunk, &nHead) != 2 || nHead == 0) {
+			return false;
+		}
+		CYondChunkMap map;
+		if (!map.Reset(nSize, nChunk) || strData.size() != map.HeaderSize() + map.Count()) {
+			return false;
+		}
+		for (size_t i = 0; i < map.Count(); i++) {
+			if (strData[map.HeaderSize() + i] == '1') map.m_vDone[i] = '1';
+		}
+		*this = map;
+		return true;
+	}
+
+	std::string Serialize() const {
+		return Header() + std::string(m_vDone.begin(), m_vDone.end());
+	}
+
+	size_t HeaderSize() const { return Header().size(); }
+	int64_t Size() const { return m_nSize; }
+	int64_t Chunk() const { return m_nChunk; }
+	size_t Count() const { return m_vDone.size(); }
+	bool Done(size_t i) const { return m_vDone[i] == '1'; }
+
+	// 第一个未完成块的下标, 全部完成时为Count()
+	size_t FirstMissing() const {
+		size_t i = 0;
+		while (i < Count() && Done(i)) i++;
+		return i;
+	}
+	bool Complete() const { return FirstMissing() == Count(); }
+
+	// 第i块的起始偏移, i为Count()时是文件末尾
+	int64_t Offset(size_t i) const {
+		int64_t nOff = (int64_t)i * m_nChunk;
+		return nOff < m_nSize ? nOff : m_nSize;
+	}
+
+	// [nBegin, nEnd)已写入文件, 把其中完整覆盖的块标记为完成, 返回这些块的下标范围[first, last)
+	std::pair<size_t, size_t> MarkRange(int64_t nBegin, int64_t nEnd) {
+		size_t nFirst = (size_t)((nBegin + m_nChunk - 1) / m_nChunk);
+		size_t nLast = nEnd >= m_nSize ? Count() : (size_t)(nEnd / m_nChunk);
+		for (size_t i = nFirst; i < nLast; i++) {
+			m_vDone[i] = '1';
+		}
+		return std::make_pair(nFirst, nLast > nFirst ? nLast : nFirst);
+	}
+
+private:
+	std::string Header() const {
+		return "YCM1 " + std::to_string(m_nSize) + " " + std::to_string(m_nChunk) + "\n";
+	}
+
+	int64_t m_nSize;
+	int64_t m_nChunk;
+	std::vector<char> m_vDone;
+};
@@ -0,0 +1,549 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "CYondCrc32c.h"
+#include "CYondScan.h"
+
+// 服务端和客户端共用的帧编解码, 只依赖标准库(C++14), 两边都按本文件读写线上格式.
+// 帧格式v1, 多字节字段都是大端:
+//   魔数0xFEFF(2) 版本(1) 长度(3) 命令(2) 用户(2) 负载 校验和(2)
+// 长度 = 命令 + 用户 + 负载 = 负载长度 + 4, 整帧 = 长度 + 8; 校验和为负载各字节之和(16位回绕).
+// 版本字节最高位YOND_FLAG_CRC32C置位时帧尾换成4字节CRC32C, 覆盖版本字节到负载末尾, 整帧 = 长度 + 10.
+// 协商方式: 支持CRC32C的一端发出的帧都带该位, 对端收到过带位的帧后才用CRC32C回发, 老对端始终收到字节和.
+// 旧版本的对端把长度写成4字节, 其最高字节在帧长上限内恒为0, 正好落在版本字节上,
+// 所以版本0的帧与v1逐字节相同, 解码时照常接受. Encode总是写YOND_PROTO_VERSION.
+//
+// 帧格式v2(紧凑), 版本字节的CRC32C标志、帧尾和校验范围都与v1相同:
+//   魔数0xFEFF(2) 版本(1) 长度(varint, 1~4字节) 命令(1) [用户(2)] 负载 校验和(2)/CRC32C(4)
+// 长度 = 命令字节 + 用户 + 负载; 命令字节最高位YOND_CMD_USER表示后跟用户字段, 用户为0时省略.
+// varint每字节低7位有效, 低位组在前, 最高位为1表示后面还有字节. 短消息的帧头帧尾共7字节, v1为12字节.
+// YBatch只出现在v2中, 负载是若干条目首尾相接, 每条: 命令字节 [用户(2)] 负载长度(varint) 负载.
+// 协商方式同CRC32C: 支持v2的一端发出的帧都用v2, 对端收到过v2帧后才用v2和YBatch回发
+
+#define YOND_PROTO_VERSION 1
+#define YOND_PROTO_V2 2
+#define YOND_FRAME_MAGIC 0xFEFF
+#define YOND_FRAME_HEAD 10	// v1魔数到用户字段
+#define YOND_FRAME_TAIL 2	// 校验和
+#define YOND_FRAME_TAIL_CRC 4	// CRC32C
+#define YOND_FLAG_CRC32C 0x80	// 版本字节中的标志位
+#define YOND_VERSION_MASK 0x7F
+#define YOND_CMD_USER 0x80	// v2命令字节中的标志位
+#define YOND_VARINT_MAX 4
+#define YOND_MAX_FRAME 0xFFFFFF	// 长度字段上限, 也用于识别错位后读出的非法长度
+
+enum YondCmd
+{
+	YConnect,
+	YMsg,
+	YFile,
+	YRecv,
+	YBatch,		// v2: 多条消息合成一帧
+
+	YNULL
+};
+
+// Decode的返回值
+enum YondDecode
+{
+	YDecodeBadSum = -2,	// 帧完整但校验和或CRC不对, 丢弃nUsed字节(整帧)
+	YDecodeBad = -1,	// 丢弃nUsed字节(坏帧或错位)
+	YDecodeMore = 0,	// 数据不足, 等待更多字节
+	YDecodeFrame = 1	// 解出一帧
+};
+
+enum YondEndian
+{
+	YEndianBig,
+	YEndianLittle
+};
+
+// 定长字段描述: 相对帧头的偏移、字节数和字节序
+struct YondField
+{
+	unsigned nOffset;
+	unsigned nSize;
+	YondEndian eEndian;
+};
+
+constexpr YondField YFieldMagic = { 0, 2, YEndianBig };
+constexpr YondField YFieldVersion = { 2, 1, YEndianBig };
+constexpr YondField YFieldLength = { 3, 3, YEndianBig };	// v1
+constexpr YondField YFieldCmd = { 6, 2, YEndianBig };	// v1
+constexpr YondField YFieldUser = { 8, 2, YEndianBig };	// v1
+constexpr YondField YFieldSum = { 0, 2, YEndianBig };	// 偏移相对负载末尾
+constexpr YondField YFieldCrc = { 0, 4, YEndianBig };	// 偏移相对负载末尾
+constexpr YondField YFieldUserV2 = { 1, 2, YEndianBig };	// 偏移相对命令字节
+
+// 解出的帧头, 负载从nBody开始(相对Decode的输入)
+struct YondFrameHead
+{
+	unsigned nVersion;	// 不含标志位
+	bool bCrc;
+	uint32_t nLength;	// 长度字段原值, 含义见各版本的格式说明
+	unsigned sCmd;
+	unsigned sUser;
+	size_t nBody;
+	size_t nBodySize;
+	size_t nFrame;	// 整帧长度
+	size_t nWant;	// 返回YDecodeMore时: 丢弃nUsed字节后输入至少要有这么多字节才值得再试
+};
+
+// YBatch中的一条, 负载从nBody开始(相对批量帧的负载)
+struct YondBatchEntry
+{
+	unsigned sCmd;
+	unsigned sUser;
+	size_t nBody;
+	size_t nBodySize;
+};
+
+class CYondCodec
+{
+public:
+	// Byte可以是char或unsigned char, 服务端和Qt客户端的缓冲类型不同
+	template<class Byte>
+	static constexpr uint32_t Get(const Byte* pFrame, YondField field) {
+		uint32_t v = 0;
+		for (unsigned i = 0; i < field.nSize; i++) {
+			uint32_t b = (unsigned char)pFrame[field.nOffset + i];
+			if (field.eEndian == YEndianBig) v = (v << 8) | b;
+			else v |= b << (8 * i);
+		}
+		return v;
+	}
+
+	template<class Byte>
+	static constexpr void Put(Byte* pFrame, YondField field, uint32_t v) {
+		for (unsigned i = 0; i < field.nSize; i++) {
+			unsigned nShift = field.eEndian == YEndianBig ? 8 * (field.nSize - 1 - i) : 8 * i;
+			pFrame[field.nOffset + i] = (Byte)((v >> nShift) & 0xFF);
+		}
+	}
+
+	static constexpr size_t VarintSize(uint32_t v) {
+		size_t n = 1;
+		while (v >= 0x80) {
+			v >>= 7;
+			n++;
+		}
+		return n;
+	}
+
+	template<class Byte>
+	static constexpr size_t PutVarint(Byte* pOut, uint32_t v) {
+		size_t n = 0;
+		while (v >= 0x80) {
+			pOut[n++] = (Byte)((v & 0x7F) | 0x80);
+			v >>= 7;
+		}
+		pOut[n++] = (Byte)v;
+		return n;
+	}
+
+	// 从p读varint, 最多nSize字节. 返回读掉的字节数, 数据不足返回0, 超过YOND_VARINT_MAX字节返回-1
+	template<class Byte>
+	static constexpr int GetVarint(const Byte* p, size_t nSize, uint32_t& v) {
+		v = 0;
+		for (int i = 0; i < YOND_VARINT_MAX; i++) {
+			if ((size_t)i >= nSize) return 0;
+			unsigned b = (unsigned char)p[i];
+			v |= (uint32_t)(b & 0x7F) << (7 * i);
+			if ((b & 0x80) == 0) return i + 1;
+		}
+		return -1;
+	}
+
+	template<class Byte>
+	static constexpr uint16_t Sum(const Byte* pData, size_t nSize) {
+		uint16_t sum = 0;
+		for (size_t i = 0; i < nSize; i++) {
+			sum = (uint16_t)(sum + (unsigned char)pData[i]);
+		}
+		return sum;
+	}
+
+	static constexpr size_t FrameSize(size_t nBody, bool bCrc = false) {
+		return YOND_FRAME_HEAD + nBody + (bCrc ? YOND_FRAME_TAIL_CRC : YOND_FRAME_TAIL);
+	}
+
+	// v2帧头长度: 魔数到用户字段
+	static constexpr size_t HeadSizeV2(size_t nBody, bool bUser) {
+		return 3 + VarintSize((uint32_t)(1 + (bUser ? 2 : 0) + nBody)) + 1 + (bUser ? 2 : 0);
+	}
+
+	static constexpr size_t FrameSizeV2(size_t nBody, bool bUser, bool bCrc = false) {
+		return HeadSizeV2(nBody, bUser) + nBody + (bCrc ? YOND_FRAME_TAIL_CRC : YOND_FRAME_TAIL);
+	}
+
+	// CRC32C帧的校验范围: 从版本字节到负载末尾, nEnd为负载末尾相对帧头的偏移
+	template<class Byte>
+	static uint32_t Crc(const Byte* pFrame, size_t nEnd) {
+		return CYondCrc32c::Compute(pFrame + YFieldVersion.nOffset, nEnd - YFieldVersion.nOffset);
+	}
+
+	// 把一帧v1直接写入调用方的缓冲, 返回帧长; 缓冲不足或负载超长时返回0, 不写任何字节.
+	// bCrc为true时写CRC32C帧, 只能在运行期调用
+	template<class Byte>
+	static constexpr size_t Encode(Byte* pOut, size_t nCap, unsigned sCmd, unsigned sUser,
+		const char* pBody, size_t nBody, bool bCrc = false) {
+		if (nBody + 4 > YOND_MAX_FRAME || nCap < FrameSize(nBody, bCrc)) {
+			return 0;
+		}
+		Put(pOut, YFieldMagic, YOND_FRAME_MAGIC);
+		Put(pOut, YFieldVersion, bCrc ? YOND_PROTO_VERSION | YOND_FLAG_CRC32C : YOND_PROTO_VERSION);
+		Put(pOut, YFieldLength, (uint32_t)(nBody + 4));
+		Put(pOut, YFieldCmd, sCmd);
+		Put(pOut, YFieldUser, sUser);
+		return PutBody(pOut, YOND_FRAME_HEAD, pBody, nBody, bCrc);
+	}
+
+	// 写v2帧头, 返回帧头长度. 负载可以由调用方随后直接写在帧头之后, 再调用Seal补帧尾
+	template<class Byte>
+	static constexpr size_t PutHeadV2(Byte* pOut, unsigned sCmd, unsigned sUser, size_t nBody, bool bCrc) {
+		Put(pOut, YFieldMagic, YOND_FRAME_MAGIC);
+		Put(pOut, YFieldVersion, bCrc ? YOND_PROTO_V2 | YOND_FLAG_CRC32C : YOND_PROTO_V2);
+		size_t n = 3 + PutVarint(pOut + 3, (uint32_t)(1 + (sUser != 0 ? 2 : 0) + nBody));
+		return n + PutTag(pOut + n, sCmd, sUser);
+	}
+
+	// 按已写入的帧头和负载计算并写帧尾, 返回帧长
+	template<class Byte>
+	static constexpr size_t Seal(Byte* pOut, size_t nHead, size_t nBody, bool bCrc) {
+		if (bCrc) {
+			Put(pOut + nHead + nBody, YFieldCrc, Crc(pOut, nHead + nBody));
+			return nHead + nBody + YOND_FRAME_TAIL_CRC;
+		}
+		Put(pOut + nHead + nBody, YFieldSum, Sum(pOut + nHead, nBody));
+		return nHead + nBody + YOND_FRAME_TAIL;
+	}
+
+	// 把一帧v2直接写入调用方的缓冲, 规则同Encode
+	template<class Byte>
+	static constexpr size_t EncodeV2(Byte* pOut, size_t nCap, unsigned sCmd, unsigned sUser,
+		const char* pBody, size_t nBody, bool bCrc = false) {
+		if (1 + 2 + nBody > YOND_MAX_FRAME || nCap < FrameSizeV2(nBody, sUser != 0, bCrc)) {
+			return 0;
+		}
+		return PutBody(pOut, PutHeadV2(pOut, sCmd, sUser, nBody, bCrc), pBody, nBody, bCrc);
+	}
+
+	static constexpr size_t BatchEntrySize(size_t nBody, bool bUser) {
+		return 1 + (bUser ? 2 : 0) + VarintSize((uint32_t)nBody) + nBody;
+	}
+
+	// 把一条消息追加到YBatch负载, pOut至少BatchEntrySize字节, 返回写入的字节数
+	template<class Byte>
+	static constexpr size_t PutBatchEntry(Byte* pOut, unsigned sCmd, unsigned sUser, const char* pBody, size_t nBody) {
+		size_t n = PutTag(pOut, sCmd, sUser);
+		n += PutVarint(pOut + n, (uint32_t)nBody);
+		for (size_t i = 0; i < nBody; i++) {
+			pOut[n + i] = (Byte)pBody[i];
+		}
+		return n + nBody;
+	}
+
+	// 从YBatch负载的nPos处取一条并前移nPos. 返回YDecodeFrame, 到末尾返回YDecodeMore, 条目不完整返回YDecodeBad
+	template<class Byte>
+	static constexpr int NextBatchEntry(const Byte* pBatch, size_t nSize, size_t& nPos, YondBatchEntry& entry) {
+		if (nPos >= nSize) {
+			return YDecodeMore;
+		}
+		unsigned nTag = (unsigned char)pBatch[nPos];
+		size_t n = nPos + 1;
+		entry.sCmd = nTag & ~YOND_CMD_USER & 0xFF;
+		entry.sUser = 0;
+		if (nTag & YOND_CMD_USER) {
+			if (nSize - n < 2) return YDecodeBad;
+			entry.sUser = Get(pBatch + nPos, YFieldUserV2);
+			n += 2;
+		}
+		uint32_t nBody = 0;
+		int nVar = GetVarint(pBatch + n, nSize - n, nBody);
+		if (nVar <= 0) return YDecodeBad;
+		n += (size_t)nVar;
+		if (nSize - n < nBody) return YDecodeBad;
+		entry.nBody = n;
+		entry.nBodySize = nBody;
+		nPos = n + nBody;
+		return YDecodeFrame;
+	}
+
+	// 解析魔数之后的帧头, p指向魔数, 最多读nSize字节. 返回YDecodeFrame表示帧头完整且合法,
+	// 同时填好head中除nBody、nFrame外的字段, nHead为帧头长度; 帧头不全返回YDecodeMore;
+	// 版本或长度不合法返回YDecodeBad, 说明这里的0xFEFF是负载中的字节
+	template<class Byte>
+	static constexpr int ParseHead(const Byte* p, size_t nSize, YondFrameHead& head, size_t& nHead) {
+		if (nSize < 3) return YDecodeMore;
+		unsigned nVersion = Get(p, YFieldVersion);
+		head.bCrc = (nVersion & YOND_FLAG_CRC32C) != 0;
+		head.nVersion = nVersion & YOND_VERSION_MASK;
+		if (head.nVersion == 0 || head.nVersion == YOND_PROTO_VERSION) {
+			if (head.bCrc && head.nVersion == 0) return YDecodeBad;
+			if (nSize < YFieldLength.nOffset + YFieldLength.nSize) return YDecodeMore;
+			head.nLength = Get(p, YFieldLength);
+			if (head.nLength < 4) return YDecodeBad;
+			if (nSize < YOND_FRAME_HEAD) return YDecodeMore;
+			head.sCmd = Get(p, YFieldCmd);
+			head.sUser = Get(p, YFieldUser);
+			head.nBodySize = head.nLength - 4;
+			nHead = YOND_FRAME_HEAD;
+			return YDecodeFrame;
+		}
+		if (head.nVersion != YOND_PROTO_V2) return YDecodeBad;
+		int nVar = GetVarint(p + 3, nSize - 3, head.nLength);
+		if (nVar < 0 || (nVar > 0 && (head.nLength < 1 || head.nLength > YOND_MAX_FRAME))) return YDecodeBad;
+		if (nVar == 0 || nSize < 3 + (size_t)nVar + 1) return YDecodeMore;
+		size_t nTag = 3 + (size_t)nVar;
+		unsigned sTag = (unsigned char)p[nTag];
+		bool bUser = (sTag & YOND_CMD_USER) != 0;
+		if (bUser && head.nLength < 3) return YDecodeBad;
+		nHead = nTag + 1 + (bUser ? 2 : 0);
+		if (nSize < nHead) return YDecodeMore;
+		head.sCmd = sTag & ~YOND_CMD_USER & 0xFF;
+		head.sUser = bUser ? Get(p + nTag, YFieldUserV2) : 0;
+		head.nBodySize = head.nLength - 1 - (bUser ? 2 : 0);
+		return YDecodeFrame;
+	}
+
+	// 魔数之后的帧头是否可能合法, 数据不足判断不了的也算合法
+	template<class Byte>
+	static constexpr bool HeadSane(const Byte* p, size_t nSize) {
+		YondFrameHead head = {};
+		size_t nHead = 0;
+		return ParseHead(p, nSize, head, nHead) != YDecodeBad;
+	}
+
+	// 逐字节的帧解析, 编译期也能求值: 从pData开始最多解出一帧, nUsed返回应从输入丢弃的字节数
+	// (帧前的垃圾字节+帧本身), 半帧时保留数据由调用方补齐后重试. 运行期的流式输入用DecodeStream
+	template<class Byte>
+	static constexpr int Decode(const Byte* pData, size_t nSize, size_t& nUsed, YondFrameHead& head) {
+		nUsed = 0;
+		head.nWant = 2;
+		size_t i = 0;
+		for (; i + 1 < nSize; i++) {
+			if ((unsigned char)pData[i] == 0xFE && (unsigned char)pData[i + 1] == 0xFF) break;
+		}
+		if (i + 1 >= nSize) {
+			// 末尾单个0xFE可能是下一个帧头的前半部分
+			nUsed = (nSize > 0 && (unsigned char)pData[nSize - 1] == 0xFE) ? nSize - 1 : nSize;
+			return YDecodeMore;
+		}
+		nUsed = i;
+
+		const Byte* p = pData + i;
+		size_t nHead = 0;
+		int ret = ParseHead(p, nSize - i, head, nHead);
+		if (ret == YDecodeBad) {
+			// 跳过这个0xFEFF后继续找帧头
+			nUsed = i + 1;
+			return YDecodeBad;
+		}
+		if (ret == YDecodeMore) {
+			head.nWant = nSize - i + 1;
+			return YDecodeMore;
+		}
+		size_t nFrame = nHead + head.nBodySize + (head.bCrc ? YOND_FRAME_TAIL_CRC : YOND_FRAME_TAIL);
+		if (nSize - i < nFrame) {
+			head.nWant = nFrame;
+			return YDecodeMore;
+		}
+		nUsed = i + nFrame;
+		const Byte* pTail = p + nHead + head.nBodySize;
+		if (head.bCrc ? Crc(p, nHead + head.nBodySize) != Get(pTail, YFieldCrc) :
+			Sum(p + nHead, head.nBodySize) != Get(pTail, YFieldSum)) {
+			return YDecodeBadSum;
+		}
+		head.nBody = i + nHead;
+		head.nFrame = nFrame;
+		return YDecodeFrame;
+	}
+
+	// 跳过帧头之前的垃圾, 返回第一个可能的帧头位置: 魔数后的帧头合法,
+	// 或者离末尾太近还判断不了. 都没有时返回可以整体丢弃的长度(末尾单个0xFE保留)
+	template<class Byte>
+	static size_t Resync(const Byte* pData, size_t nSize) {
+		const unsigned char* p = (const unsigned char*)pData;
+		size_t i = 0;
+		while (true) {
+			i += CYondScan::FindMagic(p + i, nSize - i);
+			if (i >= nSize) {
+				return (nSize > 0 && p[nSize - 1] == 0xFE) ? nSize - 1 : nSize;
+			}
+			if (HeadSane(p + i, nSize - i)) {
+				return i;
+			}
+			i++;
+		}
+	}
+
+	// 流式输入的解析: 先用Resync成块跳过垃圾再交给Decode, 返回值和各字段的含义同Decode,
+	// head.nBody相对pData. 只有魔数错位时才会扫描, 对齐的输入只比较两个字节
+	template<class Byte>
+	static int DecodeStream(const Byte* pData, size_t nSize, size_t& nUsed, YondFrameHead& head) {
+		size_t nSkip = 0;
+		if (nSize >= 2 && !((unsigned char)pData[0] == 0xFE && (unsigned char)pData[1] == 0xFF)) {
+			nSkip = Resync(pData, nSize);
+		}
+		int ret = Decode(pData + nSkip, nSize - nSkip, nUsed, head);
+		nUsed += nSkip;
+		if (ret == YDecodeFrame) {
+			head.nBody += nSkip;
+		}
+		return ret;
+	}
+
+private:
+	// v2的命令字节和可选的用户字段
+	template<class Byte>
+	static constexpr size_t PutTag(Byte* pOut, unsigned sCmd, unsigned sUser) {
+		if (sUser == 0) {
+			pOut[0] = (Byte)(sCmd & ~YOND_CMD_USER & 0xFF);
+			return 1;
+		}
+		pOut[0] = (Byte)((sCmd | YOND_CMD_USER) & 0xFF);
+		Put(pOut, YFieldUserV2, sUser);
+		return 3;
+	}
+
+	// 在nHead处写负载和帧尾, 返回帧长. 字节和与复制一起算, 只扫一遍负载
+	template<class Byte>
+	static constexpr size_t PutBody(Byte* pOut, size_t nHead, const char* pBody, size_t nBody, bool bCrc) {
+		if (bCrc) {
+			memcpy(pOut + nHead, pBody, nBody);
+			return Seal(pOut, nHead, nBody, true);
+		}
+		uint16_t sum = 0;
+		for (size_t i = 0; i < nBody; i++) {
+			pOut[nHead + i] = (Byte)pBody[i];
+			sum = (uint16_t)(sum + (unsigned char)pBody[i]);
+		}
+		Put(pOut + nHead + nBody, YFieldSum, sum);
+		return nHead + nBody + YOND_FRAME_TAIL;
+	}
+};
+
+// 编译期的黄金向量: 编码结果必须与下面的字节逐一相同, 并能按原样解回; 旧版本的帧也要能解出
+namespace YondCodecGolden
+{
+	constexpr unsigned char kFrameV1[] = {
+		0xFE, 0xFF, 0x01, 0x00, 0x00, 0x06, 0x00, 0x01, 0x01, 0x02, 'h', 'i', 0x00, 0xD1
+	};
+	// CRC32C帧: 版本字节0x81, 帧尾为0x01到'i'的CRC32C. CRC要在运行期按CPU计算, 这里只核对字节布局和CRC32C本身
+	constexpr unsigned char kFrameCrc[] = {
+		0xFE, 0xFF, 0x81, 0x00, 0x00, 0x06, 0x00, 0x01, 0x01, 0x02, 'h', 'i', 0x89, 0xB5, 0x45, 0xA2
+	};
+	constexpr unsigned char kFrameV0[] = {
+		0x55, 0xFE, 0xFF, 0x00, 0x00, 0x00, 0x07, 0x00, 0x02, 0x00, 0x00, 'a', 'b', 'c', 0x01, 0x26
+	};
+	// v2: 用户为0时省略, 长度3 = 命令字节 + "hi"
+	constexpr unsigned char kFrameV2[] = {
+		0xFE, 0xFF, 0x02, 0x03, 0x01, 'h', 'i', 0x00, 0xD1
+	};
+	// v2 YBatch, 两条: YMsg "hi"; YConnect 用户5 "a"
+	constexpr unsigned char kFrameBatch[] = {
+		0xFE, 0xFF, 0x02, 0x0A, 0x04, 0x01, 0x02, 'h', 'i', 0x80, 0x00, 0x05, 0x01, 'a', 0x01, 0xBB
+	};
+
+	constexpr bool EncodeMatches() {
+		unsigned char buf[sizeof(kFrameV1)] = {};
+		if (CYondCodec::Encode(buf, sizeof(buf), YMsg, 0x0102, "hi", 2) != sizeof(kFrameV1)) return false;
+		for (size_t i = 0; i < sizeof(kFrameV1); i++) {
+			if (buf[i] != kFrameV1[i]) return false;
+		}
+		return CYondCodec::Encode(buf, sizeof(buf) - 1, YMsg, 0, "hi", 2) == 0;
+	}
+
+	constexpr bool RoundTrip() {
+		YondFrameHead head = {};
+		size_t nUsed = 0;
+		if (CYondCodec::Decode(kFrameV1, sizeof(kFrameV1), nUsed, head) != YDecodeFrame) return false;
+		if (nUsed != sizeof(kFrameV1) || head.nVersion != 1 || head.sCmd != YMsg || head.sUser != 0x0102) return false;
+		if (head.nBody != YOND_FRAME_HEAD || head.nBodySize != 2 || kFrameV1[head.nBody] != 'h') return false;
+		// 半帧
+		if (CYondCodec::Decode(kFrameV1, sizeof(kFrameV1) - 1, nUsed, head) != YDecodeMore || nUsed != 0) return false;
+		if (head.nWant != sizeof(kFrameV1)) return false;
+		return true;
+	}
+
+	constexpr bool DecodeLegacy() {
+		YondFrameHead head = {};
+		size_t nUsed = 0;
+		if (CYondCodec::Decode(kFrameV0, sizeof(kFrameV0), nUsed, head) != YDecodeFrame) return false;
+		return nUsed == sizeof(kFrameV0) && head.nVersion == 0 && head.sCmd == YFile &&
+			head.nBody == 1 + YOND_FRAME_HEAD && head.nBodySize == 3;
+	}
+
+	constexpr bool CrcLayout() {
+		if (CYondCrc32c::Bitwise("123456789", 9) != 0xE3069283) return false;
+		if (CYondCodec::FrameSize(2, true) != sizeof(kFrameCrc)) return false;
+		return CYondCodec::Get(kFrameCrc, YFieldVersion) == (YOND_PROTO_VERSION | YOND_FLAG_CRC32C) &&
+			CYondCodec::Get(kFrameCrc + YOND_FRAME_HEAD + 2, YFieldCrc) ==
+			CYondCrc32c::Bitwise(kFrameCrc + YFieldVersion.nOffset, YOND_FRAME_HEAD - YFieldVersion.nOffset + 2);
+	}
+
+	constexpr bool CompactRoundTrip() {
+		unsigned char buf[sizeof(kFrameV2)] = {};
+		if (CYondCodec::EncodeV2(buf, sizeof(buf), YMsg, 0, "hi", 2) != sizeof(kFrameV2)) return false;
+		for (size_t i = 0; i < sizeof(kFrameV2); i++) {
+			if (buf[i] != kFrameV2[i]) return false;
+		}
+		YondFrameHead head = {};
+		size_t nUsed = 0;
+		if (CYondCodec::Decode(kFrameV2, sizeof(kFrameV2), nUsed, head) != YDecodeFrame) return false;
+		if (nUsed != sizeof(kFrameV2) || head.nVersion != YOND_PROTO_V2 || head.sCmd != YMsg || head.sUser != 0) return false;
+		if (head.nBody != 5 || head.nBodySize != 2 || head.nFrame != sizeof(kFrameV2)) return false;
+		// varint还没读完
+		if (CYondCodec::Decode(kFrameV2, 3, nUsed, head) != YDecodeMore || nUsed != 0) return false;
+		// 带用户和多字节varint
+		unsigned char big[300] = {};
+		char body[200] = {};
+		size_t n = CYondCodec::EncodeV2(big, sizeof(big), YFile, 0x0304, body, sizeof(body));
+		if (n != CYondCodec::FrameSizeV2(sizeof(body), true) || big[3] != 0xCB || big[4] != 0x01) return false;
+		return CYondCodec::Decode(big, n, nUsed, head) == YDecodeFrame && head.sUser == 0x0304 &&
+			head.sCmd == YFile && head.nBodySize == sizeof(body) && head.nBody == 8;
+	}
+
+	constexpr bool BatchRoundTrip() {
+		unsigned char buf[sizeof(kFrameBatch)] = {};
+		size_t nBody = CYondCodec::BatchEntrySize(2, false) + CYondCodec::BatchEntrySize(1, true);
+		size_t nHead = CYondCodec::PutHeadV2(buf, YBatch, 0, nBody, false);
+		size_t n = nHead + CYondCodec::PutBatchEntry(buf + nHead, YMsg, 0, "hi", 2);
+		n += CYondCodec::PutBatchEntry(buf + n, YConnect, 5, "a", 1);
+		if (n != nHead + nBody || CYondCodec::Seal(buf, nHead, nBody, false) != sizeof(kFrameBatch)) return false;
+		for (size_t i = 0; i < sizeof(kFrameBatch); i++) {
+			if (buf[i] != kFrameBatch[i]) return false;
+		}
+		YondFrameHead head = {};
+		size_t nUsed = 0;
+		if (CYondCodec::Decode(kFrameBatch, sizeof(kFrameBatch), nUsed, head) != YDecodeFrame || head.sCmd != YBatch) return false;
+		const unsigned char* pBatch = kFrameBatch + head.nBody;
+		size_t nPos = 0;
+		YondBatchEntry e1 = {}, e2 = {};
+		if (CYondCodec::NextBatchEntry(pBatch, head.nBodySize, nPos, e1) != YDecodeFrame) return false;
+		if (CYondCodec::NextBatchEntry(pBatch, head.nBodySize, nPos, e2) != YDecodeFrame) return false;
+		if (CYondCodec::NextBatchEntry(pBatch, head.nBodySize, nPos, e2) != YDecodeMore) return false;
+		if (e1.sCmd != YMsg || e1.nBodySize != 2 || pBatch[e1.nBody] != 'h') return false;
+		if (e2.sCmd != YConnect || e2.sUser != 5 || e2.nBodySize != 1 || pBatch[e2.nBody] != 'a') return false;
+		// 截断的条目
+		nPos = 0;
+		return CYondCodec::NextBatchEntry(pBatch, head.nBodySize - 1, nPos, e1) == YDecodeFrame &&
+			CYondCodec::NextBatchEntry(pBatch, head.nBodySize - 1, nPos, e2) == YDecodeBad;
+	}
+
+	constexpr bool FieldEndian() {
+		unsigned char buf[4] = {};
+		CYondCodec::Put(buf, YondField{ 0, 4, YEndianLittle }, 0x11223344);
+		return buf[0] == 0x44 && buf[3] == 0x11 &&
+			CYondCodec::Get(buf, YondField{ 0, 4, YEndianBig }) == 0x44332211 &&
+			CYondCodec::Get(buf, YondField{ 1, 2, YEndianLittle }) == 0x2233;
+	}
+
+	static_assert(EncodeMatches(), "frame encoding differs from the golden vector");
+	static_assert(RoundTrip(), "golden frame does not decode back");
+	static_assert(DecodeLegacy(), "legacy frame is no longer accepted");
+	static_assert(CrcLayout(), "crc32c frame layout or checksum is broken");
+	static_assert(CompactRoundTrip(), "v2 frame differs from the golden vector or does not decode back");
+	static_assert(BatchRoundTrip(), "batch frame differs from the golden vector or does not decode back");
+	static_assert(FieldEndian(), "field endianness is broken");
+}
@@ -0,0 +1,204 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// CRC32C(Castagnoli, 反射多项式0x82F63B78), 帧校验用. 服务端和客户端共用, 只依赖标准库(C++14)和编译器内建函数.
+// 运行时按CPU选择实现: x86的SSE4.2 crc32指令、ARMv8的CRC扩展, 都不支持时用slicing-by-8查表.
+// 传入和返回的都是最终值(已取反), 分段计算时把上一段的结果作为下一段的crc传入即可
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define YOND_CRC_X86 1
+#define YOND_CRC_TARGET __attribute__((target("sse4.2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <nmmintrin.h>
+#include <intrin.h>
+#define YOND_CRC_X86 1
+#define YOND_CRC_TARGET
+#elif defined(__GNUC__) && defined(__aarch64__)
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#define YOND_CRC_ARM 1
+#if defined(__clang__)
+#define YOND_CRC_TARGET __attribute__((target("crc")))
+#else
+#define YOND_CRC_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+#define YOND_CRC32C_POLY 0x82F63B78u
+
+class CYondCrc32c
+{
+public:
+	typedef uint32_t (*Fn)(uint32_t crc, const unsigned char* p, size_t n);
+
+	static uint32_t Compute(const void* pData, size_t nSize, uint32_t crc = 0) {
+		return Chosen().fn(crc, (const unsigned char*)pData, nSize);
+	}
+
+	// 当前选中的实现, 写日志用
+	static const char* ImplName() {
+		return Chosen().pName;
+	}
+
+	// 逐位计算, 只用于编译期的黄金向量和运行时自检
+	template<class Byte>
+	static constexpr uint32_t Bitwise(const Byte* pData, size_t nSize, uint32_t crc = 0) {
+		crc = ~crc;
+		for (size_t i = 0; i < nSize; i++) {
+			crc ^= (unsigned char)pData[i];
+			for (int k = 0; k < 8; k++) {
+				crc = (crc >> 1) ^ (YOND_CRC32C_POLY & (0u - (crc & 1)));
+			}
+		}
+		return ~crc;
+	}
+
+	static uint32_t Slice8(uint32_t crc, const unsigned char* p, size_t n) {
+		const Table& t = Tables();
+		crc = ~crc;
+		for (; n > 0 && ((uintptr_t)p & 7) != 0; n--) {
+			crc = t.v[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		}
+		for (; n >= 8; n -= 8, p += 8) {
+			// 按小端拼出两个字, 大端机器上结果相同
+			uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+			uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+			crc = t.v[7][lo & 0xFF] ^ t.v[6][(lo >> 8) & 0xFF] ^ t.v[5][(lo >> 16) & 0xFF] ^ t.v[4][lo >> 24] ^
+				t.v[3][hi & 0xFF] ^ t.v[2][(hi >> 8) & 0xFF] ^ t.v[1][(hi >> 16) & 0xFF] ^ t.v[0][hi >> 24];
+		}
+		for (; n > 0; n--) {
+			crc = t.v[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+#if defined(YOND_CRC_X86)
+	static YOND_CRC_TARGET uint32_t Sse42(uint32_t crc, const unsigned char* p, size_t n) {
+		crc = ~crc;
+		for (; n > 0 && ((uintptr_t)p & 7) != 0; n--) {
+			crc = _mm_crc32_u8(crc, *p++);
+		}
+#if defined(__x86_64__) || defined(_M_X64)
+		uint64_t crc64 = crc;
+		for (; n >= 8; n -= 8, p += 8) {
+			uint64_t v;
+			memcpy(&v, p, 8);
+			crc64 = _mm_crc32_u64(crc64, v);
+		}
+		crc = (uint32_t)crc64;
+#else
+		for (; n >= 4; n -= 4, p += 4) {
+			uint32_t v;
+			memcpy(&v, p, 4);
+			crc = _mm_crc32_u32(crc, v);
+		}
+#endif
+		for (; n > 0; n--) {
+			crc = _mm_crc32_u8(crc, *p++);
+		}
+		return ~crc;
+	}
+#endif
+
+#if defined(YOND_CRC_ARM)
+	static YOND_CRC_TARGET uint32_t Armv8(uint32_t crc, const unsigned char* p, size_t n) {
+		crc = ~crc;
+		for (; n > 0 && ((uintptr_t)p & 7) != 0; n--) {
+			crc = __crc32cb(crc, *p++);
+		}
+		for (; n >= 8; n -= 8, p += 8) {
+			uint64_t v;
+			memcpy(&v, p, 8);
+			crc = __crc32cd(crc, v);
+		}
+		for (; n > 0; n--) {
+			crc = __crc32cb(crc, *p++);
+		}
+		return ~crc;
+	}
+#endif
+
+private:
+	struct Table
+	{
+		uint32_t v[8][256];
+	};
+
+	struct Choice
+	{
+		Fn fn;
+		const char* pName;
+	};
+
+	static const Table& Tables() {
+		static const Table s_table = BuildTables();
+		return s_table;
+	}
+
+	static Table BuildTables() {
+		Table t;
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int k = 0; k < 8; k++) {
+				crc = (crc >> 1) ^ (YOND_CRC32C_POLY & (0u - (crc & 1)));
+			}
+			t.v[0][i] = crc;
+		}
+		for (int k = 1; k < 8; k++) {
+			for (uint32_t i = 0; i < 256; i++) {
+				t.v[k][i] = (t.v[k - 1][i] >> 8) ^ t.v[0][t.v[k - 1][i] & 0xFF];
+			}
+		}
+		return t;
+	}
+
+	static bool HasHardware() {
+#if defined(YOND_CRC_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 20)) != 0;
+#elif defined(YOND_CRC_X86)
+		return __builtin_cpu_supports("sse4.2");
+#elif defined(YOND_CRC_ARM) && defined(__APPLE__)
+		return true;
+#elif defined(YOND_CRC_ARM) && defined(__linux__)
+		return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+		return false;
+#endif
+	}
+
+	// 首次调用时选择实现; 硬件实现要先和逐位计算的结果对一遍, 不一致就退回查表
+	static const Choice& Chosen() {
+		static const Choice s_choice = Select();
+		return s_choice;
+	}
+
+	static Choice Select() {
+		Choice soft = { Slice8, "slicing-by-8" };
+		Choice choice = soft;
+		if (HasHardware()) {
+#if defined(YOND_CRC_X86)
+			choice = { Sse42, "sse4.2" };
+#elif defined(YOND_CRC_ARM)
+			choice = { Armv8, "armv8-crc" };
+#endif
+		}
+		unsigned char probe[61];
+		for (size_t i = 0; i < sizeof(probe); i++) {
+			probe[i] = (unsigned char)(i * 131 + 7);
+		}
+		if (choice.fn(0, probe + 3, sizeof(probe) - 3) != Bitwise(probe + 3, sizeof(probe) - 3)) {
+			choice = soft;
+		}
+		return choice;
+	}
+};
+
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// 在字节流中查找帧头魔数0xFE 0xFF, 错位后重新同步用. 服务端和客户端共用(C++14).
+// x86上CPU支持AVX2时每次比较32字节, aarch64上用NEON每次16字节, 其他情况用memchr找0xFE再核对下一字节
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define YOND_SCAN_AVX2 1
+#elif defined(__GNUC__) && defined(__aarch64__)
+#include <arm_neon.h>
+#define YOND_SCAN_NEON 1
+#endif
+
+class CYondScan
+{
+public:
+	typedef size_t (*Fn)(const unsigned char* p, size_t n);
+
+	// 返回第一个0xFE 0xFF的位置, 没有时返回n
+	static size_t FindMagic(const void* pData, size_t nSize) {
+		return Chosen()((const unsigned char*)pData, nSize);
+	}
+
+	static size_t Memchr(const unsigned char* p, size_t n) {
+		size_t i = 0;
+		while (i + 1 < n) {
+			const void* q = memchr(p + i, 0xFE, n - 1 - i);
+			if (q == nullptr) break;
+			i = (size_t)((const unsigned char*)q - p);
+			if (p[i + 1] == 0xFF) return i;
+			i++;
+		}
+		return n;
+	}
+
+#if defined(YOND_SCAN_AVX2)
+	__attribute__((target("avx2"))) static size_t Avx2(const unsigned char* p, size_t n) {
+		const __m256i fe = _mm256_set1_epi8((char)0xFE);
+		const __m256i ff = _mm256_set1_epi8((char)0xFF);
+		size_t i = 0;
+		// 同时比较i和i+1开始的字节, 两个掩码相与即魔数位置; 每轮先看64字节, 命中后再定位
+		for (; i + 65 <= n; i += 64) {
+			__m256i m0 = _mm256_and_si256(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), fe),
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 1)), ff));
+			__m256i m1 = _mm256_and_si256(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 32)), fe),
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 33)), ff));
+			if (_mm256_testz_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m0, m1))) continue;
+			uint64_t mask = (uint32_t)_mm256_movemask_epi8(m0) | (uint64_t)(uint32_t)_mm256_movemask_epi8(m1) << 32;
+			return i + (size_t)__builtin_ctzll(mask);
+		}
+		for (; i + 33 <= n; i += 32) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)(p + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(p + i + 1));
+			unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+				_mm256_cmpeq_epi8(a, fe), _mm256_cmpeq_epi8(b, ff)));
+			if (mask != 0) return i + (size_t)__builtin_ctz(mask);
+		}
+		size_t r = Memchr(p + i, n - i);
+		return i + r;
+	}
+#endif
+
+#if defined(YOND_SCAN_NEON)
+	static size_t Neon(const unsigned char* p, size_t n) {
+		const uint8x16_t fe = vdupq_n_u8(0xFE);
+		const uint8x16_t ff = vdupq_n_u8(0xFF);
+		size_t i = 0;
+		for (; i + 17 <= n; i += 16) {
+			uint8x16_t m = vandq_u8(vceqq_u8(vld1q_u8(p + i), fe), vceqq_u8(vld1q_u8(p + i + 1), ff));
+			// 每字节压成4位, 得到64位掩码
+			uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+			if (mask != 0) return i + (size_t)(__builtin_ctzll(mask) >> 2);
+		}
+		size_t r = Memchr(p + i, n - i);
+		return i + r;
+	}
+#endif
+
+private:
+	static Fn Chosen() {
+		static const Fn s_fn = Select();
+		return s_fn;
+	}
+
+	static Fn Select() {
+#if defined(YOND_SCAN_AVX2)
+		if (__builtin_cpu_supports("avx2")) return Avx2;
+#elif defined(YOND_SCAN_NEON)
+		return Neon;
+#endif
+		return Memchr;
+	}
+};
@@ -0,0 +1,236 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// SHA-256(FIPS 180-4), 附件块按内容寻址用. 服务端和客户端共用, 只依赖标准库(C++14)和编译器内建函数.
+// x86上CPU支持SHA扩展时用sha256rnds2等指令, 否则用逐轮计算
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#include <cpuid.h>
+#define YOND_SHA_X86 1
+#define YOND_SHA_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define YOND_SHA_X86 1
+#define YOND_SHA_TARGET
+#endif
+
+#define YOND_SHA256_SIZE 32
+
+class CYondSha256
+{
+public:
+	typedef void (*Fn)(uint32_t state[8], const unsigned char* p, size_t nBlocks);
+
+	CYondSha256() {
+		Reset();
+	}
+
+	void Reset() {
+		static const uint32_t init[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+		memcpy(m_state, init, sizeof(m_state));
+		m_nTotal = 0;
+		m_nBuf = 0;
+	}
+
+	void Update(const void* pData, size_t nSize) {
+		const unsigned char* p = (const unsigned char*)pData;
+		m_nTotal += nSize;
+		if (m_nBuf > 0) {
+			size_t n = nSize < 64 - m_nBuf ? nSize : 64 - m_nBuf;
+			memcpy(m_buf + m_nBuf, p, n);
+			m_nBuf += n;
+			p += n;
+			nSize -= n;
+			if (m_nBuf < 64) return;
+			Chosen().fn(m_state, m_buf, 1);
+			m_nBuf = 0;
+		}
+		if (nSize >= 64) {
+			Chosen().fn(m_state, p, nSize / 64);
+			p += nSize & ~(size_t)63;
+			nSize &= 63;
+		}
+		memcpy(m_buf, p, nSize);
+		m_nBuf = nSize;
+	}
+
+	void Final(unsigned char digest[YOND_SHA256_SIZE]) {
+		uint64_t nBits = m_nTotal * 8;
+		unsigned char pad[72] = { 0x80 };
+		size_t nPad = (m_nBuf < 56 ? 56 : 120) - m_nBuf;
+		for (int i = 0; i < 8; i++) {
+			pad[nPad + i] = (unsigned char)(nBits >> (56 - 8 * i));
+		}
+		Update(pad, nPad + 8);
+		for (int i = 0; i < 8; i++) {
+			digest[4 * i] = (unsigned char)(m_state[i] >> 24);
+			digest[4 * i + 1] = (unsigned char)(m_state[i] >> 16);
+			digest[4 * i + 2] = (unsigned char)(m_state[i] >> 8);
+			digest[4 * i + 3] = (unsigned char)m_state[i];
+		}
+	}
+
+	// 一次算完, 返回64位小写十六进制
+	static std::string Hex(const void* pData, size_t nSize) {
+		CYondSha256 sha;
+		sha.Update(pData, nSize);
+		unsigned char digest[YOND_SHA256_SIZE];
+		sha.Final(digest);
+		static const char* pDigits = "0123456789abcdef";
+		std::string strHex(2 * YOND_SHA256_SIZE, '0');
+		for (int i = 0; i < YOND_SHA256_SIZE; i++) {
+			strHex[2 * i] = pDigits[digest[i] >> 4];
+			strHex[2 * i + 1] = pDigits[digest[i] & 15];
+		}
+		return strHex;
+	}
+
+	// 当前选中的实现, 写日志用
+	static const char* ImplName() {
+		return Chosen().pName;
+	}
+
+	static void Portable(uint32_t state[8], const unsigned char* p, size_t nBlocks) {
+		for (; nBlocks > 0; nBlocks--, p += 64) {
+			uint32_t w[64];
+			for (int i = 0; i < 16; i++) {
+				w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) |
+					((uint32_t)p[4 * i + 2] << 8) | (uint32_t)p[4 * i + 3];
+			}
+			for (int i = 16; i < 64; i++) {
+				uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int i = 0; i < 64; i++) {
+				uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + K()[i] + w[i];
+				uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+			state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		}
+	}
+
+#if defined(YOND_SHA_X86)
+	// 状态按ABEF/CDGH两个寄存器存放, 每条sha256rnds2做两轮
+	YOND_SHA_TARGET static void ShaNi(uint32_t state[8], const unsigned char* p, size_t nBlocks) {
+		const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+		__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+		__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+		state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+		for (; nBlocks > 0; nBlocks--, p += 64) {
+			__m128i abef = state0, cdgh = state1;
+			__m128i msg[4];
+			for (int g = 0; g < 16; g++) {
+				// 第g组为W[4g..4g+3], 前4组直接取输入, 之后由前面四组推出
+				if (g < 4) {
+					msg[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16 * g)), mask);
+				}
+				else {
+					tmp = _mm_sha256msg1_epu32(msg[g & 3], msg[(g + 1) & 3]);
+					tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(msg[(g + 3) & 3], msg[(g + 2) & 3], 4));
+					msg[g & 3] = _mm_sha256msg2_epu32(tmp, msg[(g + 3) & 3]);
+				}
+				__m128i wk = _mm_add_epi32(msg[g & 3], _mm_loadu_si128((const __m128i*)&K()[4 * g]));
+				state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+				state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E));
+			}
+			state0 = _mm_add_epi32(state0, abef);
+			state1 = _mm_add_epi32(state1, cdgh);
+		}
+		tmp = _mm_shuffle_epi32(state0, 0x1B);
+		state1 = _mm_shuffle_epi32(state1, 0xB1);
+		_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+		_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+	}
+#endif
+
+private:
+	struct Choice
+	{
+		Fn fn;
+		const char* pName;
+	};
+
+	static uint32_t Rotr(uint32_t x, int n) {
+		return (x >> n) | (x << (32 - n));
+	}
+
+	static const uint32_t* K() {
+		alignas(16) static const uint32_t k[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+		};
+		return k;
+	}
+
+	static bool HasHardware() {
+#if defined(YOND_SHA_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+		__cpuid(info, 1);
+		bool bSse41 = (info[2] & (1 << 19)) != 0;
+		__cpuidex(info, 7, 0);
+		return bSse41 && (info[1] & (1 << 29)) != 0;
+#elif defined(YOND_SHA_X86)
+		unsigned a, b, c, d;
+		if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & (1u << 19))) return false;
+		return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29)) != 0;
+#else
+		return false;
+#endif
+	}
+
+	// 首次调用时选择实现; 硬件实现要先和逐轮计算的结果对一遍, 不一致就退回
+	static const Choice& Chosen() {
+		static const Choice s_choice = Select();
+		return s_choice;
+	}
+
+	static Choice Select() {
+		Choice soft = { Portable, "portable" };
+		Choice choice = soft;
+#if defined(YOND_SHA_X86)
+		if (HasHardware()) {
+			choice = { ShaNi, "sha-ni" };
+		}
+#endif
+		unsigned char probe[128];
+		for (size_t i = 0; i < sizeof(probe); i++) {
+			probe[i] = (unsigned char)(i * 131 + 7);
+		}
+		uint32_t hw[8], sw[8];
+		for (int i = 0; i < 8; i++) {
+			hw[i] = sw[i] = (uint32_t)(0x9e3779b9u * (i + 1));
+		}
+		choice.fn(hw, probe, 2);
+		Portable(sw, probe, 2);
+		if (memcmp(hw, sw, sizeof(hw)) != 0) {
+			choice = soft;
+		}
+		return choice;
+	}
+
+	uint32_t m_state[8];
+	uint64_t m_nTotal;
+	unsigned char m_buf[64];
+	size_t m_nBuf;
+};
@@ -1,45 +1,43 @@
 #include "CChatServer.h"
+#include <thread>
 
 CChatServer* CChatServer::m_instance = NULL;
 
-int CChatServer::EpollDo(epoll_event* alevt) {
+int CChatServer::StartService(const YondServerOpt& opt) {
 	int err = 0;
-	m_bStop = false;
-	while (!m_bStop) {
-		int eventMnt = epoll_wait(m_nEpollFd, alevt, MAX_EVENTS, 1000);
-		if (eventMnt == -1) {
-			return LOG_ERROR(YOND_ERR_EPOLL_WAIT, "Failed to wait for epoll events");
-		}
-		for (int i = 0; i < eventMnt; i++) {
-			if (alevt[i].data.fd == m_nSockFd) {
-				err = m_handleEvent.addNew(&alevt[i], m_nEpollFd);
-			}
-			else {
-				err = m_handleEvent.HandleEvent(&alevt[i]);
-			}
-		}
+	int nLoops = opt.nLoops;
+	if (nLoops <= 0) {
+		nLoops = (int)std::thread::hardware_concurrency();
+		if (nLoops <= 0) nLoops = 1;
 	}
-	return err;
-}
-
-int CChatServer::StartService() {
-	int err = 0;
-	err = InitSocket();
 
-	m_nEpollFd = epoll_create1(0);
-	if (m_nEpollFd < 0) {
-		return LOG_ERROR(YOND_ERR_EPOLL_CREATE, "Failed to create epoll instance");
+	m_handleEvent.Init(opt);
+	for (int i = 0; i < nLoops; i++) {
+		CYondReactor* pReactor = CYondReactor::Create(i, &m_handleEvent, opt);
+		err = pReactor->InitSocket(m_nPort);
+		if (err != 0) {
+			delete pReactor;
+			StopService();
+			return err;
+		}
+		m_vReactors.push_back(pReactor);
 	}
-
-	struct epoll_event event, all_events[MAX_EVENTS];
-	event.events = EPOLLIN;
-	event.data.fd = m_nSockFd;
-	if (epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, m_nSockFd, &event) < 0) {
-		return LOG_ERROR(YOND_ERR_EPOLL_CTL, "Failed to add socket to epoll");
+	m_handleEvent.SetReactors(m_vReactors);
+	// 文件中转起不来时聊天照常服务
+	if (m_fileRelay.Start(opt, m_handleEvent.ThreadPool()) == 0) {
+		m_handleEvent.SetFileRelay(&m_fileRelay);
 	}
 
-	err = EpollDo(all_events);
-	LOG_INFO("Server started, waiting for connections...");
+	m_bStop = false;
+	for (CYondReactor* pReactor : m_vReactors) {
+		err = pReactor->Start();
+		if (err != 0) {
+			StopService();
+			return err;
+		}
+	}
+	LOG_INFO("Server started with " + std::to_string(nLoops) + " event loops, waiting for connections...");
+	LOG_INFO(std::string("Frame crc32c implementation: ") + CYondCrc32c::ImplName());
 
 	return err;
 }
@@ -47,7 +45,17 @@ int CChatServer::StartService() {
 int CChatServer::StopService()
 {
 	m_bStop = true;
-	close(m_nSockFd);
-	close(m_nEpollFd);
+	for (CYondReactor* pReactor : m_vReactors) {
+		pReactor->Stop();
+	}
+	// 中转先停, 它的入库任务在线程池上; 再等线程池处理完已收到的消息, 之后才能换掉循环表、删除循环
+	m_fileRelay.Stop();
+	m_handleEvent.StopPool();
+	m_handleEvent.SetReactors(std::vector<CYondReactor*>());
+	m_handleEvent.SetFileRelay(nullptr);
+	for (CYondReactor* pReactor : m_vReactors) {
+		delete pReactor;
+	}
+	m_vReactors.clear();
 	return 0;
 }
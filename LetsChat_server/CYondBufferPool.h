@@ -0,0 +1,195 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdlib.h>
+
+#define YOND_BUF_CLASSES 3				// 4K/16K/64K三档, 每档是上一档的4倍
+#define YOND_BUF_MIN 4096
+#define YOND_BUF_SLAB (1024 * 1024)		// 每次向系统申请一块slab, 切成同一档的缓冲
+#define YOND_BUF_CACHE_MAX 64			// 每线程每档缓存的空闲缓冲上限, 超出时一半还给全局空闲表
+
+// 从CYondBufferPool借出的I/O缓冲
+struct YondBuf
+{
+	char* pData = nullptr;
+	size_t nCap = 0;
+};
+
+struct YondBufStats
+{
+	uint64_t nGets;		// 借出次数
+	uint64_t nHits;		// 由本线程缓存直接满足的次数
+	size_t nResident;	// 向系统申请且未释放的字节数(slab和超大缓冲)
+	int64_t nInUse;		// 正被借出的字节数
+};
+
+// 固定档位的I/O缓冲池: 内存按slab申请后切成同一档的缓冲, 不再还给系统;
+// 每个线程先从自己的缓存借还, 不加锁, 缓存空了或满了才批量与全局空闲表交换.
+// 超过最大一档的缓冲直接向系统申请, 归还时释放
+class CYondBufferPool
+{
+public:
+	static CYondBufferPool& Instance() {
+		static CYondBufferPool pool;
+		return pool;
+	}
+
+	// 借一块容量不小于nMin的缓冲
+	YondBuf Get(size_t nMin) {
+		Cache& cache = Local();
+		Bump(cache.nGets, 1);
+		YondBuf buf;
+		int k = ClassOf(nMin);
+		if (k < 0) {
+			buf.nCap = nMin;
+			buf.pData = (char*)::operator new(nMin);
+			m_nLarge.fetch_add(nMin, std::memory_order_relaxed);
+		}
+		else {
+			buf.nCap = ClassSize(k);
+			std::vector<char*>& vFree = cache.vFree[k];
+			if (!vFree.empty()) {
+				Bump(cache.nHits, 1);
+			}
+			else {
+				Refill(k, vFree);
+			}
+			buf.pData = vFree.back();
+			vFree.pop_back();
+		}
+		Bump(cache.nInUse, (int64_t)buf.nCap);
+		return buf;
+	}
+
+	// 归还后buf置空
+	void Put(YondBuf& buf) {
+		if (buf.pData == nullptr) {
+			return;
+		}
+		Cache& cache = Local();
+		Bump(cache.nInUse, -(int64_t)buf.nCap);
+		int k = ClassOf(buf.nCap);
+		if (k < 0 || ClassSize(k) != buf.nCap) {
+			::operator delete(buf.pData);
+			m_nLarge.fetch_sub(buf.nCap, std::memory_order_relaxed);
+		}
+		else {
+			std::vector<char*>& vFree = cache.vFree[k];
+			vFree.push_back(buf.pData);
+			if (vFree.size() > YOND_BUF_CACHE_MAX) {
+				Spill(k, vFree, YOND_BUF_CACHE_MAX / 2);
+			}
+		}
+		buf = YondBuf();
+	}
+
+	YondBufStats Stats() {
+		std::unique_lock<std::mutex> lock(m_lock);
+		YondBufStats stats = m_retired;
+		for (const Cache* pCache : m_vCaches) {
+			stats.nGets += pCache->nGets.load(std::memory_order_relaxed);
+			stats.nHits += pCache->nHits.load(std::memory_order_relaxed);
+			stats.nInUse += pCache->nInUse.load(std::memory_order_relaxed);
+		}
+		stats.nResident = m_vSlabs.size() * (size_t)YOND_BUF_SLAB + m_nLarge.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	static constexpr size_t ClassSize(int k) {
+		return (size_t)YOND_BUF_MIN << (2 * k);
+	}
+
+private:
+	// 线程缓存, 计数只由所属线程写, Stats在其他线程读
+	struct Cache
+	{
+		std::vector<char*> vFree[YOND_BUF_CLASSES];
+		std::atomic<uint64_t> nGets{ 0 };
+		std::atomic<uint64_t> nHits{ 0 };
+		std::atomic<int64_t> nInUse{ 0 };
+
+		Cache() { Instance().Attach(this); }
+		~Cache() { Instance().Detach(this); }
+	};
+
+	CYondBufferPool() : m_nLarge(0) {
+		m_retired = YondBufStats{ 0, 0, 0, 0 };
+	}
+	~CYondBufferPool() {
+		for (char* pSlab : m_vSlabs) {
+			free(pSlab);
+		}
+	}
+
+	static Cache& Local() {
+		thread_local Cache cache;
+		return cache;
+	}
+
+	static int ClassOf(size_t n) {
+		for (int k = 0; k < YOND_BUF_CLASSES; k++) {
+			if (n <= ClassSize(k)) return k;
+		}
+		return -1;
+	}
+
+	// 只有所属线程写, 不需要原子加
+	template<class T, class U>
+	static void Bump(std::atomic<T>& value, U n) {
+		value.store(value.load(std::memory_order_relaxed) + (T)n, std::memory_order_relaxed);
+	}
+
+	// 从全局空闲表取半个缓存的量, 不够时先切一块新的slab
+	void Refill(int k, std::vector<char*>& vFree) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		std::vector<char*>& vGlobal = m_vFree[k];
+		if (vGlobal.empty()) {
+			char* pSlab = (char*)aligned_alloc(YOND_BUF_MIN, YOND_BUF_SLAB);
+			if (pSlab == nullptr) {
+				throw std::bad_alloc();
+			}
+			m_vSlabs.push_back(pSlab);
+			for (size_t off = 0; off + ClassSize(k) <= YOND_BUF_SLAB; off += ClassSize(k)) {
+				vGlobal.push_back(pSlab + off);
+			}
+		}
+		size_t n = std::min(vGlobal.size(), (size_t)YOND_BUF_CACHE_MAX / 2);
+		vFree.insert(vFree.end(), vGlobal.end() - n, vGlobal.end());
+		vGlobal.resize(vGlobal.size() - n);
+	}
+
+	void Spill(int k, std::vector<char*>& vFree, size_t n) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_vFree[k].insert(m_vFree[k].end(), vFree.end() - n, vFree.end());
+		vFree.resize(vFree.size() - n);
+	}
+
+	void Attach(Cache* pCache) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_vCaches.push_back(pCache);
+	}
+
+	// 线程退出时缓存的缓冲和计数并入全局
+	void Detach(Cache* pCache) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		for (int k = 0; k < YOND_BUF_CLASSES; k++) {
+			m_vFree[k].insert(m_vFree[k].end(), pCache->vFree[k].begin(), pCache->vFree[k].end());
+		}
+		m_retired.nGets += pCache->nGets.load(std::memory_order_relaxed);
+		m_retired.nHits += pCache->nHits.load(std::memory_order_relaxed);
+		m_retired.nInUse += pCache->nInUse.load(std::memory_order_relaxed);
+		m_vCaches.erase(std::remove(m_vCaches.begin(), m_vCaches.end(), pCache), m_vCaches.end());
+	}
+
+	std::mutex m_lock;
+	std::vector<char*> m_vFree[YOND_BUF_CLASSES];
+	std::vector<char*> m_vSlabs;
+	std::vector<Cache*> m_vCaches;
+	YondBufStats m_retired;			// 已退出线程的计数
+	std::atomic<size_t> m_nLarge;	// 借出中的超大缓冲字节数
+};
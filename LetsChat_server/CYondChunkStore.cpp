@@ -0,0 +1,181 @@
+#include "CYondChunkStore.h"
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+void YondManifest::Index() {
+	vOffsets.resize(vChunks.size());
+	int64_t nOff = 0;
+	for (size_t i = 0; i < vChunks.size(); i++) {
+		vOffsets[i] = nOff;
+		nOff += vChunks[i].nLen;
+	}
+}
+
+size_t YondManifest::Find(int64_t nOffset) const {
+	return (size_t)(std::upper_bound(vOffsets.begin(), vOffsets.end(), nOffset) - vOffsets.begin()) - 1;
+}
+
+int CYondChunkStore::Open(const std::string& strDir) {
+	m_strDir = strDir;
+	for (const char* pSub : { "/chunks", "/manifests" }) {
+		std::string strPath = m_strDir + pSub;
+		if (mkdir(strPath.c_str(), 0755) != 0 && errno != EEXIST) {
+			return LOG_ERROR(YOND_ERR_FILE_OPEN, "Failed to create chunk store directory " + strPath);
+		}
+	}
+	return 0;
+}
+
+bool CYondChunkStore::ValidHash(const std::string& strHash) {
+	if (strHash.size() != 2 * YOND_SHA256_SIZE) {
+		return false;
+	}
+	for (char c : strHash) {
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+	}
+	return true;
+}
+
+std::string CYondChunkStore::ChunkPath(const std::string& strHash) const {
+	return m_strDir + "/chunks/" + strHash.substr(0, 2) + "/" + strHash;
+}
+
+bool CYondChunkStore::HasChunk(const std::string& strHash) const {
+	struct stat st;
+	return stat(ChunkPath(strHash).c_str(), &st) == 0;
+}
+
+bool CYondChunkStore::PutChunk(const std::string& strHash, const char* pData, size_t nLen) {
+	if (HasChunk(strHash)) {
+		return true;
+	}
+	if (CYondSha256::Hex(pData, nLen) != strHash) {
+		LOG_ERROR(YOND_ERR_CHUNK_STORE, "Chunk content does not match hash " + strHash);
+		return false;
+	}
+	return StoreChunk(strHash, pData, nLen);
+}
+
+bool CYondChunkStore::StoreChunk(const std::string& strHash, const char* pData, size_t nLen) {
+	std::string strDir = m_strDir + "/chunks/" + strHash.substr(0, 2);
+	if (mkdir(strDir.c_str(), 0755) != 0 && errno != EEXIST) {
+		LOG_ERROR(YOND_ERR_CHUNK_STORE, "Failed to create chunk directory " + strDir);
+		return false;
+	}
+	return WriteFile(ChunkPath(strHash), pData, nLen);
+}
+
+bool CYondChunkStore::WriteFile(const std::string& strPath, const char* pData, size_t nLen) {
+	std::string strTmp = strPath + ".tmp" + std::to_string(m_nTmpSeq++);
+	int fd = open(strTmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		LOG_ERROR(YOND_ERR_CHUNK_STORE, "Failed to create " + strTmp);
+		return false;
+	}
+	size_t nDone = 0;
+	while (nDone < nLen) {
+		ssize_t n = write(fd, pData + nDone, nLen - nDone);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		nDone += (size_t)n;
+	}
+	close(fd);
+	if (nDone != nLen || rename(strTmp.c_str(), strPath.c_str()) != 0) {
+		LOG_ERROR(YOND_ERR_CHUNK_STORE, "Failed to write " + strPath);
+		unlink(strTmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool CYondChunkStore::HasManifest(const std::string& strName) const {
+	struct stat st;
+	return stat(ManifestPath(strName).c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool CYondChunkStore::LoadManifest(const std::string& strName, YondManifest& manifest) const {
+	FILE* fp = fopen(ManifestPath(strName).c_str(), "re");
+	if (fp == NULL) {
+		return false;
+	}
+	long long nSize = 0;
+	size_t nCount = 0;
+	bool bOk = fscanf(fp, "YMF1 %lld %zu\n", &nSize, &nCount) == 2 && nSize >= 0 &&
+		nCount <= (size_t)(nSize / YOND_CDC_MIN) + 1;
+	manifest = YondManifest();
+	manifest.nSize = nSize;
+	int64_t nTotal = 0;
+	char szHash[2 * YOND_SHA256_SIZE + 1];
+	unsigned nLen = 0;
+	for (size_t i = 0; bOk && i < nCount; i++) {
+		bOk = fscanf(fp, "%64s %u\n", szHash, &nLen) == 2 && ValidHash(szHash) && nLen > 0;
+		manifest.vChunks.push_back(YondChunkRef{ szHash, nLen });
+		nTotal += nLen;
+	}
+	fclose(fp);
+	if (!bOk || nTotal != nSize) {
+		LOG_ERROR(YOND_ERR_CHUNK_STORE, "Malformed manifest of " + strName);
+		return false;
+	}
+	manifest.Index();
+	return true;
+}
+
+bool CYondChunkStore::SaveManifest(const std::string& strName, const YondManifest& manifest) {
+	std::string strData = "YMF1 " + std::to_string(manifest.nSize) + " " + std::to_string(manifest.vChunks.size()) + "\n";
+	for (const YondChunkRef& ref : manifest.vChunks) {
+		strData += ref.strHash + " " + std::to_string(ref.nLen) + "\n";
+	}
+	return WriteFile(ManifestPath(strName), strData.data(), strData.size());
+}
+
+bool CYondChunkStore::Ingest(const std::string& strName, const std::string& strPath) {
+	int fd = open(strPath.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0) close(fd);
+		LOG_ERROR(YOND_ERR_FILE_OPEN, "Failed to open " + strPath + " for the chunk store");
+		return false;
+	}
+	const char* pData = nullptr;
+	if (st.st_size > 0) {
+		void* pMap = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (pMap == MAP_FAILED) {
+			close(fd);
+			LOG_ERROR(YOND_ERR_FILE_IO, "Failed to map " + strPath);
+			return false;
+		}
+		madvise(pMap, (size_t)st.st_size, MADV_SEQUENTIAL);
+		pData = (const char*)pMap;
+	}
+	close(fd);
+
+	YondManifest manifest;
+	manifest.nSize = st.st_size;
+	size_t nNew = 0;
+	bool bOk = true;
+	for (size_t nOff = 0; bOk && nOff < (size_t)st.st_size; ) {
+		size_t nLen = CYondCdc::Cut(pData + nOff, (size_t)st.st_size - nOff);
+		YondChunkRef ref{ CYondSha256::Hex(pData + nOff, nLen), (uint32_t)nLen };
+		if (!HasChunk(ref.strHash)) {
+			bOk = StoreChunk(ref.strHash, pData + nOff, nLen);
+			nNew++;
+		}
+		manifest.vChunks.push_back(ref);
+		nOff += nLen;
+	}
+	if (pData != nullptr) {
+		munmap((void*)pData, (size_t)st.st_size);
+	}
+	if (!bOk || !SaveManifest(strName, manifest)) {
+		return false;
+	}
+	LOG_INFOF("Chunk store ingested %s: %zu chunks, %zu new", strName.c_str(), manifest.vChunks.size(), nNew);
+	return true;
+}
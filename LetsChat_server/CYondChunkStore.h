@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include "CYondLog.h"
+#include "../LetsChat_common/CYondSha256.h"
+#include "../LetsChat_common/CYondCdc.h"
+
+#define STORE_MANIFEST_MAX (64 * 1024 * 1024)	// 清单文件的大小上限
+
+// 清单中的一块
+struct YondChunkRef
+{
+	std::string strHash;	// SHA-256的十六进制
+	uint32_t nLen;
+};
+
+// 一个文件的清单: 各块按顺序拼起来就是文件内容
+struct YondManifest
+{
+	int64_t nSize = 0;
+	std::vector<YondChunkRef> vChunks;
+	std::vector<int64_t> vOffsets;	// 每块的起始偏移, 由Index算出
+
+	void Index();
+	// nOffset所在块的下标, 调用方保证nOffset < nSize
+	size_t Find(int64_t nOffset) const;
+};
+
+// 按内容寻址的附件存储, 相同内容的块只存一份:
+//   <dir>/chunks/<哈希前两位>/<哈希>  块内容
+//   <dir>/manifests/<name>             "YMF1 <size> <count>\n" 后每块一行 "<hash> <len>\n"
+// 块和清单都先写临时文件再改名, 读到的总是完整内容. 写操作在文件中转线程和线程池上的入库任务中进行,
+// 临时文件名各不相同, 同一块被同时写入时后改名的覆盖先改名的, 内容一样; 查询可在任意线程
+class CYondChunkStore
+{
+public:
+	int Open(const std::string& strDir);
+
+	bool HasChunk(const std::string& strHash) const;
+	// 内容与哈希不符时拒绝, 已有时不再写
+	bool PutChunk(const std::string& strHash, const char* pData, size_t nLen);
+	std::string ChunkPath(const std::string& strHash) const;
+
+	bool HasManifest(const std::string& strName) const;
+	bool LoadManifest(const std::string& strName, YondManifest& manifest) const;
+	bool SaveManifest(const std::string& strName, const YondManifest& manifest);
+
+	// 把完整的文件按CYondCdc切块入库并写清单, 成功后调用方可以删掉原文件
+	bool Ingest(const std::string& strName, const std::string& strPath);
+
+	static bool ValidHash(const std::string& strHash);
+
+private:
+	// 哈希由调用方算好
+	bool StoreChunk(const std::string& strHash, const char* pData, size_t nLen);
+	bool WriteFile(const std::string& strPath, const char* pData, size_t nLen);
+	std::string ManifestPath(const std::string& strName) const { return m_strDir + "/manifests/" + strName; }
+
+	std::string m_strDir;
+	std::atomic<unsigned> m_nTmpSeq{ 0 };	// 临时文件名的序号
+};
@@ -0,0 +1,143 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cstdint>
+#include "CYondFrame.h"
+#include "CYondConnRegistry.h"
+#include "CYondThreadPool.h"
+#include "CYondBufferPool.h"
+#include <string.h>
+#include <sys/uio.h>
+
+#define CONN_READ_CHUNK 4096
+
+// 单个客户端连接的状态, 只由所属事件循环线程访问
+class CYondConn
+{
+public:
+	CYondConn(int nFd, const std::string& strIp)
+		: m_nFd(nFd), m_nId(YOND_CONN_NONE), m_nPos(0), m_strIp(strIp),
+		m_pName(std::make_shared<const std::string>(strIp)), m_bLogin(false), m_nWire(0), m_nDropped(0), m_bPending(false), m_bReadAgain(false),
+		m_bZeroCopy(false), m_nZcSeq(0), m_nInLen(0), m_nInWant(0), m_nOutOffset(0), m_nOutBytes(0) {}
+	~CYondConn() {
+		CYondBufferPool::Instance().Put(m_in);
+	}
+	CYondConn(const CYondConn&) = delete;
+	CYondConn& operator=(const CYondConn&) = delete;
+
+	// 返回输入缓冲尾部的空闲区. 输入缓冲从缓冲池借, 不足nMin字节时换一块至少大一倍的
+	char* InTail(size_t nMin = CONN_READ_CHUNK) {
+		if (m_in.nCap - m_nInLen < nMin) {
+			YondBuf in = CYondBufferPool::Instance().Get(std::max(m_nInLen + nMin, m_in.nCap * 2));
+			if (m_nInLen > 0) {
+				memcpy(in.pData, m_in.pData, m_nInLen);
+			}
+			CYondBufferPool::Instance().Put(m_in);
+			m_in = in;
+		}
+		return m_in.pData + m_nInLen;
+	}
+	size_t InFree() const { return m_in.nCap - m_nInLen; }
+	void InCommit(size_t n) { m_nInLen += n; }
+
+	// 缓冲中是半帧时记下凑齐需要的长度, 之前的读取不必重新解析
+	bool InReady() const { return m_nInLen >= m_nInWant; }
+	void InWant(size_t n) { m_nInWant = n; }
+
+	const unsigned char* InData() const { return (const unsigned char*)m_in.pData; }
+	size_t InSize() const { return m_nInLen; }
+
+	// 丢弃已解析的前n字节, 剩余的半帧移到缓冲头部等待下次读取.
+	// 缓冲空了就还给缓冲池, 空闲连接不占输入缓冲
+	void InConsume(size_t n) {
+		if (n >= m_nInLen) {
+			m_nInLen = 0;
+			CYondBufferPool::Instance().Put(m_in);
+			return;
+		}
+		if (n == 0) {
+			return;
+		}
+		memmove(m_in.pData, m_in.pData + n, m_nInLen - n);
+		m_nInLen -= n;
+	}
+
+	// 出站队列: 只追加完整帧的引用, 队首帧可能已经发出一部分
+	void OutPush(const CYondFramePtr& frame) {
+		m_nOutBytes += frame->Size();
+		m_dqOut.push_back(frame);
+	}
+	bool OutEmpty() const { return m_dqOut.empty(); }
+	const CYondFramePtr& OutFront() const { return m_dqOut.front(); }
+	size_t OutOffset() const { return m_nOutOffset; }
+
+	// 把从队首开始最多nMax个待发片段填入iov, 遇到bStop返回true的帧时停止
+	template<class Pred>
+	int OutGather(struct iovec* iov, int nMax, Pred bStop) const {
+		int cnt = 0;
+		for (size_t i = 0; i < m_dqOut.size() && cnt < nMax; i++) {
+			const CYondFramePtr& frame = m_dqOut[i];
+			if (i > 0 && bStop(frame)) break;
+			size_t off = (i == 0) ? m_nOutOffset : 0;
+			iov[cnt].iov_base = (void*)(frame->Data() + off);
+			iov[cnt].iov_len = frame->Size() - off;
+			cnt++;
+		}
+		return cnt;
+	}
+
+	// 已被内核接收n字节, 跨帧推进队首
+	void OutSent(size_t n) {
+		m_nOutBytes -= n;
+		while (n > 0) {
+			size_t left = m_dqOut.front()->Size() - m_nOutOffset;
+			if (n < left) {
+				m_nOutOffset += n;
+				return;
+			}
+			n -= left;
+			m_dqOut.pop_front();
+			m_nOutOffset = 0;
+		}
+	}
+	size_t OutFrames() const { return m_dqOut.size(); }
+	size_t OutBytes() const { return m_nOutBytes; }
+
+	// 登录前为IP. 工作线程任务持有NamePtr的引用, 不必每条消息复制一次名字
+	const std::string& Name() const { return *m_pName; }
+	const std::shared_ptr<const std::string>& NamePtr() const { return m_pName; }
+	void SetName(const std::string& strName) {
+		m_pName = std::make_shared<const std::string>(strName);
+		m_bLogin = true;
+	}
+
+public:
+	int m_nFd;
+	YondConnId m_nId;	// 跨线程引用连接时使用, 不直接持有fd
+	size_t m_nPos;		// 在所属循环连接数组中的下标
+	std::string m_strIp;
+	std::shared_ptr<const std::string> m_pName;
+	bool m_bLogin;
+	unsigned m_nWire;	// 对端发来过的帧格式(YOND_WIRE_*), 之后发给它的帧都用这种格式
+	size_t m_nDropped;	// 高水位策略为丢弃时累计丢掉的帧数
+	bool m_bPending;	// 已在所属循环的待发送列表中
+	bool m_bReadAgain;	// 已在所属循环的续读列表中
+	// 本连接消息的串行执行器, 收到第一帧时创建; 排队中的任务持有引用, 可比连接活得久
+	std::shared_ptr<CYondStrand> m_pStrand;
+
+	// MSG_ZEROCOPY: 每次成功的sendmsg占用一个序号, 内核在错误队列通知完成前必须持有帧
+	bool m_bZeroCopy;
+	uint32_t m_nZcSeq;
+	std::deque<std::pair<uint32_t, CYondFramePtr>> m_dqZcPending;
+
+private:
+	YondBuf m_in;
+	size_t m_nInLen;
+	size_t m_nInWant;
+
+	std::deque<CYondFramePtr> m_dqOut;
+	size_t m_nOutOffset;
+	size_t m_nOutBytes;
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <sys/resource.h>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+class CYondReactor;
+class CYondConn;
+
+// 连接标识: 高32位为槽位代数, 低32位为fd. fd被复用后代数不同, 旧标识自动失效
+typedef uint64_t YondConnId;
+#define YOND_CONN_NONE 0
+
+#define REGISTRY_MAX_SLOTS (1 << 18)
+
+// 全局连接表: 以fd为下标的定长槽位数组, 不加锁.
+// Open/Close只由连接所属的事件循环线程调用, Owner/Alive可在任意线程调用.
+// 槽位代数为奇数表示在用, 偶数表示空闲
+class CYondConnRegistry
+{
+public:
+	CYondConnRegistry() : m_nSlots(0), m_nCount(0) {
+		// 槽位数取进程可打开的fd上限, 之后不再扩容, 读者无需同步
+		struct rlimit rl;
+		size_t nSlots = 1024;
+		if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+			nSlots = (size_t)rl.rlim_cur;
+		}
+		if (nSlots > REGISTRY_MAX_SLOTS) nSlots = REGISTRY_MAX_SLOTS;
+		m_pSlots.reset(new Slot[nSlots]);
+		m_nSlots = nSlots;
+	}
+
+	// 登记新接受的连接, fd超出槽位范围时返回YOND_CONN_NONE
+	YondConnId Open(int fd, CYondReactor* pOwner, CYondConn* pConn) {
+		if (fd < 0 || (size_t)fd >= m_nSlots) {
+			return YOND_CONN_NONE;
+		}
+		Slot& slot = m_pSlots[fd];
+		slot.pOwner.store(pOwner, std::memory_order_relaxed);
+		slot.pConn.store(pConn, std::memory_order_relaxed);
+		uint32_t nGen = slot.nGen.load(std::memory_order_relaxed) + 1;
+		slot.nGen.store(nGen, std::memory_order_release);
+		m_nCount.fetch_add(1, std::memory_order_relaxed);
+		return ((YondConnId)nGen << 32) | (uint32_t)fd;
+	}
+
+	// 必须在close(fd)之前调用, 否则fd可能已被其他循环复用并重新登记
+	void Close(YondConnId id) {
+		Slot* pSlot = Find(id);
+		if (pSlot == nullptr) {
+			return;
+		}
+		pSlot->pOwner.store(nullptr, std::memory_order_relaxed);
+		pSlot->pConn.store(nullptr, std::memory_order_relaxed);
+		pSlot->nGen.store(Gen(id) + 1, std::memory_order_release);
+		m_nCount.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// 线程安全: 返回连接所属的事件循环, 连接已关闭时返回nullptr.
+	// 返回后连接仍可能关闭, 调用方投递到该循环后需要再次校验
+	CYondReactor* Owner(YondConnId id) const {
+		const Slot* pSlot = Find(id);
+		if (pSlot == nullptr) {
+			return nullptr;
+		}
+		CYondReactor* pOwner = pSlot->pOwner.load(std::memory_order_relaxed);
+		// 读取期间槽位被关闭或复用则作废
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return pSlot->nGen.load(std::memory_order_relaxed) == Gen(id) ? pOwner : nullptr;
+	}
+
+	bool Alive(YondConnId id) const {
+		return Find(id) != nullptr;
+	}
+
+	// 只能在连接所属的事件循环线程调用并使用返回值
+	CYondConn* Get(YondConnId id) const {
+		const Slot* pSlot = Find(id);
+		return pSlot == nullptr ? nullptr : pSlot->pConn.load(std::memory_order_relaxed);
+	}
+
+	// 按fd查找属于pOwner的连接, 供事件循环处理就绪事件
+	CYondConn* Get(int fd, const CYondReactor* pOwner) const {
+		if (fd < 0 || (size_t)fd >= m_nSlots) {
+			return nullptr;
+		}
+		const Slot& slot = m_pSlots[fd];
+		if ((slot.nGen.load(std::memory_order_acquire) & 1) == 0 ||
+			slot.pOwner.load(std::memory_order_relaxed) != pOwner) {
+			return nullptr;
+		}
+		return slot.pConn.load(std::memory_order_relaxed);
+	}
+
+	size_t Count() const { return m_nCount.load(std::memory_order_relaxed); }
+	size_t Capacity() const { return m_nSlots; }
+
+	static int Fd(YondConnId id) { return (int)(uint32_t)id; }
+	static uint32_t Gen(YondConnId id) { return (uint32_t)(id >> 32); }
+
+private:
+	// 槽位紧凑排列, 按fd直接定位, 无需哈希或树查找
+	struct Slot
+	{
+		std::atomic<uint32_t> nGen{ 0 };
+		std::atomic<CYondReactor*> pOwner{ nullptr };
+		std::atomic<CYondConn*> pConn{ nullptr };
+	};
+
+	const Slot* Find(YondConnId id) const {
+		int fd = Fd(id);
+		uint32_t nGen = Gen(id);
+		if ((nGen & 1) == 0 || fd < 0 || (size_t)fd >= m_nSlots) {
+			return nullptr;
+		}
+		const Slot& slot = m_pSlots[fd];
+		return slot.nGen.load(std::memory_order_acquire) == nGen ? &slot : nullptr;
+	}
+	Slot* Find(YondConnId id) {
+		return const_cast<Slot*>(static_cast<const CYondConnRegistry*>(this)->Find(id));
+	}
+
+	std::unique_ptr<Slot[]> m_pSlots;
+	size_t m_nSlots;
+	std::atomic<size_t> m_nCount;
+};
@@ -0,0 +1,313 @@
+#include "CYondEpollReactor.h"
+#include "CYondHandleEvent.h"
+#include "CYondConn.h"
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <sys/timerfd.h>
+
+int CYondEpollReactor::InitEngine() {
+	m_nEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_nEpollFd < 0) {
+		return LOG_ERROR(YOND_ERR_EPOLL_CREATE, "Failed to create epoll instance");
+	}
+
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = m_nSockFd;
+	if (epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, m_nSockFd, &event) < 0) {
+		return LOG_ERROR(YOND_ERR_EPOLL_CTL, "Failed to add socket to epoll");
+	}
+	event.events = EPOLLIN;
+	event.data.fd = m_nWakeFd;
+	if (epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, m_nWakeFd, &event) < 0) {
+		return LOG_ERROR(YOND_ERR_EPOLL_CTL, "Failed to add wakeup eventfd to epoll");
+	}
+
+	// 只在设置了发送延迟时用到
+	if (m_opt.nFlushDelayUs > 0) {
+		m_nTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (m_nTimerFd < 0) {
+			return LOG_ERROR(YOND_ERR_EPOLL_CREATE, "Failed to create flush timerfd");
+		}
+		event.events = EPOLLIN;
+		event.data.fd = m_nTimerFd;
+		if (epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, m_nTimerFd, &event) < 0) {
+			return LOG_ERROR(YOND_ERR_EPOLL_CTL, "Failed to add flush timerfd to epoll");
+		}
+	}
+	return 0;
+}
+
+void CYondEpollReactor::CloseEngine() {
+	if (m_nEpollFd >= 0) close(m_nEpollFd);
+	if (m_nTimerFd >= 0) close(m_nTimerFd);
+	m_nEpollFd = m_nTimerFd = -1;
+}
+
+int CYondEpollReactor::Loop() {
+	epoll_event all_events[MAX_EVENTS];
+	return EpollDo(all_events);
+}
+
+int CYondEpollReactor::EpollDo(epoll_event* alevt) {
+	int err = 0;
+	while (!m_bStop) {
+		ArmFlushTimer();
+		int nWait = m_vReadAgain.empty() ? 1000 : (m_bReadMore ? 0 : READ_PAUSE_MS);
+		int eventMnt = epoll_wait(m_nEpollFd, alevt, MAX_EVENTS, nWait);
+		if (eventMnt == -1) {
+			if (errno == EINTR) continue;
+			return LOG_ERROR(YOND_ERR_EPOLL_WAIT, "Failed to wait for epoll events");
+		}
+		for (int i = 0; i < eventMnt; i++) {
+			if (alevt[i].data.fd == m_nSockFd) {
+				err = AcceptAll();
+			}
+			else if (alevt[i].data.fd == m_nWakeFd) {
+				uint64_t cnt = 0;
+				read(m_nWakeFd, &cnt, sizeof(cnt));
+				DrainInbox();
+			}
+			else if (alevt[i].data.fd == m_nTimerFd) {
+				uint64_t cnt = 0;
+				read(m_nTimerFd, &cnt, sizeof(cnt));
+				m_bTimerArmed = false;
+			}
+			else {
+				// MSG_ZEROCOPY完成通知通过错误队列以EPOLLERR上报, 不代表连接出错
+				if ((alevt[i].events & EPOLLERR) && HandleErrQueue(alevt[i].data.fd)) {
+					alevt[i].events &= ~EPOLLERR;
+				}
+				// 先发后收: 读到对端关闭时会释放连接
+				if (alevt[i].events & EPOLLOUT) {
+					HandleWritable(alevt[i].data.fd);
+				}
+				if (alevt[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+					err = HandleReadable(alevt[i].data.fd, alevt[i].events);
+				}
+			}
+		}
+		// 期间关闭的fd可能已被新连接复用, 新连接不带续读标记
+		m_vReadNow.swap(m_vReadAgain);
+		m_bReadMore = false;
+		for (int fd : m_vReadNow) {
+			CYondConn* pConn = FindConn(fd);
+			if (pConn != nullptr && pConn->m_bReadAgain) {
+				pConn->m_bReadAgain = false;
+				HandleReadable(fd, EPOLLIN);
+			}
+		}
+		m_vReadNow.clear();
+		FlushPending();
+		Tick();
+	}
+	return err;
+}
+
+void CYondEpollReactor::ArmFlushTimer() {
+	long us = PendingWaitUs();
+	if (m_nTimerFd < 0 || m_bTimerArmed || us <= 0) {
+		return;
+	}
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = us / 1000000;
+	its.it_value.tv_nsec = (us % 1000000) * 1000;
+	m_bTimerArmed = timerfd_settime(m_nTimerFd, 0, &its, NULL) == 0;
+}
+
+int CYondEpollReactor::AcceptAll() {
+	while (true) {
+		struct sockaddr_in clientAddr;
+		socklen_t clientLen = sizeof(clientAddr);
+		int clientFd = accept4(m_nSockFd, (struct sockaddr*)&clientAddr, &clientLen,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (clientFd < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			return LOG_ERROR(YOND_ERR_SOCKET_ACCEPT, "Failed to accept new connection");
+		}
+
+		char ip[INET_ADDRSTRLEN] = { 0 };
+		inet_ntop(AF_INET, &clientAddr.sin_addr, ip, sizeof(ip));
+		CYondConn* pConn = AddConn(clientFd, ip);
+		if (pConn == nullptr) {
+			close(clientFd);
+			continue;
+		}
+
+		// 将新客户端添加到epoll
+		struct epoll_event ev;
+		// EPOLLOUT同样为边沿触发, 只在发送缓冲由满变为可写时通知
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = clientFd;
+		if (epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, clientFd, &ev) < 0) {
+			RemoveClient(clientFd);
+			return LOG_ERROR(YOND_ERR_EPOLL_CTL, "Failed to add client to epoll");
+		}
+
+		if (m_opt.nZeroCopyMin > 0) {
+			int on = 1;
+			pConn->m_bZeroCopy = setsockopt(clientFd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+		}
+	}
+}
+
+int CYondEpollReactor::HandleReadable(int clientFd, uint32_t events) {
+	CYondConn* pConn = FindConn(clientFd);
+	if (pConn == nullptr) {
+		return 0;
+	}
+
+	bool bClosed = (events & (EPOLLHUP | EPOLLERR)) != 0;
+	size_t nRead = 0;
+	while (!bClosed) {
+		if (m_pHandler->Busy(pConn)) {
+			ReadAgain(pConn, false);
+			break;
+		}
+		if (nRead >= CONN_READ_BUDGET) {
+			ReadAgain(pConn, true);
+			break;
+		}
+		char* pTail = pConn->InTail();
+		ssize_t n = recv(pConn->m_nFd, pTail, std::min(pConn->InFree(), (size_t)CONN_READ_BUDGET - nRead), 0);
+		if (n > 0) {
+			pConn->InCommit(n);
+			nRead += (size_t)n;
+			// 读一次解一次, 缓冲中只留半帧; 对端关闭前发来的完整帧也已处理
+			if (m_pHandler->HandleEvent(this, pConn) != 0) {
+				bClosed = true;
+			}
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if (n < 0) LOG_ERROR(YOND_ERR_SOCKET_RECV, "Failed to recv from client " + pConn->Name());
+		bClosed = true;
+	}
+
+	if (bClosed) {
+		// 客户端断开连接
+		LOG_INFOF("Client disconnected: %s", pConn->Name().c_str());
+		RemoveClient(pConn->m_nFd);
+	}
+	return 0;
+}
+
+bool CYondEpollReactor::FlushOut(CYondConn* pConn) {
+	size_t nZcMin = pConn->m_bZeroCopy ? m_opt.nZeroCopyMin : 0;
+	auto isZc = [nZcMin](const CYondFramePtr& frame) {
+		return nZcMin > 0 && frame->Size() >= nZcMin;
+	};
+
+	while (!pConn->OutEmpty()) {
+		// 大帧单独以MSG_ZEROCOPY发送, 其余连续的小帧合并成一次sendmsg.
+		// 这次发不完队列时带MSG_MORE, 让内核把下一次的数据接着凑成满段
+		struct iovec iov[OUT_IOV_MAX];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		int flags = MSG_NOSIGNAL;
+		CYondFramePtr zcFrame;
+		if (isZc(pConn->OutFront())) {
+			zcFrame = pConn->OutFront();
+			iov[0].iov_base = (void*)(zcFrame->Data() + pConn->OutOffset());
+			iov[0].iov_len = zcFrame->Size() - pConn->OutOffset();
+			msg.msg_iovlen = 1;
+			flags |= MSG_ZEROCOPY;
+		}
+		else {
+			msg.msg_iovlen = pConn->OutGather(iov, OUT_IOV_MAX, isZc);
+		}
+		if (msg.msg_iovlen < pConn->OutFrames()) {
+			flags |= MSG_MORE;
+		}
+
+		ssize_t n = sendmsg(pConn->m_nFd, &msg, flags);
+		if (n >= 0) {
+			if (zcFrame) {
+				pConn->m_dqZcPending.emplace_back(pConn->m_nZcSeq++, zcFrame);
+			}
+			pConn->OutSent((size_t)n);
+			continue;
+		}
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+		if (errno == ENOBUFS && zcFrame) {
+			// 超出锁定内存配额, 本连接退回普通发送
+			pConn->m_bZeroCopy = false;
+			nZcMin = 0;
+			continue;
+		}
+		LOG_ERROR(YOND_ERR_SOCKET_SEND, "Failed to send message to client " + pConn->Name());
+		return false;
+	}
+	return true;
+}
+
+bool CYondEpollReactor::ReapZeroCopy(CYondConn* pConn) {
+	bool bReaped = false;
+	while (true) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(pConn->m_nFd, &msg, MSG_ERRQUEUE) < 0) {
+			break;
+		}
+		for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+				(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			const struct sock_extended_err* serr = (const struct sock_extended_err*)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+			// [ee_info, ee_data]范围内的发送已完成, 可以释放对应帧的引用
+			uint32_t hi = serr->ee_data;
+			while (!pConn->m_dqZcPending.empty() &&
+				(int32_t)(pConn->m_dqZcPending.front().first - hi) <= 0) {
+				pConn->m_dqZcPending.pop_front();
+			}
+			bReaped = true;
+		}
+	}
+	return bReaped;
+}
+
+bool CYondEpollReactor::HandleErrQueue(int clientFd) {
+	CYondConn* pConn = FindConn(clientFd);
+	if (pConn == nullptr || pConn->m_dqZcPending.empty()) {
+		return false;
+	}
+	ReapZeroCopy(pConn);
+	int err = 0;
+	socklen_t len = sizeof(err);
+	getsockopt(clientFd, SOL_SOCKET, SO_ERROR, &err, &len);
+	return err == 0;
+}
+
+void CYondEpollReactor::ReadAgain(CYondConn* pConn, bool bMore) {
+	m_bReadMore = m_bReadMore || bMore;
+	if (!pConn->m_bReadAgain) {
+		pConn->m_bReadAgain = true;
+		m_vReadAgain.push_back(pConn->m_nFd);
+	}
+}
+
+void CYondEpollReactor::HandleWritable(int clientFd) {
+	CYondConn* pConn = FindConn(clientFd);
+	if (pConn == nullptr || pConn->OutEmpty()) {
+		return;
+	}
+	if (!FlushOut(pConn)) {
+		RemoveClient(clientFd);
+	}
+}
+
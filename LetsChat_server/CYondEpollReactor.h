@@ -0,0 +1,53 @@
+#pragma once
+#include <sys/epoll.h>
+#include <vector>
+#include "CYondReactor.h"
+
+#define MAX_EVENTS 100
+#define CONN_READ_BUDGET (256 * 1024)	// 每个连接每次唤醒最多读的字节, 读满的下一轮接着读
+#define READ_PAUSE_MS 1		// 线程池积压而暂停读取时, 多久检查一次能否恢复
+
+// epoll引擎: 客户端socket非阻塞, EPOLLIN/EPOLLOUT均为边沿触发
+class CYondEpollReactor : public CYondReactor
+{
+public:
+	CYondEpollReactor(int nIndex, CYondHandleEvent* pHandler, const YondServerOpt& opt)
+		: CYondReactor(nIndex, pHandler, opt), m_nEpollFd(-1), m_nTimerFd(-1), m_bTimerArmed(false), m_bReadMore(false) {}
+	~CYondEpollReactor() override {
+		Stop();
+	}
+
+	const char* EngineName() const override { return "epoll"; }
+
+	int EpollDo(epoll_event* alevt);
+	// 读取MSG_ZEROCOPY完成通知, 释放内核已用完的帧
+	bool ReapZeroCopy(CYondConn* pConn);
+
+protected:
+	int InitEngine() override;
+	int Loop() override;
+	// 发到EAGAIN为止, 剩余部分等EPOLLOUT. SendTo入队的帧由FlushPending在循环末尾调用
+	bool FlushOut(CYondConn* pConn) override;
+	void CloseEngine() override;
+
+private:
+	// 监听socket可读时接受所有排队的连接
+	int AcceptAll();
+	// 每次recv后交给CYondHandleEvent解帧, 读到EAGAIN或用完CONN_READ_BUDGET为止.
+	// 线程池积压时不读, 留在续读列表中, 由TCP流控让对端慢下来
+	int HandleReadable(int clientFd, uint32_t events);
+	// bMore为true表示用完了读配额, 下一轮立即续读; 否则是暂停, 隔READ_PAUSE_MS再看
+	void ReadAgain(CYondConn* pConn, bool bMore);
+	void HandleWritable(int clientFd);
+	bool HandleErrQueue(int clientFd);
+	// 有攒着的出站帧时按最早一帧的期限设置单次定时器, 到期时epoll_wait返回
+	void ArmFlushTimer();
+
+	int m_nEpollFd;
+	int m_nTimerFd;		// nFlushDelayUs为0时不创建
+	bool m_bTimerArmed;
+	// 用完读配额或暂停读取的连接, 边沿触发下不会再通知, 之后主动续读
+	std::vector<int> m_vReadAgain;
+	std::vector<int> m_vReadNow;
+	bool m_bReadMore;		// 续读列表中有用完读配额的连接
+};
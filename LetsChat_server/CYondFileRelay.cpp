@@ -0,0 +1,975 @@
+#include "CYondFileRelay.h"
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <exception>
+
+// 整段都是非负十进制数
+static bool ParseOffset(const std::string& strNum, int64_t& nValue) {
+	char* pEnd = nullptr;
+	long long n = strtoll(strNum.c_str(), &pEnd, 10);
+	if (strNum.empty() || *pEnd != '\0' || n < 0) {
+		return false;
+	}
+	nValue = n;
+	return true;
+}
+
+static bool ReadAll(int nFd, std::string& strData) {
+	struct stat st;
+	if (fstat(nFd, &st) != 0) {
+		return false;
+	}
+	strData.resize((size_t)st.st_size);
+	size_t nRead = 0;
+	while (nRead < strData.size()) {
+		ssize_t n = pread(nFd, &strData[nRead], strData.size() - nRead, (off_t)nRead);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		nRead += (size_t)n;
+	}
+	return true;
+}
+
+int CYondFileRelay::Start(const YondServerOpt& opt, CYondThreadPool* pPool) {
+	if (opt.nFilePort == 0) {
+		return 0;
+	}
+	m_pPool = pPool;
+	m_strSpool = opt.strSpoolDir;
+	if (mkdir(m_strSpool.c_str(), 0755) != 0 && errno != EEXIST) {
+		return LOG_ERROR(YOND_ERR_FILE_OPEN, "Failed to create spool directory " + m_strSpool);
+	}
+	int err = m_store.Open(m_strSpool);
+	if (err != 0) {
+		return err;
+	}
+	m_nKeepSec = opt.nPartKeepSec;
+	m_nUploadMax = opt.nUploadMax;
+	m_tSwept = time(NULL);
+	Sweep();
+
+	m_nSockFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_nSockFd < 0) {
+		return LOG_ERROR(YOND_ERR_SOCKET_CREATE, "Failed to initialize file relay socket");
+	}
+	int on = 1;
+	setsockopt(m_nSockFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(opt.nFilePort);
+	if (bind(m_nSockFd, (sockaddr*)&addr, sizeof(addr))) {
+		Stop();
+		return LOG_ERROR(YOND_ERR_SOCKET_BIND, "Failed to bind file relay socket");
+	}
+	if (listen(m_nSockFd, SOMAXCONN)) {
+		Stop();
+		return LOG_ERROR(YOND_ERR_SOCKET_LISTEN, "Failed to listen on file relay socket");
+	}
+
+	m_nEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	m_nWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_nEpollFd < 0 || m_nWakeFd < 0) {
+		Stop();
+		return LOG_ERROR(YOND_ERR_EPOLL_CREATE, "Failed to create file relay epoll instance");
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, m_nSockFd, &ev);
+	ev.data.ptr = &m_nWakeFd;
+	epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, m_nWakeFd, &ev);
+
+	m_bStop = false;
+	err = m_thread.Start([this]() {
+		Loop();
+	});
+	if (err == 0) {
+		LOG_INFO("File relay listening on port " + std::to_string(opt.nFilePort) + ", spool " + m_strSpool);
+	}
+	return err;
+}
+
+int CYondFileRelay::Stop() {
+	if (!m_bStop.exchange(true)) {
+		uint64_t one = 1;
+		write(m_nWakeFd, &one, sizeof(one));
+		m_thread.Stop();
+	}
+	// 入库任务完成时要写m_nWakeFd, 等它们都结束再关闭
+	while (m_nIngesting.load() > 0) {
+		usleep(10 * 1000);
+	}
+	m_vIngested.clear();
+	m_setUploading.clear();
+	m_mapWanted.clear();
+	m_nWantedBytes = 0;
+	while (!m_mapConns.empty()) {
+		Close(m_mapConns.begin()->second);
+	}
+	if (m_nSockFd >= 0) close(m_nSockFd);
+	if (m_nEpollFd >= 0) close(m_nEpollFd);
+	if (m_nWakeFd >= 0) close(m_nWakeFd);
+	m_nSockFd = m_nEpollFd = m_nWakeFd = -1;
+	return 0;
+}
+
+bool CYondFileRelay::Has(const std::string& strName) const {
+	std::string strSafe = SafeName(strName);
+	struct stat st;
+	return !strSafe.empty() && (m_store.HasManifest(strSafe) ||
+		(stat(FilePath(strSafe).c_str(), &st) == 0 && S_ISREG(st.st_mode)));
+}
+
+std::string CYondFileRelay::SafeName(const std::string& strName) {
+	size_t nSlash = strName.find_last_of("/\\");
+	std::string strBase = (nSlash == std::string::npos) ? strName : strName.substr(nSlash + 1);
+	if (strBase.empty() || strBase == "." || strBase == "..") {
+		return std::string();
+	}
+	return strBase;
+}
+
+int CYondFileRelay::Loop() {
+	struct epoll_event events[RELAY_MAX_EVENTS];
+	while (!m_bStop) {
+		int n = epoll_wait(m_nEpollFd, events, RELAY_MAX_EVENTS, m_vReady.empty() ? 1000 : 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return LOG_ERROR(YOND_ERR_EPOLL_WAIT, "Failed to wait for file relay events");
+		}
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == nullptr) {
+				AcceptAll();
+			}
+			else if (events[i].data.ptr == &m_nWakeFd) {
+				uint64_t cnt = 0;
+				read(m_nWakeFd, &cnt, sizeof(cnt));
+				FinishIngests();
+			}
+			else {
+				OnEvent((RelayConn*)events[i].data.ptr, events[i].events);
+			}
+		}
+		// 上一轮用完配额的连接, 其间可能已关闭, 按fd重新查找
+		std::vector<int> vReady;
+		vReady.swap(m_vReady);
+		for (int fd : vReady) {
+			auto it = m_mapConns.find(fd);
+			if (it == m_mapConns.end() || !it->second->bReady) continue;
+			it->second->bReady = false;
+			OnEvent(it->second, it->second->eState == RDownload ? EPOLLOUT : EPOLLIN);
+		}
+		time_t tNow = time(NULL);
+		if (tNow - m_tSwept >= RELAY_SWEEP_SEC) {
+			m_tSwept = tNow;
+			Sweep();
+		}
+	}
+	return 0;
+}
+
+void CYondFileRelay::AcceptAll() {
+	while (true) {
+		int fd = accept4(m_nSockFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				LOG_ERROR(YOND_ERR_SOCKET_ACCEPT, "Failed to accept file relay connection");
+			}
+			return;
+		}
+		RelayConn* pConn = new RelayConn();
+		pConn->nFd = fd;
+		pConn->eState = RHead;
+		pConn->nFile = -1;
+		pConn->nPipe[0] = pConn->nPipe[1] = -1;
+		pConn->nPiped = 0;
+		pConn->nSize = pConn->nDone = pConn->nAcked = 0;
+		pConn->nEnd = pConn->nMarked = 0;
+		pConn->nIdx = -1;
+		pConn->bStored = false;
+		pConn->nPart = (size_t)-1;
+		pConn->nListLeft = pConn->nNeedPos = 0;
+		pConn->put.nLen = 0;
+		pConn->nPutBytes = 0;
+		pConn->bReady = false;
+		m_mapConns[fd] = pConn;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = pConn;
+		if (epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			LOG_ERROR(YOND_ERR_EPOLL_CTL, "Failed to add file relay connection to epoll");
+			Close(pConn);
+		}
+	}
+}
+
+void CYondFileRelay::OnEvent(RelayConn* pConn, uint32_t events) {
+	bool bOk = true;
+	// 一个连接处理中抛出的异常(如分配失败)只断开这个连接, 不能让中转线程终止整个进程
+	try {
+		if (events & EPOLLOUT) {
+			bOk = FlushLine(pConn);
+			if (bOk && pConn->eState == RDownload) {
+				bOk = PumpDownload(pConn);
+				// 发完一段后下一个请求可能早已到达, 边沿触发不会再通知
+				if (pConn->eState == RHead) {
+					events |= EPOLLIN;
+				}
+			}
+		}
+		if (bOk && (events & EPOLLIN)) {
+			if (pConn->eState == RHead) {
+				bOk = ReadHead(pConn);
+			}
+			if (bOk && pConn->eState == RUpload) {
+				bOk = PumpUpload(pConn);
+			}
+			if (bOk && (pConn->eState == RList || pConn->eState == RChunks || pConn->eState == RPut)) {
+				bOk = PumpPush(pConn);
+			}
+		}
+		// 上传中途断开时Pump已经读到EOF并返回false; 入库中的连接半关闭后仍要等最后的ACP; 其余阶段对端关闭即结束
+		bool bReceiving = pConn->eState == RUpload || pConn->eState == RList ||
+			pConn->eState == RChunks || pConn->eState == RPut || pConn->eState == RIngest;
+		if (bOk && (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !bReceiving) {
+			bOk = false;
+		}
+	}
+	catch (const std::exception& e) {
+		LOG_ERROR(YOND_ERR_FILE_IO, "File relay connection failed: " + std::string(e.what()));
+		bOk = false;
+	}
+	if (!bOk) {
+		Close(pConn);
+	}
+}
+
+bool CYondFileRelay::ReadHead(RelayConn* pConn) {
+	// 先窥视再只取走握手行, 后面的文件内容留在socket中交给splice
+	char szHead[RELAY_HEAD_MAX];
+	ssize_t n = recv(pConn->nFd, szHead, sizeof(szHead), MSG_PEEK);
+	if (n == 0) return false;
+	if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	char* pEnd = (char*)memchr(szHead, '\n', (size_t)n);
+	if (pEnd == nullptr) {
+		return n < (ssize_t)sizeof(szHead);
+	}
+	size_t nLine = (size_t)(pEnd - szHead) + 1;
+	std::string strLine(szHead, nLine - 1);
+	// 窥视到的字节已在socket中, 取走时只会被信号打断; 少取一个字节后面的内容都会错位
+	for (size_t nTaken = 0; nTaken < nLine; ) {
+		ssize_t m = recv(pConn->nFd, szHead, nLine - nTaken, 0);
+		if (m < 0 && errno == EINTR) continue;
+		if (m <= 0) {
+			LOG_ERROR(YOND_ERR_SOCKET_RECV, "Failed to consume file relay handshake");
+			return false;
+		}
+		nTaken += (size_t)m;
+	}
+	if (!strLine.empty() && strLine.back() == '\r') strLine.pop_back();
+
+	// 文件名可能含空格, 数字取最后几段
+	if (strLine.compare(0, 5, "FILE ") == 0) {
+		size_t nSp = strLine.find_last_of(' ');
+		int64_t nSize = 0;
+		if (nSp > 5 && ParseOffset(strLine.substr(nSp + 1), nSize)) {
+			return BeginUpload(pConn, strLine.substr(5, nSp - 5), nSize);
+		}
+	}
+	else if (strLine.compare(0, 4, "REQ ") == 0) {
+		return BeginDownload(pConn, strLine.substr(4), 0, 0, false);
+	}
+	else if (strLine.compare(0, 5, "PUSH ") == 0) {
+		size_t nSp2 = strLine.find_last_of(' ');
+		size_t nSp1 = nSp2 > 5 ? strLine.find_last_of(' ', nSp2 - 1) : std::string::npos;
+		int64_t nSize = 0, nCount = 0;
+		if (nSp1 != std::string::npos && nSp1 > 5 &&
+			ParseOffset(strLine.substr(nSp1 + 1, nSp2 - nSp1 - 1), nSize) &&
+			ParseOffset(strLine.substr(nSp2 + 1), nCount)) {
+			return BeginPush(pConn, strLine.substr(5, nSp1 - 5), nSize, (size_t)nCount);
+		}
+	}
+	else if (strLine.compare(0, 4, "PUT ") == 0) {
+		int64_t nCount = 0;
+		if (ParseOffset(strLine.substr(4), nCount) && nCount > 0 && nCount <= RELAY_PUT_MAX) {
+			return BeginPut(pConn, (size_t)nCount);
+		}
+	}
+	else if (strLine.compare(0, 4, "GET ") == 0) {
+		size_t nSp2 = strLine.find_last_of(' ');
+		size_t nSp1 = nSp2 > 4 ? strLine.find_last_of(' ', nSp2 - 1) : std::string::npos;
+		int64_t nOffset = 0, nLen = 0;
+		if (nSp1 != std::string::npos && nSp1 > 4 &&
+			ParseOffset(strLine.substr(nSp1 + 1, nSp2 - nSp1 - 1), nOffset) &&
+			ParseOffset(strLine.substr(nSp2 + 1), nLen)) {
+			return BeginDownload(pConn, strLine.substr(4, nSp1 - 4), nOffset, nLen, true);
+		}
+	}
+	LOG_WARNING("Malformed file relay handshake: " + strLine);
+	SendLine(pConn, "ERR bad request\n");
+	pConn->eState = RDone;
+	return true;
+}
+
+bool CYondFileRelay::BeginUpload(RelayConn* pConn, const std::string& strName, int64_t nSize) {
+	pConn->strName = SafeName(strName);
+	if (pConn->strName.empty()) {
+		SendLine(pConn, "ERR bad name\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	if (m_setUploading.count(pConn->strName)) {
+		SendLine(pConn, "ERR busy\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	// 长度来自客户端, 先于打开文件和分配块表检查
+	if (nSize > m_nUploadMax) {
+		LOG_WARNINGF("File relay refused upload of %s: %lld bytes", pConn->strName.c_str(), (long long)nSize);
+		SendLine(pConn, "ERR too large\n");
+		pConn->eState = RDone;
+		return true;
+	}
+
+	// 同名同大小的暂存文件和块表都在时续传, 否则从头开始
+	std::string strIdx;
+	pConn->nIdx = open(IdxPath(pConn->strName).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	bool bResume = pConn->nIdx >= 0 && ReadAll(pConn->nIdx, strIdx) &&
+		pConn->chunks.Parse(strIdx) && pConn->chunks.Size() == nSize &&
+		access(PartPath(pConn->strName).c_str(), F_OK) == 0;
+	pConn->nFile = open(PartPath(pConn->strName).c_str(),
+		O_WRONLY | O_CREAT | O_CLOEXEC | (bResume ? 0 : O_TRUNC), 0644);
+	if (pConn->nFile < 0 || pConn->nIdx < 0 || pipe2(pConn->nPipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+		LOG_ERROR(YOND_ERR_FILE_OPEN, "Failed to open spool file for " + pConn->strName);
+		SendLine(pConn, "ERR cannot store\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	fcntl(pConn->nPipe[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+	if (!bResume) {
+		if (!pConn->chunks.Reset(nSize)) {
+			SendLine(pConn, "ERR too large\n");
+			pConn->eState = RDone;
+			return true;
+		}
+		strIdx = pConn->chunks.Serialize();
+		if (ftruncate(pConn->nIdx, 0) != 0 ||
+			pwrite(pConn->nIdx, strIdx.data(), strIdx.size(), 0) != (ssize_t)strIdx.size()) {
+			LOG_ERROR(YOND_ERR_FILE_IO, "Failed to write chunk map of " + pConn->strName);
+			SendLine(pConn, "ERR cannot store\n");
+			pConn->eState = RDone;
+			return true;
+		}
+		// 预先分配, 不支持的文件系统上忽略(posix_fallocate会退化成逐块写零, 不用它)
+		if (nSize > 0) {
+			fallocate(pConn->nFile, 0, 0, nSize);
+		}
+	}
+	pConn->nSize = nSize;
+	pConn->nDone = pConn->nAcked = pConn->nMarked = pConn->chunks.Offset(pConn->chunks.FirstMissing());
+	pConn->eState = RUpload;
+	m_setUploading.insert(pConn->strName);
+	LOG_INFOF("File relay receiving %s (%lld bytes) from offset %lld", pConn->strName.c_str(),
+		(long long)nSize, (long long)pConn->nDone);
+	if (!SendLine(pConn, "ACP " + std::to_string(pConn->nDone) + "\n")) {
+		return false;
+	}
+	// 块已全部写完但上次没来得及改名
+	return pConn->nDone == pConn->nSize ? PumpUpload(pConn) : true;
+}
+
+bool CYondFileRelay::BeginDownload(RelayConn* pConn, const std::string& strName, int64_t nOffset, int64_t nLen, bool bRange) {
+	pConn->strName = SafeName(strName);
+	pConn->bStored = false;
+	pConn->nPart = (size_t)-1;
+	struct stat st;
+	// 先找块存储中的清单, 再找存储之前发布的整文件
+	if (!pConn->strName.empty() && m_store.LoadManifest(pConn->strName, pConn->manifest)) {
+		pConn->bStored = true;
+		pConn->nSize = pConn->manifest.nSize;
+	}
+	else if (pConn->strName.empty() ||
+		(pConn->nFile = open(FilePath(pConn->strName).c_str(), O_RDONLY | O_CLOEXEC)) < 0 ||
+		fstat(pConn->nFile, &st) != 0) {
+		SendLine(pConn, "ERR not found\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	else {
+		pConn->nSize = st.st_size;
+	}
+	if (nOffset > pConn->nSize) {
+		SendLine(pConn, "ERR bad range\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	pConn->nDone = nOffset;
+	pConn->nEnd = (nLen == 0 || nLen > pConn->nSize - nOffset) ? pConn->nSize : nOffset + nLen;
+	pConn->eState = RDownload;
+	LOG_INFOF("File relay sending %s [%lld, %lld) of %lld bytes", pConn->strName.c_str(),
+		(long long)pConn->nDone, (long long)pConn->nEnd, (long long)pConn->nSize);
+	// 头部与文件内容尽量合并成同一个段
+	if (bRange) {
+		pConn->strOut = "RANGE " + pConn->strName + " " + std::to_string(pConn->nSize) + " " +
+			std::to_string(pConn->nDone) + " " + std::to_string(pConn->nEnd - pConn->nDone) + "\n";
+	}
+	else {
+		pConn->strOut = "FILE " + pConn->strName + " " + std::to_string(pConn->nSize) + "\n";
+	}
+	if (!FlushLine(pConn)) return false;
+	return PumpDownload(pConn);
+}
+
+bool CYondFileRelay::PumpUpload(RelayConn* pConn) {
+	int64_t nStart = pConn->nDone;
+	while (pConn->nDone + (int64_t)pConn->nPiped < pConn->nSize) {
+		if (pConn->nDone - nStart >= RELAY_QUANTUM) {
+			MarkReady(pConn);
+			break;
+		}
+		size_t nWant = (size_t)(pConn->nSize - pConn->nDone - (int64_t)pConn->nPiped);
+		if (nWant > RELAY_PIPE_SIZE - pConn->nPiped) nWant = RELAY_PIPE_SIZE - pConn->nPiped;
+		ssize_t n = splice(pConn->nFd, NULL, pConn->nPipe[1], NULL, nWant, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n == 0) {
+			LOG_WARNING("File relay upload of " + pConn->strName + " ended at " +
+				std::to_string(pConn->nDone) + "/" + std::to_string(pConn->nSize) + " bytes");
+			return false;
+		}
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			// 管道满时先写文件再继续
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				LOG_ERROR(YOND_ERR_FILE_IO, "Failed to splice upload of " + pConn->strName);
+				return false;
+			}
+			if (pConn->nPiped == 0) break;
+		}
+		else {
+			pConn->nPiped += (size_t)n;
+		}
+		while (pConn->nPiped > 0) {
+			loff_t off = pConn->nDone;
+			ssize_t m = splice(pConn->nPipe[0], NULL, pConn->nFile, &off, pConn->nPiped, SPLICE_F_MOVE);
+			if (m < 0 && errno == EINTR) continue;
+			if (m <= 0) {
+				LOG_ERROR(YOND_ERR_FILE_IO, "Failed to write spool file of " + pConn->strName);
+				return false;
+			}
+			pConn->nPiped -= (size_t)m;
+			pConn->nDone += m;
+		}
+	}
+
+	// 块表先于确认落盘, 确认过的字节续传时不会再要
+	if (!SaveChunks(pConn)) {
+		return false;
+	}
+	if (pConn->nDone == pConn->nSize) {
+		StartIngest(pConn);
+		return true;
+	}
+	// 每轮读完确认一次累计字节数
+	if (pConn->nDone == pConn->nAcked) {
+		return true;
+	}
+	pConn->nAcked = pConn->nDone;
+	return SendLine(pConn, "ACP " + std::to_string(pConn->nDone) + "\n");
+}
+
+void CYondFileRelay::StartIngest(RelayConn* pConn) {
+	close(pConn->nFile);
+	pConn->nFile = -1;
+	close(pConn->nIdx);
+	pConn->nIdx = -1;
+	pConn->eState = RIngest;
+	m_nIngesting++;
+	// 切块和SHA-256要过一遍整个文件, 放在线程池上, 中转线程照常服务其他连接
+	auto task = [this, nFd = pConn->nFd, strName = pConn->strName]() {
+		std::string strPart = PartPath(strName);
+		bool bOk = true;
+		// 存不进块存储时按整文件发布
+		if (m_store.Ingest(strName, strPart)) {
+			unlink(strPart.c_str());
+			unlink(FilePath(strName).c_str());
+		}
+		else if (rename(strPart.c_str(), FilePath(strName).c_str()) != 0) {
+			LOG_ERROR(YOND_ERR_FILE_IO, "Failed to publish spool file of " + strName);
+			bOk = false;
+		}
+		if (bOk) {
+			unlink(IdxPath(strName).c_str());
+		}
+		{
+			std::unique_lock<std::mutex> lock(m_ingestLock);
+			m_vIngested.push_back(IngestDone{ nFd, strName, bOk });
+		}
+		uint64_t one = 1;
+		write(m_nWakeFd, &one, sizeof(one));
+		m_nIngesting--;
+	};
+	if (m_pPool != nullptr) {
+		m_pPool->Enqueue(std::move(task));
+	}
+	else {
+		task();
+	}
+}
+
+void CYondFileRelay::FinishIngests() {
+	std::vector<IngestDone> vDone;
+	{
+		std::unique_lock<std::mutex> lock(m_ingestLock);
+		vDone.swap(m_vIngested);
+	}
+	for (const IngestDone& done : vDone) {
+		m_setUploading.erase(done.strName);
+		// 入库期间对端可能已断开, fd也可能已被复用; 同名上传在此之前不会开始
+		auto it = m_mapConns.find(done.nFd);
+		RelayConn* pConn = it == m_mapConns.end() ? nullptr : it->second;
+		if (pConn == nullptr || pConn->eState != RIngest || pConn->strName != done.strName) {
+			continue;
+		}
+		pConn->eState = RDone;
+		bool bOk = done.bOk;
+		if (bOk) {
+			LOG_INFOF("File relay stored %s (%lld bytes)", pConn->strName.c_str(), (long long)pConn->nSize);
+			pConn->nAcked = pConn->nSize;
+			bOk = SendLine(pConn, "ACP " + std::to_string(pConn->nSize) + "\n");
+		}
+		else {
+			bOk = SendLine(pConn, "ERR cannot store\n");
+		}
+		if (!bOk) {
+			Close(pConn);
+		}
+	}
+}
+
+bool CYondFileRelay::PumpDownload(RelayConn* pConn) {
+	if (!pConn->strOut.empty()) {
+		return true;
+	}
+	int64_t nStart = pConn->nDone;
+	while (pConn->nDone < pConn->nEnd) {
+		if (pConn->nDone - nStart >= RELAY_QUANTUM) {
+			MarkReady(pConn);
+			return true;
+		}
+		// 块存储中的文件逐块发送, 每块是一个文件
+		int64_t nBase = 0, nLimit = pConn->nEnd;
+		if (pConn->bStored) {
+			size_t i = pConn->manifest.Find(pConn->nDone);
+			if (i != pConn->nPart) {
+				if (pConn->nFile >= 0) close(pConn->nFile);
+				pConn->nPart = i;
+				pConn->nFile = open(m_store.ChunkPath(pConn->manifest.vChunks[i].strHash).c_str(), O_RDONLY | O_CLOEXEC);
+				if (pConn->nFile < 0) {
+					LOG_ERROR(YOND_ERR_FILE_OPEN, "Missing chunk of " + pConn->strName);
+					return false;
+				}
+			}
+			nBase = pConn->manifest.vOffsets[i];
+			nLimit = std::min(nLimit, nBase + (int64_t)pConn->manifest.vChunks[i].nLen);
+		}
+		off_t off = pConn->nDone - nBase;
+		size_t nWant = (size_t)(nLimit - pConn->nDone);
+		if (nWant > RELAY_QUANTUM) nWant = RELAY_QUANTUM;
+		ssize_t n = sendfile(pConn->nFd, pConn->nFile, &off, nWant);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+			LOG_ERROR(YOND_ERR_FILE_IO, "Failed to sendfile " + pConn->strName);
+			return false;
+		}
+		if (n == 0) {
+			// 文件在发送中被截短
+			LOG_ERROR(YOND_ERR_FILE_IO, "Spool file " + pConn->strName + " shrank while sending");
+			return false;
+		}
+		pConn->nDone += n;
+	}
+	if (pConn->nFile >= 0) close(pConn->nFile);
+	pConn->nFile = -1;
+	pConn->eState = RHead;
+	return true;
+}
+
+bool CYondFileRelay::BeginPush(RelayConn* pConn, const std::string& strName, int64_t nSize, size_t nCount) {
+	pConn->strName = SafeName(strName);
+	// 长度和块数都来自客户端, 清单按行增长, 不按count预留
+	if (nSize > m_nUploadMax || nCount > RELAY_LIST_MAX) {
+		LOG_WARNINGF("File relay refused push of %s: %lld bytes in %zu chunks", pConn->strName.c_str(), (long long)nSize, nCount);
+		SendLine(pConn, "ERR too large\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	// 除最后一块外都不短于切块下限, 块数不会超过这个值
+	if (pConn->strName.empty() || nCount > (size_t)(nSize / YOND_CDC_MIN) + 1) {
+		SendLine(pConn, "ERR bad request\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	pConn->manifest = YondManifest();
+	pConn->manifest.nSize = nSize;
+	pConn->nListLeft = nCount;
+	pConn->eState = RList;
+	return true;
+}
+
+bool CYondFileRelay::PumpPush(RelayConn* pConn) {
+	size_t nRead = 0;
+	while (true) {
+		// 先处理缓冲中已有的内容, 空清单或不缺块时不用等数据
+		if (pConn->eState == RList && !ParseList(pConn)) return false;
+		if (pConn->eState == RChunks && !StoreChunks(pConn)) return false;
+		if (pConn->eState == RPut && !StorePut(pConn)) return false;
+		if (pConn->eState != RList && pConn->eState != RChunks && pConn->eState != RPut) break;
+		if (nRead >= RELAY_QUANTUM) {
+			MarkReady(pConn);
+			break;
+		}
+		size_t nOld = pConn->strIn.size();
+		pConn->strIn.resize(nOld + RELAY_READ_SIZE);
+		ssize_t n = recv(pConn->nFd, &pConn->strIn[nOld], RELAY_READ_SIZE, 0);
+		pConn->strIn.resize(nOld + (n > 0 ? (size_t)n : 0));
+		if (n == 0) {
+			// 收到NEED后一块都没发就断开, 是客户端改用PUT连接并行上传
+			if (pConn->eState != RChunks || pConn->nDone > 0) {
+				LOG_WARNING("File relay push of " + pConn->strName + " ended at " +
+					std::to_string(pConn->nDone) + "/" + std::to_string(pConn->nSize) + " bytes");
+			}
+			return false;
+		}
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			LOG_ERROR(YOND_ERR_SOCKET_RECV, "Failed to receive push of " + pConn->strName);
+			return false;
+		}
+		nRead += (size_t)n;
+	}
+	if (pConn->nDone == pConn->nAcked) {
+		return true;
+	}
+	pConn->nAcked = pConn->nDone;
+	return SendLine(pConn, "ACP " + std::to_string(pConn->nDone) + "\n");
+}
+
+bool CYondFileRelay::ParseList(RelayConn* pConn) {
+	YondManifest& manifest = pConn->manifest;
+	size_t nPos = 0;
+	bool bOk = true;
+	while (bOk && pConn->nListLeft > 0) {
+		size_t nEnd = pConn->strIn.find('\n', nPos);
+		if (nEnd == std::string::npos) {
+			bOk = pConn->strIn.size() - nPos <= RELAY_HEAD_MAX;
+			break;
+		}
+		std::string strLine = pConn->strIn.substr(nPos, nEnd - nPos);
+		nPos = nEnd + 1;
+		size_t nSp = strLine.find(' ');
+		int64_t nLen = 0;
+		bOk = nSp != std::string::npos && CYondChunkStore::ValidHash(strLine.substr(0, nSp)) &&
+			ParseOffset(strLine.substr(nSp + 1), nLen) && nLen > 0 && nLen <= YOND_CDC_MAX &&
+			(pConn->nListLeft == 1 || nLen >= YOND_CDC_MIN);
+		if (bOk) {
+			manifest.vChunks.push_back(YondChunkRef{ strLine.substr(0, nSp), (uint32_t)nLen });
+			pConn->nListLeft--;
+		}
+	}
+	pConn->strIn.erase(0, nPos);
+	if (bOk && pConn->nListLeft > 0) {
+		return true;
+	}
+	manifest.Index();
+	if (!bOk || (manifest.vChunks.empty() ? 0 : manifest.vOffsets.back() + manifest.vChunks.back().nLen) != manifest.nSize) {
+		LOG_WARNING("Malformed chunk list for " + pConn->strName);
+		SendLine(pConn, "ERR bad list\n");
+		pConn->eState = RDone;
+		return true;
+	}
+
+	// 缺少的块按连续区间回复; 同一文件中重复的块只要一次
+	std::unordered_set<std::string> setNeed;
+	int64_t nNeed = 0;
+	size_t nRuns = 0;
+	std::string strRuns;
+	for (size_t i = 0; i < manifest.vChunks.size(); i++) {
+		const YondChunkRef& ref = manifest.vChunks[i];
+		if (m_store.HasChunk(ref.strHash) || !setNeed.insert(ref.strHash).second) {
+			continue;
+		}
+		if (pConn->vNeed.empty() || pConn->vNeed.back() != i - 1) {
+			if (!pConn->vNeed.empty()) {
+				strRuns += " " + std::to_string(pConn->vNeed.back() + 1 - nRuns) + "\n";
+			}
+			strRuns += std::to_string(i);
+			nRuns = i;
+		}
+		pConn->vNeed.push_back(i);
+		nNeed += ref.nLen;
+	}
+	if (!pConn->vNeed.empty()) {
+		strRuns += " " + std::to_string(pConn->vNeed.back() + 1 - nRuns) + "\n";
+	}
+	// 缺的块登记为待收, PUT连接只能上传这些块; 总量超限时整个PUSH拒绝
+	int64_t nAdd = 0;
+	for (size_t i : pConn->vNeed) {
+		if (!m_mapWanted.count(manifest.vChunks[i].strHash)) nAdd += manifest.vChunks[i].nLen;
+	}
+	if (m_nWantedBytes + nAdd > RELAY_WANT_MAX) {
+		LOG_WARNINGF("File relay refused push of %s: %lld bytes already awaited", pConn->strName.c_str(), (long long)m_nWantedBytes);
+		SendLine(pConn, "ERR quota\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	time_t tExpire = time(NULL) + RELAY_WANT_SEC;
+	for (size_t i : pConn->vNeed) {
+		const YondChunkRef& ref = manifest.vChunks[i];
+		auto ret = m_mapWanted.emplace(ref.strHash, WantedChunk{ ref.nLen, tExpire });
+		ret.first->second.tExpire = tExpire;
+	}
+	m_nWantedBytes += nAdd;
+	size_t nRunCount = (size_t)std::count(strRuns.begin(), strRuns.end(), '\n');
+	pConn->nSize = nNeed;
+	pConn->nDone = pConn->nAcked = 0;
+	pConn->nNeedPos = 0;
+	pConn->eState = RChunks;
+	LOG_INFOF("File relay receiving %s by chunks: %zu of %zu chunks, %lld of %lld bytes missing",
+		pConn->strName.c_str(), pConn->vNeed.size(), manifest.vChunks.size(), (long long)nNeed, (long long)manifest.nSize);
+	return SendLine(pConn, "NEED " + std::to_string(nRunCount) + "\n" + strRuns);
+}
+
+bool CYondFileRelay::StoreChunks(RelayConn* pConn) {
+	YondManifest& manifest = pConn->manifest;
+	size_t nPos = 0;
+	while (pConn->nNeedPos < pConn->vNeed.size()) {
+		const YondChunkRef& ref = manifest.vChunks[pConn->vNeed[pConn->nNeedPos]];
+		if (pConn->strIn.size() - nPos < ref.nLen) {
+			break;
+		}
+		if (!m_store.PutChunk(ref.strHash, pConn->strIn.data() + nPos, ref.nLen)) {
+			SendLine(pConn, "ERR bad chunk\n");
+			pConn->eState = RDone;
+			pConn->strIn.clear();
+			return true;
+		}
+		Unwant(ref.strHash);
+		nPos += ref.nLen;
+		pConn->nDone += ref.nLen;
+		pConn->nNeedPos++;
+	}
+	pConn->strIn.erase(0, nPos);
+	if (pConn->nNeedPos < pConn->vNeed.size()) {
+		return true;
+	}
+	if (!m_store.SaveManifest(pConn->strName, manifest)) {
+		SendLine(pConn, "ERR cannot store\n");
+		pConn->eState = RDone;
+		return true;
+	}
+	// 存储之前发布的同名整文件已被清单取代
+	unlink(FilePath(pConn->strName).c_str());
+	pConn->eState = RDone;
+	LOG_INFOF("File relay stored %s (%lld bytes, %lld new)", pConn->strName.c_str(),
+		(long long)manifest.nSize, (long long)pConn->nSize);
+	return true;
+}
+
+bool CYondFileRelay::BeginPut(RelayConn* pConn, size_t nCount) {
+	pConn->nListLeft = nCount;
+	pConn->put.nLen = 0;
+	pConn->nDone = pConn->nAcked = 0;
+	pConn->eState = RPut;
+	return true;
+}
+
+bool CYondFileRelay::StorePut(RelayConn* pConn) {
+	size_t nPos = 0;
+	bool bOk = true;
+	while (pConn->nListLeft > 0) {
+		if (pConn->put.nLen == 0) {
+			size_t nEnd = pConn->strIn.find('\n', nPos);
+			if (nEnd == std::string::npos) {
+				bOk = pConn->strIn.size() - nPos <= RELAY_HEAD_MAX;
+				break;
+			}
+			std::string strLine = pConn->strIn.substr(nPos, nEnd - nPos);
+			nPos = nEnd + 1;
+			size_t nSp = strLine.find(' ');
+			int64_t nLen = 0;
+			bOk = nSp != std::string::npos && CYondChunkStore::ValidHash(strLine.substr(0, nSp)) &&
+				ParseOffset(strLine.substr(nSp + 1), nLen) && nLen > 0 && nLen <= YOND_CDC_MAX;
+			if (!bOk) break;
+			std::string strHash = strLine.substr(0, nSp);
+			// 只收NEED要过的块; 别的连接刚传过的块内容已在库中, 照常收下丢弃
+			auto it = m_mapWanted.find(strHash);
+			if ((it == m_mapWanted.end() || it->second.nLen != (uint32_t)nLen) && !m_store.HasChunk(strHash)) {
+				LOG_WARNING("File relay PUT of unrequested chunk " + strHash);
+				SendLine(pConn, "ERR not needed\n");
+				pConn->eState = RDone;
+				pConn->strIn.clear();
+				return true;
+			}
+			if (pConn->nPutBytes + nLen > RELAY_PUT_CONN_MAX) {
+				LOG_WARNINGF("File relay PUT quota exceeded after %lld bytes", (long long)pConn->nPutBytes);
+				SendLine(pConn, "ERR quota\n");
+				pConn->eState = RDone;
+				pConn->strIn.clear();
+				return true;
+			}
+			pConn->put = YondChunkRef{ strHash, (uint32_t)nLen };
+		}
+		if (pConn->strIn.size() - nPos < pConn->put.nLen) {
+			break;
+		}
+		if (!m_store.PutChunk(pConn->put.strHash, pConn->strIn.data() + nPos, pConn->put.nLen)) {
+			SendLine(pConn, "ERR bad chunk\n");
+			pConn->eState = RDone;
+			pConn->strIn.clear();
+			return true;
+		}
+		Unwant(pConn->put.strHash);
+		nPos += pConn->put.nLen;
+		pConn->nDone += pConn->put.nLen;
+		pConn->nPutBytes += pConn->put.nLen;
+		pConn->put.nLen = 0;
+		pConn->nListLeft--;
+	}
+	pConn->strIn.erase(0, nPos);
+	// 下一个请求要等最后的ACP之后才能发, 缓冲中不应还有数据
+	if (!bOk || (pConn->nListLeft == 0 && !pConn->strIn.empty())) {
+		LOG_WARNING("Malformed chunk record in file relay PUT");
+		SendLine(pConn, "ERR bad request\n");
+		pConn->eState = RDone;
+		pConn->strIn.clear();
+		return true;
+	}
+	if (pConn->nListLeft == 0) {
+		pConn->eState = RHead;
+	}
+	return true;
+}
+
+bool CYondFileRelay::SaveChunks(RelayConn* pConn) {
+	std::pair<size_t, size_t> range = pConn->chunks.MarkRange(pConn->nMarked, pConn->nDone);
+	if (range.first == range.second) {
+		return true;
+	}
+	std::string strDone(range.second - range.first, '1');
+	off_t off = (off_t)(pConn->chunks.HeaderSize() + range.first);
+	if (pwrite(pConn->nIdx, strDone.data(), strDone.size(), off) != (ssize_t)strDone.size()) {
+		LOG_ERROR(YOND_ERR_FILE_IO, "Failed to record chunks of " + pConn->strName);
+		return false;
+	}
+	pConn->nMarked = pConn->chunks.Offset(range.second);
+	return true;
+}
+
+void CYondFileRelay::Sweep() {
+	DIR* pDir = opendir(m_strSpool.c_str());
+	if (pDir == NULL) {
+		return;
+	}
+	time_t tNow = time(NULL);
+	while (struct dirent* pEnt = readdir(pDir)) {
+		std::string strFile = pEnt->d_name;
+		std::string strName;
+		if (strFile.size() > 9 && strFile.compare(strFile.size() - 9, 9, ".part.idx") == 0) {
+			strName = strFile.substr(0, strFile.size() - 9);
+		}
+		else if (strFile.size() > 5 && strFile.compare(strFile.size() - 5, 5, ".part") == 0) {
+			strName = strFile.substr(0, strFile.size() - 5);
+		}
+		else {
+			continue;
+		}
+		std::string strPath = m_strSpool + "/" + strFile;
+		struct stat st;
+		if (m_setUploading.count(strName) || stat(strPath.c_str(), &st) != 0 ||
+			tNow - st.st_mtime < (time_t)m_nKeepSec) {
+			continue;
+		}
+		unlink(strPath.c_str());
+		LOG_INFO("File relay dropped expired partial upload " + strFile);
+	}
+	closedir(pDir);
+
+	for (auto it = m_mapWanted.begin(); it != m_mapWanted.end(); ) {
+		if (it->second.tExpire > tNow) {
+			++it;
+			continue;
+		}
+		m_nWantedBytes -= it->second.nLen;
+		it = m_mapWanted.erase(it);
+	}
+}
+
+void CYondFileRelay::Unwant(const std::string& strHash) {
+	auto it = m_mapWanted.find(strHash);
+	if (it != m_mapWanted.end()) {
+		m_nWantedBytes -= it->second.nLen;
+		m_mapWanted.erase(it);
+	}
+}
+
+void CYondFileRelay::MarkReady(RelayConn* pConn) {
+	if (!pConn->bReady) {
+		pConn->bReady = true;
+		m_vReady.push_back(pConn->nFd);
+	}
+}
+
+bool CYondFileRelay::SendLine(RelayConn* pConn, const std::string& strLine) {
+	bool bIdle = pConn->strOut.empty();
+	pConn->strOut += strLine;
+	return bIdle ? FlushLine(pConn) : true;
+}
+
+bool CYondFileRelay::FlushLine(RelayConn* pConn) {
+	while (!pConn->strOut.empty()) {
+		int flags = MSG_NOSIGNAL | (pConn->eState == RDownload && pConn->nDone < pConn->nEnd ? MSG_MORE : 0);
+		ssize_t n = send(pConn->nFd, pConn->strOut.data(), pConn->strOut.size(), flags);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+			return false;
+		}
+		pConn->strOut.erase(0, (size_t)n);
+	}
+	return true;
+}
+
+void CYondFileRelay::Close(RelayConn* pConn) {
+	m_mapConns.erase(pConn->nFd);
+	close(pConn->nFd);
+	if (pConn->nFile >= 0) close(pConn->nFile);
+	if (pConn->nPipe[0] >= 0) close(pConn->nPipe[0]);
+	if (pConn->nPipe[1] >= 0) close(pConn->nPipe[1]);
+	if (pConn->nIdx >= 0) close(pConn->nIdx);
+	// 没收齐的上传不发布, 保留暂存文件和块表等待续传, 由Sweep过期删除
+	if (pConn->eState == RUpload) {
+		m_setUploading.erase(pConn->strName);
+		if (m_nKeepSec == 0) {
+			unlink(PartPath(pConn->strName).c_str());
+			unlink(IdxPath(pConn->strName).c_str());
+		}
+	}
+	delete pConn;
+}
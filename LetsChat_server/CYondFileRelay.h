@@ -0,0 +1,183 @@
+#pragma once
+#include <sys/epoll.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <ctime>
+#include "CYondLog.h"
+#include "CYondThreadPool.h"
+#include "CYondOpt.h"
+#include "../LetsChat_common/CYondChunkMap.h"
+#include "CYondChunkStore.h"
+
+#define RELAY_MAX_EVENTS 64
+#define RELAY_HEAD_MAX 1024					// 握手行的长度上限
+#define RELAY_PIPE_SIZE (1024 * 1024)		// 上传连接中转管道的容量
+#define RELAY_QUANTUM (4 * 1024 * 1024)		// 每个连接每轮最多搬运的字节数, 用完让给其他连接
+#define RELAY_SWEEP_SEC 60					// 清理过期暂存文件的间隔
+#define RELAY_READ_SIZE (64 * 1024)			// 块清单和块内容每次recv的长度
+#define RELAY_PUT_MAX 65536					// 一次PUT最多带的块数
+#define RELAY_LIST_MAX (256 * 1024)			// 一次PUSH清单最多的块数, 默认上传上限按切块下限切开也不超过
+#define RELAY_WANT_SEC 3600					// NEED列出的块多久之内可以用PUT上传
+#define RELAY_WANT_MAX (16LL * 1024 * 1024 * 1024)	// 所有NEED列出、还没收到的块的总字节上限
+#define RELAY_PUT_CONN_MAX (4LL * 1024 * 1024 * 1024)	// 单个连接经PUT累计上传的字节上限
+
+// 文件中转连接的阶段
+enum YondRelayState
+{
+	RHead,		// 等待握手行
+	RUpload,	// 接收文件内容
+	RIngest,	// 已收齐, 等线程池切块入库后再回最后的ACP
+	RList,		// 接收PUSH的块清单
+	RChunks,	// 接收服务端缺少的块
+	RPut,		// 接收PUT带来的块
+	RDownload,	// 发送文件内容
+	RDone		// 传输结束, 等对端关闭
+};
+
+// 文件中转服务: 独立的监听端口和epoll线程, 与聊天循环互不阻塞.
+// 握手为一行文本:
+//   上传 "FILE <name> <size>\n", 服务端回 "ACP <已收字节>\n" 作为累计确认, 收齐后再回一次总长度.
+//     size超过nUploadMax时回 "ERR too large\n"
+//     同名同大小的暂存文件还在时第一个ACP是第一个未完成块的偏移, 客户端从那里续传
+//   下载 "REQ <name>\n", 服务端回 "FILE <name> <size>\n" 后紧跟文件内容, 不存在时回 "ERR <原因>\n"
+//   区间下载 "GET <name> <offset> <len>\n", len为0表示到文件末尾,
+//     服务端回 "RANGE <name> <size> <offset> <len>\n" 后紧跟这一段内容
+//   按块上传 "PUSH <name> <size> <count>\n" 后跟count行 "<sha256> <len>\n"(按CYondCdc切块),
+//     size超过nUploadMax或count超过RELAY_LIST_MAX时回 "ERR too large\n",
+//     服务端回 "NEED <runs>\n" 后跟runs行 "<first> <count>\n" 列出缺少的块, 客户端按顺序只发这些块,
+//     服务端回 "ACP <已收字节>\n" 累计确认, 字节数只算缺少的块. 所有待收的块超过RELAY_WANT_MAX字节时回 "ERR quota\n"
+//   单独传块 "PUT <count>\n" 后跟count段 "<sha256> <len>\n<内容>", 服务端逐块校验入库并回 "ACP <已收字节>\n".
+//     只收RELAY_WANT_SEC秒内某次NEED列出的块, 其他块回 "ERR not needed\n";
+//     一个连接累计超过RELAY_PUT_CONN_MAX字节回 "ERR quota\n"
+//     大文件可以在NEED之后断开PUSH连接, 把缺的块分给多条PUT连接并行上传, 最后再PUSH一次写清单
+// GET和PUT完成后连接回到等待握手的状态, 客户端收到最后的数据或ACP后可以在同一连接上发下一个请求.
+// 上传经管道splice进暂存文件, 收齐后在线程池上切块存进CYondChunkStore, 入库完成才回最后的ACP;
+// 下载从清单对应的块文件sendfile.
+// 暂存文件旁的.idx记录已写完的块(见CYondChunkMap), 断开后保留nPartKeepSec秒等待续传
+class CYondFileRelay
+{
+public:
+	CYondFileRelay() : m_nSockFd(-1), m_nEpollFd(-1), m_nWakeFd(-1), m_bStop(true), m_nKeepSec(0), m_nUploadMax(0), m_tSwept(0),
+		m_nWantedBytes(0), m_pPool(nullptr), m_nIngesting(0) {}
+	~CYondFileRelay() {
+		Stop();
+	}
+
+	// opt.nFilePort为0时不启动. 收齐的文件在pPool上切块入库, pPool为nullptr时在中转线程上做
+	int Start(const YondServerOpt& opt, CYondThreadPool* pPool);
+	int Stop();
+
+	// 线程安全: 暂存目录中是否有已收齐的文件
+	bool Has(const std::string& strName) const;
+
+	// 只保留文件名部分, 不合法时返回空串
+	static std::string SafeName(const std::string& strName);
+
+private:
+	struct RelayConn
+	{
+		int nFd;
+		YondRelayState eState;
+		int nFile;
+		int nPipe[2];
+		size_t nPiped;		// 已进管道、尚未写进文件的字节
+		int64_t nSize;
+		int64_t nDone;		// 已写进文件或已发出到的偏移
+		int64_t nEnd;		// 下载区间的结束偏移
+		int64_t nMarked;	// 块表已记录到的偏移
+		int nIdx;			// 上传块表文件
+		CYondChunkMap chunks;
+		bool bStored;		// 下载的文件在块存储中, nFile为当前块
+		size_t nPart;		// nFile对应的清单块下标
+		YondManifest manifest;	// 下载或PUSH的文件清单
+		size_t nListLeft;	// 块清单还差的行数
+		std::vector<size_t> vNeed;	// PUSH中服务端缺少的块下标, 按发送顺序
+		size_t nNeedPos;	// 下一个要收的vNeed下标
+		YondChunkRef put;	// PUT中正在收的块, nLen为0时等下一行
+		int64_t nPutBytes;	// 本连接各次PUT累计收下的字节
+		std::string strIn;	// 块清单或块内容的接收缓冲
+		int64_t nAcked;		// 上次确认的字节数
+		bool bReady;		// 配额用完时仍可读写, 下一轮接着处理
+		std::string strName;
+		std::string strOut;	// 待发的控制行
+	};
+
+	// NEED列出、还没收到的块
+	struct WantedChunk
+	{
+		uint32_t nLen;
+		time_t tExpire;
+	};
+
+	// 线程池上入库完成的上传
+	struct IngestDone
+	{
+		int nFd;
+		std::string strName;
+		bool bOk;
+	};
+
+	int Loop();
+	void AcceptAll();
+	void OnEvent(RelayConn* pConn, uint32_t events);
+	// 返回false表示连接应被关闭
+	bool ReadHead(RelayConn* pConn);
+	bool BeginUpload(RelayConn* pConn, const std::string& strName, int64_t nSize);
+	bool BeginPush(RelayConn* pConn, const std::string& strName, int64_t nSize, size_t nCount);
+	bool PumpPush(RelayConn* pConn);
+	// 解析已收到的清单行, 收齐后回NEED; 返回false表示清单不合法
+	bool ParseList(RelayConn* pConn);
+	// 存下缓冲中完整的块, 全部收齐后写清单
+	bool StoreChunks(RelayConn* pConn);
+	bool BeginPut(RelayConn* pConn, size_t nCount);
+	// 解析并存下缓冲中完整的PUT块, 收齐后回到RHead
+	bool StorePut(RelayConn* pConn);
+	// bRange为false时按老的REQ回"FILE"头, 否则回"RANGE"头
+	bool BeginDownload(RelayConn* pConn, const std::string& strName, int64_t nOffset, int64_t nLen, bool bRange);
+	bool PumpUpload(RelayConn* pConn);
+	// 把收齐的暂存文件交给线程池入库, 连接进入RIngest
+	void StartIngest(RelayConn* pConn);
+	// 处理线程池送回的入库结果: 回最后的ACP, 放开同名上传
+	void FinishIngests();
+	bool PumpDownload(RelayConn* pConn);
+	// 把新写完的块记进块表文件
+	bool SaveChunks(RelayConn* pConn);
+	// 删除超过保留时间、没有连接在写的暂存文件, 以及过期的待收块
+	void Sweep();
+	// 块已入库, 不再等它
+	void Unwant(const std::string& strHash);
+	void MarkReady(RelayConn* pConn);
+	// 发送控制行, 发不完的留到可写时
+	bool SendLine(RelayConn* pConn, const std::string& strLine);
+	bool FlushLine(RelayConn* pConn);
+	void Close(RelayConn* pConn);
+
+	std::string PartPath(const std::string& strName) const { return m_strSpool + "/" + strName + ".part"; }
+	std::string FilePath(const std::string& strName) const { return m_strSpool + "/" + strName; }
+	std::string IdxPath(const std::string& strName) const { return PartPath(strName) + ".idx"; }
+
+	int m_nSockFd;
+	int m_nEpollFd;
+	int m_nWakeFd;
+	std::atomic<bool> m_bStop;
+	std::string m_strSpool;
+	CYondChunkStore m_store;
+	unsigned m_nKeepSec;
+	int64_t m_nUploadMax;
+	time_t m_tSwept;
+	CYondThread m_thread;
+	std::unordered_map<int, RelayConn*> m_mapConns;	// 只由中转线程访问
+	std::vector<int> m_vReady;	// 边沿触发下不会再通知, 需要主动续上的连接
+	std::unordered_set<std::string> m_setUploading;	// 正在上传或入库的文件名, 同名的第二个上传被拒绝
+	std::unordered_map<std::string, WantedChunk> m_mapWanted;	// 按哈希索引, PUT只收其中的块
+	int64_t m_nWantedBytes;	// m_mapWanted中块的总字节
+
+	CYondThreadPool* m_pPool;
+	std::mutex m_ingestLock;
+	std::vector<IngestDone> m_vIngested;	// 由中转线程经m_nWakeFd唤醒后取走
+	std::atomic<int> m_nIngesting;	// 已交给线程池、还没送回结果的入库任务数
+};
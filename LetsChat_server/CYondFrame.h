@@ -0,0 +1,87 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include "CYondPack.h"
+
+class CYondFrame;
+typedef std::shared_ptr<const CYondFrame> CYondFramePtr;
+
+// 编码完成后只读的帧缓冲, 一次广播的所有接收者共享同一份引用计数的缓冲,
+// 发送时直接把它交给sendmsg, 不再按接收者复制.
+// Make编出的是v1字节和帧, 发给协商了其他格式的连接时用As取对应的编码, 首次用到才编码, 之后共享
+class CYondFrame
+{
+public:
+	static CYondFramePtr Make(YondCmd sCmd, const char* pData, size_t nData, unsigned short sUser = 0) {
+		std::shared_ptr<CYondFrame> frame(new CYondFrame(CYondPack::FrameSize(nData), sCmd, sUser, YOND_FRAME_HEAD, nData));
+		CYondPack::Encode(frame->m_pBuf.get(), sCmd, sUser, pData, nData);
+		return frame;
+	}
+
+	// 把多条消息按顺序合成一个v2 YBatch帧
+	static CYondFramePtr MakeBatch(const std::vector<const CYondFrame*>& vItems, bool bCrc) {
+		size_t nBody = 0;
+		for (const CYondFrame* pItem : vItems) {
+			nBody += CYondCodec::BatchEntrySize(pItem->BodySize(), pItem->User() != 0);
+		}
+		size_t nHead = CYondCodec::HeadSizeV2(nBody, false);
+		std::shared_ptr<CYondFrame> frame(new CYondFrame(CYondCodec::FrameSizeV2(nBody, false, bCrc), YBatch, 0, nHead, nBody));
+		char* p = frame->m_pBuf.get();
+		CYondCodec::PutHeadV2(p, YBatch, 0, nBody, bCrc);
+		size_t n = nHead;
+		for (const CYondFrame* pItem : vItems) {
+			n += CYondCodec::PutBatchEntry(p + n, pItem->m_sCmd, pItem->m_sUser, pItem->Body(), pItem->BodySize());
+		}
+		CYondCodec::Seal(p, nHead, nBody, bCrc);
+		return frame;
+	}
+
+	// 同一内容按nWire格式编码的帧, nWire为0时就是frame本身. 多个循环线程可能同时首次调用
+	static const CYondFramePtr& As(const CYondFramePtr& frame, unsigned nWire) {
+		if (nWire == 0) {
+			return frame;
+		}
+		const CYondFrame* pSelf = frame.get();
+		std::call_once(pSelf->m_once[nWire], [pSelf, nWire]() {
+			bool bCrc = (nWire & YOND_WIRE_CRC) != 0;
+			size_t nBody = pSelf->BodySize();
+			std::shared_ptr<CYondFrame> variant;
+			if (nWire & YOND_WIRE_V2) {
+				variant.reset(new CYondFrame(CYondCodec::FrameSizeV2(nBody, pSelf->m_sUser != 0, bCrc), pSelf->m_sCmd,
+					pSelf->m_sUser, CYondCodec::HeadSizeV2(nBody, pSelf->m_sUser != 0), nBody));
+				CYondCodec::EncodeV2(variant->m_pBuf.get(), variant->m_nSize, pSelf->m_sCmd, pSelf->m_sUser,
+					pSelf->Body(), nBody, bCrc);
+			}
+			else {
+				variant.reset(new CYondFrame(CYondPack::FrameSize(nBody, bCrc), pSelf->m_sCmd, pSelf->m_sUser, YOND_FRAME_HEAD, nBody));
+				CYondPack::Encode(variant->m_pBuf.get(), (YondCmd)pSelf->m_sCmd, pSelf->m_sUser, pSelf->Body(), nBody, bCrc);
+			}
+			pSelf->m_vVariant[nWire] = variant;
+		});
+		return pSelf->m_vVariant[nWire];
+	}
+
+	const char* Data() const { return m_pBuf.get(); }
+	size_t Size() const { return m_nSize; }
+	const char* Body() const { return m_pBuf.get() + m_nBody; }
+	size_t BodySize() const { return m_nBodySize; }
+	unsigned Cmd() const { return m_sCmd; }
+	unsigned short User() const { return m_sUser; }
+
+private:
+	CYondFrame(size_t nSize, unsigned sCmd, unsigned short sUser, size_t nBody, size_t nBodySize)
+		: m_pBuf(new char[nSize]), m_nSize(nSize), m_sCmd(sCmd), m_sUser(sUser), m_nBody(nBody), m_nBodySize(nBodySize) {}
+	CYondFrame(const CYondFrame&) = delete;
+	CYondFrame& operator=(const CYondFrame&) = delete;
+
+	std::unique_ptr<char[]> m_pBuf;
+	size_t m_nSize;
+	unsigned m_sCmd;
+	unsigned short m_sUser;
+	size_t m_nBody;		// 负载相对帧头的偏移
+	size_t m_nBodySize;
+	mutable std::once_flag m_once[YOND_WIRE_MODES];
+	mutable CYondFramePtr m_vVariant[YOND_WIRE_MODES];
+};
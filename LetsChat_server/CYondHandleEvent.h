@@ -1,130 +1,205 @@
 #pragma once
-#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <string>
-#include <map>
+#include <errno.h>
+#include <vector>
+#include <atomic>
 #include "CYondThreadPool.h"
+#include "CYondReactor.h"
+#include "CYondConn.h"
+#include "CYondConnRegistry.h"
 #include "CYondLog.h"
 #include <arpa/inet.h>
 #include "CYondPack.h"
+#include "CYondPayload.h"
+#include "CYondFileRelay.h"
 #include <iostream>
 
+// 输入缓冲中未解析字节的上限: 解帧后只剩半帧, 超过最大帧长说明对端在乱发
+#define YOND_IN_MAX CYondCodec::FrameSize(YOND_MAX_FRAME, true)
+
+// 交给工作线程的一条消息, 负载放在池化块中按引用传递
+struct YondMsg
+{
+	YondCmd sCmd;
+	unsigned short sUser;
+	CYondPayload data;
+};
+
 class CYondHandleEvent
 {
 public:
-	CYondHandleEvent() : m_threadPool() {
-		LOG_INFO("Thread pool initialized with 4 worker threads");
-	}
+	CYondHandleEvent() : m_pFileRelay(nullptr) {}
 
-	int addNew(epoll_event* epEvt, int epollFd) {
-		struct sockaddr_in clientAddr;
-		socklen_t clientLen = sizeof(clientAddr);
-		int clientFd = accept(epEvt->data.fd, (struct sockaddr*)&clientAddr, &clientLen);
-		//LOG_INFO("accept a new client!");
-		if (clientFd < 0) {
-			return LOG_ERROR(YOND_ERR_SOCKET_ACCEPT, "Failed to accept new connection");
+	// 启动前由CChatServer按启动参数创建线程池
+	void Init(const YondServerOpt& opt) {
+		if (!m_pThreadPool) {
+			m_pThreadPool.reset(new CYondThreadPool(6, opt.ePool));
 		}
+	}
 
-		// 将新客户端添加到epoll
-		struct epoll_event ev;
-		ev.events = EPOLLIN;
-		ev.data.fd = clientFd;
-		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &ev) < 0) {
-			close(clientFd);
-			return LOG_ERROR(YOND_ERR_EPOLL_CTL, "Failed to add client to epoll");
-		}
+	CYondThreadPool* ThreadPool() const { return m_pThreadPool.get(); }
 
-		return 0;
+	// 停止服务时由CChatServer在删除事件循环之前调用: 线程池析构时先执行完排队的任务再结束工作线程,
+	// 返回后不再有广播读m_vReactors或向事件循环投递. 再次Init会重建线程池
+	void StopPool() {
+		m_pThreadPool.reset();
 	}
 
-	int HandleEvent(epoll_event* events) {
-		char buffer[2048];
-		size_t n = recv(events->data.fd, buffer, sizeof(buffer), 0);
+	// 线程池或该连接的strand积压过多时返回true, 事件循环应暂停读取该连接
+	bool Busy(const CYondConn* pConn) const {
+		return m_pThreadPool->Backlogged() || (pConn->m_pStrand && pConn->m_pStrand->Pending() >= STRAND_PAUSE_MARK);
+	}
 
-		if (n <= 0) {
-			// 客户端断开连接
-			LOG_INFO("Client disconnected: " + m_clientFdToIp[events->data.fd]);
-			close(events->data.fd);
-			m_clientFdToIp.erase(events->data.fd);
+	// 由所属事件循环线程在连接输入缓冲追加数据后调用, 把所有完整帧交给线程池,
+	// 剩余的半帧留在缓冲中. 同一连接的帧经由其strand按收到的顺序处理.
+	// 剩余字节超过YOND_IN_MAX时返回错误码, 调用方应关闭连接
+	int HandleEvent(CYondReactor*, CYondConn* pConn) {
+		if (!pConn->InReady()) {
 			return 0;
 		}
+		LOG_HEXDUMP("Received raw data", pConn->InData(), pConn->InSize());
+		pConn->InWant(0);
+		size_t nPos = 0;
+		while (nPos < pConn->InSize()) {
+			CYondPackView view;
+			size_t nUsed = 0;
+			int ret = view.Decode(pConn->InData() + nPos, pConn->InSize() - nPos, nUsed);
+			nPos += nUsed;
+			if (ret == YDecodeMore) {
+				pConn->InWant(view.Want());
+				break;
+			}
+			if (ret == YDecodeBad) continue;
+			pConn->m_nWire |= view.Wire();
+
+			// 视图直接读输入缓冲, 只有要交给工作线程的负载才复制
+			std::string_view body = view.Body();
+			if (view.Cmd() != YBatch) {
+				PostMessage(pConn, view.Cmd(), view.User(), body);
+				continue;
+			}
+			// 批量帧拆开后逐条按原顺序处理, 条目不完整时丢弃剩余部分
+			size_t nEntry = 0;
+			YondBatchEntry entry;
+			int nNext;
+			while ((nNext = CYondCodec::NextBatchEntry(body.data(), body.size(), nEntry, entry)) == YDecodeFrame) {
+				PostMessage(pConn, (YondCmd)entry.sCmd, (unsigned short)entry.sUser, body.substr(entry.nBody, entry.nBodySize));
+			}
+			if (nNext == YDecodeBad) {
+				LOG_ERROR(YOND_ERR_RECV_PACKET, "Malformed batch frame from " + pConn->Name());
+			}
+		}
+		pConn->InConsume(nPos);
+		if (pConn->InSize() > YOND_IN_MAX) {
+			return LOG_ERROR(YOND_ERR_RECV_PACKET, "Unparsed input from " + pConn->Name() + " exceeds the frame limit");
+		}
+		return 0;
+	}
 
-		// 将消息处理任务提交到线程池
-		m_threadPool.Enqueue([this, fd = events->data.fd, data = std::string(buffer, n)]() {
-			ProcessMessage(fd, data);
-		});
+	// 所有循环共享的连接表, 工作线程通过它找到连接所属的循环
+	CYondConnRegistry& Registry() { return m_registry; }
 
-		return 0;
+	// 启动前和StopPool之后由CChatServer设置, 其间只读
+	void SetReactors(const std::vector<CYondReactor*>& vReactors) {
+		m_vReactors = vReactors;
+	}
+
+	// 由CChatServer在启动和停止时设置, 文件中转没有启动时为nullptr; 工作线程随时可能在读
+	void SetFileRelay(CYondFileRelay* pFileRelay) {
+		m_pFileRelay.store(pFileRelay, std::memory_order_release);
 	}
 
 private:
-	void ProcessMessage(int clientFd, const std::string& data) {
-		CYondPack msg;
-		size_t size = data.size();
-		const unsigned char* pData = (const unsigned char*)(data.c_str());
-		msg = CYondPack(pData, size);
-
-		if (size == 0) {
-			LOG_ERROR(YOND_ERR_RECV_PACKET, "Invalid message format");
-			return;
+	// 将消息处理任务提交到连接的strand, 任务捕获内联存放, 负载复制到池化块后输入缓冲即可复用
+	void PostMessage(CYondConn* pConn, YondCmd sCmd, unsigned short sUser, std::string_view body) {
+		if (!pConn->m_pStrand) {
+			pConn->m_pStrand = std::make_shared<CYondStrand>(*m_pThreadPool);
 		}
+		YondMsg ymsg{ sCmd, sUser, CYondPayload::Copy(body.data(), body.size()) };
+		pConn->m_pStrand->Post([this, id = pConn->m_nId,
+			name = pConn->NamePtr(), ymsg = std::move(ymsg)]() {
+			ProcessMessage(id, *name, ymsg);
+		});
+	}
 
-		switch (msg.m_sCmd) {
-		case YConnect:
+	void ProcessMessage(YondConnId id, const std::string& strName, const YondMsg& msg) {
+		switch (msg.sCmd) {
+		case YConnect: {
 			// 处理连接请求
-			// 记录新客户端
-			m_clientFdToIp[clientFd] = msg.m_strData;
-			LOG_INFO("Client " + m_clientFdToIp[clientFd] + " connected" + " broad login msg!");
-			BroadCastToAll(clientFd, msg.m_strData, YConnect);
+			// 连接已断开(fd可能已被复用)时不再登记
+			CYondReactor* pOwner = m_registry.Owner(id);
+			if (pOwner == nullptr) break;
+			// 记录新客户端, 连接归属的循环先登记再收到广播
+			pOwner->Post([pOwner, id, name = msg.data.Str()]() {
+				pOwner->Login(id, name);
+			});
+			LOG_INFOF("Client %.*s connected broad login msg!", (int)msg.data.Size(), msg.data.Data());
+			BroadCastToAll(id, msg);
 			break;
+		}
 
 		case YMsg:
 			// 广播消息给所有客户端
-			if (!msg.m_strData.empty()) {
-				LOG_INFO("Broadcasting message from " + m_clientFdToIp[clientFd] + ": " + msg.m_strData);
-				BroadCastToAll(clientFd, msg.m_strData);
+			if (!msg.data.Empty()) {
+				LOG_INFOF("Broadcasting message from %s: %.*s", strName.c_str(), (int)msg.data.Size(), msg.data.Data());
+				BroadCastToAll(id, msg);
 			}
 			break;
 
 		case YFile:
-			// 处理文件传输请求
-			if (!msg.m_strData.empty()) {
-				LOG_INFO("File transfer request from " + m_clientFdToIp[clientFd] + ": " + msg.m_strData);
-				// TODO: 实现文件传输逻辑
+			// 文件通告"<文件名> <大小>", 内容由客户端另行上传到文件中转端口, 这里只转告其他人
+			if (!msg.data.Empty()) {
+				LOG_INFOF("File transfer request from %s: %.*s", strName.c_str(), (int)msg.data.Size(), msg.data.Data());
+				BroadCastToAll(id, msg);
 			}
 			break;
 
-		case YRecv:
-			// 处理文件接收请求
-			if (!msg.m_strData.empty()) {
-				LOG_INFO("File receive request from " + m_clientFdToIp[clientFd] + ": " + msg.m_strData);
-				// TODO: 实现文件接收逻辑
+		case YRecv: {
+			// 下载请求"<文件名> <发送者>": 中转处已收齐时原样回给请求者, 客户端收到后连文件中转端口下载
+			if (msg.data.Empty()) break;
+			LOG_INFOF("File receive request from %s: %.*s", strName.c_str(), (int)msg.data.Size(), msg.data.Data());
+			std::string strReq = msg.data.Str();
+			std::string strFile = strReq.substr(0, strReq.find(' '));
+			CYondFileRelay* pFileRelay = m_pFileRelay.load(std::memory_order_acquire);
+			if (pFileRelay == nullptr || !pFileRelay->Has(strFile)) {
+				LOG_WARNING("Requested file " + strFile + " is not available on the relay");
+				break;
 			}
+			CYondReactor* pOwner = m_registry.Owner(id);
+			if (pOwner == nullptr) break;
+			CYondFramePtr frame = CYondFrame::Make(YRecv, msg.data.Data(), msg.data.Size(), msg.sUser);
+			pOwner->Post([pOwner, id, frame]() {
+				pOwner->SendToOne(id, frame);
+			});
 			break;
+		}
 
 		default:
-			LOG_WARNING("Unknown message type: " + std::to_string(msg.m_sCmd));
+			LOG_WARNINGF("Unknown message type: %d", (int)msg.sCmd);
 		}
 	}
 
-	void BroadCastToAll(int senderFd, const std::string& message , YondCmd cmd = YMsg) {
-		CYondPack broadcastMsg(cmd, message.c_str(), message.size());
-		const char* data = broadcastMsg.Data().c_str();
-		size_t size = broadcastMsg.Size();
-
-		for (const auto& client : m_clientFdToIp) {
-			if (client.first != senderFd) {  // 不发送给发送者
-				if (send(client.first, data, size, 0) < 0) {
-					LOG_ERROR(YOND_ERR_SOCKET_SEND, "Failed to broadcast message to client " + client.second);
-				}
-			}
+	// 原样转发发送方帧头中的用户字段, 不为0时v2连接收到带用户的帧头或批量条目
+	void BroadCastToAll(YondConnId senderId, const YondMsg& msg) {
+		const CYondPayload& message = msg.data;
+		// 只编码一次, 各循环和各接收者的出站队列共享同一帧缓冲
+		CYondFramePtr frame = CYondFrame::Make(msg.sCmd, message.Data(), message.Size(), msg.sUser);
+
+		// 跨循环广播通过各循环的投递队列完成, 由拥有连接的线程执行send
+		for (CYondReactor* pReactor : m_vReactors) {
+			pReactor->Post([pReactor, senderId, frame]() {
+				pReactor->SendToClients(senderId, frame);
+			});
 		}
-		LOG_INFO("Broad msg:" + broadcastMsg.Data() + " | to all");
+		LOG_INFOF("Broad msg:%.*s | to all", (int)message.Size(), message.Data());
 	}
 
-	CYondThreadPool m_threadPool;
-	std::map<int, std::string> m_clientFdToIp; // 客户端fd到IP地址的映射
+	CYondConnRegistry m_registry;
+	std::unique_ptr<CYondThreadPool> m_pThreadPool;
+	std::vector<CYondReactor*> m_vReactors;
+	std::atomic<CYondFileRelay*> m_pFileRelay;
 };
 
@@ -9,6 +9,18 @@
 #include <filesystem>
 #include <unistd.h>
 #include <linux/limits.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <time.h>
+#include <string.h>
+#include <stdarg.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <condition_variable>
+#include <algorithm>
+#include "CYondLogCodec.h"
 //return CYondLog::log(CYondLog::LOG_LEVEL_ERROR, __FILE__, __LINE__, YOND_ERR_SOCKET_CREATE, "socket init error");
 #pragma once
 #ifndef _COMMON_ERROR_CODE_H_
@@ -29,6 +41,13 @@ const YondErrCode YOND_ERR_EPOLL_CTL = 2007; // Error adding or modifying epoll
 const YondErrCode YOND_ERR_EPOLL_WAIT = 2008; // Error waiting for epoll events
 
 const YondErrCode YOND_ERR_THREAD_CREATE = 2009; // Error creating thread
+const YondErrCode YOND_ERR_SOCKET_OPT = 2010; // Error setting socket option
+const YondErrCode YOND_ERR_URING_SETUP = 2011; // Error setting up io_uring
+const YondErrCode YOND_ERR_URING_ENTER = 2012; // Error submitting io_uring requests
+const YondErrCode YOND_ERR_CONN_LIMIT = 2013; // Connection table is full
+const YondErrCode YOND_ERR_FILE_OPEN = 2014; // Error opening spool file
+const YondErrCode YOND_ERR_FILE_IO = 2015; // Error relaying file data
+const YondErrCode YOND_ERR_CHUNK_STORE = 2016; // Error storing attachment chunk
 
 const YondErrCode YOND_ERR_RECV_PACKET = 2050;	//Error recv packet
 const YondErrCode YOND_ERR_PACKET_SUMCHECK = 2051;	//Error packet sumCheck
@@ -36,15 +55,54 @@ const YondErrCode ERR_LOG_THREAD_TASK = 2052;	//Error thread task
 
 #endif // !_COMMON_ERROR_CODE_H_
 
+#define LOG_RING_SIZE 1024		// 每个线程的异步日志环可容纳的记录数, 必须为2的幂
+#define LOG_RECORD_MSG 200		// 单条异步记录的消息长度上限, 超出部分截断
+#define LOG_BATCH_BYTES 65536	// 后台线程攒够该字节数或环已取空时写一次文件
+#define LOG_FORMAT_STACK 1024	// 同步模式格式化时先用栈缓冲, 超长才分配
+#define LOG_ROTATE_CHECK_MS 1000	// 轮转线程检查日期的间隔
+
+// 编译期日志级别: 低于它的日志调用连同参数求值一起被编译器删除.
+// 0=TRACE 1=INFO 2=WARNING 3=ERROR, 默认调试构建保留TRACE, 发布构建从INFO开始
+#ifndef YOND_LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define YOND_LOG_COMPILE_LEVEL 1
+#else
+#define YOND_LOG_COMPILE_LEVEL 0
+#endif
+#endif
+
+// 异步日志环满时的处理方式
+enum YondLogOverflow
+{
+	YLogBlock,	// 生产者等待后台线程腾出空间
+	YLogDrop	// 丢弃并计数, 由后台线程定期报告
+};
+
+struct YondLogOpt;
+
 class CYondLog
 {
 public:
 	enum LogLevel {
+		LOG_LEVEL_TRACE,	// 调试跟踪通道, 如收发数据的十六进制转储
 		LOG_LEVEL_INFO,
 		LOG_LEVEL_WARNING,
 		LOG_LEVEL_ERROR
 	};
 
+	static constexpr LogLevel COMPILE_LEVEL = (LogLevel)YOND_LOG_COMPILE_LEVEL;
+
+	// 在Initialize之后调用, 切换同步/异步模式、运行期级别和控制台输出
+	static void Configure(const YondLogOpt& opt);
+
+	// 运行期级别检查, 宏在求值消息参数之前调用
+	static bool Enabled(LogLevel level) {
+		return level >= m_nLevel.load(std::memory_order_relaxed);
+	}
+
+	// 异步模式下因环满被丢弃的记录数
+	static uint64_t Dropped() { return m_nDropped.load(std::memory_order_relaxed); }
+
 	static bool Initialize(const std::string& logDir = "logs") {
 		static std::mutex initMutex;
 		std::lock_guard<std::mutex> lock(initMutex);
@@ -72,21 +130,22 @@ public:
 			// 创建日志目录
 			std::filesystem::create_directories(logDirPath);
 			
-			// 生成日志文件名（使用当前日期）
-			auto now = std::chrono::system_clock::now();
-			auto time = std::chrono::system_clock::to_time_t(now);
-			std::stringstream ss;
-			ss << logDirPath.string() << "/chat_server_" 
-			   << std::put_time(std::localtime(&time), "%Y%m%d") << ".log";
-			
-			m_logFile.open(ss.str(), std::ios::app);
+			// 生成日志文件名（使用当前日期）, 之后由轮转线程按日期和大小切换
+			m_strLogDir = logDirPath.string();
+			m_strDate = Today();
+			m_nSeq = 0;
+			m_strLogPath = LogPath(m_strDate, m_nSeq, ".log");
+			m_logFile.open(m_strLogPath, std::ios::app);
 			if (!m_logFile.is_open()) {
-				printf("Failed to open log file: %s\n", ss.str().c_str());
+				printf("Failed to open log file: %s\n", m_strLogPath.c_str());
 				return false;
 			}
+			std::error_code ec;
+			uintmax_t nSize = std::filesystem::file_size(m_strLogPath, ec);
+			m_nFileBytes = ec ? 0 : (uint64_t)nSize;
 
 			// 记录日志文件路径
-			printf("Log file created at: %s\n", ss.str().c_str());
+			printf("Log file created at: %s\n", m_strLogPath.c_str());
 			m_initialized = true;
 			return true;
 		} catch (const std::exception& e) {
@@ -96,9 +155,15 @@ public:
 	}
 
 	static void Shutdown() {
+		StopRotator();
+		StopWriter();
 		if (m_logFile.is_open()) {
 			m_logFile.close();
 		}
+		m_bBinary = false;
+		if (m_binFile.is_open()) {
+			m_binFile.close();
+		}
 		m_initialized = false;
 	}
 
@@ -118,6 +183,7 @@ public:
 	// 获取日志级别字符串
 	static const char* GetLogLevelString(LogLevel level) {
 		switch (level) {
+			case LOG_LEVEL_TRACE: return "TRACE";
 			case LOG_LEVEL_INFO: return "INFO";
 			case LOG_LEVEL_WARNING: return "WARNING";
 			case LOG_LEVEL_ERROR: return "ERROR";
@@ -139,12 +205,56 @@ public:
 			case YOND_ERR_EPOLL_CTL: return "Error adding or modifying epoll event";
 			case YOND_ERR_EPOLL_WAIT: return "Error waiting for epoll events";
 			case YOND_ERR_THREAD_CREATE: return "Error creating thread";
+			case YOND_ERR_SOCKET_OPT: return "Error setting socket option";
+			case YOND_ERR_URING_SETUP: return "Error setting up io_uring";
+			case YOND_ERR_URING_ENTER: return "Error submitting io_uring requests";
+			case YOND_ERR_CONN_LIMIT: return "Connection table is full";
+			case YOND_ERR_FILE_OPEN: return "Error opening spool file";
+			case YOND_ERR_FILE_IO: return "Error relaying file data";
+			case YOND_ERR_CHUNK_STORE: return "Error storing attachment chunk";
 			case YOND_ERR_RECV_PACKET: return "Error recv packet";
 			case YOND_ERR_PACKET_SUMCHECK: return "Error packet sum check";
 			default: return "Unknown error code";
 		}
 	}
 
+	// 格式化"[时间] [级别] [文件:行号] [错误码] "前缀, 返回写入长度.
+	// 同一秒内复用已格式化的日期时间, 只能在后台线程或持有m_logMutex时调用
+	static size_t FormatHead(int64_t nWallNs, LogLevel level, const char* file, int line, YondErrCode err,
+		char* pOut, size_t nCap) {
+		static time_t s_tLast = 0;
+		static char s_szTime[32];
+		time_t t = (time_t)(nWallNs / 1000000000);
+		if (t != s_tLast) {
+			struct tm tmLocal;
+			localtime_r(&t, &tmLocal);
+			strftime(s_szTime, sizeof(s_szTime), "%Y-%m-%d %H:%M:%S", &tmLocal);
+			s_tLast = t;
+		}
+		int ms = (int)(nWallNs / 1000000 % 1000);
+
+		int n;
+		if (err != YOND_ERR_OK) {
+			n = snprintf(pOut, nCap, "[%s.%03d] [%s] [%s:%d] [ERR:%d - %s] ", s_szTime, ms,
+				GetLogLevelString(level), file, line, err, GetErrorDescription(err).c_str());
+		}
+		else {
+			n = snprintf(pOut, nCap, "[%s.%03d] [%s] [%s:%d] ", s_szTime, ms,
+				GetLogLevelString(level), file, line);
+		}
+		return (n < 0) ? 0 : ((size_t)n < nCap ? (size_t)n : nCap - 1);
+	}
+
+	static int64_t MonoNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static int64_t WallNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
 	// 格式化日志消息
 	static std::string FormatLogMessage(LogLevel level, const char* file, int line, 
 									  YondErrCode err, const std::string& msg) {
@@ -164,38 +274,108 @@ public:
 	// 主日志函数
 	static int Log(LogLevel level, const char* file, int line, YondErrCode err, 
 				  const std::string& msg) {
-		static std::mutex logMutex;
-		std::lock_guard<std::mutex> lock(logMutex);
+		if (m_bAsync.load(std::memory_order_acquire)) {
+			LogAsync(level, file, line, err, msg);
+			return err;
+		}
+
+		std::lock_guard<std::mutex> lock(m_logMutex);
 
 		if (!m_initialized && !Initialize()) {
 			printf("Logger not initialized\n");
 			return err;
 		}
 
+		if (m_bBinary.load(std::memory_order_relaxed)) {
+			LogBinary(nullptr, level, file, line, err, false, msg.data(), msg.size());
+			return err;
+		}
+
 		std::string logMsg = FormatLogMessage(level, file, line, err, msg);
 		
 		// 写入文件
 		m_logFile << logMsg << std::endl;
 		m_logFile.flush();
+		AddFileBytes(logMsg.size() + 1);
 
 		// 同时输出到控制台（带颜色）
+		if (m_bConsole) {
+			EchoConsole(level, logMsg.c_str());
+		}
+		return err;
+	}
+
+	static void EchoConsole(LogLevel level, const char* logMsg) {
 		switch (level) {
 			case LOG_LEVEL_INFO:
-				printf("\033[32m%s\033[0m\n", logMsg.c_str()); // 绿色
+				printf("\033[32m%s\033[0m\n", logMsg); // 绿色
 				break;
 			case LOG_LEVEL_WARNING:
-				printf("\033[33m%s\033[0m\n", logMsg.c_str()); // 黄色
+				printf("\033[33m%s\033[0m\n", logMsg); // 黄色
 				break;
 			case LOG_LEVEL_ERROR:
-				printf("\033[31m%s\033[0m\n", logMsg.c_str()); // 红色
+				printf("\033[31m%s\033[0m\n", logMsg); // 红色
 				break;
 			default:
-				printf("%s\n", logMsg.c_str());
+				printf("%s\n", logMsg);
 		}
+	}
 
+	// printf风格格式化: 异步模式直接格式化进记录, 不构造std::string
+	static int LogF(LogLevel level, const char* file, int line, YondErrCode err, const char* fmt, ...)
+		__attribute__((format(printf, 5, 6))) {
+		va_list ap;
+		va_start(ap, fmt);
+		LogV(level, file, line, err, fmt, ap);
+		va_end(ap);
 		return err;
 	}
 
+	// 调用点版本, 由LOG_*F宏使用: 文本模式同LogF, 二进制模式只保存调用点id和原始参数, 不做任何格式化
+	template<class... Args>
+	static int LogS(const YondLogSite& site, YondErrCode err, const Args&... args) {
+		if (!m_bBinary.load(std::memory_order_acquire)) {
+			LogVA((LogLevel)site.level, site.file, site.line, err, site.fmt, args...);
+			return err;
+		}
+		if (m_bAsync.load(std::memory_order_acquire)) {
+			Ring* pRing = nullptr;
+			Record* pRec = BeginRecord(pRing, (LogLevel)site.level, site.file, site.line, err);
+			if (pRec == nullptr) {
+				return err;
+			}
+			CYondLogArgs enc((unsigned char*)pRec->msg, LOG_RECORD_MSG, site.nBounded);
+			pRec->nLen = (unsigned short)enc.Encode(args...);
+			pRec->bTrunc = enc.Truncated();
+			pRec->pSite = &site;
+			CommitRecord(pRing);
+			return err;
+		}
+		unsigned char buf[LOG_FORMAT_STACK];
+		CYondLogArgs enc(buf, sizeof(buf), site.nBounded);
+		size_t nLen = enc.Encode(args...);
+		std::lock_guard<std::mutex> lock(m_logMutex);
+		LogBinary(&site, (LogLevel)site.level, site.file, site.line, err, enc.Truncated(), buf, nLen);
+		return err;
+	}
+
+	// 只用于宏里的sizeof, 让编译器照常检查格式串与参数, 不会被调用
+	static int CheckFormat(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+	// 以十六进制转储数据, 走TRACE通道
+	static void HexDump(const char* file, int line, const char* tag, const void* pData, size_t nSize) {
+		static const char hex[] = "0123456789ABCDEF";
+		const unsigned char* p = (const unsigned char*)pData;
+		std::string out(tag);
+		out += " (" + std::to_string(nSize) + " bytes):";
+		for (size_t i = 0; i < nSize; i++) {
+			out += (i % 16 == 0) ? '\n' : ' ';
+			out += hex[p[i] >> 4];
+			out += hex[p[i] & 0xF];
+		}
+		Log(LOG_LEVEL_TRACE, file, line, YOND_ERR_OK, out);
+	}
+
 	// 便捷日志函数
 	static int Info(const char* file, int line, const std::string& msg) {
 		return Log(LOG_LEVEL_INFO, file, line, YOND_ERR_OK, msg);
@@ -210,10 +390,669 @@ public:
 	}
 
 private:
+	static void LogV(LogLevel level, const char* file, int line, YondErrCode err, const char* fmt, va_list ap) {
+		if (m_bAsync.load(std::memory_order_acquire)) {
+			LogAsyncV(level, file, line, err, fmt, ap);
+			return;
+		}
+		char buf[LOG_FORMAT_STACK];
+		va_list ap2;
+		va_copy(ap2, ap);
+		int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+		if (n < 0) {
+			va_end(ap2);
+			return;
+		}
+		if ((size_t)n < sizeof(buf)) {
+			va_end(ap2);
+			Log(level, file, line, err, std::string(buf, n));
+			return;
+		}
+		std::string msg(n, '\0');
+		vsnprintf(&msg[0], n + 1, fmt, ap2);
+		va_end(ap2);
+		Log(level, file, line, err, msg);
+	}
+
+	// 格式串已在宏里检查过, 这里不再带format属性
+	static void LogVA(LogLevel level, const char* file, int line, YondErrCode err, const char* fmt, ...) {
+		va_list ap;
+		va_start(ap, fmt);
+		LogV(level, file, line, err, fmt, ap);
+		va_end(ap);
+	}
+
+	// 定长记录, 生产者只做一次memcpy, 格式化全部留给后台线程.
+	// pSite非空时msg中是二进制编码的参数, 否则是已格式化的消息
+	struct Record
+	{
+		int64_t nMono;	// 单调时钟ns, 写出时再换算成墙上时间
+		const YondLogSite* pSite;
+		const char* file;
+		int line;
+		LogLevel level;
+		YondErrCode err;
+		unsigned short nLen;
+		bool bTrunc;
+		char msg[LOG_RECORD_MSG];
+	};
+
+	// 单生产者单消费者环: 所属线程写, 后台线程读
+	struct Ring
+	{
+		Ring() : nHead(0), nTail(0), bDead(false) {}
+		std::atomic<size_t> nHead;	// 后台线程读取位置
+		std::atomic<size_t> nTail;	// 所属线程写入位置
+		std::atomic<bool> bDead;	// 所属线程已退出, 取空后释放
+		Record records[LOG_RING_SIZE];
+	};
+
+	// 线程退出时标记自己的环, 由后台线程取空后回收
+	struct RingHolder
+	{
+		Ring* pRing = nullptr;
+		~RingHolder() {
+			if (pRing != nullptr) pRing->bDead.store(true, std::memory_order_release);
+		}
+	};
+
+	static Ring* ThreadRing() {
+		thread_local RingHolder holder;
+		if (holder.pRing == nullptr) {
+			holder.pRing = new Ring();
+			std::lock_guard<std::mutex> lock(m_ringsMutex);
+			m_vRings.push_back(holder.pRing);
+		}
+		return holder.pRing;
+	}
+
+	// 在本线程的环中预留一条记录并填好头部, 环满且策略为丢弃时返回nullptr
+	static Record* BeginRecord(Ring*& pRing, LogLevel level, const char* file, int line, YondErrCode err) {
+		pRing = ThreadRing();
+		size_t nTail = pRing->nTail.load(std::memory_order_relaxed);
+		while (nTail - pRing->nHead.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+			if (m_eOverflow == YLogDrop || m_bWriterStop.load(std::memory_order_relaxed)) {
+				m_nDropped.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			std::this_thread::yield();
+		}
+
+		Record* pRec = &pRing->records[nTail & (LOG_RING_SIZE - 1)];
+		pRec->nMono = MonoNs();
+		pRec->pSite = nullptr;
+		pRec->file = file;
+		pRec->line = line;
+		pRec->level = level;
+		pRec->err = err;
+		return pRec;
+	}
+
+	static void CommitRecord(Ring* pRing) {
+		pRing->nTail.store(pRing->nTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	static void LogAsync(LogLevel level, const char* file, int line, YondErrCode err, const std::string& msg) {
+		Ring* pRing = nullptr;
+		Record* pRec = BeginRecord(pRing, level, file, line, err);
+		if (pRec == nullptr) {
+			return;
+		}
+		pRec->bTrunc = msg.size() > LOG_RECORD_MSG;
+		pRec->nLen = (unsigned short)(pRec->bTrunc ? LOG_RECORD_MSG : msg.size());
+		memcpy(pRec->msg, msg.data(), pRec->nLen);
+		CommitRecord(pRing);
+	}
+
+	static void LogAsyncV(LogLevel level, const char* file, int line, YondErrCode err, const char* fmt, va_list ap) {
+		Ring* pRing = nullptr;
+		Record* pRec = BeginRecord(pRing, level, file, line, err);
+		if (pRec == nullptr) {
+			return;
+		}
+		// 记录里的消息不需要结尾的'\0', 多留一个字节给vsnprintf
+		char buf[LOG_RECORD_MSG + 1];
+		int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+		if (n < 0) n = 0;
+		pRec->bTrunc = n > LOG_RECORD_MSG;
+		pRec->nLen = (unsigned short)(pRec->bTrunc ? LOG_RECORD_MSG : n);
+		memcpy(pRec->msg, buf, pRec->nLen);
+		CommitRecord(pRing);
+	}
+
+	// 把一条记录格式化到pOut, 格式与同步模式相同. nOffset为单调时钟到墙上时间的偏移
+	static size_t FormatRecord(const Record& rec, int64_t nOffset, char* pOut, size_t nCap) {
+		size_t nLen = FormatHead(rec.nMono + nOffset, rec.level, rec.file, rec.line, rec.err, pOut, nCap);
+		size_t nMsg;
+		if (rec.pSite != nullptr) {
+			// 二进制模式下的记录, 输出到控制台或刚切回文本模式时才在这里格式化
+			nMsg = YondLogFormatArgs(rec.pSite->fmt, (const unsigned char*)rec.msg, rec.nLen, pOut + nLen, nCap - nLen - 4);
+		}
+		else {
+			nMsg = rec.nLen;
+			if (nLen + nMsg + 5 > nCap) nMsg = nCap - nLen - 5;
+			memcpy(pOut + nLen, rec.msg, nMsg);
+		}
+		nLen += nMsg;
+		if (rec.bTrunc) {
+			memcpy(pOut + nLen, "...", 3);
+			nLen += 3;
+		}
+		pOut[nLen++] = '\n';
+		return nLen;
+	}
+
+	// 二进制模式写文件, 文本只在需要输出到控制台时格式化; 文本模式格式化后攒批. 返回写入pOut的长度
+	static size_t EmitRecord(const Record& rec, bool bBinary, int64_t nOffset, char* pOut) {
+		if (bBinary) {
+			WriteBinary(rec.pSite, rec.level, rec.file, rec.line, rec.nMono, rec.err, rec.bTrunc, rec.msg, rec.nLen);
+			if (!m_bConsole) {
+				return 0;
+			}
+		}
+		return FormatRecord(rec, nOffset, pOut, 512);
+	}
+
+	// 后台线程: 轮询各线程的环, 批量格式化后一次写入文件和控制台
+	static void WriterThread() {
+		std::unique_ptr<char[]> pBuf(new char[LOG_BATCH_BYTES + 512]);
+		uint64_t nReported = 0;
+		while (true) {
+			bool bStop = m_bWriterStop.load(std::memory_order_acquire);
+			bool bBinary = m_bBinary.load(std::memory_order_acquire);
+			// 每轮重新取时钟偏移, 跟随系统时间的调整
+			int64_t nOffset = WallNs() - MonoNs();
+			// 二进制记录直接写进文件流, 调用点表与同步模式共用, 整轮持锁
+			std::unique_lock<std::mutex> binLock(m_logMutex, std::defer_lock);
+			if (bBinary) {
+				binLock.lock();
+			}
+			size_t nLen = 0;
+			size_t nRecords = 0;
+			std::vector<Ring*> vRings;
+			{
+				std::lock_guard<std::mutex> lock(m_ringsMutex);
+				vRings = m_vRings;
+			}
+			for (Ring* pRing : vRings) {
+				size_t nHead = pRing->nHead.load(std::memory_order_relaxed);
+				size_t nTail = pRing->nTail.load(std::memory_order_acquire);
+				while (nHead != nTail) {
+					nLen += EmitRecord(pRing->records[nHead & (LOG_RING_SIZE - 1)], bBinary, nOffset, pBuf.get() + nLen);
+					nHead++;
+					nRecords++;
+					if (nLen >= LOG_BATCH_BYTES) {
+						pRing->nHead.store(nHead, std::memory_order_release);
+						WriteBatch(pBuf.get(), nLen, bBinary);
+						nLen = 0;
+					}
+				}
+				pRing->nHead.store(nHead, std::memory_order_release);
+			}
+
+			uint64_t nDropped = m_nDropped.load(std::memory_order_relaxed);
+			if (nDropped != nReported) {
+				Record rec;
+				rec.nMono = MonoNs();
+				rec.pSite = nullptr;
+				rec.file = __FILE__;
+				rec.line = __LINE__;
+				rec.level = LOG_LEVEL_WARNING;
+				rec.err = YOND_ERR_OK;
+				rec.bTrunc = false;
+				int n = snprintf(rec.msg, sizeof(rec.msg), "Async log ring overflow, %llu records dropped so far",
+					(unsigned long long)nDropped);
+				rec.nLen = (unsigned short)((n > 0 && n < (int)sizeof(rec.msg)) ? n : 0);
+				nLen += EmitRecord(rec, bBinary, nOffset, pBuf.get() + nLen);
+				nReported = nDropped;
+			}
+			if (nLen > 0) {
+				WriteBatch(pBuf.get(), nLen, bBinary);
+			}
+			if (bBinary) {
+				m_binFile.flush();
+				binLock.unlock();
+			}
+			ReapDeadRings();
+
+			if (bStop) {
+				break;
+			}
+			if (nRecords == 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+		}
+	}
+
+	// 控制台输出不带颜色, 整批一次写出. 二进制模式下文本只用于控制台, 调用方已持有m_logMutex
+	static void WriteBatch(const char* pData, size_t nLen, bool bConsoleOnly) {
+		if (bConsoleOnly) {
+			fwrite(pData, 1, nLen, stdout);
+			fflush(stdout);
+			return;
+		}
+		// 切回同步模式的过程中同步日志可能同时写文件
+		std::lock_guard<std::mutex> lock(m_logMutex);
+		m_logFile.write(pData, nLen);
+		m_logFile.flush();
+		AddFileBytes(nLen);
+		if (m_bConsole) {
+			fwrite(pData, 1, nLen, stdout);
+			fflush(stdout);
+		}
+	}
+
+	// 以下二进制写入函数都要求调用方持有m_logMutex
+	static void BinPut(const void* p, size_t n) {
+		m_binFile.write((const char*)p, n);
+		AddFileBytes(n);
+	}
+
+	template<class T>
+	static void BinVal(T v) {
+		BinPut(&v, sizeof(v));
+	}
+
+	static void BinStr16(const char* s) {
+		size_t n = strlen(s);
+		if (n > 0xFFFF) n = 0xFFFF;
+		BinVal<uint16_t>((uint16_t)n);
+		BinPut(s, n);
+	}
+
+	// 打开二进制文件并写文件头, 不访问共享状态, 轮转线程可以在锁外调用
+	static bool OpenBinaryFile(std::ofstream& file, const std::string& strPath) {
+		file.open(strPath, std::ios::binary | std::ios::app);
+		if (!file.is_open()) {
+			printf("Failed to open binary log file: %s\n", strPath.c_str());
+			return false;
+		}
+		uint16_t vHead[2] = { YLOG_VERSION, 0 };
+		file.write(YLOG_MAGIC, 4);
+		file.write((const char*)vHead, sizeof(vHead));
+		file.flush();
+		return true;
+	}
+
+	// 打开二进制文件, 路径与文本日志相同, 扩展名为.ylog
+	static bool OpenBinary() {
+		if (m_binFile.is_open()) {
+			return true;
+		}
+		std::string strPath = std::filesystem::path(m_strLogPath).replace_extension(".ylog").string();
+		if (!OpenBinaryFile(m_binFile, strPath)) {
+			return false;
+		}
+		m_vSiteSeen.clear();
+		m_nLastClock = -1;
+		printf("Binary log file: %s\n", strPath.c_str());
+		return true;
+	}
+
+	// 写一条二进制记录: 必要时先补时间锚点和调用点定义
+	static void WriteBinary(const YondLogSite* pSite, LogLevel level, const char* file, int line, int64_t nMono,
+		YondErrCode err, bool bTrunc, const void* pMsg, size_t nLen) {
+		if (m_nLastClock < 0 || nMono >= m_nLastClock + 1000000000LL) {
+			int64_t nNow = MonoNs();
+			BinVal<uint8_t>(YLogRecClock);
+			BinVal<int64_t>(WallNs());
+			BinVal<int64_t>(nNow);
+			m_nLastClock = nNow;
+		}
+		uint8_t nFlags = bTrunc ? YLOG_FLAG_TRUNC : 0;
+		if (pSite != nullptr) {
+			if (pSite->nId >= m_vSiteSeen.size()) {
+				m_vSiteSeen.resize(pSite->nId + 1, false);
+			}
+			if (!m_vSiteSeen[pSite->nId]) {
+				BinVal<uint8_t>(YLogRecSite);
+				BinVal<uint32_t>(pSite->nId);
+				BinVal<uint8_t>((uint8_t)pSite->level);
+				BinVal<uint32_t>((uint32_t)pSite->line);
+				BinStr16(pSite->file);
+				BinStr16(pSite->fmt);
+				m_vSiteSeen[pSite->nId] = true;
+			}
+			BinVal<uint8_t>(YLogRecFmt);
+			BinVal<uint32_t>(pSite->nId);
+			BinVal<int64_t>(nMono);
+			BinVal<int32_t>(err);
+			BinVal<uint8_t>(nFlags);
+			BinVal<uint16_t>((uint16_t)nLen);
+			BinPut(pMsg, nLen);
+		}
+		else {
+			BinVal<uint8_t>(YLogRecText);
+			BinVal<uint8_t>((uint8_t)level);
+			BinVal<int64_t>(nMono);
+			BinVal<int32_t>(err);
+			BinVal<uint8_t>(nFlags);
+			BinVal<uint32_t>((uint32_t)line);
+			BinStr16(file);
+			BinVal<uint32_t>((uint32_t)nLen);
+			BinPut(pMsg, nLen);
+		}
+	}
+
+	// 同步二进制模式: 写一条记录并立即刷新, 需要时格式化一份文本输出到控制台
+	static void LogBinary(const YondLogSite* pSite, LogLevel level, const char* file, int line,
+		YondErrCode err, bool bTrunc, const void* pMsg, size_t nLen) {
+		int64_t nMono = MonoNs();
+		WriteBinary(pSite, level, file, line, nMono, err, bTrunc, pMsg, nLen);
+		m_binFile.flush();
+		if (!m_bConsole) {
+			return;
+		}
+		char buf[LOG_FORMAT_STACK];
+		size_t n = FormatHead(WallNs(), level, file, line, err, buf, sizeof(buf));
+		if (pSite != nullptr) {
+			n += YondLogFormatArgs(pSite->fmt, (const unsigned char*)pMsg, nLen, buf + n, sizeof(buf) - n);
+		}
+		else {
+			size_t nMsg = nLen < sizeof(buf) - n - 1 ? nLen : sizeof(buf) - n - 1;
+			memcpy(buf + n, pMsg, nMsg);
+			buf[n + nMsg] = '\0';
+		}
+		EchoConsole(level, buf);
+	}
+
+	static void ReapDeadRings() {
+		std::lock_guard<std::mutex> lock(m_ringsMutex);
+		for (size_t i = 0; i < m_vRings.size();) {
+			Ring* pRing = m_vRings[i];
+			if (pRing->bDead.load(std::memory_order_acquire) &&
+				pRing->nHead.load(std::memory_order_relaxed) == pRing->nTail.load(std::memory_order_acquire)) {
+				delete pRing;
+				m_vRings[i] = m_vRings.back();
+				m_vRings.pop_back();
+			}
+			else {
+				i++;
+			}
+		}
+	}
+
+	static std::string Today() {
+		time_t t = time(nullptr);
+		struct tm tmLocal;
+		localtime_r(&t, &tmLocal);
+		char szDate[16];
+		strftime(szDate, sizeof(szDate), "%Y%m%d", &tmLocal);
+		return szDate;
+	}
+
+	// chat_server_YYYYMMDD.log, 同一天按大小切换出的文件加序号: chat_server_YYYYMMDD_1.log
+	static std::string LogPath(const std::string& strDate, int nSeq, const char* pExt) {
+		std::string strPath = m_strLogDir + "/chat_server_" + strDate;
+		if (nSeq > 0) {
+			strPath += "_" + std::to_string(nSeq);
+		}
+		return strPath + pExt;
+	}
+
+	// 写文件的线程只累加字节数, 超过上限时叫醒轮转线程, 自己不做任何文件操作
+	static void AddFileBytes(size_t n) {
+		uint64_t nLimit = m_nRotateBytes.load(std::memory_order_relaxed);
+		if (nLimit > 0 && m_nFileBytes.fetch_add(n, std::memory_order_relaxed) + n >= nLimit &&
+			!m_bRotateDue.exchange(true, std::memory_order_relaxed)) {
+			m_rotateCv.notify_one();
+		}
+	}
+
+	// 轮转线程: 按日期变化或大小超限切换文件. 新文件在锁外打开, 持锁只交换文件流,
+	// 旧文件的关闭、压缩和过期清理都在锁外进行, 写日志的线程最多等一次交换
+	static void RotatorThread() {
+		std::unique_lock<std::mutex> lock(m_rotateMutex);
+		while (!m_bRotateStop) {
+			m_rotateCv.wait_for(lock, std::chrono::milliseconds(LOG_ROTATE_CHECK_MS),
+				[] { return m_bRotateStop || m_bRotateDue.load(std::memory_order_relaxed); });
+			if (m_bRotateStop) {
+				break;
+			}
+			bool bSize = m_bRotateDue.exchange(false, std::memory_order_relaxed);
+			std::string strDate = Today();
+			if (!bSize && strDate == m_strDate) {
+				continue;
+			}
+			lock.unlock();
+			Rotate(strDate);
+			lock.lock();
+		}
+	}
+
+	static void Rotate(const std::string& strDate) {
+		// 跳过已存在的序号, 不往已归档(可能已压缩)的文件里追加
+		int nSeq = strDate == m_strDate ? m_nSeq + 1 : 0;
+		auto used = [&](int n) {
+			for (const char* pExt : { ".log", ".log.gz", ".ylog", ".ylog.gz" }) {
+				if (std::filesystem::exists(LogPath(strDate, n, pExt))) return true;
+			}
+			return false;
+		};
+		while (used(nSeq)) {
+			nSeq++;
+		}
+
+		std::string strText = LogPath(strDate, nSeq, ".log");
+		std::string strBin = LogPath(strDate, nSeq, ".ylog");
+		std::ofstream textFile(strText, std::ios::app);
+		if (!textFile.is_open()) {
+			// 下次超限或下个检查周期再试
+			printf("Failed to open log file: %s\n", strText.c_str());
+			m_nFileBytes = 0;
+			return;
+		}
+		bool bBinary;
+		{
+			std::lock_guard<std::mutex> lock(m_logMutex);
+			bBinary = m_binFile.is_open();
+		}
+		std::ofstream binFile;
+		if (bBinary && !OpenBinaryFile(binFile, strBin)) {
+			bBinary = false;
+		}
+
+		std::string strOldText;
+		std::string strOldBin;
+		{
+			std::lock_guard<std::mutex> lock(m_logMutex);
+			m_logFile.swap(textFile);
+			strOldText = m_strLogPath;
+			m_strLogPath = strText;
+			if (bBinary && m_binFile.is_open()) {
+				m_binFile.swap(binFile);
+				strOldBin = std::filesystem::path(strOldText).replace_extension(".ylog").string();
+				m_vSiteSeen.clear();
+				m_nLastClock = -1;
+			}
+			m_strDate = strDate;
+			m_nSeq = nSeq;
+			m_nFileBytes = 0;
+		}
+		textFile.close();
+		binFile.close();
+
+		if (m_bCompress) {
+			Compress(strOldText);
+			if (!strOldBin.empty()) {
+				Compress(strOldBin);
+			}
+		}
+		Prune();
+	}
+
+	// 调用系统的gzip压缩旧文件, 在轮转线程上等待它结束
+	static void Compress(const std::string& strPath) {
+		char* argv[] = { (char*)"gzip", (char*)"-f", (char*)strPath.c_str(), nullptr };
+		pid_t pid;
+		if (posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) != 0) {
+			printf("Failed to run gzip for %s, left uncompressed\n", strPath.c_str());
+			return;
+		}
+		int nStatus = 0;
+		waitpid(pid, &nStatus, 0);
+	}
+
+	// 只保留最新的m_nKeepFiles个已轮转文件, 按修改时间排序, 0表示全部保留
+	static void Prune() {
+		int nKeep = m_nKeepFiles.load(std::memory_order_relaxed);
+		if (nKeep <= 0) {
+			return;
+		}
+		std::string strText;
+		{
+			std::lock_guard<std::mutex> lock(m_logMutex);
+			strText = m_strLogPath;
+		}
+		std::string strBin = std::filesystem::path(strText).replace_extension(".ylog").string();
+
+		std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> vFiles;
+		std::error_code ec;
+		for (const auto& entry : std::filesystem::directory_iterator(m_strLogDir, ec)) {
+			std::string strName = entry.path().filename().string();
+			if (strName.compare(0, 12, "chat_server_") != 0 || !entry.is_regular_file(ec) ||
+				entry.path() == strText || entry.path() == strBin) {
+				continue;
+			}
+			vFiles.emplace_back(entry.last_write_time(ec), entry.path());
+		}
+		if (vFiles.size() <= (size_t)nKeep) {
+			return;
+		}
+		std::sort(vFiles.begin(), vFiles.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+		for (size_t i = nKeep; i < vFiles.size(); i++) {
+			std::filesystem::remove(vFiles[i].second, ec);
+		}
+	}
+
+	static void StopRotator() {
+		{
+			std::lock_guard<std::mutex> lock(m_rotateMutex);
+			m_bRotateStop = true;
+		}
+		m_rotateCv.notify_one();
+		if (m_rotator.joinable()) {
+			m_rotator.join();
+		}
+	}
+
+	// 停止后台线程前先切回同步模式, 之后的日志直接写文件; 后台线程退出前会取空所有环
+	static void StopWriter() {
+		if (!m_bAsync) {
+			return;
+		}
+		m_bAsync.store(false, std::memory_order_release);
+		m_bWriterStop = true;
+		if (m_writer.joinable()) {
+			m_writer.join();
+		}
+	}
+
 	inline static std::ofstream m_logFile;
 	inline static bool m_initialized;
+	inline static std::mutex m_logMutex;
+	inline static std::atomic<bool> m_bConsole{ true };
+	inline static std::atomic<int> m_nLevel{ LOG_LEVEL_INFO };
+
+	inline static std::atomic<bool> m_bAsync{ false };
+	inline static std::atomic<bool> m_bWriterStop{ false };
+	inline static std::atomic<YondLogOverflow> m_eOverflow{ YLogDrop };
+	inline static std::atomic<uint64_t> m_nDropped{ 0 };
+	inline static std::thread m_writer;
+	inline static std::mutex m_ringsMutex;	// 只在线程首次写日志和后台线程取环列表时加锁
+	inline static std::vector<Ring*> m_vRings;
+
+	inline static std::string m_strLogPath;
+	inline static std::atomic<bool> m_bBinary{ false };
+	inline static std::ofstream m_binFile;
+	inline static std::vector<bool> m_vSiteSeen;	// 当前二进制文件中已写过定义的调用点
+	inline static int64_t m_nLastClock = -1;		// 上一个时间锚点的单调时钟, -1表示本文件还没有
+
+	// 以下由Initialize设置, 之后只由轮转线程修改(m_strLogPath在m_logMutex下修改)
+	inline static std::string m_strLogDir;
+	inline static std::string m_strDate;
+	inline static int m_nSeq = 0;
+	inline static std::atomic<uint64_t> m_nFileBytes{ 0 };	// 当前文件已写字节数, 文本和二进制合计
+	inline static std::atomic<uint64_t> m_nRotateBytes{ 0 };
+	inline static std::atomic<int> m_nKeepFiles{ 0 };
+	inline static std::atomic<bool> m_bCompress{ false };
+	inline static std::atomic<bool> m_bRotateDue{ false };
+	inline static bool m_bRotateStop = false;
+	inline static std::mutex m_rotateMutex;
+	inline static std::condition_variable m_rotateCv;
+	inline static std::thread m_rotator;
+};
+struct YondLogOpt
+{
+	bool bAsync = false;	// 由后台线程格式化并写文件
+	bool bConsole = true;	// 同时输出到控制台
+	bool bBinary = false;	// 写二进制日志(.ylog), 由yondlog-decode还原成文本
+	YondLogOverflow eOverflow = YLogDrop;
+	uint64_t nRotateBytes = 64ull << 20;	// 单个文件超过该大小时切换, 0表示只按日期切换
+	int nKeepFiles = 14;	// 保留的已轮转文件个数, 0表示全部保留
+	bool bCompress = true;	// 用gzip压缩已轮转的文件
+	CYondLog::LogLevel eLevel = CYondLog::LOG_LEVEL_INFO;	// 运行期级别, 不能低于编译期级别
 };
-// 便捷宏定义
-#define LOG_INFO(msg) CYondLog::Info(__FILE__, __LINE__, msg)
-#define LOG_WARNING(msg) CYondLog::Warning(__FILE__, __LINE__, msg)
-#define LOG_ERROR(err, msg) CYondLog::Error(__FILE__, __LINE__, err, msg)
\ No newline at end of file
+
+inline void CYondLog::Configure(const YondLogOpt& opt) {
+	m_bConsole = opt.bConsole;
+	m_eOverflow = opt.eOverflow;
+	m_nLevel = opt.eLevel;
+	if (opt.bBinary && !m_bBinary) {
+		std::lock_guard<std::mutex> lock(m_logMutex);
+		m_bBinary = OpenBinary();
+	}
+	else if (!opt.bBinary && m_bBinary) {
+		// 文件保持打开, 已在环中的二进制记录由后台线程格式化成文本
+		m_bBinary = false;
+	}
+	m_nRotateBytes = opt.nRotateBytes;
+	m_nKeepFiles = opt.nKeepFiles;
+	m_bCompress = opt.bCompress;
+	if (m_initialized && !m_rotator.joinable()) {
+		m_bRotateStop = false;
+		m_rotator = std::thread(RotatorThread);
+	}
+	if (opt.bAsync && !m_bAsync) {
+		m_bWriterStop = false;
+		m_writer = std::thread(WriterThread);
+		m_bAsync = true;
+	}
+	else if (!opt.bAsync && m_bAsync) {
+		StopWriter();
+	}
+}
+
+// 便捷宏定义: 级别低于编译期级别时整条语句被删除, 运行期级别未开启时不求值消息参数.
+// 错误码照常返回
+#define YOND_LOG_ON(level) \
+	(CYondLog::level >= CYondLog::COMPILE_LEVEL && CYondLog::Enabled(CYondLog::level))
+
+#define LOG_INFO(msg) (YOND_LOG_ON(LOG_LEVEL_INFO) ? CYondLog::Info(__FILE__, __LINE__, msg) : YOND_ERR_OK)
+#define LOG_WARNING(msg) (YOND_LOG_ON(LOG_LEVEL_WARNING) ? CYondLog::Warning(__FILE__, __LINE__, msg) : YOND_ERR_OK)
+#define LOG_ERROR(err, msg) (YOND_LOG_ON(LOG_LEVEL_ERROR) ? CYondLog::Error(__FILE__, __LINE__, err, msg) : (err))
+
+// 调用点描述: 格式串、文件和行号在首次执行时登记一次
+#define YOND_LOG_SITE(level, fmt) \
+	([]() -> const YondLogSite& { static const YondLogSite s_site(CYondLog::level, fmt, __FILE__, __LINE__); return s_site; }())
+
+// sizeof中的CheckFormat不求值, 只让编译器按printf检查参数
+#define YOND_LOGF(level, err, fmt, ...) \
+	((void)sizeof(CYondLog::CheckFormat(fmt, ##__VA_ARGS__)), \
+	CYondLog::LogS(YOND_LOG_SITE(level, fmt), err, ##__VA_ARGS__))
+
+// printf风格的延迟格式化版本, 热路径上使用, 过滤掉时不做任何字符串操作;
+// 二进制模式下只记录调用点id和原始参数
+#define LOG_TRACEF(fmt, ...) (YOND_LOG_ON(LOG_LEVEL_TRACE) ? \
+	YOND_LOGF(LOG_LEVEL_TRACE, YOND_ERR_OK, fmt, ##__VA_ARGS__) : YOND_ERR_OK)
+#define LOG_INFOF(fmt, ...) (YOND_LOG_ON(LOG_LEVEL_INFO) ? \
+	YOND_LOGF(LOG_LEVEL_INFO, YOND_ERR_OK, fmt, ##__VA_ARGS__) : YOND_ERR_OK)
+#define LOG_WARNINGF(fmt, ...) (YOND_LOG_ON(LOG_LEVEL_WARNING) ? \
+	YOND_LOGF(LOG_LEVEL_WARNING, YOND_ERR_OK, fmt, ##__VA_ARGS__) : YOND_ERR_OK)
+#define LOG_ERRORF(err, fmt, ...) (YOND_LOG_ON(LOG_LEVEL_ERROR) ? \
+	YOND_LOGF(LOG_LEVEL_ERROR, err, fmt, ##__VA_ARGS__) : (err))
+
+// 十六进制转储只在调试跟踪通道输出, 发布构建中不生成代码
+#define LOG_HEXDUMP(tag, data, size) do { \
+	if (YOND_LOG_ON(LOG_LEVEL_TRACE)) CYondLog::HexDump(__FILE__, __LINE__, tag, data, size); \
+} while (0)
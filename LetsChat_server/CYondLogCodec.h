@@ -0,0 +1,294 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 二进制日志文件格式, 所有整数按小端存放. 服务端和yondlog-decode共用本文件.
+// 文件头可以出现多次(每次打开文件追加一个), 解码器遇到后清空调用点表:
+//   "YLOG" 版本(u16) 保留(u16)
+// 之后每条记录以一字节类型开头:
+//   YLogRecClock  墙上时间ns(i64) 单调时钟ns(i64)                           时间锚点, 至少每秒一条
+//   YLogRecSite   id(u32) level(u8) line(u32) fileLen(u16) file fmtLen(u16) fmt   调用点在本文件首次出现时写一次
+//   YLogRecFmt    id(u32) 单调时钟ns(i64) err(i32) flags(u8) argLen(u16) args    printf风格日志, 参数原样存放
+//   YLogRecText   level(u8) 单调时钟ns(i64) err(i32) flags(u8) line(u32) fileLen(u16) file msgLen(u32) msg
+#define YLOG_MAGIC "YLOG"
+#define YLOG_VERSION 1
+#define YLOG_FLAG_TRUNC 0x01	// 消息或字符串参数被截断
+
+enum YondLogRecType
+{
+	YLogRecClock = 1,
+	YLogRecSite,
+	YLogRecFmt,
+	YLogRecText
+};
+
+// 日志调用点: 格式串、文件、行号和级别都是编译期常量, 宏里以函数内静态对象定义,
+// 首次执行时分配id并预先分析格式串, 之后每条日志只需写id和参数
+struct YondLogSite
+{
+	YondLogSite(int nLevel, const char* pFmt, const char* pFile, int nLine)
+		: fmt(pFmt), file(pFile), line(nLine), level(nLevel), nBounded(0) {
+		static std::atomic<uint32_t> s_nNext{ 0 };
+		nId = s_nNext.fetch_add(1, std::memory_order_relaxed);
+		Analyze();
+	}
+
+	const char* fmt;
+	const char* file;
+	int line;
+	int level;
+	uint32_t nId;
+	uint32_t nBounded;	// 第i位为1表示第i个参数是%.*s的字符串, 长度由前一个参数限定
+
+private:
+	void Analyze() {
+		int nArg = 0;
+		for (const char* p = fmt; *p != '\0'; p++) {
+			if (*p != '%') continue;
+			if (*++p == '%') continue;
+			while (*p != '\0' && strchr("-+ #0", *p) != nullptr) p++;
+			if (*p == '*') { nArg++; p++; }
+			while (*p >= '0' && *p <= '9') p++;
+			bool bStarPrec = false;
+			if (*p == '.') {
+				p++;
+				if (*p == '*') { nArg++; p++; bStarPrec = true; }
+				while (*p >= '0' && *p <= '9') p++;
+			}
+			while (*p != '\0' && strchr("hljztL", *p) != nullptr) p++;
+			if (*p == '\0') break;
+			if (*p == 's' && bStarPrec && nArg < 32) nBounded |= 1u << nArg;
+			nArg++;
+		}
+	}
+};
+
+// 把printf参数按类型原样写入缓冲: 整数8字节, 浮点8字节, 字符串u16长度加内容, 其他指针8字节.
+// 缓冲不足时截断字符串, 放不下的定长参数直接丢弃并置截断标志
+class CYondLogArgs
+{
+public:
+	CYondLogArgs(unsigned char* pBuf, size_t nCap, uint32_t nBounded)
+		: m_pBuf(pBuf), m_nCap(nCap), m_nLen(0), m_nIndex(0), m_nPrev(-1), m_nBounded(nBounded), m_bTrunc(false) {}
+
+	template<class... Args>
+	size_t Encode(const Args&... args) {
+		(Put(args), ...);
+		return m_nLen;
+	}
+
+	bool Truncated() const { return m_bTrunc; }
+
+private:
+	template<class T>
+	void Put(const T& v) {
+		if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+			m_nPrev = (int64_t)v;
+			PutRaw(&m_nPrev, 8);
+		}
+		else if constexpr (std::is_floating_point<T>::value) {
+			double d = (double)v;
+			PutRaw(&d, 8);
+		}
+		else if constexpr (std::is_convertible<const T&, const char*>::value) {
+			PutStr((const char*)v);
+		}
+		else {
+			static_assert(std::is_pointer<T>::value, "unsupported log argument type");
+			uint64_t n = (uint64_t)(uintptr_t)v;
+			PutRaw(&n, 8);
+		}
+		m_nIndex++;
+	}
+
+	void PutRaw(const void* p, size_t n) {
+		if (m_nLen + n > m_nCap) {
+			m_bTrunc = true;
+			m_nLen = m_nCap;
+			return;
+		}
+		memcpy(m_pBuf + m_nLen, p, n);
+		m_nLen += n;
+	}
+
+	void PutStr(const char* s) {
+		if (s == nullptr) s = "(null)";
+		size_t n;
+		if (m_nIndex < 32 && (m_nBounded >> m_nIndex & 1) && m_nPrev >= 0) {
+			n = strnlen(s, (size_t)m_nPrev);
+		}
+		else {
+			n = strlen(s);
+		}
+		if (m_nLen + 2 > m_nCap) {
+			m_bTrunc = true;
+			m_nLen = m_nCap;
+			return;
+		}
+		size_t nRoom = m_nCap - m_nLen - 2;
+		if (nRoom > 0xFFFF) nRoom = 0xFFFF;
+		if (n > nRoom) {
+			n = nRoom;
+			m_bTrunc = true;
+		}
+		uint16_t nLen16 = (uint16_t)n;
+		memcpy(m_pBuf + m_nLen, &nLen16, 2);
+		memcpy(m_pBuf + m_nLen + 2, s, n);
+		m_nLen += 2 + n;
+	}
+
+	unsigned char* m_pBuf;
+	size_t m_nCap;
+	size_t m_nLen;
+	int m_nIndex;
+	int64_t m_nPrev;	// 上一个整数参数, 作为%.*s的长度
+	uint32_t m_nBounded;
+	bool m_bTrunc;
+};
+
+// 按格式串逐个取出原样存放的参数, 还原成与printf相同的输出, 返回写入pOut的长度(不含'\0').
+// 参数不足时缺失的按0或空串输出
+inline size_t YondLogFormatArgs(const char* fmt, const unsigned char* pArgs, size_t nArgs, char* pOut, size_t nCap) {
+	struct Reader
+	{
+		const unsigned char* p;
+		size_t n;
+		int64_t I64() {
+			int64_t v = 0;
+			if (n >= 8) { memcpy(&v, p, 8); p += 8; n -= 8; }
+			else n = 0;
+			return v;
+		}
+		double F64() {
+			double v = 0;
+			if (n >= 8) { memcpy(&v, p, 8); p += 8; n -= 8; }
+			else n = 0;
+			return v;
+		}
+		const char* Str(size_t& nLen) {
+			uint16_t nLen16 = 0;
+			if (n >= 2) memcpy(&nLen16, p, 2);
+			if (n < 2 || n - 2 < nLen16) { n = 0; nLen = 0; return ""; }
+			const char* s = (const char*)p + 2;
+			p += 2 + nLen16;
+			n -= 2 + nLen16;
+			nLen = nLen16;
+			return s;
+		}
+	} rd{ pArgs, nArgs };
+
+	if (nCap == 0) return 0;
+	size_t nLen = 0;
+	auto append = [&](int n) {
+		if (n > 0) nLen += (size_t)n;
+		if (nLen >= nCap) nLen = nCap - 1;
+	};
+
+	const char* p = fmt;
+	while (*p != '\0' && nLen + 1 < nCap) {
+		if (*p != '%') {
+			const char* q = strchr(p, '%');
+			size_t n = q == nullptr ? strlen(p) : (size_t)(q - p);
+			if (n > nCap - 1 - nLen) n = nCap - 1 - nLen;
+			memcpy(pOut + nLen, p, n);
+			nLen += n;
+			p += n;
+			continue;
+		}
+		if (p[1] == '%') {
+			pOut[nLen++] = '%';
+			p += 2;
+			continue;
+		}
+
+		// 重新拼出单个转换说明, 整数统一按long long、浮点按double交给snprintf
+		char spec[32];
+		size_t nSpec = 0;
+		int vStar[2];
+		int nStar = 0;
+		int nPrec = -1;
+		bool bPrecStar = false;
+		spec[nSpec++] = *p++;
+		while (*p != '\0' && strchr("-+ #0", *p) != nullptr && nSpec < 8) spec[nSpec++] = *p++;
+		if (*p == '*') {
+			vStar[nStar++] = (int)rd.I64();
+			spec[nSpec++] = *p++;
+		}
+		while (*p >= '0' && *p <= '9' && nSpec < 16) spec[nSpec++] = *p++;
+		size_t nSpecNoPrec = nSpec;
+		if (*p == '.') {
+			spec[nSpec++] = *p++;
+			if (*p == '*') {
+				nPrec = (int)rd.I64();
+				bPrecStar = true;
+				spec[nSpec++] = *p++;
+			}
+			else {
+				nPrec = atoi(p);
+				while (*p >= '0' && *p <= '9' && nSpec < 24) spec[nSpec++] = *p++;
+			}
+		}
+		while (*p != '\0' && strchr("hljztL", *p) != nullptr) p++;
+		char conv = *p;
+		if (conv == '\0') break;
+		p++;
+		if (bPrecStar) vStar[nStar++] = nPrec;
+
+		auto emit = [&](auto v) {
+			char* pDst = pOut + nLen;
+			size_t nRoom = nCap - nLen;
+			if (nStar == 0) append(snprintf(pDst, nRoom, spec, v));
+			else if (nStar == 1) append(snprintf(pDst, nRoom, spec, vStar[0], v));
+			else append(snprintf(pDst, nRoom, spec, vStar[0], vStar[1], v));
+		};
+		switch (conv) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+			spec[nSpec++] = 'l';
+			spec[nSpec++] = 'l';
+			spec[nSpec++] = conv;
+			spec[nSpec] = '\0';
+			emit((long long)rd.I64());
+			break;
+		case 'c':
+			spec[nSpec++] = 'c';
+			spec[nSpec] = '\0';
+			emit((int)rd.I64());
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			spec[nSpec++] = conv;
+			spec[nSpec] = '\0';
+			emit(rd.F64());
+			break;
+		case 'p':
+			spec[nSpec++] = 'p';
+			spec[nSpec] = '\0';
+			emit((void*)(uintptr_t)rd.I64());
+			break;
+		case 's': {
+			// 存放的字符串已按精度截好, 不一定以'\0'结尾, 统一用实际长度作精度
+			size_t nStr = 0;
+			const char* s = rd.Str(nStr);
+			if (nPrec >= 0 && (size_t)nPrec < nStr) nStr = (size_t)nPrec;
+			nSpec = nSpecNoPrec;
+			spec[nSpec++] = '.';
+			spec[nSpec++] = '*';
+			spec[nSpec++] = 's';
+			spec[nSpec] = '\0';
+			nStar = nStar > (bPrecStar ? 1 : 0) ? 1 : 0;	// 只保留宽度
+			vStar[nStar++] = (int)nStr;
+			emit(s);
+			break;
+		}
+		default:
+			// %n等不支持的转换原样丢弃
+			break;
+		}
+	}
+	pOut[nLen] = '\0';
+	return nLen;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 出站队列超过高水位时的处理策略
+enum YondOverflow
+{
+	YOverflowDrop,	// 丢弃新帧, 保留连接
+	YOverflowClose	// 断开跟不上的连接
+};
+
+// 事件循环使用的I/O引擎
+enum YondEngine
+{
+	YEngineEpoll,
+	YEngineUring	// 内核不支持时自动退回epoll
+};
+
+// 消息处理线程池的调度方式
+enum YondPoolMode
+{
+	YPoolShared,	// 所有线程共用一个无锁有界环
+	YPoolSteal		// 每线程工作窃取队列 + 无锁注入队列
+};
+
+// 启动参数, 由main解析后传给CChatServer和各事件循环
+struct YondServerOpt
+{
+	int nLoops = 0;							// 事件循环个数, 0表示每个核一个
+	YondEngine eEngine = YEngineEpoll;
+	YondPoolMode ePool = YPoolShared;
+	size_t nHighWater = 4 * 1024 * 1024;	// 单连接出站队列的字节上限
+	YondOverflow eOverflow = YOverflowClose;
+	size_t nZeroCopyMin = 0;				// 不小于该字节数的帧用MSG_ZEROCOPY发送, 0表示关闭
+	size_t nBatchBytes = 16 * 1024;			// 发给v2连接的广播每轮合成YBatch的负载上限, 0表示不合并
+	unsigned nFlushDelayUs = 0;				// 忙时出站帧最多攒多少微秒再一起发, 0表示每轮循环末尾即发
+	unsigned short nFilePort = 8888;		// 文件中转服务端口, 0表示不启动
+	std::string strSpoolDir = "spool";		// 中转文件的暂存目录
+	unsigned nPartKeepSec = 24 * 3600;		// 未传完的上传保留多少秒等待续传, 0表示断开即删除
+	int64_t nUploadMax = 4LL * 1024 * 1024 * 1024;	// 单个中转上传的字节上限, 超过的握手回ERR too large
+};
@@ -2,137 +2,136 @@
 #include <string>
 #include <string.h>
 #include <stdlib.h>
-#include <arpa/inet.h>  // ntohs, ntohl
 #include <cstring>      // memcpy
 #include <cstdint>
+#include <string_view>
 #include "CYondLog.h"
+#include "../LetsChat_common/CYondCodec.h"
 
-enum YondCmd
+// 连接协商出的线上格式, 按位组合
+#define YOND_WIRE_CRC 0x01	// 帧尾用CRC32C
+#define YOND_WIRE_V2 0x02	// v2紧凑帧头, 可以收YBatch
+#define YOND_WIRE_MODES 4
+
+class CYondPack;
+
+// 不持有数据的帧视图: 在输入缓冲上原地校验一帧, 头部字段和负载都直接从缓冲读取.
+// 缓冲被消费或复用后视图失效, 消息需要比缓冲活得久时才用ToPack或CYondPayload::Copy复制
+class CYondPackView
 {
-	YConnect,
-	YMsg,
-	YFile,
-	YRecv,
+public:
+	CYondPackView() : m_pData(nullptr), m_head() {}
+
+	// 流式解析, 帧格式和丢弃规则见CYondCodec::DecodeStream. 校验和或CRC错误记日志后按坏帧返回
+	int Decode(const unsigned char* pData, size_t nSize, size_t& nUsed) {
+		int ret = CYondCodec::DecodeStream(pData, nSize, nUsed, m_head);
+		if (ret == YDecodeBadSum) {
+			LOG_ERROR(YOND_ERR_PACKET_SUMCHECK, "Packet sum check error!!");
+			return YDecodeBad;
+		}
+		m_pData = pData;
+		return ret;
+	}
+
+	// 以下只在Decode返回YDecodeFrame后有效
+	YondCmd Cmd() const { return (YondCmd)m_head.sCmd; }
+	unsigned short User() const { return (unsigned short)m_head.sUser; }
+	unsigned Version() const { return m_head.nVersion; }
+	uint32_t Length() const { return m_head.nLength; }
+	bool Crc() const { return m_head.bCrc; }
+	// 本帧的格式, 按位组合的YOND_WIRE_*
+	unsigned Wire() const { return (m_head.bCrc ? YOND_WIRE_CRC : 0) | (m_head.nVersion >= YOND_PROTO_V2 ? YOND_WIRE_V2 : 0); }
+	// 帧尾的校验值: CRC32C帧为32位CRC, 否则为16位字节和
+	uint32_t Check() const {
+		return CYondCodec::Get(m_pData + m_head.nBody + m_head.nBodySize, m_head.bCrc ? YFieldCrc : YFieldSum);
+	}
+	std::string_view Body() const { return std::string_view((const char*)m_pData + m_head.nBody, m_head.nBodySize); }
+	size_t FrameSize() const { return m_head.nFrame; }
+	// Decode返回YDecodeMore时, 丢弃nUsed字节后还要凑够的输入长度
+	size_t Want() const { return m_head.nWant; }
+	// 复制出持有数据的包
+	CYondPack ToPack() const;
 
-	YNULL
+private:
+	const unsigned char* m_pData;	// Decode的输入, 负载位置相对它计算
+	YondFrameHead m_head;
 };
 
 class CYondPack
 {
 public:
-	CYondPack() :m_sHead(0), m_nLength(0), m_sCmd(YNULL), m_sUser(NULL), m_sSum(0) {}
+	CYondPack() :m_sHead(0), m_nLength(0), m_sCmd(YNULL), m_sUser(0), m_pBody(nullptr), m_nBody(0), m_bCrc(false), m_nCheck(0) {}
 	CYondPack(YondCmd sCmd, const char* pData, size_t nSize) {
-		m_sHead = 0xFEFF;
+		m_sHead = YOND_FRAME_MAGIC;
 		m_nLength = nSize + 4;
 		m_sCmd = sCmd;
+		m_sUser = 0;
+		m_pBody = nullptr;
+		m_nBody = 0;
+		m_bCrc = false;
+		m_nCheck = 0;
 		if (nSize > 0) {
-			m_strData.reserve(nSize);
-			memcpy((void*)m_strData.c_str(), pData, nSize);
+			m_strData.assign(pData, nSize);
 		}
 		else {
 			m_strData.clear();
 		}
-		m_sSum = 0;
-		for (size_t i = 0; i < m_strData.size(); i++) {
-			m_sSum += (unsigned char)(m_strData[i] & 0xFF);
-		}
 	}
 	CYondPack(const CYondPack& pack) {
 		m_sHead = pack.m_sHead;
 		m_nLength = pack.m_nLength;
 		m_sCmd = pack.m_sCmd;
+		m_sUser = pack.m_sUser;
 		m_strData = pack.m_strData;
-		m_sSum = pack.m_sSum;
+		m_pBody = nullptr;
+		m_nBody = 0;
+		m_bCrc = pack.m_bCrc;
+		m_nCheck = pack.m_nCheck;
 	}
-	CYondPack(const unsigned char* pData, size_t& nSize) {
-		// 打印接收到的原始数据
-		LOG_INFO("Received raw data:");
-		for (size_t i = 0; i < nSize; i++) {
-			printf("%02X ", pData[i]);
-		}
-		printf("\r\n");
-
-		// 查找消息头部
-		size_t i = 0;
-		for (; i < nSize - 1; i++) {
-			uint16_t header;
-			memcpy(&header, pData + i, sizeof(header));
-			header = ntohs(header);
-
-			if (header == 0xFEFF) {
-				m_sHead = header;
-				LOG_INFO("Found message header 0xFEFF at position" + std::to_string(i));
-				i += 2;
-				break;
-			}
-		}
-		if (i + 4 + 2 + 2 + 2 > nSize) {
-			nSize = 0;
-			LOG_ERROR(YOND_ERR_RECV_PACKET, "Incomplete packet header!");
-			return;
-		}
-		uint32_t len32;
-		memcpy(&len32, pData + i, sizeof(len32));
-		m_nLength = ntohl(len32);
-		i += 4;
-		if (m_nLength + i > nSize) {
-			nSize = 0;
+	// 从pData解出一帧并复制负载, nSize返回帧之后剩余的字节数, 失败时为0
+	CYondPack(const unsigned char* pData, size_t& nSize) : CYondPack() {
+		LOG_HEXDUMP("Received raw data", pData, nSize);
+		CYondPackView view;
+		size_t nUsed = 0;
+		if (view.Decode(pData, nSize, nUsed) != YDecodeFrame) {
 			LOG_ERROR(YOND_ERR_RECV_PACKET, "Failed to recv the packet!!");
+			nSize = 0;
 			return;
 		}
-		uint16_t cmd16;
-		memcpy(&cmd16, pData + i, sizeof(cmd16));
-		m_sCmd = (YondCmd)ntohs(cmd16);
-		i += 2;
-
-		uint16_t user16;
-		memcpy(&user16, pData + i, sizeof(user16));
-		m_sUser = ntohs(user16);
-		i += 2;
-
-		if (m_nLength > 4) {
-			m_strData.resize(m_nLength - 2 - 2);
-			memcpy((void*)m_strData.c_str(), pData + i, m_nLength - 4);
-			i += m_nLength - 4;
-		}
-		uint16_t sum16;
-		memcpy(&sum16, pData + i, sizeof(sum16));
-		m_sSum = htons(sum16);
-		unsigned short sum = 0;
-		for (size_t j = 0; j < m_strData.size(); j++) {
-			sum += (unsigned char)((m_strData[j]) & 0xFF);
-		}
-		if (sum == m_sSum) {
-			nSize -= i;
-			LOG_INFO("Sum check is success:" + std::to_string(m_sSum));
-			return;
-		}
-		LOG_ERROR(YOND_ERR_PACKET_SUMCHECK, "Packet sum check error!!");
-		nSize = 0;
+		*this = view.ToPack();
+		nSize -= nUsed;
 	}
+	// 流式解析, 规则同CYondPackView::Decode. 负载不复制, m_pBody指向pData内部, 调用方丢弃输入前必须取走
+	int Decode(const unsigned char* pData, size_t nSize, size_t& nUsed);
 	~CYondPack() {};
 	CYondPack& operator=(const CYondPack& pack) {
 		if (this != &pack) {
 			m_sHead = pack.m_sHead;
 			m_nLength = pack.m_nLength;
 			m_sCmd = pack.m_sCmd;
+			m_sUser = pack.m_sUser;
 			m_strData = pack.m_strData;
-			m_sSum = pack.m_sSum;
+			// 与复制构造相同: 负载视图指向对方的输入缓冲, 不复制, 也不保留自己原来的
+			m_pBody = nullptr;
+			m_nBody = 0;
+			m_bCrc = pack.m_bCrc;
+			m_nCheck = pack.m_nCheck;
 		}
 		return *this;
 	}
-	size_t Size() {
-		return m_nLength + 6;
+	static size_t FrameSize(size_t nData, bool bCrc = false) {
+		return CYondCodec::FrameSize(nData, bCrc);
+	}
+	// 把一帧直接写入pOut, pOut至少FrameSize(nData, bCrc)字节
+	static size_t Encode(char* pOut, YondCmd sCmd, unsigned short sUser, const char* pData, size_t nData, bool bCrc = false) {
+		return CYondCodec::Encode(pOut, FrameSize(nData, bCrc), sCmd, sUser, pData, nData, bCrc);
 	}
-	std::string Data() {
-		m_strOut.resize(m_nLength + 6);
-		char* pData = (char*)m_strOut.c_str();
-		*(unsigned short*)pData = m_sHead; pData += 2;
-		*(unsigned long*)pData = m_nLength; pData += 4;
-		*(YondCmd*)pData = m_sCmd; pData += 2;
-		memcpy(pData, m_strData.c_str(), m_strData.size()); pData += m_strData.size();
-		*(unsigned short*)pData = m_sSum;
-		return m_strOut;
+	size_t Size() const {
+		return FrameSize(m_strData.size(), m_bCrc);
+	}
+	// 按m_bCrc选择的校验方式序列化到调用方的缓冲, nCap不足Size()时返回0
+	size_t Serialize(char* pOut, size_t nCap) const {
+		return CYondCodec::Encode(pOut, nCap, m_sCmd, (unsigned short)m_sUser, m_strData.data(), m_strData.size(), m_bCrc);
 	}
 public:
 	unsigned short m_sHead;
@@ -140,6 +139,34 @@ public:
 	YondCmd m_sCmd;
 	short m_sUser;
 	std::string m_strData;
-	unsigned short m_sSum;
-	std::string m_strOut;
-};
\ No newline at end of file
+	const char* m_pBody;	// Decode解出的负载, 指向输入缓冲
+	size_t m_nBody;
+	bool m_bCrc;		// 解出的帧是否为CRC32C帧, 序列化时沿用
+	uint32_t m_nCheck;	// 解出的帧尾校验值, 自行构造的包为0, 序列化时才计算
+};
+
+inline int CYondPack::Decode(const unsigned char* pData, size_t nSize, size_t& nUsed) {
+	CYondPackView view;
+	int ret = view.Decode(pData, nSize, nUsed);
+	if (ret != YDecodeFrame) {
+		return ret;
+	}
+	m_sHead = YOND_FRAME_MAGIC;
+	m_nLength = view.Length();
+	m_sCmd = view.Cmd();
+	m_sUser = (short)view.User();
+	m_pBody = view.Body().data();
+	m_nBody = view.Body().size();
+	m_bCrc = view.Crc();
+	m_nCheck = view.Check();
+	return ret;
+}
+
+inline CYondPack CYondPackView::ToPack() const {
+	std::string_view body = Body();
+	CYondPack pack(Cmd(), body.data(), body.size());
+	pack.m_sUser = (short)User();
+	pack.m_bCrc = Crc();
+	pack.m_nCheck = Check();
+	return pack;
+}
\ No newline at end of file
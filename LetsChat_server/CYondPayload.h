@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <cstddef>
+#include <string.h>
+#include "CYondTask.h"
+
+#define PAYLOAD_BLOCK_SIZE 2048	// 池化块的数据容量, 覆盖绝大多数聊天消息
+#define PAYLOAD_POOL_MAX 4096		// 空闲块上限, 超出的直接释放
+
+// 消息负载块: 引用计数在块头, 数据紧随其后
+struct YondPayloadBlock
+{
+	std::atomic<int> nRef;
+	size_t nCap;
+	char* Data() { return (char*)(this + 1); }
+};
+
+// 固定大小负载块的全局空闲表, 用无锁环保存空闲块指针, 多个循环线程取、工作线程还
+class CYondPayloadPool
+{
+public:
+	static CYondPayloadPool& Instance() {
+		static CYondPayloadPool pool;
+		return pool;
+	}
+
+	YondPayloadBlock* Get(size_t nSize) {
+		YondPayloadBlock* pBlock = nullptr;
+		if (nSize <= PAYLOAD_BLOCK_SIZE) {
+			if (!m_free.TryPop(pBlock)) {
+				pBlock = New(PAYLOAD_BLOCK_SIZE);
+			}
+		}
+		else {
+			// 超大负载不进池
+			pBlock = New(nSize);
+		}
+		pBlock->nRef.store(1, std::memory_order_relaxed);
+		return pBlock;
+	}
+
+	void Put(YondPayloadBlock* pBlock) {
+		if (pBlock->nCap != PAYLOAD_BLOCK_SIZE || !m_free.TryPush(std::move(pBlock))) {
+			::operator delete(pBlock);
+		}
+	}
+
+private:
+	CYondPayloadPool() : m_free(PAYLOAD_POOL_MAX) {}
+	~CYondPayloadPool() {
+		YondPayloadBlock* pBlock = nullptr;
+		while (m_free.TryPop(pBlock)) {
+			::operator delete(pBlock);
+		}
+	}
+
+	static YondPayloadBlock* New(size_t nCap) {
+		YondPayloadBlock* pBlock = (YondPayloadBlock*)::operator new(sizeof(YondPayloadBlock) + nCap);
+		new (&pBlock->nRef) std::atomic<int>(0);
+		pBlock->nCap = nCap;
+		return pBlock;
+	}
+
+	CYondMpmcRing<YondPayloadBlock*> m_free;
+};
+
+// 指向池化负载块的句柄, 复制只增加引用计数, 在循环线程和工作线程之间传递时不复制数据
+class CYondPayload
+{
+public:
+	CYondPayload() : m_pBlock(nullptr), m_nSize(0) {}
+
+	static CYondPayload Copy(const char* pData, size_t nSize) {
+		CYondPayload payload;
+		if (nSize > 0) {
+			payload.m_pBlock = CYondPayloadPool::Instance().Get(nSize);
+			payload.m_nSize = nSize;
+			memcpy(payload.m_pBlock->Data(), pData, nSize);
+		}
+		return payload;
+	}
+
+	CYondPayload(const CYondPayload& other) : m_pBlock(other.m_pBlock), m_nSize(other.m_nSize) {
+		if (m_pBlock != nullptr) {
+			m_pBlock->nRef.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	CYondPayload(CYondPayload&& other) noexcept : m_pBlock(other.m_pBlock), m_nSize(other.m_nSize) {
+		other.m_pBlock = nullptr;
+		other.m_nSize = 0;
+	}
+	CYondPayload& operator=(CYondPayload other) noexcept {
+		std::swap(m_pBlock, other.m_pBlock);
+		std::swap(m_nSize, other.m_nSize);
+		return *this;
+	}
+	~CYondPayload() {
+		if (m_pBlock != nullptr && m_pBlock->nRef.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			CYondPayloadPool::Instance().Put(m_pBlock);
+		}
+	}
+
+	const char* Data() const { return m_pBlock == nullptr ? "" : m_pBlock->Data(); }
+	size_t Size() const { return m_nSize; }
+	bool Empty() const { return m_nSize == 0; }
+	// 需要std::string时才复制(如写日志)
+	std::string Str() const { return std::string(Data(), m_nSize); }
+
+private:
+	YondPayloadBlock* m_pBlock;
+	size_t m_nSize;
+};
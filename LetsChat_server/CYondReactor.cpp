@@ -0,0 +1,403 @@
+#include "CYondReactor.h"
+#include "CYondHandleEvent.h"
+#include "CYondConn.h"
+#include "CYondEpollReactor.h"
+#include "CYondUringReactor.h"
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <netinet/tcp.h>
+
+CYondReactor::CYondReactor(int nIndex, CYondHandleEvent* pHandler, const YondServerOpt& opt)
+	: m_nIndex(nIndex), m_nSockFd(-1), m_nWakeFd(-1),
+	m_bStop(true), m_pHandler(pHandler), m_opt(opt),
+	m_tLastReport(std::chrono::steady_clock::now()), m_nLastBufGets(0), m_pRegistry(&pHandler->Registry()) {
+}
+
+CYondReactor::~CYondReactor() {
+	// 子类析构时已调用Stop, 这里只兜底关闭未打开成功时残留的fd
+	if (m_nSockFd >= 0) close(m_nSockFd);
+	if (m_nWakeFd >= 0) close(m_nWakeFd);
+}
+
+CYondReactor* CYondReactor::Create(int nIndex, CYondHandleEvent* pHandler, const YondServerOpt& opt) {
+	if (opt.eEngine == YEngineUring) {
+		if (CYondUringReactor::Probe()) {
+			return new CYondUringReactor(nIndex, pHandler, opt);
+		}
+		if (nIndex == 0) {
+			LOG_WARNING("io_uring is not available on this kernel, falling back to epoll");
+		}
+	}
+	return new CYondEpollReactor(nIndex, pHandler, opt);
+}
+
+int CYondReactor::InitSocket(unsigned short nPort) {
+	if (m_nSockFd != -1)
+		return LOG_ERROR(YOND_ERR_SOCKET_CREATE, "Socket already initialized");
+
+	m_nSockFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_nSockFd < 0) {
+		return LOG_ERROR(YOND_ERR_SOCKET_CREATE, "Failed to initialize socket");
+	}
+
+	// 每个循环绑定同一端口, 由内核按连接分片到各监听socket
+	int on = 1;
+	if (setsockopt(m_nSockFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+		setsockopt(m_nSockFd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+		close(m_nSockFd);
+		m_nSockFd = -1;
+		return LOG_ERROR(YOND_ERR_SOCKET_OPT, "Failed to set SO_REUSEPORT");
+	}
+
+	memset(&m_addr, 0, sizeof(m_addr));
+	m_addr.sin_family = AF_INET;
+	m_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	m_addr.sin_port = htons(nPort);
+
+	if (bind(m_nSockFd, (sockaddr*)&m_addr, sizeof(m_addr))) {
+		close(m_nSockFd);
+		m_nSockFd = -1;
+		return LOG_ERROR(YOND_ERR_SOCKET_BIND, "Failed to bind socket");
+	}
+
+	if (listen(m_nSockFd, SOMAXCONN)) {
+		close(m_nSockFd);
+		m_nSockFd = -1;
+		return LOG_ERROR(YOND_ERR_SOCKET_LISTEN, "Failed to listen on socket");
+	}
+
+	m_nWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_nWakeFd < 0) {
+		return LOG_ERROR(YOND_ERR_EPOLL_CREATE, "Failed to create reactor wakeup eventfd");
+	}
+
+	int err = InitEngine();
+	if (err != 0) {
+		return err;
+	}
+
+	LOG_INFO("Reactor " + std::to_string(m_nIndex) + " (" + EngineName() + ") socket initialized successfully");
+	return 0;
+}
+
+int CYondReactor::Start() {
+	m_bStop = false;
+	return m_thread.Start([this]() {
+		LOG_INFO("Reactor " + std::to_string(m_nIndex) + " waiting for connections...");
+		Loop();
+	});
+}
+
+int CYondReactor::Stop() {
+	if (!m_bStop.exchange(true)) {
+		uint64_t one = 1;
+		write(m_nWakeFd, &one, sizeof(one));
+		m_thread.Stop();
+	}
+
+	CloseEngine();
+	CloseConns();
+	if (m_nSockFd >= 0) close(m_nSockFd);
+	if (m_nWakeFd >= 0) close(m_nWakeFd);
+	m_nSockFd = m_nWakeFd = -1;
+	return 0;
+}
+
+void CYondReactor::CloseConns() {
+	for (CYondConn* pConn : m_vConns) {
+		m_pRegistry->Close(pConn->m_nId);
+		close(pConn->m_nFd);
+		delete pConn;
+	}
+	m_vConns.clear();
+}
+
+void CYondReactor::Post(CYondTask task) {
+	bool bWake = false;
+	{
+		std::unique_lock<std::mutex> lock(m_inboxLock);
+		bWake = m_vInbox.empty();
+		m_vInbox.emplace_back(std::move(task));
+	}
+	// 队列原本非空时循环必然已被唤醒, 省掉多余的write
+	if (bWake) {
+		uint64_t one = 1;
+		write(m_nWakeFd, &one, sizeof(one));
+	}
+}
+
+// 调用前引擎已读走eventfd计数
+void CYondReactor::DrainInbox() {
+	{
+		std::unique_lock<std::mutex> lock(m_inboxLock);
+		m_vInboxRun.swap(m_vInbox);
+	}
+	for (CYondTask& task : m_vInboxRun) {
+		task();
+	}
+	// 保留容量, 两个数组轮换使用
+	m_vInboxRun.clear();
+	FlushBatch();
+}
+
+void CYondReactor::FlushBatch() {
+	if (m_vBatch.empty()) {
+		return;
+	}
+	std::vector<YondConnId> vOwnIds;
+	for (const YondBatchItem& item : m_vBatch) {
+		vOwnIds.push_back(item.nTarget == YOND_CONN_NONE ? item.nSender : item.nTarget);
+	}
+	std::sort(vOwnIds.begin(), vOwnIds.end());
+
+	// 既不是发送者也不是单发对象的连接收到的内容相同, 按是否CRC32C各编一份共用;
+	// 发送者要去掉自己的消息、单发对象要插入发给它的消息, 单独编
+	std::vector<CYondFramePtr> vShared[2];
+	bool bShared[2] = { false, false };
+	std::vector<CYondFramePtr> vOwn;
+	std::vector<int> vClose;
+	for (CYondConn* pConn : m_vConns) {
+		if (!pConn->m_bLogin || !(pConn->m_nWire & YOND_WIRE_V2)) continue;
+		const std::vector<CYondFramePtr>* pFrames = &vOwn;
+		if (std::binary_search(vOwnIds.begin(), vOwnIds.end(), pConn->m_nId)) {
+			vOwn.clear();
+			BuildBatch(pConn->m_nId, pConn->m_nWire, vOwn);
+		}
+		else {
+			int k = (pConn->m_nWire & YOND_WIRE_CRC) ? 1 : 0;
+			if (!bShared[k]) {
+				BuildBatch(YOND_CONN_NONE, pConn->m_nWire, vShared[k]);
+				bShared[k] = true;
+			}
+			pFrames = &vShared[k];
+		}
+		for (const CYondFramePtr& frame : *pFrames) {
+			if (!SendTo(pConn, frame)) {
+				vClose.push_back(pConn->m_nFd);
+				break;
+			}
+		}
+	}
+	m_vBatch.clear();
+	for (int fd : vClose) {
+		RemoveClient(fd);
+	}
+}
+
+void CYondReactor::BuildBatch(YondConnId selfId, unsigned nWire, std::vector<CYondFramePtr>& vOut) {
+	// 连续的小消息合成YBatch, 负载不超过nBatchBytes; 更大的消息单独发, 只有一条时也不必合并
+	std::vector<const CYondFrame*> vRun;
+	const CYondFramePtr* pFirst = nullptr;
+	size_t nRun = 0;
+	auto flush = [&]() {
+		if (vRun.size() == 1) {
+			vOut.push_back(CYondFrame::As(*pFirst, nWire));
+		}
+		else if (vRun.size() > 1) {
+			vOut.push_back(CYondFrame::MakeBatch(vRun, (nWire & YOND_WIRE_CRC) != 0));
+		}
+		vRun.clear();
+		nRun = 0;
+	};
+	for (const YondBatchItem& item : m_vBatch) {
+		if (item.nTarget == YOND_CONN_NONE ? item.nSender == selfId : item.nTarget != selfId) continue;
+		const CYondFramePtr& frame = item.frame;
+		size_t n = CYondCodec::BatchEntrySize(frame->BodySize(), frame->User() != 0);
+		if (n > m_opt.nBatchBytes) {
+			flush();
+			vOut.push_back(CYondFrame::As(frame, nWire));
+			continue;
+		}
+		if (nRun + n > m_opt.nBatchBytes) {
+			flush();
+		}
+		if (vRun.empty()) {
+			pFirst = &frame;
+		}
+		vRun.push_back(frame.get());
+		nRun += n;
+	}
+	flush();
+}
+
+void CYondReactor::Tick() {
+	auto now = std::chrono::steady_clock::now();
+	if (now - m_tLastReport >= std::chrono::seconds(10)) {
+		m_tLastReport = now;
+		ReportQueueDepth();
+		// 缓冲池是全局的, 由第一个循环报告
+		if (m_nIndex == 0) {
+			ReportBufferPool();
+		}
+	}
+}
+
+void CYondReactor::ReportBufferPool() {
+	YondBufStats stats = CYondBufferPool::Instance().Stats();
+	if (stats.nGets == m_nLastBufGets) return;
+	m_nLastBufGets = stats.nGets;
+	LOG_INFOF("Buffer pool: %llu gets, %.1f%% thread cache hits, %zu bytes resident, %lld bytes in use",
+		(unsigned long long)stats.nGets, stats.nGets > 0 ? 100.0 * stats.nHits / stats.nGets : 0.0,
+		stats.nResident, (long long)stats.nInUse);
+}
+
+CYondConn* CYondReactor::AddConn(int clientFd, const std::string& strIp) {
+	CYondConn* pConn = new CYondConn(clientFd, strIp);
+	pConn->m_nId = m_pRegistry->Open(clientFd, this, pConn);
+	if (pConn->m_nId == YOND_CONN_NONE) {
+		LOG_ERROR(YOND_ERR_CONN_LIMIT, "Connection table is full, rejecting client " + strIp);
+		delete pConn;
+		return nullptr;
+	}
+	pConn->m_nPos = m_vConns.size();
+	m_vConns.push_back(pConn);
+	// 出站帧已按轮合并, 不需要Nagle再延迟小包
+	int on = 1;
+	setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return pConn;
+}
+
+CYondConn* CYondReactor::FindConn(int clientFd) {
+	return m_pRegistry->Get(clientFd, this);
+}
+
+CYondConn* CYondReactor::FindConn(YondConnId id) {
+	CYondConn* pConn = m_pRegistry->Get(id);
+	return (pConn != nullptr && m_pRegistry->Owner(id) == this) ? pConn : nullptr;
+}
+
+void CYondReactor::Login(YondConnId id, const std::string& strName) {
+	CYondConn* pConn = FindConn(id);
+	if (pConn != nullptr) {
+		pConn->SetName(strName);
+	}
+}
+
+void CYondReactor::DetachConn(CYondConn* pConn) {
+	CYondConn* pLast = m_vConns.back();
+	m_vConns[pConn->m_nPos] = pLast;
+	pLast->m_nPos = pConn->m_nPos;
+	m_vConns.pop_back();
+	m_pRegistry->Close(pConn->m_nId);
+}
+
+void CYondReactor::RemoveClient(int clientFd) {
+	CYondConn* pConn = FindConn(clientFd);
+	if (pConn == nullptr) {
+		return;
+	}
+	// 先注销再关闭fd, 之后fd才可能被其他循环复用
+	DetachConn(pConn);
+	close(clientFd);
+	delete pConn;
+}
+
+std::string CYondReactor::ClientName(int clientFd) {
+	CYondConn* pConn = FindConn(clientFd);
+	return pConn == nullptr ? std::string() : pConn->Name();
+}
+
+void CYondReactor::SendToClients(YondConnId senderId, const CYondFramePtr& frame) {
+	std::vector<int> vClose;
+	bool bBatch = false;
+	for (CYondConn* pConn : m_vConns) {
+		// 不发送给发送者和未登录的连接
+		if (pConn->m_nId == senderId || !pConn->m_bLogin) continue;
+		// v2连接的消息全部经过合并队列, 大消息也一样, 保证顺序
+		if ((pConn->m_nWire & YOND_WIRE_V2) && m_opt.nBatchBytes > 0) {
+			bBatch = true;
+			continue;
+		}
+		if (!SendTo(pConn, CYondFrame::As(frame, pConn->m_nWire))) {
+			vClose.push_back(pConn->m_nFd);
+		}
+	}
+	if (bBatch) {
+		m_vBatch.push_back({ senderId, YOND_CONN_NONE, frame });
+	}
+	for (int fd : vClose) {
+		RemoveClient(fd);
+	}
+}
+
+void CYondReactor::SendToOne(YondConnId id, const CYondFramePtr& frame) {
+	CYondConn* pConn = FindConn(id);
+	if (pConn == nullptr) {
+		return;
+	}
+	// 与广播走同一条合并队列, 否则会越过本轮已记下、还没发出的广播
+	if (pConn->m_bLogin && (pConn->m_nWire & YOND_WIRE_V2) && m_opt.nBatchBytes > 0) {
+		m_vBatch.push_back({ YOND_CONN_NONE, id, frame });
+		return;
+	}
+	if (!SendTo(pConn, CYondFrame::As(frame, pConn->m_nWire))) {
+		RemoveClient(pConn->m_nFd);
+	}
+}
+
+bool CYondReactor::SendTo(CYondConn* pConn, const CYondFramePtr& frame) {
+	// 单帧可以超过高水位, 只有已有积压时才触发策略
+	if (!pConn->OutEmpty() && pConn->OutBytes() + frame->Size() > m_opt.nHighWater) {
+		if (m_opt.eOverflow == YOverflowClose) {
+			LOG_WARNING("Client " + pConn->Name() + " fell behind with " +
+				std::to_string(pConn->OutBytes()) + " bytes queued, disconnecting");
+			return false;
+		}
+		if (pConn->m_nDropped++ == 0) {
+			LOG_WARNING("Client " + pConn->Name() + " fell behind with " +
+				std::to_string(pConn->OutBytes()) + " bytes queued, dropping frames");
+		}
+		return true;
+	}
+
+	bool bIdle = pConn->OutEmpty();
+	pConn->OutPush(frame);
+	// 队列原本非空说明在等可写通知, 此时send必然EAGAIN
+	if (bIdle && !pConn->m_bPending) {
+		if (m_vPending.empty()) {
+			m_tPending = std::chrono::steady_clock::now();
+		}
+		pConn->m_bPending = true;
+		m_vPending.push_back(pConn->m_nId);
+	}
+	return true;
+}
+
+long CYondReactor::PendingWaitUs() const {
+	if (m_vPending.empty()) {
+		return -1;
+	}
+	if (m_opt.nFlushDelayUs == 0) {
+		return 0;
+	}
+	auto wait = m_tPending + std::chrono::microseconds(m_opt.nFlushDelayUs) - std::chrono::steady_clock::now();
+	long us = (long)std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+	return us > 0 ? us : 0;
+}
+
+void CYondReactor::FlushPending() {
+	if (PendingWaitUs() != 0) {
+		return;
+	}
+	m_vPendingRun.swap(m_vPending);
+	for (YondConnId id : m_vPendingRun) {
+		// 连接可能已在本轮断开
+		CYondConn* pConn = FindConn(id);
+		if (pConn == nullptr) continue;
+		pConn->m_bPending = false;
+		if (!pConn->OutEmpty() && !FlushOut(pConn)) {
+			RemoveClient(pConn->m_nFd);
+		}
+	}
+	m_vPendingRun.clear();
+}
+
+void CYondReactor::ReportQueueDepth() {
+	for (const CYondConn* pConn : m_vConns) {
+		if (pConn->OutEmpty() && pConn->m_nDropped == 0) continue;
+		LOG_INFO("Reactor " + std::to_string(m_nIndex) + " client " + pConn->Name() +
+			" queue depth: " + std::to_string(pConn->OutFrames()) + " frames, " +
+			std::to_string(pConn->OutBytes()) + " bytes, dropped " + std::to_string(pConn->m_nDropped));
+	}
+}
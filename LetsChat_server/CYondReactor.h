@@ -0,0 +1,121 @@
+#pragma once
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include "CYondTask.h"
+#include <chrono>
+#include "CYondLog.h"
+#include "CYondThreadPool.h"
+#include "CYondOpt.h"
+#include "CYondFrame.h"
+#include "CYondConnRegistry.h"
+
+#define OUT_IOV_MAX 64
+
+class CYondHandleEvent;
+class CYondConn;
+
+// 本轮待合并的一条消息: nTarget为YOND_CONN_NONE时是广播, 发给除nSender外的v2连接, 否则只发给nTarget
+struct YondBatchItem
+{
+	YondConnId nSender;
+	YondConnId nTarget;
+	CYondFramePtr frame;
+};
+
+// 单个事件循环: 独立的监听socket(SO_REUSEPORT)、I/O引擎和投递队列,
+// 只在本循环线程上访问自己接受的连接. I/O引擎(epoll/io_uring)由子类实现
+class CYondReactor
+{
+public:
+	CYondReactor(int nIndex, CYondHandleEvent* pHandler, const YondServerOpt& opt);
+	virtual ~CYondReactor();
+
+	// 按opt.eEngine创建事件循环, 内核不支持io_uring时退回epoll
+	static CYondReactor* Create(int nIndex, CYondHandleEvent* pHandler, const YondServerOpt& opt);
+
+	int InitSocket(unsigned short nPort);
+	int Start();
+	int Stop();
+
+	// 线程安全: 把任务投递到本循环线程执行
+	void Post(CYondTask task);
+
+	// 以下接口只能在本循环线程调用
+	// 登记新连接, fd超出连接表容量时返回nullptr, 由调用方关闭fd
+	CYondConn* AddConn(int clientFd, const std::string& strIp);
+	CYondConn* FindConn(int clientFd);
+	// 按标识查找, fd已被复用时返回nullptr
+	CYondConn* FindConn(YondConnId id);
+	void Login(YondConnId id, const std::string& strName);
+	virtual void RemoveClient(int clientFd);
+	std::string ClientName(int clientFd);
+	// 广播给本循环除发送者外已登录的连接. 协商了v2的连接先记下, 本轮投递任务处理完后合并发送
+	void SendToClients(YondConnId senderId, const CYondFramePtr& frame);
+	// 只发给一个连接, 连接已断开时忽略. v2连接同样经过合并队列, 不会越过本轮先到的广播
+	void SendToOne(YondConnId id, const CYondFramePtr& frame);
+	// 帧入出站队列, 由循环末尾的FlushPending统一发送; 返回false表示连接应被关闭
+	bool SendTo(CYondConn* pConn, const CYondFramePtr& frame);
+	// 打印本循环中出站队列非空的连接
+	void ReportQueueDepth();
+	// 打印输入缓冲池的命中率和占用, 与上次报告相比没有借还时不打印
+	void ReportBufferPool();
+
+	int Index() const { return m_nIndex; }
+	virtual const char* EngineName() const = 0;
+
+protected:
+	// 监听socket和eventfd就绪后由InitSocket调用, 建立引擎自己的资源
+	virtual int InitEngine() = 0;
+	virtual int Loop() = 0;
+	// 发送出站队列, 返回false表示连接应被关闭
+	virtual bool FlushOut(CYondConn* pConn) = 0;
+	// 循环线程退出后释放引擎资源
+	virtual void CloseEngine() = 0;
+
+	// 从连接数组和连接表摘除, 不关闭fd也不释放
+	void DetachConn(CYondConn* pConn);
+	void DrainInbox();
+	// 把本轮记下的广播发给v2连接
+	void FlushBatch();
+	// 按顺序把发给selfId的待合并消息切成要发的帧: 跳过它自己发出的广播, 带上只发给它的;
+	// selfId为YOND_CONN_NONE时只取广播
+	void BuildBatch(YondConnId selfId, unsigned nWire, std::vector<CYondFramePtr>& vOut);
+	// 每轮循环末尾调用, 把入队的帧按连接一次发出. 设置了nFlushDelayUs时最早的帧等够才发
+	void FlushPending();
+	// 距离FlushPending需要发送还有多少微秒, 没有待发帧时返回-1. 引擎据此设置等待超时
+	long PendingWaitUs() const;
+	// 每轮循环调用, 处理周期性任务
+	void Tick();
+	void CloseConns();
+
+	int m_nIndex;
+	int m_nSockFd;
+	int m_nWakeFd;
+	sockaddr_in m_addr;
+	std::atomic<bool> m_bStop;
+	CYondThread m_thread;
+	CYondHandleEvent* m_pHandler;
+	YondServerOpt m_opt;
+	std::chrono::steady_clock::time_point m_tLastReport;
+	uint64_t m_nLastBufGets;
+
+	std::mutex m_inboxLock;
+	std::vector<CYondTask> m_vInbox;
+	std::vector<CYondTask> m_vInboxRun;	// 只由循环线程访问
+	// 本轮待合并的消息, 只由循环线程访问
+	std::vector<YondBatchItem> m_vBatch;
+	// 出站队列由空变为非空、等待本轮末尾发送的连接, 及其中最早一帧入队的时间
+	std::vector<YondConnId> m_vPending;
+	std::vector<YondConnId> m_vPendingRun;
+	std::chrono::steady_clock::time_point m_tPending;
+
+	CYondConnRegistry* m_pRegistry;
+	// 本循环接受的连接, 连续存放便于广播遍历, 删除时与末尾交换
+	std::vector<CYondConn*> m_vConns;
+};
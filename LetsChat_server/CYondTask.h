@@ -0,0 +1,189 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#define TASK_INLINE_SIZE 64	// 捕获不超过该字节数的可调用对象直接存放在任务内部
+
+// 只能移动的任务类型: 小的可调用对象放在内联缓冲中, 入队出队不分配内存;
+// 超过TASK_INLINE_SIZE或移动可能抛异常时才退回堆上
+class CYondTask
+{
+public:
+	CYondTask() : m_pOps(nullptr) {}
+
+	template<class F, class = typename std::enable_if<
+		!std::is_same<typename std::decay<F>::type, CYondTask>::value>::type>
+	CYondTask(F&& f) : m_pOps(nullptr) {
+		typedef typename std::decay<F>::type Fn;
+		if (sizeof(Fn) <= TASK_INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) &&
+			std::is_nothrow_move_constructible<Fn>::value) {
+			new (m_buf) Fn(std::forward<F>(f));
+			m_pOps = &InlineOps<Fn>::ops;
+		}
+		else {
+			*(Fn**)m_buf = new Fn(std::forward<F>(f));
+			m_pOps = &HeapOps<Fn>::ops;
+		}
+	}
+
+	CYondTask(CYondTask&& other) noexcept : m_pOps(other.m_pOps) {
+		if (m_pOps != nullptr) {
+			m_pOps->pfnMove(m_buf, other.m_buf);
+			other.m_pOps = nullptr;
+		}
+	}
+
+	CYondTask& operator=(CYondTask&& other) noexcept {
+		if (this != &other) {
+			Reset();
+			m_pOps = other.m_pOps;
+			if (m_pOps != nullptr) {
+				m_pOps->pfnMove(m_buf, other.m_buf);
+				other.m_pOps = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	CYondTask(const CYondTask&) = delete;
+	CYondTask& operator=(const CYondTask&) = delete;
+
+	~CYondTask() {
+		Reset();
+	}
+
+	void operator()() {
+		m_pOps->pfnInvoke(m_buf);
+	}
+
+	explicit operator bool() const { return m_pOps != nullptr; }
+
+	void Reset() {
+		if (m_pOps != nullptr) {
+			m_pOps->pfnDestroy(m_buf);
+			m_pOps = nullptr;
+		}
+	}
+
+private:
+	struct Ops
+	{
+		void (*pfnInvoke)(void* pBuf);
+		void (*pfnMove)(void* pDst, void* pSrc);	// 移动后销毁源对象
+		void (*pfnDestroy)(void* pBuf);
+	};
+
+	template<class Fn>
+	struct InlineOps
+	{
+		static void Invoke(void* pBuf) { (*(Fn*)pBuf)(); }
+		static void Move(void* pDst, void* pSrc) {
+			new (pDst) Fn(std::move(*(Fn*)pSrc));
+			((Fn*)pSrc)->~Fn();
+		}
+		static void Destroy(void* pBuf) { ((Fn*)pBuf)->~Fn(); }
+		static constexpr Ops ops = { Invoke, Move, Destroy };
+	};
+
+	template<class Fn>
+	struct HeapOps
+	{
+		static void Invoke(void* pBuf) { (**(Fn**)pBuf)(); }
+		static void Move(void* pDst, void* pSrc) { *(Fn**)pDst = *(Fn**)pSrc; }
+		static void Destroy(void* pBuf) { delete *(Fn**)pBuf; }
+		static constexpr Ops ops = { Invoke, Move, Destroy };
+	};
+
+	alignas(std::max_align_t) unsigned char m_buf[TASK_INLINE_SIZE];
+	const Ops* m_pOps;
+};
+
+// Vyukov有界MPMC环形队列: 每个槽位带序号, 生产者和消费者各自CAS推进位置,
+// 不加锁也不分配内存. 容量必须为2的幂, 满时TryPush返回false由调用方决定等待或丢弃
+template<class T>
+class CYondMpmcRing
+{
+public:
+	explicit CYondMpmcRing(size_t nCapacity)
+		: m_pCells(new Cell[nCapacity]), m_nMask(nCapacity - 1), m_nEnqueue(0), m_nDequeue(0) {
+		for (size_t i = 0; i < nCapacity; i++) {
+			m_pCells[i].nSeq.store(i, std::memory_order_relaxed);
+		}
+	}
+	~CYondMpmcRing() {
+		T item;
+		while (TryPop(item)) {}
+		delete[] m_pCells;
+	}
+	CYondMpmcRing(const CYondMpmcRing&) = delete;
+	CYondMpmcRing& operator=(const CYondMpmcRing&) = delete;
+
+	bool TryPush(T&& item) {
+		Cell* pCell;
+		size_t nPos = m_nEnqueue.load(std::memory_order_relaxed);
+		while (true) {
+			pCell = &m_pCells[nPos & m_nMask];
+			size_t nSeq = pCell->nSeq.load(std::memory_order_acquire);
+			intptr_t nDiff = (intptr_t)nSeq - (intptr_t)nPos;
+			if (nDiff == 0) {
+				if (m_nEnqueue.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed)) break;
+			}
+			else if (nDiff < 0) {
+				return false;
+			}
+			else {
+				nPos = m_nEnqueue.load(std::memory_order_relaxed);
+			}
+		}
+		new (pCell->storage) T(std::move(item));
+		pCell->nSeq.store(nPos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool TryPop(T& item) {
+		Cell* pCell;
+		size_t nPos = m_nDequeue.load(std::memory_order_relaxed);
+		while (true) {
+			pCell = &m_pCells[nPos & m_nMask];
+			size_t nSeq = pCell->nSeq.load(std::memory_order_acquire);
+			intptr_t nDiff = (intptr_t)nSeq - (intptr_t)(nPos + 1);
+			if (nDiff == 0) {
+				if (m_nDequeue.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed)) break;
+			}
+			else if (nDiff < 0) {
+				return false;
+			}
+			else {
+				nPos = m_nDequeue.load(std::memory_order_relaxed);
+			}
+		}
+		T* pItem = (T*)pCell->storage;
+		item = std::move(*pItem);
+		pItem->~T();
+		pCell->nSeq.store(nPos + m_nMask + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 近似值, 只用于统计
+	size_t Size() const {
+		size_t nEnq = m_nEnqueue.load(std::memory_order_relaxed);
+		size_t nDeq = m_nDequeue.load(std::memory_order_relaxed);
+		return nEnq > nDeq ? nEnq - nDeq : 0;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> nSeq;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	Cell* m_pCells;
+	size_t m_nMask;
+	// 生产者和消费者位置分开缓存行, 避免互相失效
+	alignas(64) std::atomic<size_t> m_nEnqueue;
+	alignas(64) std::atomic<size_t> m_nDequeue;
+};
@@ -3,10 +3,25 @@
 #include <mutex>
 #include <thread>
 #include <vector>
-#include <queue>
 #include <functional>
-#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include "CYondLog.h"
+#include "CYondOpt.h"
+#include "CYondTask.h"
+
+#define STRAND_BATCH 64
+#define STEAL_DEQUE_INIT 256	// 工作线程本地双端队列的初始容量, 满时翻倍
+#define STEAL_SPIN 64			// 无任务时休眠前的自旋轮数
+#define STEAL_INJECT_BATCH 32	// 从注入队列一次搬到本地队列的最大任务数
+#define POOL_QUEUE_SIZE 16384	// 共享模式任务环的容量, 满时转入溢出队列
+#define POOL_PAUSE_MARK (POOL_QUEUE_SIZE * 3 / 4)	// 排队任务超过该数时事件循环暂停读取
+#define STRAND_PAUSE_MARK 4096	// strand积压的任务超过该数时暂停读取所属连接
+#define TASK_NODE_POOL_MAX 8192	// 空闲任务节点上限
 
 class CYondThread {
 public:
@@ -70,28 +85,229 @@ private:
 	bool m_bIsRunning;
 };
 
+// 线程池与strand共用的任务节点, 通过Alloc/Free复用, 稳态下不分配内存
+struct YondTaskNode
+{
+	YondTaskNode() : pNext(nullptr) {}
+	std::atomic<YondTaskNode*> pNext;
+	CYondTask task;
+
+	template<class F>
+	static YondTaskNode* Alloc(F&& f) {
+		YondTaskNode* pNode = nullptr;
+		if (!FreeList().TryPop(pNode)) {
+			pNode = new YondTaskNode();
+		}
+		pNode->task = CYondTask(std::forward<F>(f));
+		return pNode;
+	}
+
+	static void Free(YondTaskNode* pNode) {
+		pNode->task.Reset();
+		if (!FreeList().TryPush(std::move(pNode))) {
+			delete pNode;
+		}
+	}
+
+private:
+	// 分配和释放通常在不同线程, 用无锁环而不是链表栈, 避免ABA问题
+	struct NodeRing : CYondMpmcRing<YondTaskNode*>
+	{
+		NodeRing() : CYondMpmcRing<YondTaskNode*>(TASK_NODE_POOL_MAX) {}
+		~NodeRing() {
+			YondTaskNode* pNode = nullptr;
+			while (TryPop(pNode)) {
+				delete pNode;
+			}
+		}
+	};
+	static NodeRing& FreeList() {
+		static NodeRing ring;
+		return ring;
+	}
+};
+
+// Vyukov侵入式MPSC队列: 多个生产者交换头指针入队, 同一时刻只能有一个消费者出队.
+// 生产者交换头指针后、链接完成前, Pop可能暂时返回nullptr
+class CYondTaskQueue
+{
+public:
+	CYondTaskQueue() : m_pHead(&m_stub), m_pTail(&m_stub) {}
+	CYondTaskQueue(const CYondTaskQueue&) = delete;
+	CYondTaskQueue& operator=(const CYondTaskQueue&) = delete;
+
+	void Push(YondTaskNode* pNode) {
+		pNode->pNext.store(nullptr, std::memory_order_relaxed);
+		YondTaskNode* pPrev = m_pHead.exchange(pNode, std::memory_order_acq_rel);
+		pPrev->pNext.store(pNode, std::memory_order_release);
+	}
+
+	YondTaskNode* Pop() {
+		YondTaskNode* pTail = m_pTail;
+		YondTaskNode* pNext = pTail->pNext.load(std::memory_order_acquire);
+		if (pTail == &m_stub) {
+			if (pNext == nullptr) return nullptr;
+			m_pTail = pNext;
+			pTail = pNext;
+			pNext = pNext->pNext.load(std::memory_order_acquire);
+		}
+		if (pNext != nullptr) {
+			m_pTail = pNext;
+			return pTail;
+		}
+		if (pTail != m_pHead.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		// 取最后一个节点前先把占位节点放回队列
+		Push(&m_stub);
+		pNext = pTail->pNext.load(std::memory_order_acquire);
+		if (pNext != nullptr) {
+			m_pTail = pNext;
+			return pTail;
+		}
+		return nullptr;
+	}
+
+private:
+	YondTaskNode m_stub;
+	std::atomic<YondTaskNode*> m_pHead;
+	YondTaskNode* m_pTail;	// 只由消费者访问
+};
+
+// Chase-Lev工作窃取双端队列: 所属线程在底部Push/Take, 其他线程从顶部Steal.
+// 扩容后旧数组可能仍被窃取者读取, 留到析构时释放
+class CYondStealDeque
+{
+public:
+	CYondStealDeque() : m_nTop(0), m_nBottom(0) {
+		m_pArray.store(NewArray(STEAL_DEQUE_INIT), std::memory_order_relaxed);
+	}
+	~CYondStealDeque() {
+		delete m_pArray.load(std::memory_order_relaxed);
+		for (Array* pOld : m_vRetired) {
+			delete pOld;
+		}
+	}
+	CYondStealDeque(const CYondStealDeque&) = delete;
+	CYondStealDeque& operator=(const CYondStealDeque&) = delete;
+
+	void Push(YondTaskNode* pNode) {
+		int64_t b = m_nBottom.load(std::memory_order_relaxed);
+		int64_t t = m_nTop.load(std::memory_order_acquire);
+		Array* pArr = m_pArray.load(std::memory_order_relaxed);
+		if (b - t > pArr->nSize - 1) {
+			pArr = Grow(pArr, t, b);
+		}
+		pArr->Put(b, pNode);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_nBottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	YondTaskNode* Take() {
+		int64_t b = m_nBottom.load(std::memory_order_relaxed) - 1;
+		Array* pArr = m_pArray.load(std::memory_order_relaxed);
+		m_nBottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = m_nTop.load(std::memory_order_relaxed);
+		if (t > b) {
+			m_nBottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		YondTaskNode* pNode = pArr->Get(b);
+		if (t == b) {
+			// 只剩最后一个, 与窃取者竞争
+			if (!m_nTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				pNode = nullptr;
+			}
+			m_nBottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return pNode;
+	}
+
+	YondTaskNode* Steal() {
+		int64_t t = m_nTop.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = m_nBottom.load(std::memory_order_acquire);
+		if (t >= b) {
+			return nullptr;
+		}
+		YondTaskNode* pNode = m_pArray.load(std::memory_order_acquire)->Get(t);
+		if (!m_nTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return nullptr;
+		}
+		return pNode;
+	}
+
+	bool Empty() const {
+		return m_nBottom.load(std::memory_order_relaxed) <= m_nTop.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Array
+	{
+		int64_t nSize;
+		std::unique_ptr<std::atomic<YondTaskNode*>[]> pSlots;
+		YondTaskNode* Get(int64_t i) const { return pSlots[i & (nSize - 1)].load(std::memory_order_relaxed); }
+		void Put(int64_t i, YondTaskNode* p) { pSlots[i & (nSize - 1)].store(p, std::memory_order_relaxed); }
+	};
+
+	static Array* NewArray(int64_t nSize) {
+		Array* pArr = new Array();
+		pArr->nSize = nSize;
+		pArr->pSlots.reset(new std::atomic<YondTaskNode*>[nSize]);
+		return pArr;
+	}
+
+	Array* Grow(Array* pOld, int64_t t, int64_t b) {
+		Array* pNew = NewArray(pOld->nSize * 2);
+		for (int64_t i = t; i < b; i++) {
+			pNew->Put(i, pOld->Get(i));
+		}
+		m_vRetired.push_back(pOld);
+		m_pArray.store(pNew, std::memory_order_release);
+		return pNew;
+	}
+
+	std::atomic<int64_t> m_nTop;
+	std::atomic<int64_t> m_nBottom;
+	std::atomic<Array*> m_pArray;
+	std::vector<Array*> m_vRetired;	// 只由所属线程访问
+};
+
 class CYondThreadPool
 {
 public:
-	CYondThreadPool(size_t threads = 6) : m_bStop(false) {
+	CYondThreadPool(size_t threads = 6, YondPoolMode eMode = YPoolShared)
+		: m_eMode(eMode), m_bStop(false), m_tasks(POOL_QUEUE_SIZE), m_nInjected(0), m_nEpoch(0), m_nSleepers(0) {
 		m_vThreads.resize(threads);
+		if (m_eMode == YPoolSteal) {
+			for (size_t i = 0; i < threads; ++i) {
+				m_vDeques.emplace_back(new CYondStealDeque());
+			}
+		}
 		for (size_t i = 0; i < m_vThreads.size(); ++i) {
 			m_vThreads[i] = new CYondThread();
-			m_vThreads[i]->Start([this]() {
-				this->WorkerThread(); 
-			});
+			if (m_eMode == YPoolSteal) {
+				m_vThreads[i]->Start([this, i]() {
+					this->StealWorkerThread(i);
+				});
+			}
+			else {
+				m_vThreads[i]->Start([this]() {
+					this->WorkerThread();
+				});
+			}
 		}
-		LOG_INFO("Thread pool initialized with " + std::to_string(threads) + " worker threads");
+		LOG_INFO("Thread pool initialized with " + std::to_string(threads) + " worker threads" +
+			(m_eMode == YPoolSteal ? " (work stealing)" : ""));
 	}
 
 	~CYondThreadPool() {
-		{
-			std::unique_lock<std::mutex> lock(m_lock);
-			m_bStop = true;
-		}
-		m_condition.notify_all();
+		m_bStop = true;
+		m_nEpoch.fetch_add(1, std::memory_order_release);
+		FutexWake(INT_MAX);
 		
-		for (int i = 0; i < m_vThreads.size(); ++i) {
+		for (size_t i = 0; i < m_vThreads.size(); ++i) {
 			if (m_vThreads[i]->IsRunning()) {
 				m_vThreads[i]->Stop();
 			}
@@ -104,50 +320,273 @@ public:
 			delete thread;
 		}*/
 		m_vThreads.clear();
+		m_vDeques.clear();
 		LOG_INFO("Thread pool destroyed");
 	}
 
 	template<class F>
 	void Enqueue(F&& f) {
-		{
-			std::unique_lock<std::mutex> lock(m_lock);
-			m_tasks.emplace(std::forward<F>(f));
+		if (m_eMode == YPoolSteal) {
+			YondTaskNode* pNode = YondTaskNode::Alloc(std::forward<F>(f));
+			// 工作线程提交的任务放入自己的本地队列, 其他线程经注入队列提交
+			if (s_pCurPool == this) {
+				m_vDeques[s_nCurWorker]->Push(pNode);
+			}
+			else {
+				// 先计数后入队, 出队方减计数时不会减到负数
+				m_nInjected.fetch_add(1, std::memory_order_relaxed);
+				m_inject.Push(pNode);
+			}
+			WakeOne();
+			return;
+		}
+		CYondTask task(std::forward<F>(f));
+		// 环满时放进无界的溢出队列, 提交方不等待; 背压由事件循环根据Backlogged暂停读取来施加
+		if (!m_tasks.TryPush(std::move(task))) {
+			m_nInjected.fetch_add(1, std::memory_order_relaxed);
+			m_inject.Push(YondTaskNode::Alloc(std::move(task)));
+		}
+		WakeOne();
+	}
+
+	// 排队的任务是否已多到应当暂停接收新消息, 近似值
+	bool Backlogged() const {
+		size_t nQueued = m_nInjected.load(std::memory_order_relaxed);
+		if (m_eMode == YPoolShared) {
+			nQueued += m_tasks.Size();
 		}
-		m_condition.notify_one();
+		return nQueued >= POOL_PAUSE_MARK;
 	}
 
 private:
+	// 共享模式: 所有线程从同一个无锁环取任务, 取不到时与工作窃取模式同样先自旋再休眠
 	void WorkerThread() {
 		LOG_INFO("Worker thread started");
+		CYondTask task;
+		bool bTurn = false;
 		while (true) {
-			std::function<void()> task;
-			{
-				std::unique_lock<std::mutex> lock(m_lock);
-				m_condition.wait(lock, [this] { 
-					return m_bStop || !m_tasks.empty(); 
-				});
-				
-				if (m_bStop && m_tasks.empty()) {
+			bool bGot = PopShared(task, bTurn);
+			for (int i = 0; !bGot && i < STEAL_SPIN; i++) {
+				std::this_thread::yield();
+				bGot = PopShared(task, bTurn);
+			}
+			if (!bGot) {
+				uint32_t nEpoch = m_nEpoch.load(std::memory_order_acquire);
+				m_nSleepers.fetch_add(1, std::memory_order_seq_cst);
+				bGot = PopShared(task, bTurn);
+				if (!bGot && !m_bStop) {
+					FutexWait(nEpoch);
+				}
+				m_nSleepers.fetch_sub(1, std::memory_order_relaxed);
+			}
+			if (!bGot) {
+				if (m_bStop) {
 					LOG_INFO("Worker thread stopping");
 					break;
 				}
-				
-				task = std::move(m_tasks.front());
-				m_tasks.pop();
+				continue;
 			}
-			try {
-				task();
+			RunTask(task);
+			task.Reset();
+		}
+	}
+
+	// 溢出队列非空时与环轮流取, 溢出的任务不会在持续高负载下一直排在后面
+	bool PopShared(CYondTask& task, bool& bTurn) {
+		bTurn = !bTurn;
+		if (bTurn && PopOverflow(task)) {
+			return true;
+		}
+		return m_tasks.TryPop(task) || PopOverflow(task);
+	}
+
+	bool PopOverflow(CYondTask& task) {
+		if (m_nInjected.load(std::memory_order_relaxed) == 0 || m_injectBusy.test_and_set(std::memory_order_acquire)) {
+			return false;
+		}
+		YondTaskNode* pNode = m_inject.Pop();
+		m_injectBusy.clear(std::memory_order_release);
+		if (pNode == nullptr) {
+			return false;
+		}
+		m_nInjected.fetch_sub(1, std::memory_order_relaxed);
+		task = std::move(pNode->task);
+		YondTaskNode::Free(pNode);
+		return true;
+	}
+
+	// 工作窃取模式: 本地队列 -> 注入队列 -> 窃取其他线程, 都没有时先自旋再futex休眠
+	void StealWorkerThread(size_t nIndex) {
+		LOG_INFO("Worker thread started");
+		s_pCurPool = this;
+		s_nCurWorker = nIndex;
+		while (true) {
+			YondTaskNode* pNode = FindTask(nIndex);
+			for (int i = 0; pNode == nullptr && i < STEAL_SPIN; i++) {
+				std::this_thread::yield();
+				pNode = FindTask(nIndex);
 			}
-			catch(const std::exception& e){
-				LOG_ERROR(ERR_LOG_THREAD_TASK, "exception thread task:" + std::string(e.what()));
+			if (pNode == nullptr) {
+				// 先登记为休眠者再检查一次, 与WakeOne中先入队后检查休眠者配对, 不会丢失唤醒
+				uint32_t nEpoch = m_nEpoch.load(std::memory_order_acquire);
+				m_nSleepers.fetch_add(1, std::memory_order_seq_cst);
+				pNode = FindTask(nIndex);
+				if (pNode == nullptr && !m_bStop) {
+					FutexWait(nEpoch);
+				}
+				m_nSleepers.fetch_sub(1, std::memory_order_relaxed);
 			}
+			if (pNode == nullptr) {
+				if (m_bStop) {
+					LOG_INFO("Worker thread stopping");
+					break;
+				}
+				continue;
+			}
+			RunTask(pNode->task);
+			YondTaskNode::Free(pNode);
 		}
+		s_pCurPool = nullptr;
 	}
 
-	std::mutex m_lock;
-	std::condition_variable m_condition;
+	YondTaskNode* FindTask(size_t nIndex) {
+		YondTaskNode* pNode = m_vDeques[nIndex]->Take();
+		if (pNode != nullptr) {
+			return pNode;
+		}
+
+		// 注入队列只允许一个消费者, 被占用时直接去窃取
+		if (!m_injectBusy.test_and_set(std::memory_order_acquire)) {
+			size_t nTaken = 0;
+			pNode = m_inject.Pop();
+			for (int i = 0; pNode != nullptr && i < STEAL_INJECT_BATCH; i++) {
+				YondTaskNode* pMore = m_inject.Pop();
+				if (pMore == nullptr) break;
+				m_vDeques[nIndex]->Push(pMore);
+				nTaken++;
+			}
+			m_injectBusy.clear(std::memory_order_release);
+			if (pNode != nullptr) {
+				m_nInjected.fetch_sub(nTaken + 1, std::memory_order_relaxed);
+			}
+			if (pNode != nullptr) {
+				return pNode;
+			}
+		}
+
+		size_t n = m_vDeques.size();
+		for (size_t i = 1; i < n; i++) {
+			pNode = m_vDeques[(nIndex + i) % n]->Steal();
+			if (pNode != nullptr) {
+				return pNode;
+			}
+		}
+		return nullptr;
+	}
+
+	void WakeOne() {
+		// 与休眠方的登记-复查配对: 任务已入队后再看是否有人在睡
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_nSleepers.load(std::memory_order_relaxed) > 0) {
+			m_nEpoch.fetch_add(1, std::memory_order_release);
+			FutexWake(1);
+		}
+	}
+
+	void FutexWait(uint32_t nEpoch) {
+		syscall(SYS_futex, (uint32_t*)&m_nEpoch, FUTEX_WAIT_PRIVATE, nEpoch, NULL, NULL, 0);
+	}
+
+	void FutexWake(int nCount) {
+		syscall(SYS_futex, (uint32_t*)&m_nEpoch, FUTEX_WAKE_PRIVATE, nCount, NULL, NULL, 0);
+	}
+
+	void RunTask(CYondTask& task) {
+		try {
+			task();
+		}
+		catch(const std::exception& e){
+			LOG_ERROR(ERR_LOG_THREAD_TASK, "exception thread task:" + std::string(e.what()));
+		}
+	}
+
+	YondPoolMode m_eMode;
 	std::vector<CYondThread*> m_vThreads;
-	std::queue<std::function<void()>> m_tasks;
-	bool m_bStop;
+	std::atomic<bool> m_bStop;
+	CYondMpmcRing<CYondTask> m_tasks;	// 共享模式
+
+	// 工作窃取模式
+	std::vector<std::unique_ptr<CYondStealDeque>> m_vDeques;
+	// 工作窃取模式的注入队列, 共享模式下用作环满时的溢出队列
+	CYondTaskQueue m_inject;
+	std::atomic_flag m_injectBusy = ATOMIC_FLAG_INIT;
+	std::atomic<size_t> m_nInjected;	// m_inject中的任务数
+	// 两种模式共用的休眠/唤醒
+	std::atomic<uint32_t> m_nEpoch;		// futex字, 每次唤醒加一
+	std::atomic<int> m_nSleepers;
+
+	inline static thread_local CYondThreadPool* s_pCurPool = nullptr;
+	inline static thread_local size_t s_nCurWorker = 0;
 };
 
+// 串行执行器: 投递到同一strand的任务按FIFO顺序在线程池上逐个执行,
+// 不同strand之间仍然并行. 任务入队为无锁MPSC链表, 只有strand由空变为
+// 非空时才向线程池投递一次执行任务, 之后的任务不再进入线程池队列
+class CYondStrand : public std::enable_shared_from_this<CYondStrand>
+{
+public:
+	explicit CYondStrand(CYondThreadPool& pool)
+		: m_pool(pool), m_nPending(0) {}
+
+	CYondStrand(const CYondStrand&) = delete;
+	CYondStrand& operator=(const CYondStrand&) = delete;
+
+	// 已投递未执行完的任务数, 近似值
+	int Pending() const { return m_nPending.load(std::memory_order_relaxed); }
+
+	// 线程安全, 必须通过shared_ptr持有strand
+	template<class F>
+	void Post(F&& f) {
+		m_queue.Push(YondTaskNode::Alloc(std::forward<F>(f)));
+		if (m_nPending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+			Schedule();
+		}
+	}
+
+private:
+	void Schedule() {
+		// 执行任务持有strand引用, 连接关闭后排队中的任务仍能执行完
+		std::shared_ptr<CYondStrand> self = shared_from_this();
+		m_pool.Enqueue([self]() {
+			self->Run();
+		});
+	}
+
+	// 同一时刻只有一个线程在执行Run, 每批最多执行STRAND_BATCH个任务后重新排队,
+	// 避免一个连接长期占住工作线程
+	void Run() {
+		for (int n = 0; n < STRAND_BATCH; n++) {
+			YondTaskNode* pNode = m_queue.Pop();
+			while (pNode == nullptr) {
+				// 计数已增加但生产者还未链接完成
+				std::this_thread::yield();
+				pNode = m_queue.Pop();
+			}
+			try {
+				pNode->task();
+			}
+			catch (const std::exception& e) {
+				LOG_ERROR(ERR_LOG_THREAD_TASK, "exception strand task:" + std::string(e.what()));
+			}
+			YondTaskNode::Free(pNode);
+			if (m_nPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				return;
+			}
+		}
+		Schedule();
+	}
+
+	CYondThreadPool& m_pool;
+	CYondTaskQueue m_queue;
+	std::atomic<int> m_nPending;	// 已投递未执行完的任务数
+};
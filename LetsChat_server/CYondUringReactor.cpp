@@ -0,0 +1,546 @@
+#include "CYondUringReactor.h"
+#include "CYondHandleEvent.h"
+#include "CYondConn.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+static int uring_setup(unsigned entries, struct io_uring_params* p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned nArgs) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nArgs);
+}
+
+CYondUringReactor::CYondUringReactor(int nIndex, CYondHandleEvent* pHandler, const YondServerOpt& opt)
+	: CYondReactor(nIndex, pHandler, opt), m_nRingFd(-1),
+	m_pSqRing(MAP_FAILED), m_nSqRingSz(0), m_pCqRing(MAP_FAILED), m_nCqRingSz(0),
+	m_pSqes((struct io_uring_sqe*)MAP_FAILED), m_nSqesSz(0),
+	m_pSqHead(nullptr), m_pSqTail(nullptr), m_pSqArray(nullptr), m_nSqMask(0), m_nSqEntries(0), m_nSqTail(0),
+	m_pCqHead(nullptr), m_pCqTail(nullptr), m_nCqMask(0), m_pCqes(nullptr),
+	m_pBufRing((struct io_uring_buf_ring*)MAP_FAILED), m_pBufs(nullptr), m_nBufTail(0), m_bFlushArmed(false) {
+	m_tsTimer.tv_sec = 1;
+	m_tsTimer.tv_nsec = 0;
+	m_tsFlush.tv_sec = 0;
+	m_tsFlush.tv_nsec = 0;
+}
+
+bool CYondUringReactor::Probe() {
+	// 多发recv需要6.0及以上内核
+	struct utsname uts;
+	if (uname(&uts) != 0 || atoi(uts.release) < 6) {
+		return false;
+	}
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = uring_setup(4, &p);
+	if (fd < 0) {
+		return false;
+	}
+
+	// 提供缓冲环需要5.19及以上, 注册一个最小的环确认可用
+	size_t sz = 4096;
+	void* ring = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	bool bOk = false;
+	if (ring != MAP_FAILED) {
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (unsigned long long)ring;
+		reg.ring_entries = 1;
+		reg.bgid = URING_BUF_GROUP;
+		bOk = uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+		munmap(ring, sz);
+	}
+	close(fd);
+	return bOk;
+}
+
+int CYondUringReactor::InitEngine() {
+	// 由io_uring负责等待就绪, 监听socket改回阻塞模式
+	int fl = fcntl(m_nSockFd, F_GETFL);
+	fcntl(m_nSockFd, F_SETFL, fl & ~O_NONBLOCK);
+
+	int err = SetupRing();
+	if (err != 0) {
+		return err;
+	}
+	return SetupBufRing();
+}
+
+int CYondUringReactor::SetupRing() {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CLAMP;
+	m_nRingFd = uring_setup(URING_ENTRIES, &p);
+	if (m_nRingFd < 0) {
+		return LOG_ERROR(YOND_ERR_URING_SETUP, "Failed to create io_uring instance");
+	}
+
+	m_nSqRingSz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	m_nCqRingSz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	bool bSingle = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (bSingle) {
+		m_nSqRingSz = m_nCqRingSz = (m_nSqRingSz > m_nCqRingSz) ? m_nSqRingSz : m_nCqRingSz;
+	}
+
+	m_pSqRing = mmap(NULL, m_nSqRingSz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		m_nRingFd, IORING_OFF_SQ_RING);
+	if (m_pSqRing == MAP_FAILED) {
+		return LOG_ERROR(YOND_ERR_URING_SETUP, "Failed to map io_uring submission ring");
+	}
+	if (bSingle) {
+		m_pCqRing = m_pSqRing;
+	}
+	else {
+		m_pCqRing = mmap(NULL, m_nCqRingSz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			m_nRingFd, IORING_OFF_CQ_RING);
+		if (m_pCqRing == MAP_FAILED) {
+			return LOG_ERROR(YOND_ERR_URING_SETUP, "Failed to map io_uring completion ring");
+		}
+	}
+	m_nSqesSz = p.sq_entries * sizeof(struct io_uring_sqe);
+	m_pSqes = (struct io_uring_sqe*)mmap(NULL, m_nSqesSz, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, m_nRingFd, IORING_OFF_SQES);
+	if (m_pSqes == MAP_FAILED) {
+		return LOG_ERROR(YOND_ERR_URING_SETUP, "Failed to map io_uring submission entries");
+	}
+
+	char* sq = (char*)m_pSqRing;
+	m_pSqHead = (unsigned*)(sq + p.sq_off.head);
+	m_pSqTail = (unsigned*)(sq + p.sq_off.tail);
+	m_pSqArray = (unsigned*)(sq + p.sq_off.array);
+	m_nSqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+	m_nSqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+	m_nSqTail = *m_pSqTail;
+
+	char* cq = (char*)m_pCqRing;
+	m_pCqHead = (unsigned*)(cq + p.cq_off.head);
+	m_pCqTail = (unsigned*)(cq + p.cq_off.tail);
+	m_nCqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+	m_pCqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+int CYondUringReactor::SetupBufRing() {
+	size_t sz = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+	m_pBufRing = (struct io_uring_buf_ring*)mmap(NULL, sz, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m_pBufRing == MAP_FAILED) {
+		return LOG_ERROR(YOND_ERR_URING_SETUP, "Failed to allocate provided buffer ring");
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long)m_pBufRing;
+	reg.ring_entries = URING_BUF_COUNT;
+	reg.bgid = URING_BUF_GROUP;
+	if (uring_register(m_nRingFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		return LOG_ERROR(YOND_ERR_URING_SETUP, "Failed to register provided buffer ring");
+	}
+
+	m_pBufs = new char[(size_t)URING_BUF_COUNT * URING_BUF_SIZE];
+	m_nBufTail = 0;
+	for (unsigned short bid = 0; bid < URING_BUF_COUNT; bid++) {
+		RecycleBuf(bid);
+	}
+	return 0;
+}
+
+void CYondUringReactor::RecycleBuf(unsigned short bid) {
+	// C++下内核头文件的柔性数组bufs会被放到偏移8处, 直接按io_uring_buf数组访问
+	struct io_uring_buf* buf = (struct io_uring_buf*)m_pBufRing + (m_nBufTail & (URING_BUF_COUNT - 1));
+	buf->addr = (unsigned long long)(m_pBufs + (size_t)bid * URING_BUF_SIZE);
+	buf->len = URING_BUF_SIZE;
+	buf->bid = bid;
+	m_nBufTail++;
+	__atomic_store_n(&m_pBufRing->tail, m_nBufTail, __ATOMIC_RELEASE);
+}
+
+void CYondUringReactor::CloseEngine() {
+	// 关闭环会取消所有未完成请求, 之后才能释放它们引用的内存
+	if (m_nRingFd >= 0) close(m_nRingFd);
+	m_nRingFd = -1;
+	if (m_pSqes != MAP_FAILED) munmap(m_pSqes, m_nSqesSz);
+	if (m_pCqRing != MAP_FAILED && m_pCqRing != m_pSqRing) munmap(m_pCqRing, m_nCqRingSz);
+	if (m_pSqRing != MAP_FAILED) munmap(m_pSqRing, m_nSqRingSz);
+	if (m_pBufRing != MAP_FAILED) munmap(m_pBufRing, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+	m_pSqes = (struct io_uring_sqe*)MAP_FAILED;
+	m_pSqRing = m_pCqRing = MAP_FAILED;
+	m_pBufRing = (struct io_uring_buf_ring*)MAP_FAILED;
+	delete[] m_pBufs;
+	m_pBufs = nullptr;
+
+	// 正在关闭的连接已从连接数组摘除, 在这里释放; 其余由CloseConns释放
+	for (const auto& it : m_mapUring) {
+		delete it.second;
+	}
+	m_mapUring.clear();
+	for (UringConn* uc : m_setClosing) {
+		close(uc->pConn->m_nFd);
+		delete uc->pConn;
+		delete uc;
+	}
+	m_setClosing.clear();
+	m_vDirty.clear();
+}
+
+struct io_uring_sqe* CYondUringReactor::GetSqe(UringOp op, UringConn* uc) {
+	// 提交队列满时先把已有条目交给内核
+	while (m_nSqTail - __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE) >= m_nSqEntries) {
+		if (Enter(0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			return nullptr;
+		}
+	}
+	unsigned idx = m_nSqTail & m_nSqMask;
+	struct io_uring_sqe* sqe = &m_pSqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (unsigned long long)(uintptr_t)uc | (unsigned long long)op;
+	m_pSqArray[idx] = idx;
+	m_nSqTail++;
+	return sqe;
+}
+
+int CYondUringReactor::Enter(unsigned nWait) {
+	__atomic_store_n(m_pSqTail, m_nSqTail, __ATOMIC_RELEASE);
+	unsigned toSubmit = m_nSqTail - __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE);
+	return uring_enter(m_nRingFd, toSubmit, nWait, nWait > 0 ? IORING_ENTER_GETEVENTS : 0);
+}
+
+int CYondUringReactor::Loop() {
+	ArmAccept();
+	ArmWake();
+	ArmTimer();
+	while (!m_bStop) {
+		// 本轮入队的所有发送与其他请求一起在一次io_uring_enter中提交
+		FlushDirty();
+		ArmFlushTimer();
+		if (Enter(1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME) {
+			return LOG_ERROR(YOND_ERR_URING_ENTER, "Failed to submit io_uring requests");
+		}
+		ReapCqes();
+		FlushPending();
+		Tick();
+		ResumeRecv();
+	}
+	return 0;
+}
+
+void CYondUringReactor::ReapCqes() {
+	unsigned head = *m_pCqHead;
+	unsigned tail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		OnCqe(&m_pCqes[head & m_nCqMask]);
+		head++;
+		// 处理中可能产生新的完成事件, 一并取走
+		if (head == tail) {
+			__atomic_store_n(m_pCqHead, head, __ATOMIC_RELEASE);
+			tail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+		}
+	}
+	__atomic_store_n(m_pCqHead, head, __ATOMIC_RELEASE);
+}
+
+void CYondUringReactor::OnCqe(const struct io_uring_cqe* cqe) {
+	UringOp op = (UringOp)(cqe->user_data & 7);
+	UringConn* uc = (UringConn*)(uintptr_t)(cqe->user_data & ~7ULL);
+	switch (op) {
+	case UR_ACCEPT:
+		if (cqe->res >= 0) {
+			OnAccept(cqe->res);
+		}
+		else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED) {
+			LOG_ERROR(YOND_ERR_SOCKET_ACCEPT, "Failed to accept new connection");
+		}
+		if (!(cqe->flags & IORING_CQE_F_MORE) && !m_bStop) {
+			ArmAccept();
+		}
+		break;
+	case UR_WAKE: {
+		uint64_t cnt = 0;
+		read(m_nWakeFd, &cnt, sizeof(cnt));
+		DrainInbox();
+		if (!m_bStop) ArmWake();
+		break;
+	}
+	case UR_TIMER:
+		if (!m_bStop) ArmTimer();
+		break;
+	case UR_FLUSH:
+		m_bFlushArmed = false;
+		break;
+	case UR_CANCEL:
+		// 被取消的recv另有自己的完成事件
+		break;
+	case UR_RECV:
+		OnRecv(uc, cqe->res, cqe->flags);
+		break;
+	case UR_SEND:
+		OnSend(uc, cqe->res);
+		break;
+	}
+}
+
+void CYondUringReactor::ArmAccept() {
+	struct io_uring_sqe* sqe = GetSqe(UR_ACCEPT);
+	if (sqe == nullptr) return;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = m_nSockFd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+void CYondUringReactor::ArmRecv(UringConn* uc) {
+	struct io_uring_sqe* sqe = GetSqe(UR_RECV, uc);
+	if (sqe == nullptr) return;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = uc->pConn->m_nFd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	uc->nOps++;
+}
+
+void CYondUringReactor::ArmWake() {
+	struct io_uring_sqe* sqe = GetSqe(UR_WAKE);
+	if (sqe == nullptr) return;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = m_nWakeFd;
+	sqe->poll32_events = POLLIN;
+}
+
+void CYondUringReactor::ArmTimer() {
+	struct io_uring_sqe* sqe = GetSqe(UR_TIMER);
+	if (sqe == nullptr) return;
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = (unsigned long long)&m_tsTimer;
+	sqe->len = 1;
+}
+
+void CYondUringReactor::ArmFlushTimer() {
+	long us = PendingWaitUs();
+	if (!m_vPaused.empty() && (us <= 0 || us > URING_PAUSE_US)) {
+		us = URING_PAUSE_US;
+	}
+	if (m_bFlushArmed || us <= 0) {
+		return;
+	}
+	struct io_uring_sqe* sqe = GetSqe(UR_FLUSH);
+	if (sqe == nullptr) return;
+	m_tsFlush.tv_sec = us / 1000000;
+	m_tsFlush.tv_nsec = (us % 1000000) * 1000;
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = (unsigned long long)&m_tsFlush;
+	sqe->len = 1;
+	m_bFlushArmed = true;
+}
+
+void CYondUringReactor::OnAccept(int clientFd) {
+	struct sockaddr_in clientAddr;
+	socklen_t clientLen = sizeof(clientAddr);
+	char ip[INET_ADDRSTRLEN] = { 0 };
+	if (getpeername(clientFd, (struct sockaddr*)&clientAddr, &clientLen) == 0) {
+		inet_ntop(AF_INET, &clientAddr.sin_addr, ip, sizeof(ip));
+	}
+
+	CYondConn* pConn = AddConn(clientFd, ip);
+	if (pConn == nullptr) {
+		close(clientFd);
+		return;
+	}
+	UringConn* uc = new UringConn();
+	uc->pConn = pConn;
+	uc->nOps = 0;
+	uc->bSending = uc->bDirty = uc->bClosing = uc->bPaused = false;
+	m_mapUring[clientFd] = uc;
+	ArmRecv(uc);
+}
+
+void CYondUringReactor::OnRecv(UringConn* uc, int res, unsigned flags) {
+	bool bMore = (flags & IORING_CQE_F_MORE) != 0;
+	if (!bMore) {
+		uc->nOps--;
+	}
+
+	if (res > 0) {
+		unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+		if (!uc->bClosing) {
+			CYondConn* pConn = uc->pConn;
+			memcpy(pConn->InTail(res), m_pBufs + (size_t)bid * URING_BUF_SIZE, res);
+			pConn->InCommit(res);
+		}
+		RecycleBuf(bid);
+		if (!uc->bClosing && m_pHandler->HandleEvent(this, uc->pConn) != 0) {
+			// RemoveClient内会在请求全部结束时释放uc
+			RemoveClient(uc->pConn->m_nFd);
+			return;
+		}
+		if (!uc->bClosing) {
+			PauseIfBusy(uc, bMore);
+		}
+		if (!bMore && !uc->bClosing) {
+			RearmRecv(uc);
+		}
+	}
+	else if (res == -ENOBUFS || res == -ECANCELED) {
+		// 提供缓冲暂时用完, 已处理的缓冲归还后重新挂上; 或因积压被取消
+		if (!bMore && !uc->bClosing) {
+			RearmRecv(uc);
+		}
+	}
+	else if (!uc->bClosing) {
+		if (res < 0) {
+			LOG_ERROR(YOND_ERR_SOCKET_RECV, "Failed to recv from client " + uc->pConn->Name());
+		}
+		// 客户端断开连接
+		LOG_INFOF("Client disconnected: %s", uc->pConn->Name().c_str());
+		RemoveClient(uc->pConn->m_nFd);
+		return;
+	}
+	MaybeFree(uc);
+}
+
+void CYondUringReactor::PauseIfBusy(UringConn* uc, bool bMore) {
+	if (uc->bPaused || !m_pHandler->Busy(uc->pConn)) {
+		return;
+	}
+	uc->bPaused = true;
+	if (!bMore) {
+		return;
+	}
+	struct io_uring_sqe* sqe = GetSqe(UR_CANCEL);
+	if (sqe == nullptr) return;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (unsigned long long)(uintptr_t)uc | (unsigned long long)UR_RECV;
+}
+
+void CYondUringReactor::RearmRecv(UringConn* uc) {
+	if (uc->bPaused) {
+		m_vPaused.push_back(uc->pConn->m_nFd);
+	}
+	else {
+		ArmRecv(uc);
+	}
+}
+
+void CYondUringReactor::ResumeRecv() {
+	size_t nKeep = 0;
+	for (int fd : m_vPaused) {
+		auto it = m_mapUring.find(fd);
+		if (it == m_mapUring.end() || !it->second->bPaused) {
+			continue;
+		}
+		UringConn* uc = it->second;
+		if (m_pHandler->Busy(uc->pConn)) {
+			m_vPaused[nKeep++] = fd;
+			continue;
+		}
+		uc->bPaused = false;
+		ArmRecv(uc);
+	}
+	m_vPaused.resize(nKeep);
+}
+
+void CYondUringReactor::OnSend(UringConn* uc, int res) {
+	uc->nOps--;
+	uc->bSending = false;
+	if (!uc->bClosing) {
+		if (res >= 0) {
+			uc->pConn->OutSent((size_t)res);
+			if (!uc->pConn->OutEmpty()) {
+				MarkDirty(uc);
+			}
+		}
+		else {
+			LOG_ERROR(YOND_ERR_SOCKET_SEND, "Failed to send message to client " + uc->pConn->Name());
+			RemoveClient(uc->pConn->m_nFd);
+			return;
+		}
+	}
+	MaybeFree(uc);
+}
+
+bool CYondUringReactor::FlushOut(CYondConn* pConn) {
+	auto it = m_mapUring.find(pConn->m_nFd);
+	if (it != m_mapUring.end()) {
+		MarkDirty(it->second);
+	}
+	return true;
+}
+
+void CYondUringReactor::MarkDirty(UringConn* uc) {
+	// 每个连接同时只有一个发送请求, 保证字节顺序; 完成后若仍有数据再次登记
+	if (!uc->bDirty && !uc->bSending) {
+		uc->bDirty = true;
+		m_vDirty.push_back(uc);
+	}
+}
+
+void CYondUringReactor::FlushDirty() {
+	std::vector<UringConn*> vDirty;
+	vDirty.swap(m_vDirty);
+	for (UringConn* uc : vDirty) {
+		uc->bDirty = false;
+		if (!uc->bClosing && !uc->bSending && !uc->pConn->OutEmpty()) {
+			SubmitSend(uc);
+		}
+		MaybeFree(uc);
+	}
+}
+
+void CYondUringReactor::SubmitSend(UringConn* uc) {
+	struct io_uring_sqe* sqe = GetSqe(UR_SEND, uc);
+	if (sqe == nullptr) return;
+	memset(&uc->msg, 0, sizeof(uc->msg));
+	uc->msg.msg_iov = uc->iov;
+	uc->msg.msg_iovlen = uc->pConn->OutGather(uc->iov, OUT_IOV_MAX,
+		[](const CYondFramePtr&) { return false; });
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = uc->pConn->m_nFd;
+	sqe->addr = (unsigned long long)&uc->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	// 一次发不完队列时, 完成后会接着提交下一次
+	if (uc->msg.msg_iovlen < uc->pConn->OutFrames()) {
+		sqe->msg_flags |= MSG_MORE;
+	}
+	uc->bSending = true;
+	uc->nOps++;
+}
+
+void CYondUringReactor::RemoveClient(int clientFd) {
+	auto it = m_mapUring.find(clientFd);
+	if (it == m_mapUring.end()) {
+		CYondReactor::RemoveClient(clientFd);
+		return;
+	}
+	UringConn* uc = it->second;
+	m_mapUring.erase(it);
+	DetachConn(uc->pConn);
+
+	// 关闭读写使挂起的recv/send尽快完成, fd等到请求全部结束再关闭, 避免被复用
+	uc->bClosing = true;
+	m_setClosing.insert(uc);
+	shutdown(clientFd, SHUT_RDWR);
+	MaybeFree(uc);
+}
+
+void CYondUringReactor::MaybeFree(UringConn* uc) {
+	if (uc->bClosing && uc->nOps == 0 && !uc->bDirty) {
+		m_setClosing.erase(uc);
+		close(uc->pConn->m_nFd);
+		delete uc->pConn;
+		delete uc;
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "CYondReactor.h"
+
+#define URING_ENTRIES 256
+#define URING_BUF_COUNT 128		// 提供给内核的接收缓冲个数, 必须为2的幂
+#define URING_BUF_SIZE (16 * 1024)
+#define URING_BUF_GROUP 0
+#define URING_PAUSE_US 1000		// 线程池积压而暂停接收时, 多久检查一次能否恢复
+
+// io_uring引擎: 多发accept、基于提供缓冲环的多发recv, 每轮循环批量提交发送.
+// 直接使用io_uring_setup/io_uring_enter系统调用, 不依赖liburing
+class CYondUringReactor : public CYondReactor
+{
+public:
+	CYondUringReactor(int nIndex, CYondHandleEvent* pHandler, const YondServerOpt& opt);
+	~CYondUringReactor() override {
+		Stop();
+	}
+
+	// 内核是否支持本引擎用到的特性(提供缓冲环、多发recv)
+	static bool Probe();
+
+	const char* EngineName() const override { return "io_uring"; }
+	// 请求仍在内核中时延迟释放连接
+	void RemoveClient(int clientFd) override;
+
+protected:
+	int InitEngine() override;
+	int Loop() override;
+	// 只登记, 由下一轮io_uring_enter统一提交
+	bool FlushOut(CYondConn* pConn) override;
+	void CloseEngine() override;
+
+private:
+	enum UringOp
+	{
+		UR_ACCEPT = 1,
+		UR_RECV,
+		UR_SEND,
+		UR_WAKE,
+		UR_TIMER,
+		UR_FLUSH,
+		UR_CANCEL
+	};
+
+	// 连接在引擎侧的状态, user_data指向它, 内核中还有请求时不能释放
+	struct UringConn
+	{
+		CYondConn* pConn;
+		int nOps;
+		bool bSending;
+		bool bDirty;
+		bool bClosing;
+		bool bPaused;		// 线程池积压, 当前recv结束后先不重新挂上
+		struct msghdr msg;
+		struct iovec iov[OUT_IOV_MAX];
+	};
+
+	int SetupRing();
+	int SetupBufRing();
+	struct io_uring_sqe* GetSqe(UringOp op, UringConn* uc = nullptr);
+	int Enter(unsigned nWait);
+	void ReapCqes();
+	void OnCqe(const struct io_uring_cqe* cqe);
+
+	void ArmAccept();
+	void ArmRecv(UringConn* uc);
+	void ArmWake();
+	void ArmTimer();
+	// 有攒着的出站帧时挂一个到期即完成的超时请求, 让io_uring_enter按时返回
+	void ArmFlushTimer();
+	void OnAccept(int clientFd);
+	void OnRecv(UringConn* uc, int res, unsigned flags);
+	// 积压时取消多发recv, 结束后进入暂停列表
+	void PauseIfBusy(UringConn* uc, bool bMore);
+	void RearmRecv(UringConn* uc);
+	void ResumeRecv();
+	void OnSend(UringConn* uc, int res);
+	void MarkDirty(UringConn* uc);
+	void FlushDirty();
+	void SubmitSend(UringConn* uc);
+	void RecycleBuf(unsigned short bid);
+	void MaybeFree(UringConn* uc);
+
+	int m_nRingFd;
+	void* m_pSqRing;
+	size_t m_nSqRingSz;
+	void* m_pCqRing;
+	size_t m_nCqRingSz;
+	struct io_uring_sqe* m_pSqes;
+	size_t m_nSqesSz;
+	unsigned* m_pSqHead;
+	unsigned* m_pSqTail;
+	unsigned* m_pSqArray;
+	unsigned m_nSqMask;
+	unsigned m_nSqEntries;
+	unsigned m_nSqTail;		// 本地尾指针, Enter时发布给内核
+	unsigned* m_pCqHead;
+	unsigned* m_pCqTail;
+	unsigned m_nCqMask;
+	struct io_uring_cqe* m_pCqes;
+
+	struct io_uring_buf_ring* m_pBufRing;
+	char* m_pBufs;
+	unsigned short m_nBufTail;
+
+	struct __kernel_timespec m_tsTimer;
+	struct __kernel_timespec m_tsFlush;
+	bool m_bFlushArmed;
+	std::unordered_map<int, UringConn*> m_mapUring;
+	std::unordered_set<UringConn*> m_setClosing;	// 已断开但仍有请求在内核中的连接
+	std::vector<UringConn*> m_vDirty;
+	std::vector<int> m_vPaused;		// 暂停接收的连接fd, 关闭后可能已失效
+};
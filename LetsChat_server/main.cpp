@@ -1,11 +1,169 @@
 ﻿#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 #include "CChatServer.h"
 #include "CYondLog.h"
 #include "CYondThreadPool.h"
 
-int main()
+static void Usage(const char* prog)
 {
+    printf("Usage: %s [-l loops] [-e epoll|uring] [-p shared|steal] [-w bytes] [-o drop|close] [-z bytes] [-c bytes] [-d usec] [-t port] [-s dir] [-x sec] [-u bytes] [-a] [-q] [-b block|drop] [-v level] [-f text|binary] [-r bytes] [-k count] [-g]\n", prog);
+    printf("  -l loops  number of event loops, default one per core\n");
+    printf("  -e engine I/O engine, uring falls back to epoll when unsupported, default epoll\n");
+    printf("  -p pool   worker pool scheduling, one shared queue or per-worker work stealing, default shared\n");
+    printf("  -w bytes  per-connection outbound queue high-water mark, default 4194304\n");
+    printf("  -o policy drop frames or close the connection above the high-water mark, default close\n");
+    printf("  -z bytes  send frames of at least this size with MSG_ZEROCOPY, default 0 (off)\n");
+    printf("  -c bytes  merge broadcasts to compact-protocol clients into batch frames up to this size, 0 disables, default 16384\n");
+    printf("  -d usec   while busy, hold outbound frames up to this long to send them together, default 0 (end of each loop pass)\n");
+    printf("  -t port   file relay port, 0 disables, default 8888\n");
+    printf("  -s dir    file relay spool directory, default spool\n");
+    printf("  -x sec    keep unfinished uploads this long for resuming, 0 drops them on disconnect, default 86400\n");
+    printf("  -u bytes  largest file accepted by the file relay, default 4294967296\n");
+    printf("  -a        write logs from a background thread\n");
+    printf("  -q        do not echo logs to the console\n");
+    printf("  -b policy block or drop log records when an async log ring is full, default drop\n");
+    printf("  -v level  trace|info|warning|error, default info; trace needs a debug build\n");
+    printf("  -f format text or binary (.ylog, read with yondlog-decode) log files, default text\n");
+    printf("  -r bytes  switch to a new log file above this size, 0 rotates by date only, default 67108864\n");
+    printf("  -k count  rotated log files to keep, 0 keeps all, default 14\n");
+    printf("  -g        do not gzip rotated log files\n");
+}
+
+int main(int argc, char* argv[])
+{
+    YondServerOpt srvOpt;
+    YondLogOpt logOpt;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "l:e:p:w:o:z:c:d:t:s:x:u:aqb:v:f:r:k:gh")) != -1) {
+        switch (opt) {
+        case 'l':
+            srvOpt.nLoops = atoi(optarg);
+            break;
+        case 'e':
+            if (strcmp(optarg, "epoll") == 0) {
+                srvOpt.eEngine = YEngineEpoll;
+            }
+            else if (strcmp(optarg, "uring") == 0) {
+                srvOpt.eEngine = YEngineUring;
+            }
+            else {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (strcmp(optarg, "shared") == 0) {
+                srvOpt.ePool = YPoolShared;
+            }
+            else if (strcmp(optarg, "steal") == 0) {
+                srvOpt.ePool = YPoolSteal;
+            }
+            else {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'w':
+            srvOpt.nHighWater = strtoull(optarg, NULL, 10);
+            break;
+        case 'z':
+            srvOpt.nZeroCopyMin = strtoull(optarg, NULL, 10);
+            break;
+        case 'c':
+            srvOpt.nBatchBytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            srvOpt.nFlushDelayUs = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            srvOpt.nFilePort = (unsigned short)atoi(optarg);
+            break;
+        case 's':
+            srvOpt.strSpoolDir = optarg;
+            break;
+        case 'x':
+            srvOpt.nPartKeepSec = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'u':
+            srvOpt.nUploadMax = strtoll(optarg, NULL, 10);
+            break;
+        case 'a':
+            logOpt.bAsync = true;
+            break;
+        case 'q':
+            logOpt.bConsole = false;
+            break;
+        case 'b':
+            if (strcmp(optarg, "block") == 0) {
+                logOpt.eOverflow = YLogBlock;
+            }
+            else if (strcmp(optarg, "drop") == 0) {
+                logOpt.eOverflow = YLogDrop;
+            }
+            else {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'v':
+            if (strcmp(optarg, "trace") == 0) {
+                logOpt.eLevel = CYondLog::LOG_LEVEL_TRACE;
+            }
+            else if (strcmp(optarg, "info") == 0) {
+                logOpt.eLevel = CYondLog::LOG_LEVEL_INFO;
+            }
+            else if (strcmp(optarg, "warning") == 0) {
+                logOpt.eLevel = CYondLog::LOG_LEVEL_WARNING;
+            }
+            else if (strcmp(optarg, "error") == 0) {
+                logOpt.eLevel = CYondLog::LOG_LEVEL_ERROR;
+            }
+            else {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "text") == 0) {
+                logOpt.bBinary = false;
+            }
+            else if (strcmp(optarg, "binary") == 0) {
+                logOpt.bBinary = true;
+            }
+            else {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            logOpt.nRotateBytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'k':
+            logOpt.nKeepFiles = atoi(optarg);
+            break;
+        case 'g':
+            logOpt.bCompress = false;
+            break;
+        case 'o':
+            if (strcmp(optarg, "drop") == 0) {
+                srvOpt.eOverflow = YOverflowDrop;
+            }
+            else if (strcmp(optarg, "close") == 0) {
+                srvOpt.eOverflow = YOverflowClose;
+            }
+            else {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            Usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
     // 打印当前工作目录
     char cwd[PATH_MAX];
     if (getcwd(cwd, sizeof(cwd)) != NULL) {
@@ -17,14 +175,11 @@ int main()
         printf("Failed to initialize logging system\n");
         return 1;
     }
+    CYondLog::Configure(logOpt);
 
     LOG_INFO("Starting chat server...");
-    CYondThread StartThread;
-    int err = 0;
-    StartThread.Start([&err]() {
-        err = CChatServer::GetInstance()->StartService();
-    });
-    StartThread.Detach();
+    // 各事件循环在自己的线程上运行, StartService启动后立即返回
+    int err = CChatServer::GetInstance()->StartService(srvOpt);
 
     if (err != 0) {
         LOG_ERROR(err, "Service start failed");
@@ -34,7 +189,6 @@ int main()
     }
 
     getchar();
-    StartThread.Stop();
     CChatServer::GetInstance()->StopService();
 
     // 关闭日志系统
@@ -0,0 +1,210 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../LetsChat_server/CYondConn.h"
+#include "../LetsChat_server/CYondReactor.h"
+
+// 一次广播在用户态复制的字节数, 对比user-004之前按接收者复制帧的出站队列
+// 和现在一次编码、所有接收者共享引用计数帧、sendmsg聚合发送的方式.
+// 接收者是本机回环上的TCP连接, 每轮广播后把对端读空.
+// 用法: bench-broadcast [接收者数=256] [负载字节=1024] [轮数=2000]
+// 构建: g++ -std=c++17 -O2 bench/bench-broadcast.cpp LetsChat_server/CYondPack.cpp -o bench-broadcast -pthread
+
+// user-004之前的出站队列: 每个接收者一份帧的std::string副本
+struct LegacyConn
+{
+	int nFd;
+	std::deque<std::string> dqOut;
+	size_t nOffset = 0;
+};
+
+struct BenchResult
+{
+	double dUs;				// 每次广播的耗时
+	double dCopied;			// 每次广播在用户态复制的字节
+	double dSent;			// 每次广播交给内核的字节
+};
+
+static size_t g_nCopied = 0;
+static size_t g_nSent = 0;
+static std::vector<char> g_vDrain(1 << 20);
+
+static int Listen(int& nPort) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1024) != 0
+		|| getsockname(fd, (sockaddr*)&addr, &len) != 0) {
+		perror("listen");
+		exit(1);
+	}
+	nPort = ntohs(addr.sin_port);
+	return fd;
+}
+
+// 建立nCount对回环连接, vSend为服务端一侧(非阻塞), vPeer为接收者一侧
+static void Connect(int nCount, std::vector<int>& vSend, std::vector<int>& vPeer) {
+	int nPort = 0;
+	int lfd = Listen(nPort);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(nPort);
+	for (int i = 0; i < nCount; i++) {
+		int cfd = socket(AF_INET, SOCK_STREAM, 0);
+		if (cfd < 0 || connect(cfd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+			perror("connect");
+			exit(1);
+		}
+		int sfd = accept(lfd, NULL, NULL);
+		if (sfd < 0) {
+			perror("accept");
+			exit(1);
+		}
+		int one = 1;
+		setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL) | O_NONBLOCK);
+		fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+		vSend.push_back(sfd);
+		vPeer.push_back(cfd);
+	}
+	close(lfd);
+}
+
+static void Drain(const std::vector<int>& vPeer) {
+	for (int fd : vPeer) {
+		while (recv(fd, g_vDrain.data(), g_vDrain.size(), 0) > 0) {}
+	}
+}
+
+// 返回true表示队列已发空
+static bool FlushLegacy(LegacyConn& conn) {
+	while (!conn.dqOut.empty()) {
+		const std::string& frame = conn.dqOut.front();
+		ssize_t n = send(conn.nFd, frame.data() + conn.nOffset, frame.size() - conn.nOffset, MSG_NOSIGNAL);
+		if (n < 0) {
+			return false;
+		}
+		g_nSent += n;
+		conn.nOffset += n;
+		if (conn.nOffset == frame.size()) {
+			conn.dqOut.pop_front();
+			conn.nOffset = 0;
+		}
+	}
+	return true;
+}
+
+static bool FlushShared(CYondConn& conn) {
+	while (!conn.OutEmpty()) {
+		struct iovec iov[OUT_IOV_MAX];
+		struct msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = conn.OutGather(iov, OUT_IOV_MAX, [](const CYondFramePtr&) { return false; });
+		ssize_t n = sendmsg(conn.m_nFd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			return false;
+		}
+		g_nSent += n;
+		conn.OutSent((size_t)n);
+	}
+	return true;
+}
+
+static BenchResult RunLegacy(const std::vector<int>& vSend, const std::vector<int>& vPeer, const std::string& strBody, int nRounds) {
+	std::vector<LegacyConn> vConn(vSend.size());
+	for (size_t i = 0; i < vSend.size(); i++) {
+		vConn[i].nFd = vSend[i];
+	}
+	g_nCopied = g_nSent = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for (int r = 0; r < nRounds; r++) {
+		// 编码进一个std::string, 再给每个接收者的队列复制一份
+		std::string strFrame(CYondPack::FrameSize(strBody.size()), '\0');
+		CYondPack::Encode(&strFrame[0], YMsg, 0, strBody.data(), strBody.size());
+		g_nCopied += strFrame.size();
+		for (LegacyConn& conn : vConn) {
+			conn.dqOut.push_back(strFrame);
+			g_nCopied += strFrame.size();
+		}
+		bool bDone = false;
+		while (!bDone) {
+			bDone = true;
+			for (LegacyConn& conn : vConn) {
+				bDone = FlushLegacy(conn) && bDone;
+			}
+			Drain(vPeer);
+		}
+	}
+	double dUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+	return { dUs / nRounds, (double)g_nCopied / nRounds, (double)g_nSent / nRounds };
+}
+
+static BenchResult RunShared(const std::vector<int>& vSend, const std::vector<int>& vPeer, const std::string& strBody, int nRounds) {
+	std::vector<CYondConn*> vConn;
+	for (int fd : vSend) {
+		vConn.push_back(new CYondConn(fd, "bench"));
+	}
+	g_nCopied = g_nSent = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for (int r = 0; r < nRounds; r++) {
+		// 只编码一次, 接收者的队列只追加引用
+		CYondFramePtr frame = CYondFrame::Make(YMsg, strBody.data(), strBody.size());
+		g_nCopied += frame->Size();
+		for (CYondConn* pConn : vConn) {
+			pConn->OutPush(frame);
+		}
+		bool bDone = false;
+		while (!bDone) {
+			bDone = true;
+			for (CYondConn* pConn : vConn) {
+				bDone = FlushShared(*pConn) && bDone;
+			}
+			Drain(vPeer);
+		}
+	}
+	double dUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+	for (CYondConn* pConn : vConn) {
+		delete pConn;
+	}
+	return { dUs / nRounds, (double)g_nCopied / nRounds, (double)g_nSent / nRounds };
+}
+
+int main(int argc, char* argv[]) {
+	int nConns = argc > 1 ? atoi(argv[1]) : 256;
+	size_t nBody = argc > 2 ? (size_t)atol(argv[2]) : 1024;
+	int nRounds = argc > 3 ? atoi(argv[3]) : 2000;
+	if (nConns <= 0 || nRounds <= 0 || CYondPack::FrameSize(nBody) > YOND_MAX_FRAME) {
+		fprintf(stderr, "usage: bench-broadcast [receivers] [payload bytes] [rounds]\n");
+		return 2;
+	}
+
+	std::vector<int> vSend, vPeer;
+	Connect(nConns, vSend, vPeer);
+	std::string strBody(nBody, 'x');
+
+	printf("receivers %d, payload %zu B, frame %zu B, %d rounds\n", nConns, nBody, CYondPack::FrameSize(nBody), nRounds);
+	printf("%-8s %14s %14s %14s\n", "mode", "us/bcast", "copied B/bcast", "sent B/bcast");
+	BenchResult legacy = RunLegacy(vSend, vPeer, strBody, nRounds);
+	printf("%-8s %14.1f %14.0f %14.0f\n", "copy", legacy.dUs, legacy.dCopied, legacy.dSent);
+	BenchResult shared = RunShared(vSend, vPeer, strBody, nRounds);
+	printf("%-8s %14.1f %14.0f %14.0f\n", "shared", shared.dUs, shared.dCopied, shared.dSent);
+
+	for (size_t i = 0; i < vSend.size(); i++) {
+		close(vSend[i]);
+		close(vPeer[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include "../LetsChat_common/CYondCodec.h"
+
+// 帧校验的吞吐(GB/s), 负载64B/1KB/64KB/1MB:
+//   sum     - 旧版16位字节和(CYondCodec::Sum), 老客户端仍在用;
+//   bitwise - 逐位CRC32C, 只作参照;
+//   slice8  - slicing-by-8查表, CPU没有CRC指令时的实现;
+//   hw      - SSE4.2或ARMv8的CRC指令, CPU不支持时不测.
+// 每种实现反复校验同一块缓冲, 总共处理约nTotal字节; 结果一致性先核对一遍.
+// 用法: bench-crc [每项总字节=1GB]
+// 构建: g++ -std=c++17 -O2 bench/bench-crc.cpp -o bench-crc
+
+#define CRC_BITWISE_MAX (64 * 1024 * 1024)	// 逐位实现太慢, 最多处理这么多字节
+
+static volatile uint32_t g_nSink = 0;
+
+template<class Fn>
+static double Measure(const std::vector<unsigned char>& vBuf, size_t nTotal, Fn check) {
+	size_t nPasses = std::max((size_t)1, nTotal / vBuf.size());
+	uint32_t acc = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for (size_t p = 0; p < nPasses; p++) {
+		acc += check(vBuf.data(), vBuf.size());
+	}
+	double dSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	g_nSink += acc;
+	return (double)(nPasses * vBuf.size()) / dSec / 1e9;
+}
+
+static uint32_t SumFn(const unsigned char* p, size_t n) { return CYondCodec::Sum(p, n); }
+static uint32_t BitwiseFn(const unsigned char* p, size_t n) { return CYondCrc32c::Bitwise(p, n); }
+static uint32_t Slice8Fn(const unsigned char* p, size_t n) { return CYondCrc32c::Slice8(0, p, n); }
+
+int main(int argc, char* argv[]) {
+	size_t nTotal = argc > 1 ? (size_t)atoll(argv[1]) : ((size_t)1 << 30);
+	if (nTotal == 0) {
+		fprintf(stderr, "usage: bench-crc [bytes per run]\n");
+		return 2;
+	}
+
+	CYondCrc32c::Fn hw = nullptr;
+#if defined(YOND_CRC_X86)
+	hw = CYondCrc32c::Sse42;
+#elif defined(YOND_CRC_ARM)
+	hw = CYondCrc32c::Armv8;
+#endif
+	// 运行时选中的不是硬件实现, 说明CPU不支持或自检没过
+	if (strcmp(CYondCrc32c::ImplName(), "slicing-by-8") == 0) {
+		hw = nullptr;
+	}
+
+	const size_t anBody[] = { 64, 1024, 65536, 1 << 20 };
+	printf("dispatch: %s, GB/s\n", CYondCrc32c::ImplName());
+	printf("%-8s %10s %10s %10s %10s\n", "payload", "sum", "bitwise", "slice8", "hw");
+	for (size_t nBody : anBody) {
+		std::vector<unsigned char> vBuf(nBody);
+		for (size_t i = 0; i < nBody; i++) {
+			vBuf[i] = (unsigned char)(i * 131 + 7);
+		}
+		uint32_t ref = CYondCrc32c::Bitwise(vBuf.data(), nBody);
+		if (CYondCrc32c::Slice8(0, vBuf.data(), nBody) != ref || (hw && hw(0, vBuf.data(), nBody) != ref)) {
+			fprintf(stderr, "crc mismatch at %zu bytes\n", nBody);
+			return 1;
+		}
+
+		double dSum = Measure(vBuf, nTotal, SumFn);
+		double dBit = Measure(vBuf, std::min(nTotal, (size_t)CRC_BITWISE_MAX), BitwiseFn);
+		double dSlice = Measure(vBuf, nTotal, Slice8Fn);
+		printf("%-8zu %10.2f %10.2f %10.2f ", nBody, dSum, dBit, dSlice);
+		if (hw) {
+			double dHw = Measure(vBuf, nTotal, [hw](const unsigned char* p, size_t n) { return hw(0, p, n); });
+			printf("%10.2f\n", dHw);
+		} else {
+			printf("%10s\n", "-");
+		}
+	}
+	return 0;
+}
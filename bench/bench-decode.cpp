@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "../LetsChat_server/CYondPack.h"
+
+// 每帧解码耗时(ns/frame), 负载32B/1KB/64KB:
+//   copy  - 持有数据的CYondPack(pData, nSize)构造再赋值给消息, user-014之前ProcessMessage的做法;
+//   pack  - CYondPack::Decode, 负载指向输入缓冲;
+//   view  - CYondPackView::Decode, HandleEvent现在的做法.
+// 每种方式反复解同一段含多帧的输入缓冲, 总共解出约nTotal字节负载.
+// 用法: bench-decode [crc] [总负载字节=1GB]
+// 构建: g++ -std=c++17 -O2 bench/bench-decode.cpp LetsChat_server/CYondPack.cpp -o bench-decode -pthread
+
+#define DECODE_BUF_BYTES (4 * 1024 * 1024)	// 输入缓冲大小, 放得下L3时测到的是解码本身
+
+static volatile size_t g_nSink = 0;
+
+static std::string MakeStream(size_t nBody, bool bCrc, size_t& nFrames) {
+	std::string strBody(nBody, '\0');
+	for (size_t i = 0; i < nBody; i++) {
+		strBody[i] = (char)(i * 131 + 7);
+	}
+	size_t nFrame = CYondPack::FrameSize(nBody, bCrc);
+	nFrames = std::max((size_t)1, DECODE_BUF_BYTES / nFrame);
+	std::string strOut(nFrame * nFrames, '\0');
+	for (size_t i = 0; i < nFrames; i++) {
+		CYondPack::Encode(&strOut[i * nFrame], YMsg, 0, strBody.data(), nBody, bCrc);
+	}
+	return strOut;
+}
+
+template<class Fn>
+static double Measure(const std::string& strIn, size_t nFrames, size_t nPasses, Fn decode) {
+	auto t0 = std::chrono::steady_clock::now();
+	for (size_t p = 0; p < nPasses; p++) {
+		size_t nGot = decode((const unsigned char*)strIn.data(), strIn.size());
+		if (nGot != nFrames) {
+			fprintf(stderr, "decoded %zu of %zu frames\n", nGot, nFrames);
+			exit(1);
+		}
+	}
+	double dNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+	return dNs / (double)(nFrames * nPasses);
+}
+
+static size_t DecodeCopy(const unsigned char* pData, size_t nSize) {
+	size_t nFrames = 0;
+	CYondPack msg;
+	while (nSize > 0) {
+		size_t nLeft = nSize;
+		msg = CYondPack(pData, nLeft);
+		if (msg.m_sHead != YOND_FRAME_MAGIC) break;
+		pData += nSize - nLeft;
+		nSize = nLeft;
+		g_nSink += msg.m_strData.size();
+		nFrames++;
+	}
+	return nFrames;
+}
+
+static size_t DecodePack(const unsigned char* pData, size_t nSize) {
+	size_t nFrames = 0;
+	size_t nPos = 0;
+	CYondPack pack;
+	while (nPos < nSize) {
+		size_t nUsed = 0;
+		int ret = pack.Decode(pData + nPos, nSize - nPos, nUsed);
+		nPos += nUsed;
+		if (ret != YDecodeFrame) break;
+		g_nSink += pack.m_nBody;
+		nFrames++;
+	}
+	return nFrames;
+}
+
+static size_t DecodeView(const unsigned char* pData, size_t nSize) {
+	size_t nFrames = 0;
+	size_t nPos = 0;
+	while (nPos < nSize) {
+		CYondPackView view;
+		size_t nUsed = 0;
+		int ret = view.Decode(pData + nPos, nSize - nPos, nUsed);
+		nPos += nUsed;
+		if (ret != YDecodeFrame) break;
+		g_nSink += view.Body().size();
+		nFrames++;
+	}
+	return nFrames;
+}
+
+int main(int argc, char* argv[]) {
+	bool bCrc = argc > 1 && strcmp(argv[1], "crc") == 0;
+	size_t nTotal = argc > 2 ? (size_t)atoll(argv[2]) : ((size_t)1 << 30);
+	YondLogOpt logOpt;
+	logOpt.bConsole = false;
+	logOpt.eLevel = CYondLog::LOG_LEVEL_ERROR;
+	CYondLog::Configure(logOpt);
+
+	const size_t anBody[] = { 32, 1024, 65536 };
+	printf("%s frames, ns/frame\n", bCrc ? "crc32c" : "byte-sum");
+	printf("%-8s %10s %10s %10s\n", "payload", "copy", "pack", "view");
+	for (size_t nBody : anBody) {
+		size_t nFrames = 0;
+		std::string strIn = MakeStream(nBody, bCrc, nFrames);
+		size_t nPasses = std::max((size_t)1, nTotal / (nBody * nFrames));
+		double dCopy = Measure(strIn, nFrames, nPasses, DecodeCopy);
+		double dPack = Measure(strIn, nFrames, nPasses, DecodePack);
+		double dView = Measure(strIn, nFrames, nPasses, DecodeView);
+		printf("%-8zu %10.1f %10.1f %10.1f\n", nBody, dCopy, dPack, dView);
+	}
+	return 0;
+}
@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "../LetsChat_server/CYondThreadPool.h"
+
+// 线程池每秒完成的任务数: 1/4/16/64个提交线程同时Enqueue空任务.
+// mutex为user-008之前的实现(std::queue<std::function> + 一把锁 + 条件变量), 作为对照;
+// shared和steal为CYondThreadPool的两种模式(-p shared|steal).
+// 用法: bench-pool [工作线程数=6] [每组任务总数=2000000]
+// 构建: g++ -std=c++17 -O2 bench/bench-pool.cpp -o bench-pool -pthread
+
+// user-008之前的线程池
+class CLegacyPool
+{
+public:
+	explicit CLegacyPool(size_t threads) : m_bStop(false) {
+		for (size_t i = 0; i < threads; i++) {
+			m_vThreads.emplace_back([this]() {
+				while (true) {
+					std::function<void()> task;
+					{
+						std::unique_lock<std::mutex> lock(m_mutex);
+						m_cv.wait(lock, [this]() { return m_bStop || !m_tasks.empty(); });
+						if (m_bStop && m_tasks.empty()) {
+							return;
+						}
+						task = std::move(m_tasks.front());
+						m_tasks.pop();
+					}
+					task();
+				}
+			});
+		}
+	}
+	~CLegacyPool() {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_bStop = true;
+		}
+		m_cv.notify_all();
+		for (std::thread& t : m_vThreads) {
+			t.join();
+		}
+	}
+
+	template<class F>
+	void Enqueue(F&& f) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_tasks.emplace(std::forward<F>(f));
+		}
+		m_cv.notify_one();
+	}
+
+private:
+	bool m_bStop;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::queue<std::function<void()>> m_tasks;
+	std::vector<std::thread> m_vThreads;
+};
+
+static std::atomic<size_t> g_nDone(0);
+
+// nProducers个线程共提交nTasks个任务, 返回从开始提交到全部执行完的每秒任务数
+template<class Pool>
+static double Run(Pool& pool, int nProducers, size_t nTasks) {
+	g_nDone = 0;
+	size_t nEach = nTasks / nProducers;
+	size_t nTotal = nEach * nProducers;
+	std::atomic<bool> bGo(false);
+	std::vector<std::thread> vProducers;
+	for (int i = 0; i < nProducers; i++) {
+		vProducers.emplace_back([&pool, &bGo, nEach]() {
+			while (!bGo.load(std::memory_order_acquire)) {
+				std::this_thread::yield();
+			}
+			for (size_t k = 0; k < nEach; k++) {
+				pool.Enqueue([]() { g_nDone.fetch_add(1, std::memory_order_relaxed); });
+			}
+		});
+	}
+	auto t0 = std::chrono::steady_clock::now();
+	bGo.store(true, std::memory_order_release);
+	for (std::thread& t : vProducers) {
+		t.join();
+	}
+	while (g_nDone.load(std::memory_order_relaxed) < nTotal) {
+		std::this_thread::yield();
+	}
+	double dSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	return nTotal / dSec;
+}
+
+int main(int argc, char* argv[]) {
+	size_t nWorkers = argc > 1 ? (size_t)atoi(argv[1]) : 6;
+	size_t nTasks = argc > 2 ? (size_t)atol(argv[2]) : 2000000;
+	if (nWorkers == 0 || nTasks < 64) {
+		fprintf(stderr, "usage: bench-pool [workers] [tasks per run]\n");
+		return 2;
+	}
+	YondLogOpt logOpt;
+	logOpt.bConsole = false;
+	CYondLog::Configure(logOpt);
+
+	const int anProducers[] = { 1, 4, 16, 64 };
+	printf("workers %zu, %zu tasks per run, Mtasks/s\n", nWorkers, nTasks);
+	printf("%-10s %10s %10s %10s\n", "producers", "mutex", "shared", "steal");
+	for (int nProducers : anProducers) {
+		double dMutex, dShared, dSteal;
+		{
+			CLegacyPool pool(nWorkers);
+			dMutex = Run(pool, nProducers, nTasks);
+		}
+		{
+			CYondThreadPool pool(nWorkers, YPoolShared);
+			dShared = Run(pool, nProducers, nTasks);
+		}
+		{
+			CYondThreadPool pool(nWorkers, YPoolSteal);
+			dSteal = Run(pool, nProducers, nTasks);
+		}
+		printf("%-10d %10.2f %10.2f %10.2f\n", nProducers, dMutex / 1e6, dShared / 1e6, dSteal / 1e6);
+	}
+	return 0;
+}
@@ -0,0 +1,267 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../LetsChat_server/CYondFileRelay.h"
+
+// 本机回环上传、下载一个文件的吞吐(MB/s), 默认1GB:
+//   loopback - 只在两个socket之间send/recv, 不落盘, 作为上限参照;
+//   copy     - 用户态中转: recv进缓冲再write进文件, 下载时read再send;
+//   relay    - CYondFileRelay: 上传经管道splice进暂存文件, 收齐后切块入库, 下载从块文件sendfile.
+// 客户端一侧都用sendfile上传、recv进缓冲下载; 上传计时到收到最后一个ACP为止, 包含切块入库.
+// 用法: bench-relay [字节数=1GB] [端口=18888]
+// 构建: g++ -std=c++17 -O2 bench/bench-relay.cpp $(ls LetsChat_server/*.cpp | grep -v main.cpp) -o bench-relay -pthread
+
+#define BENCH_IO_SIZE (1024 * 1024)		// 用户态读写缓冲大小
+
+struct RelayResult
+{
+	double dUp;		// 上传MB/s
+	double dDown;	// 下载MB/s
+};
+
+static double Seconds(std::chrono::steady_clock::time_point t0) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void Die(const char* pWhat) {
+	perror(pWhat);
+	exit(1);
+}
+
+static int Listen(unsigned short& nPort) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0
+		|| getsockname(fd, (sockaddr*)&addr, &len) != 0) {
+		Die("listen");
+	}
+	nPort = ntohs(addr.sin_port);
+	return fd;
+}
+
+static int Connect(unsigned short nPort) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(nPort);
+	if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		Die("connect");
+	}
+	return fd;
+}
+
+static void SendAll(int fd, const char* p, size_t n) {
+	while (n > 0) {
+		ssize_t m = send(fd, p, n, MSG_NOSIGNAL);
+		if (m < 0 && errno == EINTR) continue;
+		if (m <= 0) Die("send");
+		p += m;
+		n -= (size_t)m;
+	}
+}
+
+static void SendFile(int fd, int nFile, size_t n) {
+	off_t nOff = 0;
+	while ((size_t)nOff < n) {
+		ssize_t m = sendfile(fd, nFile, &nOff, n - (size_t)nOff);
+		if (m < 0 && errno == EINTR) continue;
+		if (m <= 0) Die("sendfile");
+	}
+}
+
+// 收n字节; nFile不为-1时写进文件
+static void RecvAll(int fd, size_t n, std::vector<char>& vBuf, int nFile = -1) {
+	while (n > 0) {
+		ssize_t m = recv(fd, vBuf.data(), std::min(n, vBuf.size()), 0);
+		if (m < 0 && errno == EINTR) continue;
+		if (m <= 0) Die("recv");
+		if (nFile >= 0 && write(nFile, vBuf.data(), (size_t)m) != m) Die("write");
+		n -= (size_t)m;
+	}
+}
+
+// 逐字节读一行, 不多读后面的文件内容
+static std::string ReadLine(int fd) {
+	std::string strLine;
+	char c;
+	while (true) {
+		ssize_t m = recv(fd, &c, 1, 0);
+		if (m < 0 && errno == EINTR) continue;
+		if (m <= 0) Die("recv line");
+		if (c == '\n') return strLine;
+		strLine += c;
+	}
+}
+
+static void MakeSource(const std::string& strPath, size_t nBytes) {
+	int fd = open(strPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) Die("open source");
+	std::vector<char> vBuf(BENCH_IO_SIZE);
+	uint64_t x = 0x9E3779B97F4A7C15ull;
+	for (size_t nDone = 0; nDone < nBytes; ) {
+		// 伪随机内容, 切块后不会因为重复而少存
+		for (size_t i = 0; i + 8 <= vBuf.size(); i += 8) {
+			x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+			memcpy(&vBuf[i], &x, 8);
+		}
+		size_t n = std::min(vBuf.size(), nBytes - nDone);
+		if (write(fd, vBuf.data(), n) != (ssize_t)n) Die("write source");
+		nDone += n;
+	}
+	close(fd);
+}
+
+static double RunLoopback(int nSrc, size_t nBytes) {
+	unsigned short nPort = 0;
+	int lfd = Listen(nPort);
+	std::thread server([lfd, nBytes]() {
+		int fd = accept(lfd, NULL, NULL);
+		std::vector<char> vBuf(BENCH_IO_SIZE);
+		RecvAll(fd, nBytes, vBuf);
+		SendAll(fd, "\n", 1);
+		close(fd);
+	});
+	auto t0 = std::chrono::steady_clock::now();
+	int fd = Connect(nPort);
+	SendFile(fd, nSrc, nBytes);
+	ReadLine(fd);
+	double dSec = Seconds(t0);
+	close(fd);
+	server.join();
+	close(lfd);
+	return nBytes / dSec / 1e6;
+}
+
+static RelayResult RunCopy(int nSrc, size_t nBytes, const std::string& strDir) {
+	std::string strPath = strDir + "/copy.bin";
+	unsigned short nPort = 0;
+	int lfd = Listen(nPort);
+	std::thread server([lfd, nBytes, strPath]() {
+		std::vector<char> vBuf(BENCH_IO_SIZE);
+		int fd = accept(lfd, NULL, NULL);
+		int nFile = open(strPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (nFile < 0) Die("open copy");
+		RecvAll(fd, nBytes, vBuf, nFile);
+		close(nFile);
+		SendAll(fd, "\n", 1);
+		close(fd);
+
+		fd = accept(lfd, NULL, NULL);
+		nFile = open(strPath.c_str(), O_RDONLY);
+		for (size_t nDone = 0; nDone < nBytes; ) {
+			ssize_t m = read(nFile, vBuf.data(), vBuf.size());
+			if (m <= 0) Die("read copy");
+			SendAll(fd, vBuf.data(), (size_t)m);
+			nDone += (size_t)m;
+		}
+		close(nFile);
+		close(fd);
+	});
+	RelayResult res;
+	std::vector<char> vBuf(BENCH_IO_SIZE);
+	auto t0 = std::chrono::steady_clock::now();
+	int fd = Connect(nPort);
+	SendFile(fd, nSrc, nBytes);
+	ReadLine(fd);
+	res.dUp = nBytes / Seconds(t0) / 1e6;
+	close(fd);
+
+	t0 = std::chrono::steady_clock::now();
+	fd = Connect(nPort);
+	RecvAll(fd, nBytes, vBuf);
+	res.dDown = nBytes / Seconds(t0) / 1e6;
+	close(fd);
+	server.join();
+	close(lfd);
+	unlink(strPath.c_str());
+	return res;
+}
+
+static RelayResult RunRelay(int nSrc, size_t nBytes, unsigned short nPort) {
+	RelayResult res;
+	std::vector<char> vBuf(BENCH_IO_SIZE);
+	std::string strSize = std::to_string(nBytes);
+	std::string strDone = "ACP " + strSize;
+
+	auto t0 = std::chrono::steady_clock::now();
+	int fd = Connect(nPort);
+	std::string strHead = "FILE bench.bin " + strSize + "\n";
+	SendAll(fd, strHead.data(), strHead.size());
+	SendFile(fd, nSrc, nBytes);
+	while (ReadLine(fd) != strDone) {}
+	res.dUp = nBytes / Seconds(t0) / 1e6;
+	close(fd);
+
+	t0 = std::chrono::steady_clock::now();
+	fd = Connect(nPort);
+	SendAll(fd, "REQ bench.bin\n", 14);
+	std::string strLine = ReadLine(fd);
+	if (strLine != "FILE bench.bin " + strSize) {
+		fprintf(stderr, "unexpected reply: %s\n", strLine.c_str());
+		exit(1);
+	}
+	RecvAll(fd, nBytes, vBuf);
+	res.dDown = nBytes / Seconds(t0) / 1e6;
+	close(fd);
+	return res;
+}
+
+int main(int argc, char* argv[]) {
+	size_t nBytes = argc > 1 ? (size_t)atoll(argv[1]) : ((size_t)1 << 30);
+	unsigned short nPort = argc > 2 ? (unsigned short)atoi(argv[2]) : 18888;
+	if (nBytes == 0 || nPort == 0) {
+		fprintf(stderr, "usage: bench-relay [bytes] [relay port]\n");
+		return 2;
+	}
+	YondLogOpt logOpt;
+	logOpt.bConsole = false;
+	logOpt.eLevel = CYondLog::LOG_LEVEL_ERROR;
+	CYondLog::Configure(logOpt);
+
+	char szDir[] = "/tmp/bench-relay-XXXXXX";
+	if (mkdtemp(szDir) == nullptr) Die("mkdtemp");
+	std::string strDir = szDir;
+	std::string strSrc = strDir + "/src.bin";
+	MakeSource(strSrc, nBytes);
+	int nSrc = open(strSrc.c_str(), O_RDONLY);
+	if (nSrc < 0) Die("open source");
+
+	YondServerOpt opt;
+	opt.nFilePort = nPort;
+	opt.strSpoolDir = strDir + "/spool";
+	// 与服务端一样在线程池上入库, 线程池要比中转服务晚析构
+	CYondThreadPool pool(2);
+	CYondFileRelay relay;
+	if (relay.Start(opt, &pool) != 0) {
+		fprintf(stderr, "failed to start file relay on port %u\n", (unsigned)nPort);
+		return 1;
+	}
+
+	printf("%zu bytes over loopback, MB/s\n", nBytes);
+	printf("%-10s %10s %10s\n", "mode", "upload", "download");
+	printf("%-10s %10.0f %10s\n", "loopback", RunLoopback(nSrc, nBytes), "-");
+	RelayResult copy = RunCopy(nSrc, nBytes, strDir);
+	printf("%-10s %10.0f %10.0f\n", "copy", copy.dUp, copy.dDown);
+	RelayResult splice = RunRelay(nSrc, nBytes, nPort);
+	printf("%-10s %10.0f %10.0f\n", "relay", splice.dUp, splice.dDown);
+
+	relay.Stop();
+	close(nSrc);
+	std::string strClean = "rm -rf " + strDir;
+	return system(strClean.c_str()) == 0 ? 0 : 1;
+}
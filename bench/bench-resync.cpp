@@ -0,0 +1,202 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "../LetsChat_common/CYondCodec.h"
+
+// 错位后重新同步的速度: 一段垃圾后面跟一个v1帧, 垃圾64B/4KB/64KB/1MB.
+// 垃圾中约每256字节有一个0xFE, 每4KB有一个魔数后跟非法版本的假帧头.
+//   bytewise - user-017之前的做法, 逐字节比较0xFE 0xFF再检查帧头;
+//   memchr   - CYondScan::Memchr找0xFE;
+//   simd     - CYondScan的AVX2或NEON实现, CPU不支持时不测;
+//   stream   - CYondCodec::DecodeStream, 服务端和客户端现在的入口.
+// 第二张表把同样的流按4KB分段到达: rescan为旧客户端每次从缓冲开头重扫,
+// carry为DecodeStream丢弃已扫过的垃圾、下次从断点继续.
+// 用法: bench-resync [每项总字节=256MB]
+// 构建: g++ -std=c++17 -O2 bench/bench-resync.cpp -o bench-resync
+
+#define RESYNC_READ_CHUNK 4096		// 分段到达时每次读到的字节数
+#define RESYNC_FAKE_EVERY 4096		// 每隔多少字节放一个假帧头
+
+static volatile size_t g_nSink = 0;
+
+typedef size_t (*ScanFn)(const unsigned char* p, size_t n);
+
+static std::vector<unsigned char> MakeStream(size_t nGarbage, size_t& nFrame) {
+	std::vector<unsigned char> v(nGarbage);
+	uint32_t x = 0x12345678;
+	for (size_t i = 0; i < nGarbage; i++) {
+		x = x * 1103515245 + 12345;
+		v[i] = (unsigned char)(x >> 16);
+	}
+	for (size_t i = RESYNC_FAKE_EVERY / 2; i + 3 <= nGarbage; i += RESYNC_FAKE_EVERY) {
+		v[i] = 0xFE;
+		v[i + 1] = 0xFF;
+	}
+	// 随机出来的魔数和放进去的假帧头都改成非法版本, 保证找到的第一个帧是后面真正的帧
+	for (size_t i = 0; i + 1 < nGarbage; i++) {
+		if (v[i] == 0xFE && v[i + 1] == 0xFF) {
+			if (i + 2 < nGarbage) {
+				v[i + 2] = 0x7F;
+			} else {
+				v[i + 1] = 0x00;
+			}
+		}
+	}
+	const char body[] = "resync";
+	nFrame = CYondCodec::FrameSize(sizeof(body) - 1);
+	v.resize(nGarbage + nFrame);
+	CYondCodec::Encode(v.data() + nGarbage, nFrame, YMsg, 0, body, sizeof(body) - 1);
+	return v;
+}
+
+// user-017之前的扫描
+static size_t Bytewise(const unsigned char* p, size_t n) {
+	for (size_t i = 0; i + 1 < n; i++) {
+		if (p[i] == 0xFE && p[i + 1] == 0xFF && CYondCodec::HeadSane(p + i, n - i)) {
+			return i;
+		}
+	}
+	return n;
+}
+
+// 与CYondCodec::Resync相同, 只是指定魔数查找的实现
+template<ScanFn fn>
+static size_t ScanWith(const unsigned char* p, size_t n) {
+	size_t i = 0;
+	while (true) {
+		i += fn(p + i, n - i);
+		if (i >= n || CYondCodec::HeadSane(p + i, n - i)) {
+			return i;
+		}
+		i++;
+	}
+}
+
+static size_t Stream(const unsigned char* p, size_t n) {
+	size_t nPos = 0;
+	while (nPos < n) {
+		YondFrameHead head = {};
+		size_t nUsed = 0;
+		int ret = CYondCodec::DecodeStream(p + nPos, n - nPos, nUsed, head);
+		if (ret == YDecodeFrame) {
+			return nPos + nUsed - head.nFrame;
+		}
+		nPos += nUsed;
+		if (ret == YDecodeMore) break;
+	}
+	return n;
+}
+
+// 返回跳过垃圾的速度, GB/s; 每次都必须停在帧头上
+static double Measure(const std::vector<unsigned char>& v, size_t nGarbage, size_t nTotal, ScanFn fn) {
+	size_t nPasses = std::max((size_t)1, nTotal / v.size());
+	auto t0 = std::chrono::steady_clock::now();
+	for (size_t p = 0; p < nPasses; p++) {
+		size_t nAt = fn(v.data(), v.size());
+		if (nAt != nGarbage) {
+			fprintf(stderr, "resync stopped at %zu, frame at %zu\n", nAt, nGarbage);
+			exit(1);
+		}
+		g_nSink += nAt;
+	}
+	double dSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	return (double)(nPasses * nGarbage) / dSec / 1e9;
+}
+
+// 分段到达, 旧客户端: 缓冲只追加, 每次从头重扫
+static double ChunkedRescan(const std::vector<unsigned char>& v, size_t nGarbage) {
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector<unsigned char> buf;
+	size_t nAt = v.size();
+	for (size_t nOff = 0; nOff < v.size() && nAt == v.size(); nOff += RESYNC_READ_CHUNK) {
+		buf.insert(buf.end(), v.begin() + nOff, v.begin() + std::min(v.size(), nOff + RESYNC_READ_CHUNK));
+		size_t i = Bytewise(buf.data(), buf.size());
+		if (i < buf.size() && buf.size() - i >= YOND_FRAME_HEAD) {
+			nAt = i;
+		}
+	}
+	if (nAt != nGarbage) {
+		fprintf(stderr, "rescan stopped at %zu, frame at %zu\n", nAt, nGarbage);
+		exit(1);
+	}
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// 分段到达, 现在的做法: 扫过的垃圾随即丢弃
+static double ChunkedCarry(const std::vector<unsigned char>& v, size_t nGarbage) {
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector<unsigned char> buf;
+	size_t nDropped = 0;
+	bool bFound = false;
+	for (size_t nOff = 0; nOff < v.size() && !bFound; nOff += RESYNC_READ_CHUNK) {
+		buf.insert(buf.end(), v.begin() + nOff, v.begin() + std::min(v.size(), nOff + RESYNC_READ_CHUNK));
+		size_t nPos = 0;
+		while (nPos < buf.size()) {
+			YondFrameHead head = {};
+			size_t nUsed = 0;
+			int ret = CYondCodec::DecodeStream(buf.data() + nPos, buf.size() - nPos, nUsed, head);
+			if (ret == YDecodeFrame) {
+				nDropped += nPos + nUsed - head.nFrame;
+				bFound = true;
+				break;
+			}
+			nPos += nUsed;
+			if (ret == YDecodeMore) break;
+		}
+		if (!bFound) {
+			nDropped += nPos;
+			buf.erase(buf.begin(), buf.begin() + nPos);
+		}
+	}
+	if (nDropped != nGarbage) {
+		fprintf(stderr, "carry dropped %zu, frame at %zu\n", nDropped, nGarbage);
+		exit(1);
+	}
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char* argv[]) {
+	size_t nTotal = argc > 1 ? (size_t)atoll(argv[1]) : ((size_t)256 << 20);
+	if (nTotal == 0) {
+		fprintf(stderr, "usage: bench-resync [bytes per run]\n");
+		return 2;
+	}
+	ScanFn simd = nullptr;
+#if defined(YOND_SCAN_AVX2)
+	if (__builtin_cpu_supports("avx2")) simd = ScanWith<CYondScan::Avx2>;
+#elif defined(YOND_SCAN_NEON)
+	simd = ScanWith<CYondScan::Neon>;
+#endif
+
+	const size_t anGarbage[] = { 64, 4096, 65536, 1 << 20 };
+	printf("garbage skipped, GB/s\n");
+	printf("%-8s %10s %10s %10s %10s\n", "garbage", "bytewise", "memchr", "simd", "stream");
+	for (size_t nGarbage : anGarbage) {
+		size_t nFrame = 0;
+		std::vector<unsigned char> v = MakeStream(nGarbage, nFrame);
+		double dByte = Measure(v, nGarbage, nTotal, Bytewise);
+		double dMemchr = Measure(v, nGarbage, nTotal, ScanWith<CYondScan::Memchr>);
+		double dStream = Measure(v, nGarbage, nTotal, Stream);
+		printf("%-8zu %10.2f %10.2f ", nGarbage, dByte, dMemchr);
+		if (simd) {
+			printf("%10.2f ", Measure(v, nGarbage, nTotal, simd));
+		} else {
+			printf("%10s ", "-");
+		}
+		printf("%10.2f\n", dStream);
+	}
+
+	printf("\n%d B reads, us until the frame is found\n", RESYNC_READ_CHUNK);
+	printf("%-8s %12s %12s\n", "garbage", "rescan", "carry");
+	for (size_t nGarbage : anGarbage) {
+		size_t nFrame = 0;
+		std::vector<unsigned char> v = MakeStream(nGarbage, nFrame);
+		double dRescan = ChunkedRescan(v, nGarbage);
+		double dCarry = ChunkedCarry(v, nGarbage);
+		printf("%-8zu %12.1f %12.1f\n", nGarbage, dRescan, dCarry);
+	}
+	return 0;
+}
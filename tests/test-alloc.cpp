@@ -0,0 +1,180 @@
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include "../LetsChat_server/CYondHandleEvent.h"
+
+// 稳态下消息从输入缓冲经strand交给工作线程的路径不分配内存(user-009).
+// 替换全局operator new/delete计数, 预热让各个池填满后再统计:
+//   1. 与CYondHandleEvent::PostMessage相同的路径: CYondPackView解帧 -> CYondPayload::Copy ->
+//      CYondStrand::Post -> CYondThreadPool中的CYondTask -> 工作线程读负载, 所有线程的分配都计入;
+//   2. 真实的CYondHandleEvent::HandleEvent, 只统计调用它的循环线程. 工作线程上的广播要编码新帧,
+//      本来就要分配, 不计入.
+// 不分配只对负载不超过PAYLOAD_BLOCK_SIZE(2KB)的帧成立, 这两项的帧最长正好一个负载块.
+// 更长的负载不进池, 每帧单独分配一次: 第3项用全部超过一块的帧走HandleEvent, 核对正好每帧一次.
+// 前两项不为0或第3项不等于帧数时返回1.
+// 构建: g++ -std=c++17 -O2 tests/test-alloc.cpp $(ls LetsChat_server/*.cpp | grep -v main.cpp) -o test-alloc -pthread
+
+#define ALLOC_ROUNDS 200		// 统计的轮数
+#define ALLOC_BURST 256			// 每轮连续到达的帧数
+#define ALLOC_WARMUP 20			// 预热轮数
+
+static std::atomic<size_t> g_nAllocs(0);
+static thread_local size_t t_nAllocs = 0;
+
+// 所有形式都直接用malloc/free并成对替换, 数组形式不转发给标量operator new.
+// noipa: 不内联也不合并相同的函数体, 否则GCC会把标量和数组形式混为一谈, 误报-Wmismatched-new-delete
+static void* CountedAlloc(size_t nSize) noexcept {
+	g_nAllocs.fetch_add(1, std::memory_order_relaxed);
+	t_nAllocs++;
+	return malloc(nSize == 0 ? 1 : nSize);
+}
+
+__attribute__((noipa)) void* operator new(size_t nSize) {
+	void* p = CountedAlloc(nSize);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+__attribute__((noipa)) void* operator new[](size_t nSize) {
+	void* p = CountedAlloc(nSize);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+__attribute__((noipa)) void* operator new(size_t nSize, const std::nothrow_t&) noexcept { return CountedAlloc(nSize); }
+__attribute__((noipa)) void* operator new[](size_t nSize, const std::nothrow_t&) noexcept { return CountedAlloc(nSize); }
+__attribute__((noipa)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noipa)) void operator delete(void* p, size_t) noexcept { free(p); }
+__attribute__((noipa)) void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+__attribute__((noipa)) void operator delete[](void* p) noexcept { free(p); }
+__attribute__((noipa)) void operator delete[](void* p, size_t) noexcept { free(p); }
+__attribute__((noipa)) void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+static std::atomic<size_t> g_nDone(0);
+static std::atomic<size_t> g_nBytes(0);
+
+// 一轮到达的数据: 长短不一的v1帧. bOversize为false时最长的正好占满一个负载块, 为true时每帧都超过一块
+static std::string MakeBurst(bool bOversize) {
+	std::string strOut;
+	for (int i = 0; i < ALLOC_BURST; i++) {
+		size_t nBody = i % 7 == 0 ? PAYLOAD_BLOCK_SIZE : 16 + i % 100;
+		if (bOversize) {
+			nBody = PAYLOAD_BLOCK_SIZE + 1 + i % 100;
+		}
+		std::string strBody(nBody, (char)('a' + i % 26));
+		size_t nOff = strOut.size();
+		strOut.resize(nOff + CYondPack::FrameSize(strBody.size()));
+		CYondPack::Encode(&strOut[nOff], YMsg, 0, strBody.data(), strBody.size());
+	}
+	return strOut;
+}
+
+// 像事件循环一样每次最多读CONN_READ_CHUNK字节, 读一次解一次
+template<class Parse>
+static void Feed(CYondConn* pConn, const std::string& strBurst, Parse parse) {
+	for (size_t nOff = 0; nOff < strBurst.size(); nOff += CONN_READ_CHUNK) {
+		size_t n = std::min((size_t)CONN_READ_CHUNK, strBurst.size() - nOff);
+		memcpy(pConn->InTail(), strBurst.data() + nOff, n);
+		pConn->InCommit(n);
+		parse();
+	}
+}
+
+static void WaitDone(size_t nTarget) {
+	while (g_nDone.load(std::memory_order_acquire) < nTarget) {
+		std::this_thread::yield();
+	}
+}
+
+// 与PostMessage相同的捕获和负载传递, 工作线程只读负载
+static size_t RunPipeline(CYondThreadPool& pool, const std::string& strBurst) {
+	CYondConn conn(-1, "alloc");
+	conn.m_pStrand = std::make_shared<CYondStrand>(pool);
+	size_t nPosted = 0;
+	size_t nBase = 0;
+	for (int r = 0; r < ALLOC_WARMUP + ALLOC_ROUNDS; r++) {
+		if (r == ALLOC_WARMUP) {
+			WaitDone(nPosted);
+			nBase = g_nAllocs.load();
+		}
+		Feed(&conn, strBurst, [&]() {
+			size_t nPos = 0;
+			while (nPos < conn.InSize()) {
+				CYondPackView view;
+				size_t nUsed = 0;
+				int ret = view.Decode(conn.InData() + nPos, conn.InSize() - nPos, nUsed);
+				nPos += nUsed;
+				if (ret == YDecodeMore) break;
+				if (ret != YDecodeFrame) continue;
+				std::string_view body = view.Body();
+				YondMsg ymsg{ view.Cmd(), view.User(), CYondPayload::Copy(body.data(), body.size()) };
+				conn.m_pStrand->Post([id = conn.m_nId, name = conn.NamePtr(), ymsg = std::move(ymsg)]() {
+					(void)id;
+					g_nBytes.fetch_add(ymsg.data.Size() + name->size(), std::memory_order_relaxed);
+					g_nDone.fetch_add(1, std::memory_order_release);
+				});
+				nPosted++;
+			}
+			conn.InConsume(nPos);
+		});
+		// 每轮等工作线程处理完, 稳态下池中的块和节点循环使用
+		WaitDone(nPosted);
+	}
+	return g_nAllocs.load() - nBase;
+}
+
+// 真实的HandleEvent, 只统计本线程
+static size_t RunHandleEvent(const std::string& strBurst) {
+	YondServerOpt opt;
+	CYondHandleEvent handler;
+	handler.Init(opt);
+	CYondConn conn(-1, "alloc");
+	size_t nBase = 0;
+	for (int r = 0; r < ALLOC_WARMUP + ALLOC_ROUNDS; r++) {
+		if (r == ALLOC_WARMUP) {
+			nBase = t_nAllocs;
+		}
+		Feed(&conn, strBurst, [&]() {
+			handler.HandleEvent(nullptr, &conn);
+		});
+		// 等strand排空, 下一轮的任务节点从空闲表取
+		while (conn.m_pStrand->Pending() > 0) {
+			std::this_thread::yield();
+		}
+	}
+	return t_nAllocs - nBase;
+}
+
+int main() {
+	YondLogOpt logOpt;
+	logOpt.bConsole = false;
+	logOpt.eLevel = CYondLog::LOG_LEVEL_ERROR;
+	CYondLog::Configure(logOpt);
+
+	std::string strBurst = MakeBurst(false);
+	size_t nPipeline, nHandle, nOversize;
+	{
+		CYondThreadPool pool(4);
+		nPipeline = RunPipeline(pool, strBurst);
+	}
+	nHandle = RunHandleEvent(strBurst);
+	nOversize = RunHandleEvent(MakeBurst(true));
+
+	size_t nFrames = (size_t)ALLOC_ROUNDS * ALLOC_BURST;
+	printf("pipeline: %zu allocations for %zu frames (all threads)\n", nPipeline, nFrames);
+	printf("HandleEvent: %zu allocations for %zu frames (loop thread)\n", nHandle, nFrames);
+	printf("HandleEvent, payloads over %d bytes: %zu allocations for %zu frames (loop thread)\n",
+		PAYLOAD_BLOCK_SIZE, nOversize, nFrames);
+	if (nPipeline != 0 || nHandle != 0 || nOversize != nFrames) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,251 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../LetsChat_common/CYondCodec.h"
+
+// CYondCodec::DecodeStream的运行期黄金向量测试(user-015). 编译期的static_assert只覆盖逐字节的Decode,
+// 流式入口还要经过按CPU分派的CRC32C和SIMD的Resync, 这里用同一组黄金向量在运行期核对:
+// v1、旧版长度帧、v2、CRC32C、YBatch, 以及截断、校验错误、垃圾前缀重同步和任意切分的连续流.
+// 有失败时返回1.
+// 构建: g++ -std=c++17 -O2 tests/test-codec.cpp -o test-codec
+
+using namespace YondCodecGolden;
+
+static int g_nFailed = 0;
+static int g_nChecks = 0;
+
+#define CHECK(cond) do { \
+	g_nChecks++; \
+	if (!(cond)) { \
+		g_nFailed++; \
+		printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+	} \
+} while (0)
+
+typedef std::vector<unsigned char> Bytes;
+
+template<size_t N>
+static Bytes Vec(const unsigned char (&a)[N]) {
+	return Bytes(a, a + N);
+}
+
+static int Stream(const Bytes& v, size_t& nUsed, YondFrameHead& head) {
+	head = {};
+	nUsed = 0;
+	return CYondCodec::DecodeStream(v.data(), v.size(), nUsed, head);
+}
+
+static std::string Body(const Bytes& v, const YondFrameHead& head) {
+	return std::string((const char*)v.data() + head.nBody, head.nBodySize);
+}
+
+// 整帧解出, 字段与黄金向量一致
+static void TestGolden() {
+	YondFrameHead head;
+	size_t nUsed;
+
+	Bytes v1 = Vec(kFrameV1);
+	CHECK(Stream(v1, nUsed, head) == YDecodeFrame);
+	CHECK(nUsed == v1.size() && head.nFrame == v1.size());
+	CHECK(head.nVersion == YOND_PROTO_VERSION && !head.bCrc);
+	CHECK(head.sCmd == YMsg && head.sUser == 0x0102);
+	CHECK(head.nBody == YOND_FRAME_HEAD && Body(v1, head) == "hi");
+
+	// 旧版帧: 版本字节为0, 长度字段仍是3字节; 前面有一个垃圾字节
+	Bytes v0 = Vec(kFrameV0);
+	CHECK(Stream(v0, nUsed, head) == YDecodeFrame);
+	CHECK(nUsed == v0.size());
+	CHECK(head.nVersion == 0 && head.sCmd == YFile && head.nLength == 7);
+	CHECK(head.nBody == 1 + YOND_FRAME_HEAD && Body(v0, head) == "abc");
+
+	Bytes v2 = Vec(kFrameV2);
+	CHECK(Stream(v2, nUsed, head) == YDecodeFrame);
+	CHECK(nUsed == v2.size() && head.nVersion == YOND_PROTO_V2 && !head.bCrc);
+	CHECK(head.sCmd == YMsg && head.sUser == 0 && head.nBody == 5 && Body(v2, head) == "hi");
+
+	// CRC32C帧: 运行期的CRC走硬件或查表实现, 结果必须与黄金向量的帧尾相同
+	Bytes crc = Vec(kFrameCrc);
+	CHECK(Stream(crc, nUsed, head) == YDecodeFrame);
+	CHECK(nUsed == crc.size() && head.bCrc && head.nVersion == YOND_PROTO_VERSION);
+	CHECK(head.sCmd == YMsg && head.sUser == 0x0102 && Body(crc, head) == "hi");
+	Bytes enc(CYondCodec::FrameSize(2, true));
+	CHECK(CYondCodec::Encode(enc.data(), enc.size(), YMsg, 0x0102, "hi", 2, true) == enc.size());
+	CHECK(enc == crc);
+
+	Bytes batch = Vec(kFrameBatch);
+	CHECK(Stream(batch, nUsed, head) == YDecodeFrame);
+	CHECK(nUsed == batch.size() && head.sCmd == YBatch);
+	size_t nPos = 0;
+	YondBatchEntry e = {};
+	CHECK(CYondCodec::NextBatchEntry(batch.data() + head.nBody, head.nBodySize, nPos, e) == YDecodeFrame);
+	CHECK(e.sCmd == YMsg && e.nBodySize == 2);
+	CHECK(CYondCodec::NextBatchEntry(batch.data() + head.nBody, head.nBodySize, nPos, e) == YDecodeFrame);
+	CHECK(e.sCmd == YConnect && e.sUser == 5 && e.nBodySize == 1);
+
+	// v2带用户、两字节varint、CRC32C
+	std::string strBody(200, 'q');
+	Bytes big(CYondCodec::FrameSizeV2(strBody.size(), true, true));
+	CHECK(CYondCodec::EncodeV2(big.data(), big.size(), YFile, 0x0304, strBody.data(), strBody.size(), true) == big.size());
+	CHECK(Stream(big, nUsed, head) == YDecodeFrame);
+	CHECK(nUsed == big.size() && head.bCrc && head.sCmd == YFile && head.sUser == 0x0304);
+	CHECK(head.nBody == 8 && Body(big, head) == strBody);
+}
+
+// 每个黄金帧的每个前缀都是半帧: 不丢字节, nWant说明还要等多少
+static void TestTruncated() {
+	const Bytes aFrames[] = { Vec(kFrameV1), Vec(kFrameCrc), Vec(kFrameV2), Vec(kFrameBatch) };
+	for (const Bytes& frame : aFrames) {
+		for (size_t n = 2; n < frame.size(); n++) {
+			Bytes part(frame.begin(), frame.begin() + n);
+			YondFrameHead head;
+			size_t nUsed;
+			int ret = Stream(part, nUsed, head);
+			CHECK(ret == YDecodeMore);
+			CHECK(nUsed == 0);
+			CHECK(head.nWant > n && head.nWant <= frame.size());
+		}
+	}
+	// 只有一个0xFE时保留它, 可能是下一个帧头的前半部分
+	Bytes one = { 0x12, 0x34, 0xFE };
+	YondFrameHead head;
+	size_t nUsed;
+	CHECK(Stream(one, nUsed, head) == YDecodeMore);
+	CHECK(nUsed == 2);
+}
+
+// 负载或帧尾被改动: 整帧丢弃并报告校验错误, 之后的帧照常解出
+static void TestBadChecksum() {
+	const Bytes aFrames[] = { Vec(kFrameV1), Vec(kFrameCrc), Vec(kFrameV2), Vec(kFrameBatch) };
+	for (const Bytes& frame : aFrames) {
+		YondFrameHead head;
+		size_t nUsed;
+		CHECK(Stream(frame, nUsed, head) == YDecodeFrame);
+		size_t nBody = head.nBody;
+		// 改负载的第一个字节, 再单独改帧尾的最后一个字节
+		for (size_t nPos : { nBody, frame.size() - 1 }) {
+			Bytes bad = frame;
+			bad[nPos] ^= 0x01;
+			bad.insert(bad.end(), frame.begin(), frame.end());
+			CHECK(Stream(bad, nUsed, head) == YDecodeBadSum);
+			CHECK(nUsed == frame.size());
+			Bytes rest(bad.begin() + nUsed, bad.end());
+			CHECK(Stream(rest, nUsed, head) == YDecodeFrame && nUsed == frame.size());
+		}
+	}
+	// CRC32C帧的帧头也在CRC范围内, 改命令字段同样被发现
+	Bytes crc = Vec(kFrameCrc);
+	crc[7] ^= 0x02;
+	YondFrameHead head;
+	size_t nUsed;
+	CHECK(Stream(crc, nUsed, head) == YDecodeBadSum);
+}
+
+// 不停地解, 直到解出一帧或要等更多数据, 返回解出前一共丢弃的字节数
+static int DecodeNext(const Bytes& v, size_t& nPos, YondFrameHead& head, size_t& nDropped) {
+	nDropped = 0;
+	while (true) {
+		head = {};
+		size_t nUsed = 0;
+		int ret = CYondCodec::DecodeStream(v.data() + nPos, v.size() - nPos, nUsed, head);
+		if (ret == YDecodeFrame) {
+			head.nBody += nPos;
+			nDropped += nUsed - head.nFrame;
+			nPos += nUsed;
+			return ret;
+		}
+		nPos += nUsed;
+		nDropped += nUsed;
+		if (ret == YDecodeMore) {
+			return ret;
+		}
+	}
+}
+
+// 垃圾前缀: 没有魔数的长段(走SIMD扫描)、魔数后跟非法帧头的假帧头、以0xFE结尾的段
+static void TestResync() {
+	const Bytes aFrames[] = { Vec(kFrameV1), Vec(kFrameCrc), Vec(kFrameV2), Vec(kFrameBatch) };
+	std::vector<Bytes> vPrefix;
+	vPrefix.push_back(Bytes(1, 0x00));
+	Bytes noise;
+	for (int i = 0; i < 1000; i++) {
+		noise.push_back((unsigned char)(i * 37 % 251));	// 不含0xFE和0xFF
+	}
+	vPrefix.push_back(noise);
+	vPrefix.push_back({ 0xFE, 0xFF, 0x7F, 0x00 });			// 不存在的版本
+	vPrefix.push_back({ 0xFE, 0xFF, 0x01, 0x00, 0x00, 0x02 });	// 长度小于4
+	vPrefix.push_back({ 0xFE, 0xFF, 0x80 });					// 版本0不能带CRC标志
+	vPrefix.push_back({ 0x11, 0xFE, 0xFE, 0xFE });
+	Bytes mixed = noise;
+	mixed.insert(mixed.begin() + 500, { 0xFE, 0xFF, 0x05 });
+	vPrefix.push_back(mixed);
+
+	for (const Bytes& prefix : vPrefix) {
+		for (const Bytes& frame : aFrames) {
+			Bytes v = prefix;
+			v.insert(v.end(), frame.begin(), frame.end());
+			size_t nPos = 0;
+			size_t nDropped = 0;
+			YondFrameHead head;
+			CHECK(DecodeNext(v, nPos, head, nDropped) == YDecodeFrame);
+			CHECK(nDropped == prefix.size());
+			CHECK(nPos == v.size());
+			CHECK(head.nFrame == frame.size());
+		}
+	}
+}
+
+// 多个帧连成一条流, 按各种长度切开逐段送入, 模拟连接输入缓冲的追加和消费
+static void TestStream() {
+	const Bytes aFrames[] = { Vec(kFrameV1), Vec(kFrameCrc), Vec(kFrameV0), Vec(kFrameV2), Vec(kFrameBatch) };
+	Bytes all;
+	std::vector<unsigned> vCmds;
+	for (int r = 0; r < 20; r++) {
+		for (const Bytes& frame : aFrames) {
+			all.insert(all.end(), frame.begin(), frame.end());
+			YondFrameHead head;
+			size_t nUsed;
+			Stream(frame, nUsed, head);
+			vCmds.push_back(head.sCmd);
+		}
+	}
+	for (size_t nChunk : { (size_t)1, (size_t)2, (size_t)3, (size_t)7, (size_t)64, all.size() }) {
+		Bytes buf;
+		std::vector<unsigned> vGot;
+		size_t nWant = 0;
+		for (size_t nOff = 0; nOff < all.size(); nOff += nChunk) {
+			buf.insert(buf.end(), all.begin() + nOff, all.begin() + std::min(all.size(), nOff + nChunk));
+			if (buf.size() < nWant) {
+				continue;
+			}
+			size_t nPos = 0;
+			while (nPos < buf.size()) {
+				YondFrameHead head = {};
+				size_t nUsed = 0;
+				int ret = CYondCodec::DecodeStream(buf.data() + nPos, buf.size() - nPos, nUsed, head);
+				nPos += nUsed;
+				if (ret == YDecodeMore) {
+					nWant = head.nWant;
+					break;
+				}
+				CHECK(ret == YDecodeFrame);
+				vGot.push_back(head.sCmd);
+				nWant = 0;
+			}
+			buf.erase(buf.begin(), buf.begin() + nPos);
+		}
+		CHECK(buf.empty());
+		CHECK(vGot == vCmds);
+	}
+}
+
+int main() {
+	TestGolden();
+	TestTruncated();
+	TestBadChecksum();
+	TestResync();
+	TestStream();
+	printf("%d checks, %d failed\n", g_nChecks, g_nFailed);
+	return g_nFailed == 0 ? 0 : 1;
+}
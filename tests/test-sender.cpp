@@ -0,0 +1,198 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../LetsChat_server/CYondHandleEvent.h"
+
+// 广播带上发送方帧头中的用户字段(user-018). 进程内起一个事件循环和线程池,
+// v1连接alice依次发v1帧、v2帧和YBatch帧, 各带不同的用户字段; v2连接bob收到的
+// 单帧或批量条目中必须是同样的用户字段和负载. 有失败时返回1.
+// 构建: g++ -std=c++17 -O2 tests/test-sender.cpp $(ls LetsChat_server/*.cpp | grep -v main.cpp) -o test-sender -pthread
+
+#define SENDER_WAIT_MS 3000		// 等广播到达的上限
+
+struct Received
+{
+	unsigned sCmd;
+	unsigned sUser;
+	std::string strBody;
+};
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		g_nFailed++; \
+		printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+	} \
+} while (0)
+
+// 系统分配一个空闲端口
+static unsigned short FreePort() {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(fd, (sockaddr*)&addr, &len) != 0) {
+		perror("bind");
+		exit(1);
+	}
+	close(fd);
+	return ntohs(addr.sin_port);
+}
+
+static int Connect(unsigned short nPort) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(nPort);
+	if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		perror("connect");
+		exit(1);
+	}
+	return fd;
+}
+
+static void SendAll(int fd, const std::string& strData) {
+	size_t nSent = 0;
+	while (nSent < strData.size()) {
+		ssize_t n = send(fd, strData.data() + nSent, strData.size() - nSent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			perror("send");
+			exit(1);
+		}
+		nSent += (size_t)n;
+	}
+}
+
+static std::string FrameV1(YondCmd sCmd, unsigned sUser, const std::string& strBody) {
+	std::string strOut(CYondCodec::FrameSize(strBody.size()), '\0');
+	CYondCodec::Encode(&strOut[0], strOut.size(), sCmd, sUser, strBody.data(), strBody.size());
+	return strOut;
+}
+
+static std::string FrameV2(YondCmd sCmd, unsigned sUser, const std::string& strBody) {
+	std::string strOut(CYondCodec::FrameSizeV2(strBody.size(), sUser != 0, false), '\0');
+	CYondCodec::EncodeV2(&strOut[0], strOut.size(), sCmd, sUser, strBody.data(), strBody.size());
+	return strOut;
+}
+
+// 一个YMsg条目的YBatch帧
+static std::string FrameBatch(unsigned sUser, const std::string& strBody) {
+	size_t nBody = CYondCodec::BatchEntrySize(strBody.size(), sUser != 0);
+	std::string strOut(CYondCodec::FrameSizeV2(nBody, false, false), '\0');
+	size_t nHead = CYondCodec::PutHeadV2(&strOut[0], YBatch, 0, nBody, false);
+	CYondCodec::PutBatchEntry(&strOut[nHead], YMsg, sUser, strBody.data(), strBody.size());
+	CYondCodec::Seal(&strOut[0], nHead, nBody, false);
+	return strOut;
+}
+
+// 读到收齐nWant条YMsg或超时, 批量帧拆成条目
+static std::vector<Received> Collect(int fd, size_t nWant) {
+	std::vector<Received> vGot;
+	std::string strBuf;
+	size_t nMsgs = 0;
+	auto tEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(SENDER_WAIT_MS);
+	while (nMsgs < nWant && std::chrono::steady_clock::now() < tEnd) {
+		pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0) continue;
+		char buf[4096];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0) break;
+		strBuf.append(buf, (size_t)n);
+		size_t nPos = 0;
+		while (nPos < strBuf.size()) {
+			YondFrameHead head = {};
+			size_t nUsed = 0;
+			int ret = CYondCodec::DecodeStream(strBuf.data() + nPos, strBuf.size() - nPos, nUsed, head);
+			if (ret == YDecodeMore) break;
+			const char* pBody = strBuf.data() + nPos + head.nBody;
+			nPos += nUsed;
+			CHECK(ret == YDecodeFrame);
+			if (ret != YDecodeFrame) continue;
+			CHECK(head.nVersion == YOND_PROTO_V2);
+			if (head.sCmd != YBatch) {
+				vGot.push_back(Received{ head.sCmd, head.sUser, std::string(pBody, head.nBodySize) });
+				nMsgs += head.sCmd == YMsg;
+				continue;
+			}
+			size_t nEntry = 0;
+			YondBatchEntry entry = {};
+			while (CYondCodec::NextBatchEntry(pBody, head.nBodySize, nEntry, entry) == YDecodeFrame) {
+				vGot.push_back(Received{ entry.sCmd, entry.sUser, std::string(pBody + entry.nBody, entry.nBodySize) });
+				nMsgs += entry.sCmd == YMsg;
+			}
+		}
+		strBuf.erase(0, nPos);
+	}
+	return vGot;
+}
+
+int main() {
+	YondLogOpt logOpt;
+	logOpt.bConsole = false;
+	logOpt.eLevel = CYondLog::LOG_LEVEL_ERROR;
+	CYondLog::Configure(logOpt);
+
+	YondServerOpt opt;
+	opt.nLoops = 1;
+	opt.nFilePort = 0;
+	unsigned short nPort = FreePort();
+	CYondHandleEvent handler;
+	handler.Init(opt);
+	CYondReactor* pReactor = CYondReactor::Create(0, &handler, opt);
+	if (pReactor->InitSocket(nPort) != 0) {
+		printf("failed to listen on port %u\n", (unsigned)nPort);
+		return 1;
+	}
+	handler.SetReactors(std::vector<CYondReactor*>{ pReactor });
+	pReactor->Start();
+
+	// bob用v2登录, 之后发给他的都是v2帧或YBatch
+	int nBob = Connect(nPort);
+	SendAll(nBob, FrameV2(YConnect, 0, "bob"));
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	int nAlice = Connect(nPort);
+	SendAll(nAlice, FrameV1(YConnect, 0x0007, "alice"));
+	SendAll(nAlice, FrameV1(YMsg, 0x0102, "from v1"));
+	SendAll(nAlice, FrameV2(YMsg, 0x0304, "from v2"));
+	SendAll(nAlice, FrameBatch(0x0506, "from batch"));
+	SendAll(nAlice, FrameV1(YMsg, 0, "no user"));
+
+	std::vector<Received> vGot = Collect(nBob, 4);
+	const Received aWant[] = {
+		{ YConnect, 0x0007, "alice" },
+		{ YMsg, 0x0102, "from v1" },
+		{ YMsg, 0x0304, "from v2" },
+		{ YMsg, 0x0506, "from batch" },
+		{ YMsg, 0, "no user" },
+	};
+	CHECK(vGot.size() == sizeof(aWant) / sizeof(aWant[0]));
+	for (size_t i = 0; i < vGot.size() && i < sizeof(aWant) / sizeof(aWant[0]); i++) {
+		printf("cmd %u user 0x%04x %s\n", vGot[i].sCmd, vGot[i].sUser, vGot[i].strBody.c_str());
+		CHECK(vGot[i].sCmd == aWant[i].sCmd);
+		CHECK(vGot[i].sUser == aWant[i].sUser);
+		CHECK(vGot[i].strBody == aWant[i].strBody);
+	}
+
+	close(nAlice);
+	close(nBob);
+	pReactor->Stop();
+	handler.StopPool();
+	handler.SetReactors(std::vector<CYondReactor*>());
+	delete pReactor;
+	printf("%s\n", g_nFailed == 0 ? "OK" : "FAILED");
+	return g_nFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../LetsChat_server/CYondLog.h"
+
+// 把服务端-f binary写出的.ylog文件还原成与文本日志相同的格式, 输出到标准输出.
+// 用法: yondlog-decode [file.ylog ...], 不带参数时读标准输入
+
+#define DECODE_LINE_MAX 70000	// 单行输出上限, 超长的文本消息截断
+
+struct DecodeSite
+{
+	bool bValid = false;
+	int level = 0;
+	int line = 0;
+	std::string file;
+	std::string fmt;
+};
+
+class CYondLogDecoder
+{
+public:
+	explicit CYondLogDecoder(FILE* pFile) : m_pFile(pFile), m_nOffset(0), m_nClockOff(0), m_line(DECODE_LINE_MAX) {}
+
+	// 成功解码到文件末尾返回0, 文件损坏或被截断返回1
+	int Run(const char* pName) {
+		int nType;
+		while ((nType = fgetc(m_pFile)) != EOF) {
+			m_nOffset++;
+			bool bOk = false;
+			switch (nType) {
+			case 'Y': bOk = ReadHead(); break;
+			case YLogRecClock: bOk = ReadClock(); break;
+			case YLogRecSite: bOk = ReadSite(); break;
+			case YLogRecFmt: bOk = ReadFmt(); break;
+			case YLogRecText: bOk = ReadText(); break;
+			default: break;
+			}
+			if (!bOk) {
+				fprintf(stderr, "%s: bad or truncated record (type %d) at offset %llu\n",
+					pName, nType, (unsigned long long)(m_nOffset - 1));
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+private:
+	bool Read(void* p, size_t n) {
+		if (n > 0 && fread(p, 1, n, m_pFile) != n) {
+			return false;
+		}
+		m_nOffset += n;
+		return true;
+	}
+
+	template<class T>
+	bool Val(T& v) {
+		return Read(&v, sizeof(v));
+	}
+
+	bool Str16(std::string& s) {
+		uint16_t n = 0;
+		if (!Val(n)) return false;
+		s.resize(n);
+		return Read(&s[0], n);
+	}
+
+	// 文件头"YLOG"的首字节已被当作类型读走; 新的文件头表示服务端重新打开了文件, 调用点id从头分配
+	bool ReadHead() {
+		char magic[3];
+		uint16_t nVersion = 0, nReserved = 0;
+		if (!Read(magic, 3) || memcmp(magic, YLOG_MAGIC + 1, 3) != 0 || !Val(nVersion) || !Val(nReserved)) {
+			return false;
+		}
+		if (nVersion != YLOG_VERSION) {
+			fprintf(stderr, "unsupported ylog version %u\n", (unsigned)nVersion);
+			return false;
+		}
+		m_vSites.clear();
+		return true;
+	}
+
+	bool ReadClock() {
+		int64_t nWall = 0, nMono = 0;
+		if (!Val(nWall) || !Val(nMono)) return false;
+		m_nClockOff = nWall - nMono;
+		return true;
+	}
+
+	bool ReadSite() {
+		uint32_t nId = 0, nLine = 0;
+		uint8_t nLevel = 0;
+		DecodeSite site;
+		if (!Val(nId) || !Val(nLevel) || !Val(nLine) || !Str16(site.file) || !Str16(site.fmt)) {
+			return false;
+		}
+		site.bValid = true;
+		site.level = nLevel;
+		site.line = (int)nLine;
+		if (nId >= m_vSites.size()) {
+			m_vSites.resize(nId + 1);
+		}
+		m_vSites[nId] = std::move(site);
+		return true;
+	}
+
+	bool ReadFmt() {
+		uint32_t nId = 0;
+		int64_t nMono = 0;
+		int32_t err = 0;
+		uint8_t nFlags = 0;
+		uint16_t nArgs = 0;
+		if (!Val(nId) || !Val(nMono) || !Val(err) || !Val(nFlags) || !Val(nArgs)) return false;
+		m_vArgs.resize(nArgs);
+		if (!Read(m_vArgs.data(), nArgs)) return false;
+		if (nId >= m_vSites.size() || !m_vSites[nId].bValid) {
+			fprintf(stderr, "record refers to undefined site %u\n", nId);
+			return false;
+		}
+		const DecodeSite& site = m_vSites[nId];
+		char* pOut = m_line.data();
+		size_t n = CYondLog::FormatHead(nMono + m_nClockOff, (CYondLog::LogLevel)site.level, site.file.c_str(),
+			site.line, err, pOut, DECODE_LINE_MAX);
+		n += YondLogFormatArgs(site.fmt.c_str(), m_vArgs.data(), nArgs, pOut + n, DECODE_LINE_MAX - n - 4);
+		Emit(n, nFlags);
+		return true;
+	}
+
+	bool ReadText() {
+		uint8_t nLevel = 0, nFlags = 0;
+		int64_t nMono = 0;
+		int32_t err = 0;
+		uint32_t nLine = 0, nMsg = 0;
+		std::string strFile;
+		if (!Val(nLevel) || !Val(nMono) || !Val(err) || !Val(nFlags) || !Val(nLine) || !Str16(strFile) || !Val(nMsg)) {
+			return false;
+		}
+		m_vArgs.resize(nMsg);
+		if (!Read(m_vArgs.data(), nMsg)) return false;
+		char* pOut = m_line.data();
+		size_t n = CYondLog::FormatHead(nMono + m_nClockOff, (CYondLog::LogLevel)nLevel, strFile.c_str(),
+			(int)nLine, err, pOut, DECODE_LINE_MAX);
+		size_t nCopy = nMsg < DECODE_LINE_MAX - n - 5 ? nMsg : DECODE_LINE_MAX - n - 5;
+		memcpy(pOut + n, m_vArgs.data(), nCopy);
+		Emit(n + nCopy, nFlags);
+		return true;
+	}
+
+	void Emit(size_t n, uint8_t nFlags) {
+		char* pOut = m_line.data();
+		if (nFlags & YLOG_FLAG_TRUNC) {
+			memcpy(pOut + n, "...", 3);
+			n += 3;
+		}
+		pOut[n++] = '\n';
+		fwrite(pOut, 1, n, stdout);
+	}
+
+	FILE* m_pFile;
+	uint64_t m_nOffset;
+	int64_t m_nClockOff;	// 最近一个时间锚点给出的单调时钟到墙上时间的偏移
+	std::vector<DecodeSite> m_vSites;
+	std::vector<unsigned char> m_vArgs;
+	std::vector<char> m_line;
+};
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+		printf("Usage: %s [file.ylog ...]\n", argv[0]);
+		printf("  decode binary server logs to the text log layout, reads stdin without files\n");
+		return 0;
+	}
+	if (argc < 2) {
+		return CYondLogDecoder(stdin).Run("<stdin>");
+	}
+
+	int nRet = 0;
+	for (int i = 1; i < argc; i++) {
+		FILE* pFile = fopen(argv[i], "rb");
+		if (pFile == NULL) {
+			perror(argv[i]);
+			nRet = 1;
+			continue;
+		}
+		if (CYondLogDecoder(pFile).Run(argv[i]) != 0) {
+			nRet = 1;
+		}
+		fclose(pFile);
+	}
+	return nRet;
+}